@@ -0,0 +1,325 @@
+#pragma once
+
+#include "../utils/attrs.h"
+#include "../utils/str.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Open addressing hash map using Robin Hood hashing.
+///
+/// `HASH_FN` is called as `uint64_t HASH_FN(KEY key)` and `EQUAL_FN` as
+/// `bool EQUAL_FN(KEY a, KEY b)`. See `hash_map_int_hash` and
+/// `hash_map_str_hash` below.
+///
+/// Entries live directly in `data`. An entry with `dist == 0` is empty,
+/// otherwise `dist - 1` is the distance from its home slot. To iterate, walk
+/// all `capacity` entries and skip empty ones. Pointers into the map are
+/// invalidated by `set` and `remove`.
+///
+/// The map does not own its keys or values.
+#define DEFINE_HASH_MAP(KEY, VALUE, MAP_TYPE, FN_PREFIX, HASH_FN, EQUAL_FN)    \
+    typedef KEY MAP_TYPE##Key;                                                 \
+    typedef VALUE MAP_TYPE##Value;                                             \
+    typedef struct {                                                           \
+        MAP_TYPE##Key key;                                                     \
+        MAP_TYPE##Value value;                                                 \
+        uint32_t hash;                                                         \
+        uint32_t dist;                                                         \
+    } MAP_TYPE##Entry;                                                         \
+                                                                               \
+    typedef struct {                                                           \
+        MAP_TYPE##Entry* data;                                                 \
+        size_t capacity;                                                       \
+        size_t size;                                                           \
+    } MAP_TYPE;                                                                \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_construct(MAP_TYPE* map)        \
+    {                                                                          \
+        *map = (MAP_TYPE) { .data = NULL, .capacity = 0, .size = 0 };          \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline void FN_PREFIX##_destroy(MAP_TYPE* map)         \
+    {                                                                          \
+        free(map->data);                                                       \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline MAP_TYPE##Entry* FN_PREFIX##_internal_find(     \
+        const MAP_TYPE* map, MAP_TYPE##Key key)                                \
+    {                                                                          \
+        if (map->size == 0)                                                    \
+            return NULL;                                                       \
+        uint32_t hash = (uint32_t)HASH_FN(key);                                \
+        size_t mask = map->capacity - 1;                                       \
+        size_t idx = hash & mask;                                              \
+        for (uint32_t dist = 1;; ++dist) {                                     \
+            MAP_TYPE##Entry* entry = &map->data[idx];                          \
+            /*                                                                 \
+               An empty slot, or an entry closer to its home than we are       \
+               to ours, means the key would have been placed before this.      \
+            */                                                                 \
+            if (entry->dist < dist)                                            \
+                return NULL;                                                   \
+            if (entry->hash == hash && EQUAL_FN(entry->key, key))              \
+                return entry;                                                  \
+            idx = (idx + 1) & mask;                                            \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    /* Expects the key to be absent and a free slot to exist. */               \
+    MAYBE_UNUSED static inline MAP_TYPE##Entry* FN_PREFIX##_internal_insert(   \
+        MAP_TYPE* map, MAP_TYPE##Entry entry)                                  \
+    {                                                                          \
+        MAP_TYPE##Entry* placed = NULL;                                        \
+        size_t mask = map->capacity - 1;                                       \
+        size_t idx = entry.hash & mask;                                        \
+        entry.dist = 1;                                                        \
+        for (;; ++entry.dist) {                                                \
+            MAP_TYPE##Entry* slot = &map->data[idx];                           \
+            if (slot->dist == 0) {                                             \
+                *slot = entry;                                                 \
+                map->size += 1;                                                \
+                return placed ? placed : slot;                                 \
+            }                                                                  \
+            if (slot->dist < entry.dist) {                                     \
+                MAP_TYPE##Entry displaced = *slot;                             \
+                *slot = entry;                                                 \
+                entry = displaced;                                             \
+                if (!placed)                                                   \
+                    placed = slot;                                             \
+            }                                                                  \
+            idx = (idx + 1) & mask;                                            \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_internal_grow(                  \
+        MAP_TYPE* map, size_t new_capacity)                                    \
+    {                                                                          \
+        MAP_TYPE##Entry* new_data                                              \
+            = calloc(new_capacity, sizeof(MAP_TYPE##Entry));                   \
+        if (!new_data)                                                         \
+            return -1;                                                         \
+        MAP_TYPE##Entry* old_data = map->data;                                 \
+        size_t old_capacity = map->capacity;                                   \
+        *map = (MAP_TYPE) {                                                    \
+            .data = new_data,                                                  \
+            .capacity = new_capacity,                                          \
+            .size = 0,                                                         \
+        };                                                                     \
+        for (size_t i = 0; i < old_capacity; ++i) {                            \
+            if (old_data[i].dist != 0) {                                       \
+                FN_PREFIX##_internal_insert(map, old_data[i]);                 \
+            }                                                                  \
+        }                                                                      \
+        free(old_data);                                                        \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    /* Max load factor is 7/8. */                                              \
+    MAYBE_UNUSED static inline int FN_PREFIX##_reserve(                        \
+        MAP_TYPE* map, size_t size)                                            \
+    {                                                                          \
+        size_t capacity = map->capacity ? map->capacity : 16;                  \
+        while (size * 8 > capacity * 7) {                                      \
+            capacity *= 2;                                                     \
+        }                                                                      \
+        if (capacity == map->capacity)                                         \
+            return 0;                                                          \
+        return FN_PREFIX##_internal_grow(map, capacity);                       \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_set(                            \
+        MAP_TYPE* map, MAP_TYPE##Key key, MAP_TYPE##Value value)               \
+    {                                                                          \
+        MAP_TYPE##Entry* found = FN_PREFIX##_internal_find(map, key);          \
+        if (found) {                                                           \
+            found->value = value;                                              \
+            return 0;                                                          \
+        }                                                                      \
+        if (FN_PREFIX##_reserve(map, map->size + 1) != 0)                      \
+            return -1;                                                         \
+        FN_PREFIX##_internal_insert(map,                                       \
+            (MAP_TYPE##Entry) {                                                \
+                .key = key,                                                    \
+                .value = value,                                                \
+                .hash = (uint32_t)HASH_FN(key),                                \
+                .dist = 0,                                                     \
+            });                                                                \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline MAP_TYPE##Value* FN_PREFIX##_get(               \
+        MAP_TYPE* map, MAP_TYPE##Key key)                                      \
+    {                                                                          \
+        MAP_TYPE##Entry* found = FN_PREFIX##_internal_find(map, key);          \
+        if (!found)                                                            \
+            return NULL;                                                       \
+        return &found->value;                                                  \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline const MAP_TYPE##Value* FN_PREFIX##_get_const(   \
+        const MAP_TYPE* map, MAP_TYPE##Key key)                                \
+    {                                                                          \
+        const MAP_TYPE##Entry* found = FN_PREFIX##_internal_find(map, key);    \
+        if (!found)                                                            \
+            return NULL;                                                       \
+        return &found->value;                                                  \
+    }                                                                          \
+                                                                               \
+    /*                                                                         \
+       Returns false if the key is not present. If `removed` is not            \
+       NULL, the removed entry is written to it, so that its key and           \
+       value can be freed.                                                     \
+    */                                                                         \
+    MAYBE_UNUSED static inline bool FN_PREFIX##_remove(                        \
+        MAP_TYPE* map, MAP_TYPE##Key key, MAP_TYPE##Entry* removed)            \
+    {                                                                          \
+        MAP_TYPE##Entry* found = FN_PREFIX##_internal_find(map, key);          \
+        if (!found)                                                            \
+            return false;                                                      \
+        if (removed)                                                           \
+            *removed = *found;                                                 \
+        size_t mask = map->capacity - 1;                                       \
+        size_t idx = (size_t)(found - map->data);                              \
+        size_t next = (idx + 1) & mask;                                        \
+        /* Backward shift deletion, no tombstones. */                          \
+        while (map->data[next].dist > 1) {                                     \
+            map->data[idx] = map->data[next];                                  \
+            map->data[idx].dist -= 1;                                          \
+            idx = next;                                                        \
+            next = (next + 1) & mask;                                          \
+        }                                                                      \
+        memset(&map->data[idx], 0, sizeof(MAP_TYPE##Entry));                   \
+        map->size -= 1;                                                        \
+        return true;                                                           \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline void FN_PREFIX##_clear(MAP_TYPE* map)           \
+    {                                                                          \
+        if (map->data)                                                         \
+            memset(map->data, 0, map->capacity * sizeof(MAP_TYPE##Entry));     \
+        map->size = 0;                                                         \
+    }
+
+MAYBE_UNUSED static inline uint64_t hash_map_int_hash(int64_t key)
+{
+    return str_fast_hash_bytes(&key, sizeof(key));
+}
+
+MAYBE_UNUSED static inline bool hash_map_int_equal(int64_t a, int64_t b)
+{
+    return a == b;
+}
+
+MAYBE_UNUSED static inline uint64_t hash_map_str_hash(const char* key)
+{
+    return str_fast_hash(key);
+}
+
+MAYBE_UNUSED static inline bool hash_map_str_equal(const char* a, const char* b)
+{
+    return strcmp(a, b) == 0;
+}
+
+#ifdef INCLUDE_TESTS
+#include "../utils/panic.h"
+#include <stdio.h>
+
+DEFINE_HASH_MAP(int64_t,
+    int64_t,
+    TestIntHashMap,
+    test_int_hash_map,
+    hash_map_int_hash,
+    hash_map_int_equal)
+
+DEFINE_HASH_MAP(const char*,
+    int,
+    TestStrHashMap,
+    test_str_hash_map,
+    hash_map_str_hash,
+    hash_map_str_equal)
+
+static inline void test_collections_hash_map(void)
+{
+    {
+        TestIntHashMap map;
+        test_int_hash_map_construct(&map);
+
+        if (test_int_hash_map_get(&map, 1) != NULL) {
+            PANIC("empty map should not contain anything");
+        }
+        for (int64_t i = 0; i < 1000; ++i) {
+            test_int_hash_map_set(&map, i * 7, i);
+        }
+        if (map.size != 1000) {
+            PANIC("expected 1000 entries, got %zu", map.size);
+        }
+        test_int_hash_map_set(&map, 7, 100);
+        if (map.size != 1000) {
+            PANIC("overwrite should not add an entry");
+        }
+        int64_t* val = test_int_hash_map_get(&map, 7);
+        if (!val || *val != 100) {
+            PANIC("failed to overwrite value");
+        }
+        for (int64_t i = 0; i < 1000; i += 2) {
+            if (!test_int_hash_map_remove(&map, i * 7, NULL)) {
+                PANIC("failed to remove %ld", i * 7);
+            }
+        }
+        if (test_int_hash_map_remove(&map, 0, NULL)) {
+            PANIC("removed key twice");
+        }
+        for (int64_t i = 2; i < 1000; ++i) {
+            const int64_t* found = test_int_hash_map_get_const(&map, i * 7);
+            if (i % 2 == 0 && found) {
+                PANIC("found removed key %ld", i * 7);
+            }
+            if (i % 2 == 1 && (!found || *found != i)) {
+                PANIC("failed to find key %ld", i * 7);
+            }
+        }
+        size_t occupied = 0;
+        for (size_t i = 0; i < map.capacity; ++i) {
+            if (map.data[i].dist != 0)
+                occupied += 1;
+        }
+        if (occupied != map.size || map.size != 500) {
+            PANIC("expected 500 entries, got %zu", occupied);
+        }
+
+        test_int_hash_map_destroy(&map);
+    }
+    {
+        TestStrHashMap map;
+        test_str_hash_map_construct(&map);
+
+        char keys[64][16];
+        for (int i = 0; i < 64; ++i) {
+            snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+            test_str_hash_map_set(&map, keys[i], i);
+        }
+        int* val = test_str_hash_map_get(&map, "key42");
+        if (!val || *val != 42) {
+            PANIC("failed to find string key");
+        }
+        TestStrHashMapEntry removed;
+        if (!test_str_hash_map_remove(&map, "key13", &removed)
+            || removed.key != keys[13] || removed.value != 13) {
+            PANIC("failed to remove string key");
+        }
+        if (test_str_hash_map_get(&map, "key13") != NULL) {
+            PANIC("found removed string key");
+        }
+        test_str_hash_map_clear(&map);
+        if (map.size != 0 || test_str_hash_map_get(&map, "key1") != NULL) {
+            PANIC("clear should remove all entries");
+        }
+
+        test_str_hash_map_destroy(&map);
+    }
+}
+#endif
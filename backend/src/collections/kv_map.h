@@ -25,39 +25,33 @@
     MAYBE_UNUSED static inline size_t FN_PREFIX##_internal_insert_idx(         \
         const MAP_TYPE* map, size_t begin, size_t end, MAP_TYPE##Key key)      \
     {                                                                          \
-        if (begin == end) {                                                    \
-            return begin;                                                      \
-        }                                                                      \
-        size_t middle = (end - begin) / 2 + begin;                             \
-        if (key < map->data[middle].key) {                                     \
-            return FN_PREFIX##_internal_insert_idx(map, begin, middle, key);   \
-        } else if (key > map->data[middle].key) {                              \
-            return FN_PREFIX##_internal_insert_idx(map, middle + 1, end, key); \
-        } else {                                                               \
-            return middle;                                                     \
+        while (begin != end) {                                                 \
+            size_t middle = (end - begin) / 2 + begin;                         \
+            if (key < map->data[middle].key) {                                 \
+                end = middle;                                                  \
+            } else if (key > map->data[middle].key) {                          \
+                begin = middle + 1;                                            \
+            } else {                                                           \
+                return middle;                                                 \
+            }                                                                  \
         }                                                                      \
+        return begin;                                                          \
     }                                                                          \
                                                                                \
     MAYBE_UNUSED static inline int FN_PREFIX##_set(                            \
         MAP_TYPE* map, MAP_TYPE##Key key, MAP_TYPE##Value value)               \
     {                                                                          \
         size_t idx = FN_PREFIX##_internal_insert_idx(map, 0, map->size, key);  \
-        if (idx >= map->size) {                                                \
-            int push_res = FN_PREFIX##_entry_vec_push(                         \
-                map, (MAP_TYPE_Entry) { key, value });                         \
-            if (push_res != 0)                                                 \
-                return -1;                                                     \
-            return 0;                                                          \
-        }                                                                      \
-        if (map->data[idx].key == key) {                                       \
+        if (idx < map->size && map->data[idx].key == key) {                    \
             map->data[idx].value = value;                                      \
+            return 0;                                                          \
         }                                                                      \
-        int push_res                                                           \
-            = FN_PREFIX##_entry_vec_push(map, map->data[map->size - 1]);       \
+        int push_res = FN_PREFIX##_entry_vec_push(                             \
+            map, (MAP_TYPE_Entry) { key, value });                             \
         if (push_res != 0)                                                     \
             return -1;                                                         \
-        for (size_t i = idx; i < map->size - 1; ++i) {                         \
-            map->data[i + 1] = map->data[i];                                   \
+        for (size_t i = map->size - 1; i > idx; --i) {                         \
+            map->data[i] = map->data[i - 1];                                   \
         }                                                                      \
         map->data[idx] = (MAP_TYPE_Entry) { key, value };                      \
         return 0;                                                              \
@@ -66,17 +60,11 @@
     MAYBE_UNUSED static inline MAP_TYPE_Entry* FN_PREFIX##_internal_find(      \
         MAP_TYPE* map, size_t begin, size_t end, MAP_TYPE##Key key)            \
     {                                                                          \
-        if (begin == end) {                                                    \
+        size_t idx = FN_PREFIX##_internal_insert_idx(map, begin, end, key);    \
+        if (idx >= end || map->data[idx].key != key) {                         \
             return NULL;                                                       \
         }                                                                      \
-        size_t middle = (end - begin) / 2 + begin;                             \
-        if (key < map->data[middle].key) {                                     \
-            return FN_PREFIX##_internal_find(map, begin, middle, key);         \
-        } else if (key > map->data[middle].key) {                              \
-            return FN_PREFIX##_internal_find(map, middle + 1, end, key);       \
-        } else {                                                               \
-            return &map->data[middle];                                         \
-        }                                                                      \
+        return &map->data[idx];                                                \
     }                                                                          \
                                                                                \
     MAYBE_UNUSED static inline MAP_TYPE##Value* FN_PREFIX##_get(               \
@@ -153,6 +141,22 @@ static inline void test_collections_kv_map(void)
         PANIC("failed to find value");
     }
 
+    test_int_map_set(&map, 4, 40);
+    test_int_map_set(&map, 0, 0);
+    test_int_map_set(&map, 3, 33);
+    if (map.size != 5) {
+        PANIC("expected 5 entries, got %zu", map.size);
+    }
+    for (size_t i = 1; i < map.size; ++i) {
+        if (map.data[i - 1].key >= map.data[i].key) {
+            PANIC("entries not sorted at %zu", i);
+        }
+    }
+    val = test_int_map_get(&map, 3);
+    if (!val || *val != 33) {
+        PANIC("failed to overwrite value");
+    }
+
     test_int_map_destroy(&map);
 }
 #endif
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "../utils/attrs.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Vector storing up to `INLINE_CAPACITY` elements inside the struct itself.
+/// Only when it outgrows that, are the elements moved to the heap.
+///
+/// `heap_data` is NULL while the elements are stored inline, so the struct
+/// can be moved by value. Access the elements through `_data` or `_at`.
+#define DEFINE_SMALL_VEC(TYPE, VEC_TYPE, FN_PREFIX, INLINE_CAPACITY)           \
+    typedef TYPE VEC_TYPE##T;                                                  \
+    typedef struct {                                                           \
+        VEC_TYPE##T* heap_data;                                                \
+        size_t capacity;                                                       \
+        size_t size;                                                           \
+        VEC_TYPE##T inline_data[INLINE_CAPACITY];                              \
+    } VEC_TYPE;                                                                \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_construct(VEC_TYPE* vec)        \
+    {                                                                          \
+        vec->heap_data = NULL;                                                 \
+        vec->capacity = INLINE_CAPACITY;                                       \
+        vec->size = 0;                                                         \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline void FN_PREFIX##_destroy(VEC_TYPE* vec)         \
+    {                                                                          \
+        free(vec->heap_data);                                                  \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline VEC_TYPE##T* FN_PREFIX##_data(VEC_TYPE* vec)    \
+    {                                                                          \
+        return vec->heap_data ? vec->heap_data : vec->inline_data;             \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline const VEC_TYPE##T* FN_PREFIX##_data_const(      \
+        const VEC_TYPE* vec)                                                   \
+    {                                                                          \
+        return vec->heap_data ? vec->heap_data : vec->inline_data;             \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_reserve(                        \
+        VEC_TYPE* vec, size_t capacity)                                        \
+    {                                                                          \
+        if (capacity <= vec->capacity)                                         \
+            return 0;                                                          \
+        if (vec->heap_data) {                                                  \
+            TYPE* new_data                                                     \
+                = realloc(vec->heap_data, capacity * sizeof(TYPE));            \
+            if (!new_data)                                                     \
+                return -1;                                                     \
+            vec->heap_data = new_data;                                         \
+        } else {                                                               \
+            TYPE* new_data = malloc(capacity * sizeof(TYPE));                  \
+            if (!new_data)                                                     \
+                return -1;                                                     \
+            memcpy(new_data, vec->inline_data, vec->size * sizeof(TYPE));      \
+            vec->heap_data = new_data;                                         \
+        }                                                                      \
+        vec->capacity = capacity;                                              \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_push(                           \
+        VEC_TYPE* vec, VEC_TYPE##T value)                                      \
+    {                                                                          \
+        if (vec->size + 1 > vec->capacity) {                                   \
+            if (FN_PREFIX##_reserve(vec, vec->capacity * 2) != 0)              \
+                return -1;                                                     \
+        }                                                                      \
+        FN_PREFIX##_data(vec)[vec->size] = value;                              \
+        vec->size += 1;                                                        \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline int FN_PREFIX##_extend(                         \
+        VEC_TYPE* vec, const VEC_TYPE##T* values, size_t amount)               \
+    {                                                                          \
+        if (amount == 0)                                                       \
+            return 0;                                                          \
+        if (vec->size + amount > vec->capacity) {                              \
+            size_t new_capacity = vec->capacity * 2;                           \
+            if (new_capacity < vec->size + amount)                             \
+                new_capacity = vec->size + amount;                             \
+            if (FN_PREFIX##_reserve(vec, new_capacity) != 0)                   \
+                return -1;                                                     \
+        }                                                                      \
+        memcpy(&FN_PREFIX##_data(vec)[vec->size],                              \
+            values,                                                            \
+            amount * sizeof(TYPE));                                            \
+        vec->size += amount;                                                   \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline void FN_PREFIX##_clear(VEC_TYPE* vec)           \
+    {                                                                          \
+        vec->size = 0;                                                         \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline VEC_TYPE##T* FN_PREFIX##_at(                    \
+        VEC_TYPE* vec, size_t idx)                                             \
+    {                                                                          \
+        return &FN_PREFIX##_data(vec)[idx];                                    \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline const VEC_TYPE##T* FN_PREFIX##_at_const(        \
+        const VEC_TYPE* vec, size_t idx)                                       \
+    {                                                                          \
+        return &FN_PREFIX##_data_const(vec)[idx];                              \
+    }                                                                          \
+                                                                               \
+    MAYBE_UNUSED static inline VEC_TYPE##T FN_PREFIX##_get(                    \
+        const VEC_TYPE* vec, size_t idx)                                       \
+    {                                                                          \
+        return FN_PREFIX##_data_const(vec)[idx];                               \
+    }
+
+#ifdef INCLUDE_TESTS
+#include "../utils/panic.h"
+
+DEFINE_SMALL_VEC(int, TestIntSmallVec, test_int_small_vec, 4)
+
+static inline void test_collections_small_vec(void)
+{
+    TestIntSmallVec vec;
+    test_int_small_vec_construct(&vec);
+
+    for (int i = 0; i < 4; ++i) {
+        test_int_small_vec_push(&vec, i);
+    }
+    if (vec.heap_data != NULL) {
+        PANIC("elements within inline capacity should not be on the heap");
+    }
+
+    TestIntSmallVec moved = vec;
+    if (test_int_small_vec_get(&moved, 3) != 3) {
+        PANIC("moved vector should keep its inline elements");
+    }
+
+    int values[] = { 4, 5, 6, 7, 8 };
+    test_int_small_vec_extend(&vec, values, 5);
+    if (vec.heap_data == NULL || vec.size != 9) {
+        PANIC("vector should have spilled to the heap");
+    }
+    for (int i = 0; i < 9; ++i) {
+        if (*test_int_small_vec_at(&vec, (size_t)i) != i) {
+            PANIC("expected %d at %d after spill", i, i);
+        }
+    }
+
+    test_int_small_vec_clear(&vec);
+    test_int_small_vec_push(&vec, 42);
+    if (vec.size != 1 || *test_int_small_vec_at_const(&vec, 0) != 42) {
+        PANIC("clear should allow reuse");
+    }
+
+    test_int_small_vec_destroy(&vec);
+}
+#endif
@@ -3,6 +3,7 @@
 #include "../utils/attrs.h"
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define DECLARE_VEC_TYPE(TYPE, VEC_TYPE, FN_PREFIX, FN_SPECIFIER)              \
     typedef TYPE VEC_TYPE##T;                                                  \
@@ -19,17 +20,18 @@
     FN_SPECIFIER VEC_TYPE##T* FN_PREFIX##_at(VEC_TYPE* vec, size_t idx);       \
     FN_SPECIFIER const VEC_TYPE##T* FN_PREFIX##_at_const(                      \
         const VEC_TYPE* vec, size_t idx);                                      \
-    FN_SPECIFIER VEC_TYPE##T FN_PREFIX##_get(const VEC_TYPE* vec, size_t idx);
+    FN_SPECIFIER VEC_TYPE##T FN_PREFIX##_get(const VEC_TYPE* vec, size_t idx); \
+    FN_SPECIFIER int FN_PREFIX##_reserve(VEC_TYPE* vec, size_t capacity);      \
+    FN_SPECIFIER int FN_PREFIX##_extend(                                       \
+        VEC_TYPE* vec, const VEC_TYPE##T* values, size_t amount);              \
+    FN_SPECIFIER void FN_PREFIX##_clear(VEC_TYPE* vec);                        \
+    FN_SPECIFIER int FN_PREFIX##_shrink(VEC_TYPE* vec);
 
 #define DEFINE_VEC_IMPL(TYPE, VEC_TYPE, FN_PREFIX, FN_SPECIFIER)               \
+    /* Empty vectors don't allocate until the first push or reserve. */        \
     FN_SPECIFIER int FN_PREFIX##_construct(VEC_TYPE* vec)                      \
     {                                                                          \
-        const size_t capacity                                                  \
-            = 8 / sizeof(VEC_TYPE##T) > 2 ? 8 / sizeof(VEC_TYPE##T) : 2;       \
-        VEC_TYPE##T* data = malloc(sizeof(VEC_TYPE##T) * capacity);            \
-        if (!data)                                                             \
-            return -1;                                                         \
-        *vec = (VEC_TYPE) { data, capacity, .size = 0 };                       \
+        *vec = (VEC_TYPE) { .data = NULL, .capacity = 0, .size = 0 };          \
         return 0;                                                              \
     }                                                                          \
                                                                                \
@@ -55,21 +57,70 @@
         free(vec);                                                             \
     }                                                                          \
                                                                                \
+    FN_SPECIFIER int FN_PREFIX##_reserve(VEC_TYPE* vec, size_t capacity)       \
+    {                                                                          \
+        if (capacity <= vec->capacity)                                         \
+            return 0;                                                          \
+        TYPE* new_data = realloc(vec->data, capacity * sizeof(TYPE));          \
+        if (!new_data)                                                         \
+            return -1;                                                         \
+        vec->data = new_data;                                                  \
+        vec->capacity = capacity;                                              \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
     FN_SPECIFIER int FN_PREFIX##_push(VEC_TYPE* vec, VEC_TYPE##T value)        \
     {                                                                          \
         if (vec->size + 1 > vec->capacity) {                                   \
             size_t new_capacity = vec->capacity * 2;                           \
-            TYPE* new_data = realloc(vec->data, new_capacity * sizeof(TYPE));  \
-            if (!new_data)                                                     \
+            if (new_capacity == 0)                                             \
+                new_capacity = 8 / sizeof(VEC_TYPE##T) > 2                     \
+                    ? 8 / sizeof(VEC_TYPE##T)                                  \
+                    : 2;                                                       \
+            if (FN_PREFIX##_reserve(vec, new_capacity) != 0)                   \
                 return -1;                                                     \
-            vec->data = new_data;                                              \
-            vec->capacity = new_capacity;                                      \
         }                                                                      \
         vec->data[vec->size] = value;                                          \
         vec->size += 1;                                                        \
         return 0;                                                              \
     }                                                                          \
                                                                                \
+    FN_SPECIFIER int FN_PREFIX##_extend(                                       \
+        VEC_TYPE* vec, const VEC_TYPE##T* values, size_t amount)               \
+    {                                                                          \
+        if (amount == 0)                                                       \
+            return 0;                                                          \
+        if (vec->size + amount > vec->capacity) {                              \
+            size_t new_capacity = vec->capacity * 2;                           \
+            if (new_capacity < vec->size + amount)                             \
+                new_capacity = vec->size + amount;                             \
+            if (FN_PREFIX##_reserve(vec, new_capacity) != 0)                   \
+                return -1;                                                     \
+        }                                                                      \
+        memcpy(&vec->data[vec->size], values, amount * sizeof(TYPE));          \
+        vec->size += amount;                                                   \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
+    FN_SPECIFIER void FN_PREFIX##_clear(VEC_TYPE* vec)                         \
+    {                                                                          \
+        vec->size = 0;                                                         \
+    }                                                                          \
+                                                                               \
+    /* Releases unused capacity. Keeps room for at least one element. */       \
+    FN_SPECIFIER int FN_PREFIX##_shrink(VEC_TYPE* vec)                         \
+    {                                                                          \
+        size_t new_capacity = vec->size > 0 ? vec->size : 1;                   \
+        if (new_capacity >= vec->capacity)                                     \
+            return 0;                                                          \
+        TYPE* new_data = realloc(vec->data, new_capacity * sizeof(TYPE));      \
+        if (!new_data)                                                         \
+            return -1;                                                         \
+        vec->data = new_data;                                                  \
+        vec->capacity = new_capacity;                                          \
+        return 0;                                                              \
+    }                                                                          \
+                                                                               \
     FN_SPECIFIER VEC_TYPE##T* FN_PREFIX##_at(VEC_TYPE* vec, size_t idx)        \
     {                                                                          \
         return &vec->data[idx];                                                \
@@ -89,3 +140,56 @@
 #define DEFINE_VEC(TYPE, VEC_TYPE, FN_PREFIX)                                  \
     DECLARE_VEC_TYPE(TYPE, VEC_TYPE, FN_PREFIX, MAYBE_UNUSED static inline)    \
     DEFINE_VEC_IMPL(TYPE, VEC_TYPE, FN_PREFIX, MAYBE_UNUSED static inline)
+
+#ifdef INCLUDE_TESTS
+#include "../utils/panic.h"
+
+DEFINE_VEC(int, TestIntVec, test_int_vec)
+
+static inline void test_collections_vec(void)
+{
+    TestIntVec vec;
+    if (test_int_vec_construct(&vec) != 0) {
+        PANIC("could not construct vec");
+    }
+    if (vec.data != NULL || vec.capacity != 0) {
+        PANIC("empty vec should not allocate");
+    }
+
+    test_int_vec_push(&vec, 0);
+    if (vec.capacity != 2 || vec.data[0] != 0) {
+        PANIC("first push should allocate, got capacity %zu", vec.capacity);
+    }
+
+    test_int_vec_clear(&vec);
+    test_int_vec_reserve(&vec, 100);
+    if (vec.capacity != 100) {
+        PANIC("expected capacity 100, got %zu", vec.capacity);
+    }
+    int* data = vec.data;
+    for (int i = 0; i < 100; ++i) {
+        test_int_vec_push(&vec, i);
+    }
+    if (vec.data != data) {
+        PANIC("push within reserved capacity should not reallocate");
+    }
+
+    int values[] = { 100, 101, 102 };
+    test_int_vec_extend(&vec, values, 3);
+    if (vec.size != 103 || vec.data[102] != 102) {
+        PANIC("extend should append all values");
+    }
+
+    test_int_vec_clear(&vec);
+    if (vec.size != 0 || vec.capacity < 103) {
+        PANIC("clear should keep capacity");
+    }
+    test_int_vec_extend(&vec, values, 2);
+    test_int_vec_shrink(&vec);
+    if (vec.capacity != 2 || vec.data[0] != 100 || vec.data[1] != 101) {
+        PANIC("shrink should keep elements");
+    }
+
+    test_int_vec_destroy(&vec);
+}
+#endif
@@ -10,12 +10,13 @@ extern int64_t sbc_calculate_total_price(int64_t item_amount,
 void route_post_carts_purchase(HttpCtx* ctx)
 {
     Cx* cx = http_ctx_user_ctx(ctx);
+    Arena* arena = http_ctx_arena(ctx);
     const Session* session = middleware_session(ctx);
     if (!session)
         return;
 
     const char* body_str = http_ctx_req_body_str(ctx);
-    JsonValue* body_json = json_parse(body_str, strlen(body_str));
+    JsonValue* body_json = json_parse_arena(body_str, strlen(body_str), arena);
     if (!body_json) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
@@ -23,7 +24,6 @@ void route_post_carts_purchase(HttpCtx* ctx)
 
     CartsPurchaseReq req;
     int parse_result = carts_purchase_req_from_json(&req, body_json);
-    json_free(body_json);
     if (parse_result != 0) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
@@ -53,7 +53,8 @@ void route_post_carts_purchase(HttpCtx* ctx)
     // check and update user balance
 
     User user;
-    DbRes db_res = db_user_with_id(cx->db, &user, session->user_id);
+    DbRes db_res
+        = db_user_with_id_arena(cx->db, &user, session->user_id, arena);
     if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
         goto l0_return;
@@ -98,23 +99,14 @@ void route_post_carts_purchase(HttpCtx* ctx)
     db_res = db_receipt_insert(cx->db, &receipt, &receipt_id);
     if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
-        goto l0_return;
+        goto l1_return;
     }
 
     RESPOND_JSON(ctx, 200, "{\"ok\":true,\"receipt_id\":%ld}", receipt_id);
 
-l0_return:
+l1_return:
     receipt_destroy(&receipt);
+l0_return:
     product_price_vec_destroy(&prices);
-    user_destroy(&user);
     carts_purchase_req_destroy(&req);
 }
-
-int64_t sbcs_prices_get_price(const ProductPriceVec* prices, int64_t i)
-{
-    return prices->data[i].price_dkk_cent;
-}
-int64_t sbcs_items_get_amount(const CartsItemVec* items, int64_t i)
-{
-    return items->data[i].amount;
-}
@@ -12,7 +12,7 @@ typedef struct {
     size_t token_hash;
 } Session;
 
-void session_construct(Session* session, int64_t user_id);
+int session_construct(Session* session, int64_t user_id);
 void session_destroy(Session* session);
 
 DEFINE_VEC(Session, SessionVec, session_vec)
@@ -64,17 +64,13 @@ const Session* middleware_session(HttpCtx* ctx);
 #define RESPOND(HTTP_CTX, STATUS, MIME_TYPE, ...)                              \
     {                                                                          \
         HttpCtx* _ctx = (HTTP_CTX);                                            \
-        size_t _body_size = (size_t)snprintf(NULL, 0, __VA_ARGS__);            \
-        char* _body = calloc(_body_size + 1, sizeof(char));                    \
-        sprintf(_body, __VA_ARGS__);                                           \
-                                                                               \
-        char content_length[24] = { 0 };                                       \
-        snprintf(content_length, 24 - 1, "%ld", strlen(_body));                \
+        const char* _body = arena_fmt(http_ctx_arena(_ctx), __VA_ARGS__);      \
+        if (!_body)                                                            \
+            _body = "";                                                        \
                                                                                \
         http_ctx_res_headers_set(_ctx, "Content-Type", MIME_TYPE);             \
                                                                                \
         http_ctx_respond_str(_ctx, (STATUS), _body);                           \
-        free(_body);                                                           \
     }
 
 #define RESPOND_HTML(HTTP_CTX, STATUS, ...)                                    \
@@ -1,12 +1,16 @@
 #include "../utils/str.h"
 #include "controllers.h"
 #include <pthread.h>
+#include <string.h>
 
-void session_construct(Session* session, int64_t user_id)
+int session_construct(Session* session, int64_t user_id)
 {
     char* token = str_random(64);
+    if (!token)
+        return -1;
     size_t token_hash = str_fast_hash(token);
     *session = (Session) { user_id, token, token_hash };
+    return 0;
 }
 
 void session_destroy(Session* session)
@@ -58,13 +62,19 @@ Session* cx_sessions_add(Cx* cx, int64_t user_id)
     SessionVec* vec = &cx->sessions;
     for (size_t i = 0; i < vec->size; ++i) {
         if (vec->data[i].user_id == 0) {
-            session_construct(&vec->data[i], user_id);
+            if (session_construct(&vec->data[i], user_id) != 0) {
+                res = NULL;
+                goto l0_return;
+            }
             res = &vec->data[i];
             goto l0_return;
         }
     }
     Session session;
-    session_construct(&session, user_id);
+    if (session_construct(&session, user_id) != 0) {
+        res = NULL;
+        goto l0_return;
+    }
     session_vec_push(vec, session);
 
     res = &vec->data[vec->size - 1];
@@ -82,7 +92,8 @@ const Session* cx_sessions_find(Cx* cx, const char* token)
     SessionVec* vec = &cx->sessions;
     size_t token_hash = str_fast_hash(token);
     for (size_t i = 0; i < vec->size; ++i) {
-        if (vec->data[i].token_hash == token_hash) {
+        if (vec->data[i].token && vec->data[i].token_hash == token_hash
+            && strcmp(vec->data[i].token, token) == 0) {
             res = &vec->data[i];
             goto l0_return;
         }
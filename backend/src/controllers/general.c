@@ -19,24 +19,19 @@ void route_post_set_number(HttpCtx* ctx)
     Cx* cx = http_ctx_user_ctx(ctx);
 
     const char* body_text = http_ctx_req_body_str(ctx);
-    JsonParser parser;
-    json_parser_construct(&parser, body_text, strlen(body_text));
-    JsonValue* body = json_parser_parse(&parser);
-    json_parser_destroy(&parser);
+    JsonValue* body
+        = json_parse_arena(body_text, strlen(body_text), http_ctx_arena(ctx));
 
-    if (!json_object_has(body, "value")) {
+    if (!json_is(body, JsonType_Object) || !json_object_has(body, "value")) {
         RESPOND_JSON(
             ctx, 200, "{\"ok\": false, \"msg\": \"no 'value' key\"}\r\n");
-        goto l0_return;
+        return;
     }
 
     int64_t value = json_int(json_object_get(body, "value"));
     cx->number = (int)value;
 
     RESPOND_JSON(ctx, 200, "{\"ok\": true}\r\n");
-
-l0_return:
-    json_free(body);
 }
 
 void route_get_not_found(HttpCtx* ctx)
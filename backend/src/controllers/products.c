@@ -12,9 +12,10 @@ void route_get_products_all(HttpCtx* ctx)
     ProductVec products;
     product_vec_construct(&products);
 
-    DbRes db_res = db_product_all(cx->db, &products);
+    DbRes db_res = db_product_all_arena(cx->db, &products, http_ctx_arena(ctx));
     if (db_res != DbRes_Ok) {
         RESPOND_JSON(ctx, 500, "{\"ok\":false,\"msg\":\"db error\"}");
+        product_vec_destroy(&products);
         return;
     }
 
@@ -42,7 +43,8 @@ void route_post_products_create(HttpCtx* ctx)
     Cx* cx = http_ctx_user_ctx(ctx);
 
     const char* body_str = http_ctx_req_body_str(ctx);
-    JsonValue* body_json = json_parse(body_str, strlen(body_str));
+    JsonValue* body_json
+        = json_parse_arena(body_str, strlen(body_str), http_ctx_arena(ctx));
     if (!body_json) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
@@ -50,21 +52,20 @@ void route_post_products_create(HttpCtx* ctx)
 
     ProductsCreateReq req;
     int parse_result = products_create_req_from_json(&req, body_json);
-    json_free(body_json);
     if (parse_result != 0) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
     }
 
+    // Borrows the strings of `req`.
     Product product = {
         .id = 0,
-        .name = str_dup(req.name),
+        .name = req.name,
         .price_dkk_cent = req.price_dkk_cent,
-        .description = str_dup(req.description),
+        .description = req.description,
         .coord_id = req.coord_id,
-        .barcode = str_dup(req.barcode),
+        .barcode = req.barcode,
     };
-    products_create_req_destroy(&req);
 
     DbRes db_res = db_product_insert(cx->db, &product);
     if (db_res != DbRes_Ok) {
@@ -75,7 +76,7 @@ void route_post_products_create(HttpCtx* ctx)
     RESPOND_JSON(ctx, 200, "{\"ok\":true}");
 
 l0_return:
-    product_destroy(&product);
+    products_create_req_destroy(&req);
 }
 
 void route_post_products_update(HttpCtx* ctx)
@@ -84,7 +85,8 @@ void route_post_products_update(HttpCtx* ctx)
 
     const char* body_str = http_ctx_req_body_str(ctx);
 
-    JsonValue* body_json = json_parse(body_str, strlen(body_str));
+    JsonValue* body_json
+        = json_parse_arena(body_str, strlen(body_str), http_ctx_arena(ctx));
 
     if (!body_json) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
@@ -93,7 +95,6 @@ void route_post_products_update(HttpCtx* ctx)
 
     Product product;
     int parse_result = product_from_json(&product, body_json);
-    json_free(body_json);
     if (parse_result != 0) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
@@ -121,7 +122,8 @@ void route_get_products_coords(HttpCtx* ctx)
         return;
     }
     HttpQueryParams* params = http_parse_query_params(query);
-    char* product_id_str = http_query_params_get(params, "product_id");
+    char* product_id_str = http_query_params_get_arena(
+        params, "product_id", http_ctx_arena(ctx));
     http_query_params_free(params);
     if (!product_id_str) {
         RESPOND_BAD_REQUEST(ctx, "no product_id parameter");
@@ -129,7 +131,6 @@ void route_get_products_coords(HttpCtx* ctx)
     }
 
     int64_t product_id = strtol(product_id_str, NULL, 10);
-    free(product_id_str);
 
     Coord coord;
     DbRes db_res = db_coord_with_product_id(cx->db, &coord, product_id);
@@ -153,8 +154,10 @@ void route_post_products_set_coords(HttpCtx* ctx)
 {
     Cx* cx = http_ctx_user_ctx(ctx);
 
+    Arena* arena = http_ctx_arena(ctx);
+
     const char* body_str = http_ctx_req_body_str(ctx);
-    JsonValue* body_json = json_parse(body_str, strlen(body_str));
+    JsonValue* body_json = json_parse_arena(body_str, strlen(body_str), arena);
     if (!body_json) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
@@ -162,14 +165,14 @@ void route_post_products_set_coords(HttpCtx* ctx)
 
     ProductsCoordsSetReq req;
     int parse_result = products_coords_set_req_from_json(&req, body_json);
-    json_free(body_json);
     if (parse_result != 0) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
         return;
     }
 
     Product product;
-    DbRes db_res = db_product_with_id(cx->db, &product, req.product_id);
+    DbRes db_res
+        = db_product_with_id_arena(cx->db, &product, req.product_id, arena);
     if (db_res == DbRes_NotFound) {
         RESPOND_BAD_REQUEST(ctx, "not found");
         goto l0_return;
@@ -202,9 +205,8 @@ void route_post_products_set_coords(HttpCtx* ctx)
     RESPOND_JSON(ctx, 200, "{\"ok\":true}");
 l1_return:
     coord_destroy(&coord);
-    products_coords_set_req_destroy(&req);
 l0_return:
-    product_destroy(&product);
+    products_coords_set_req_destroy(&req);
 }
 
 void route_post_products_set_image(HttpCtx* ctx)
@@ -217,7 +219,8 @@ void route_post_products_set_image(HttpCtx* ctx)
         return;
     }
     HttpQueryParams* params = http_parse_query_params(query);
-    char* product_id_str = http_query_params_get(params, "product_id");
+    char* product_id_str = http_query_params_get_arena(
+        params, "product_id", http_ctx_arena(ctx));
     http_query_params_free(params);
     if (!product_id_str) {
         RESPOND_BAD_REQUEST(ctx, "no product_id parameter");
@@ -225,7 +228,6 @@ void route_post_products_set_image(HttpCtx* ctx)
     }
 
     int64_t product_id = strtol(product_id_str, NULL, 10);
-    free(product_id_str);
 
     const uint8_t* body = http_ctx_req_body(ctx);
     size_t body_size = http_ctx_req_body_size(ctx);
@@ -294,7 +296,8 @@ void route_get_products_image_png(HttpCtx* ctx)
         return;
     }
     HttpQueryParams* params = http_parse_query_params(query);
-    char* product_id_str = http_query_params_get(params, "product_id");
+    char* product_id_str = http_query_params_get_arena(
+        params, "product_id", http_ctx_arena(ctx));
     http_query_params_free(params);
     if (!product_id_str) {
         RESPOND_HTML_BAD_REQUEST(ctx, "no product_id parameter");
@@ -302,7 +305,6 @@ void route_get_products_image_png(HttpCtx* ctx)
     }
 
     int64_t product_id = strtol(product_id_str, NULL, 10);
-    free(product_id_str);
 
     uint8_t* buffer;
     size_t buffer_size;
@@ -323,6 +325,7 @@ void route_get_products_image_png(HttpCtx* ctx)
     http_ctx_res_headers_set(ctx, "Content-Type", "image/png");
 
     http_ctx_respond(ctx, 200, buffer, buffer_size);
+    free(buffer);
 }
 
 static inline int read_and_send_file(
@@ -350,7 +353,7 @@ static inline int read_and_send_file(
         goto l0_return;
     }
 
-    char* buf = calloc(file_size + 1, sizeof(char));
+    char* buf = arena_calloc(http_ctx_arena(ctx), file_size + 1, sizeof(char));
     size_t bytes_read = fread(buf, sizeof(char), file_size, fp);
     if (bytes_read != file_size) {
         fprintf(stderr, "error: could not read file '%s'\n", filepath);
@@ -7,6 +7,7 @@
 void route_get_receipts_one(HttpCtx* ctx)
 {
     Cx* cx = http_ctx_user_ctx(ctx);
+    Arena* arena = http_ctx_arena(ctx);
     const Session* session = middleware_session(ctx);
     if (!session)
         return;
@@ -17,7 +18,8 @@ void route_get_receipts_one(HttpCtx* ctx)
         return;
     }
     HttpQueryParams* params = http_parse_query_params(query);
-    char* receipt_id_str = http_query_params_get(params, "receipt_id");
+    char* receipt_id_str
+        = http_query_params_get_arena(params, "receipt_id", arena);
     http_query_params_free(params);
     if (!receipt_id_str) {
         RESPOND_BAD_REQUEST(ctx, "no receipt_id parameter");
@@ -25,11 +27,10 @@ void route_get_receipts_one(HttpCtx* ctx)
     }
 
     int64_t receipt_id = strtol(receipt_id_str, NULL, 10);
-    free(receipt_id_str);
 
     Receipt receipt;
-    DbRes db_res = db_receipt_with_id_and_user_id(
-        cx->db, &receipt, receipt_id, session->user_id);
+    DbRes db_res = db_receipt_with_id_and_user_id_arena(
+        cx->db, &receipt, receipt_id, session->user_id, arena);
     if (db_res != DbRes_Ok) {
         RESPOND_BAD_REQUEST(ctx, "receipt not found");
         return;
@@ -37,32 +38,36 @@ void route_get_receipts_one(HttpCtx* ctx)
 
     ProductPriceVec product_prices = { 0 };
     product_price_vec_construct(&product_prices);
+    product_price_vec_reserve(&product_prices, receipt.products.size);
     db_res = db_receipt_prices(cx->db, &product_prices, receipt_id);
     if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
-        return;
+        goto l0_return;
     }
 
     ProductVec products = { 0 };
     product_vec_construct(&products);
-    db_res = db_receipt_products(cx->db, &products, receipt_id);
+    product_vec_reserve(&products, receipt.products.size);
+    db_res = db_receipt_products_arena(cx->db, &products, receipt_id, arena);
     if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
-        return;
+        goto l1_return;
     }
 
+    // Borrows the strings of `receipt` and `products`.
     ReceiptsOneRes res = {
         .receipt_id = receipt.id,
         .total_dkk_cent = receipt.total_dkk_cent,
-        .timestamp = str_dup(receipt.timestamp),
+        .timestamp = receipt.timestamp,
         .products = (ReceiptsOneResProductVec) { 0 },
     };
     receipts_one_res_product_vec_construct(&res.products);
+    receipts_one_res_product_vec_reserve(&res.products, receipt.products.size);
     for (size_t i = 0; i < receipt.products.size; ++i) {
         receipts_one_res_product_vec_push(&res.products,
             (ReceiptsOneResProduct) {
                 .product_id = products.data[i].id,
-                .name = str_dup(products.data[i].name),
+                .name = products.data[i].name,
                 .price_dkk_cent = product_prices.data[i].price_dkk_cent,
                 .amount = receipt.products.data[i].amount,
             });
@@ -73,14 +78,12 @@ void route_get_receipts_one(HttpCtx* ctx)
     RESPOND_JSON(ctx, 200, "{\"ok\":true,\"receipt\":%s}", res_json);
 
     free(res_json);
-    receipts_one_res_destroy(&res);
-    for (size_t i = 0; i < products.size; ++i)
-        product_destroy(&products.data[i]);
+    receipts_one_res_product_vec_destroy(&res.products);
+l1_return:
     product_vec_destroy(&products);
-    for (size_t i = 0; i < products.size; ++i)
-        product_price_destroy(&product_prices.data[i]);
+l0_return:
     product_price_vec_destroy(&product_prices);
-    receipt_destroy(&receipt);
+    receipt_product_vec_destroy(&receipt.products);
 }
 
 void route_get_receipts_all(HttpCtx* ctx)
@@ -92,10 +95,11 @@ void route_get_receipts_all(HttpCtx* ctx)
 
     ReceiptHeaderVec receipts;
     receipt_header_vec_construct(&receipts);
-    DbRes db_res = db_receipt_all_headers_with_user_id(
-        cx->db, &receipts, session->user_id);
+    DbRes db_res = db_receipt_all_headers_with_user_id_arena(
+        cx->db, &receipts, session->user_id, http_ctx_arena(ctx));
     if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
+        receipt_header_vec_destroy(&receipts);
         return;
     }
 
@@ -113,7 +117,5 @@ void route_get_receipts_all(HttpCtx* ctx)
     RESPOND_JSON(
         ctx, 200, "{\"ok\":true,\"receipts\":[%s]}", receipts_str.data);
     string_destroy(&receipts_str);
-    for (size_t i = 0; i < receipts.size; ++i)
-        receipt_header_destroy(&receipts.data[i]);
     receipt_header_vec_destroy(&receipts);
 }
@@ -7,18 +7,18 @@
 void route_post_sessions_login(HttpCtx* ctx)
 {
     Cx* cx = http_ctx_user_ctx(ctx);
+    Arena* arena = http_ctx_arena(ctx);
 
     const char* body_str = http_ctx_req_body_str(ctx);
 
-    JsonValue* body_json = json_parse(body_str, strlen(body_str));
+    JsonValue* body_json = json_parse_arena(body_str, strlen(body_str), arena);
 
     SessionsLoginReq req;
     int parse_res = sessions_login_req_from_json(&req, body_json);
-    json_free(body_json);
 
     if (parse_res != 0) {
         RESPOND_BAD_REQUEST(ctx, "bad request");
-        goto l0_return;
+        return;
     }
     if (strlen(req.email) == 0 || strlen(req.password) > MAX_HASH_INPUT_LEN) {
 
@@ -27,7 +27,7 @@ void route_post_sessions_login(HttpCtx* ctx)
     }
 
     User user;
-    DbRes db_res = db_user_with_email(cx->db, &user, req.email);
+    DbRes db_res = db_user_with_email_arena(cx->db, &user, req.email, arena);
     if (db_res == DbRes_NotFound) {
         RESPOND_BAD_REQUEST(ctx, "incorrect email or password");
         goto l0_return;
@@ -38,15 +38,17 @@ void route_post_sessions_login(HttpCtx* ctx)
 
     if (!str_hash_equal(user.password_hash, req.password)) {
         RESPOND_BAD_REQUEST(ctx, "incorrect email or password");
-        goto l2_return;
+        goto l0_return;
     }
 
     cx_sessions_remove(cx, user.id);
     Session* session = cx_sessions_add(cx, user.id);
+    if (!session) {
+        RESPOND_SERVER_ERROR(ctx);
+        goto l0_return;
+    }
 
     RESPOND_JSON(ctx, 200, "{\"ok\":true,\"token\":\"%s\"}", session->token);
-l2_return:
-    user_destroy(&user);
 l0_return:
     sessions_login_req_destroy(&req);
 }
@@ -71,14 +73,14 @@ void route_get_sessions_user(HttpCtx* ctx)
         return;
 
     User user;
-    DbRes db_res = db_user_with_id(cx->db, &user, session->user_id);
+    DbRes db_res = db_user_with_id_arena(
+        cx->db, &user, session->user_id, http_ctx_arena(ctx));
     if (db_res != DbRes_Ok) {
         RESPOND_BAD_REQUEST(ctx, "user not found");
         return;
     }
 
     char* user_json = user_to_json_string(&user);
-    user_destroy(&user);
 
     RESPOND_JSON(ctx, 200, "{\"ok\":true,\"user\":%s}", user_json);
     free(user_json);
@@ -10,15 +10,14 @@ void route_post_users_register(HttpCtx* ctx)
 
     const char* body_str = http_ctx_req_body_str(ctx);
 
-    JsonValue* body_json = json_parse(body_str, strlen(body_str));
+    JsonValue* body_json
+        = json_parse_arena(body_str, strlen(body_str), http_ctx_arena(ctx));
 
     UsersRegisterReq req;
     if (users_register_req_from_json(&req, body_json) != 0) {
         RESPOND_BAD_REQUEST(ctx, "invalid json");
-        json_free(body_json);
         return;
     }
-    json_free(body_json);
 
     if (strlen(req.name) == 0 || strlen(req.email) == 0
         || strlen(req.password) > MAX_HASH_INPUT_LEN) {
@@ -69,15 +68,16 @@ void route_post_users_balance_add(HttpCtx* ctx)
         return;
 
     User user;
-    if (db_user_with_id(cx->db, &user, session->user_id) != DbRes_Ok) {
+    DbRes db_res = db_user_with_id_arena(
+        cx->db, &user, session->user_id, http_ctx_arena(ctx));
+    if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
         return;
     }
 
     user.balance_dkk_cent += 10000;
 
-    DbRes db_res = db_user_update(cx->db, &user);
-    user_destroy(&user);
+    db_res = db_user_update(cx->db, &user);
     if (db_res != DbRes_Ok) {
         RESPOND_SERVER_ERROR(ctx);
         return;
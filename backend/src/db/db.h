@@ -2,6 +2,7 @@
 
 #include "../collections/vec.h"
 #include "../models/models.h"
+#include "../utils/arena.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -24,12 +25,17 @@ DbRes db_user_update(Db* db, const User* user);
 
 /// `user` field is an out parameter.
 DbRes db_user_with_id(Db* db, User* user, int64_t id);
+/// Like `db_user_with_id`, but strings are allocated in `arena`.
+DbRes db_user_with_id_arena(Db* db, User* user, int64_t id, Arena* arena);
 
 /// `exists` field is an out parameter.
 DbRes db_user_with_email_exists(Db* db, bool* exists, const char* email);
 
 /// `user` is an out parameter.
 DbRes db_user_with_email(Db* db, User* user, const char* email);
+/// Like `db_user_with_email`, but strings are allocated in `arena`.
+DbRes db_user_with_email_arena(
+    Db* db, User* user, const char* email, Arena* arena);
 
 /// `product.id` are ignored.
 DbRes db_product_insert(Db* db, const Product* product);
@@ -39,9 +45,14 @@ DbRes db_product_update(Db* db, const Product* product);
 
 /// `product` is an out parameter.
 DbRes db_product_with_id(Db* db, Product* product, int64_t id);
+/// Like `db_product_with_id`, but strings are allocated in `arena`.
+DbRes db_product_with_id_arena(
+    Db* db, Product* product, int64_t id, Arena* arena);
 
 /// Expects `vec` to be constructed.
 DbRes db_product_all(Db* db, ProductVec* vec);
+/// Like `db_product_all`, but strings are allocated in `arena`.
+DbRes db_product_all_arena(Db* db, ProductVec* vec, Arena* arena);
 
 /// `coord.id` are ignored.
 DbRes db_coord_insert(Db* db, const Coord* coord, int64_t* id);
@@ -61,10 +72,17 @@ DbRes db_receipt_insert(Db* db, const Receipt* receipt, int64_t* id);
 /// `receipt` field is an out parameter.
 DbRes db_receipt_with_id_and_user_id(
     Db* db, Receipt* receipt, int64_t id, int64_t user_id);
+/// Like `db_receipt_with_id_and_user_id`, but strings are allocated in `arena`.
+DbRes db_receipt_with_id_and_user_id_arena(
+    Db* db, Receipt* receipt, int64_t id, int64_t user_id, Arena* arena);
 
 /// Expects `receipts` to be constructed.
 DbRes db_receipt_all_headers_with_user_id(
     Db* db, ReceiptHeaderVec* receipts, int64_t user_id);
+/// Like `db_receipt_all_headers_with_user_id`, but strings are allocated in
+/// `arena`.
+DbRes db_receipt_all_headers_with_user_id_arena(
+    Db* db, ReceiptHeaderVec* receipts, int64_t user_id, Arena* arena);
 
 /// `product_prices` field is an out parameter.
 /// Expects `product_prices` to be constructed.
@@ -74,6 +92,9 @@ DbRes db_receipt_prices(
 /// `products` field is an out parameter.
 /// Expects `products` to be constructed.
 DbRes db_receipt_products(Db* db, ProductVec* products, int64_t receipt_id);
+/// Like `db_receipt_products`, but strings are allocated in `arena`.
+DbRes db_receipt_products_arena(
+    Db* db, ProductVec* products, int64_t receipt_id, Arena* arena);
 
 DbRes db_product_image_insert(
     Db* db, int64_t product_id, const uint8_t* data, size_t data_size);
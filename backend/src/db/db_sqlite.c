@@ -16,16 +16,19 @@
         __func__,                                                              \
         __LINE__)
 
-static inline char* get_str_safe(sqlite3_stmt* stmt, int col)
+static inline char* get_str_safe(sqlite3_stmt* stmt, int col, Arena* arena)
 {
     const char* val = (const char*)sqlite3_column_text(stmt, col);
     if (!val)
-        return str_dup("NULL");
-    return str_dup((const char*)val);
+        val = "NULL";
+    if (arena)
+        return arena_str_dup(arena, val);
+    return str_dup(val);
 }
 
 #define GET_INT(COL) sqlite3_column_int64(stmt, COL)
-#define GET_STR(COL) get_str_safe(stmt, COL)
+/// Expects `arena` in scope. If `arena` is NULL, the string is heap allocated.
+#define GET_STR(COL) get_str_safe(stmt, COL, arena)
 
 static inline DbRes connect(sqlite3** connection)
 {
@@ -165,6 +168,11 @@ l0_return:
 }
 
 DbRes db_user_with_id(Db* db, User* user, int64_t id)
+{
+    return db_user_with_id_arena(db, user, id, NULL);
+}
+
+DbRes db_user_with_id_arena(Db* db, User* user, int64_t id, Arena* arena)
 {
     static_assert(sizeof(User) == 40, "model has changed");
 
@@ -242,6 +250,12 @@ l0_return:
 }
 
 DbRes db_user_with_email(Db* db, User* user, const char* email)
+{
+    return db_user_with_email_arena(db, user, email, NULL);
+}
+
+DbRes db_user_with_email_arena(
+    Db* db, User* user, const char* email, Arena* arena)
 {
     static_assert(sizeof(User) == 40, "model has changed");
 
@@ -380,6 +394,12 @@ l0_return:
 }
 
 DbRes db_product_with_id(Db* db, Product* product, int64_t id)
+{
+    return db_product_with_id_arena(db, product, id, NULL);
+}
+
+DbRes db_product_with_id_arena(
+    Db* db, Product* product, int64_t id, Arena* arena)
 {
     static_assert(sizeof(Product) == 48, "model has changed");
 
@@ -428,6 +448,11 @@ l0_return:
 }
 
 DbRes db_product_all(Db* db, ProductVec* vec)
+{
+    return db_product_all_arena(db, vec, NULL);
+}
+
+DbRes db_product_all_arena(Db* db, ProductVec* vec, Arena* arena)
 {
     static_assert(sizeof(Product) == 48, "model has changed");
     sqlite3* connection;
@@ -437,8 +462,8 @@ DbRes db_product_all(Db* db, ProductVec* vec)
 
     sqlite3_stmt* stmt;
     sqlite_res = sqlite3_prepare_v2(connection,
-        "SELECT id, name, description, price_dkk_cent, coord, barcode FROM "
-        "products",
+        "SELECT id, name, description, price_dkk_cent, coord, barcode,"
+        " COUNT(*) OVER () FROM products",
         -1,
         &stmt,
         NULL);
@@ -449,6 +474,10 @@ DbRes db_product_all(Db* db, ProductVec* vec)
     }
 
     while ((sqlite_res = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (vec->size == 0) {
+            // Every row carries the total row count.
+            product_vec_reserve(vec, (size_t)GET_INT(6));
+        }
         Product product = {
             .id = GET_INT(0),
             .name = GET_STR(1),
@@ -778,6 +807,12 @@ l0_return:
 
 DbRes db_receipt_with_id_and_user_id(
     Db* db, Receipt* receipt, int64_t id, int64_t user_id)
+{
+    return db_receipt_with_id_and_user_id_arena(db, receipt, id, user_id, NULL);
+}
+
+DbRes db_receipt_with_id_and_user_id_arena(
+    Db* db, Receipt* receipt, int64_t id, int64_t user_id, Arena* arena)
 {
     static_assert(sizeof(Receipt) == 56, "model has changed");
 
@@ -864,6 +899,13 @@ l0_return:
 
 DbRes db_receipt_all_headers_with_user_id(
     Db* db, ReceiptHeaderVec* receipts, int64_t user_id)
+{
+    return db_receipt_all_headers_with_user_id_arena(
+        db, receipts, user_id, NULL);
+}
+
+DbRes db_receipt_all_headers_with_user_id_arena(
+    Db* db, ReceiptHeaderVec* receipts, int64_t user_id, Arena* arena)
 {
     static_assert(sizeof(Receipt) == 56, "model has changed");
     static_assert(sizeof(ReceiptHeader) == 32, "model has changed");
@@ -964,6 +1006,12 @@ l0_return:
 }
 
 DbRes db_receipt_products(Db* db, ProductVec* products, int64_t receipt_id)
+{
+    return db_receipt_products_arena(db, products, receipt_id, NULL);
+}
+
+DbRes db_receipt_products_arena(
+    Db* db, ProductVec* products, int64_t receipt_id, Arena* arena)
 {
     static_assert(sizeof(Product) == 48, "model has changed");
 
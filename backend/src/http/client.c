@@ -8,8 +8,10 @@
 #include <stdlib.h>
 #include <string.h>
 
-static inline int parse_request_header(Client* client, Request* request);
-static inline int recieve_request_body(Client* client, Request* request);
+static inline int parse_request_header(
+    Client* client, Request* request, Arena* arena);
+static inline int recieve_request_body(
+    Client* client, Request* request, Arena* arena);
 static inline int next_line(Client* client, StrSlice* slice);
 static inline int next_char(Client* client, char* ch);
 static inline int next_u8(Client* client, uint8_t* ch);
@@ -30,9 +32,9 @@ void http_client_free(Client* client)
     free(client);
 }
 
-int http_client_next(Client* client, Request* request)
+int http_client_next(Client* client, Request* request, Arena* arena)
 {
-    if (parse_request_header(client, request) != 0)
+    if (parse_request_header(client, request, arena) != 0)
         return -1;
 
     if (request->method == Method_POST) {
@@ -42,18 +44,32 @@ int http_client_next(Client* client, Request* request)
                 "header\n");
             return -1;
         }
-        if (recieve_request_body(client, request) != 0)
+        if (recieve_request_body(client, request, arena) != 0)
             return -1;
     }
     return 0;
 }
 
-static inline int recieve_request_body(Client* client, Request* request)
+static inline int recieve_request_body(
+    Client* client, Request* request, Arena* arena)
 {
     const char* length_val = http_request_get_header(request, "Content-Length");
-    size_t length = strtoul(length_val, NULL, 10);
+    errno = 0;
+    char* length_end;
+    unsigned long long length_ull = strtoull(length_val, &length_end, 10);
+    if (errno != 0 || length_end == length_val || *length_end != '\0'
+        || length_val[0] == '-' || length_ull > MAX_BODY_SIZE) {
+        fprintf(stderr, "error: invalid Content-Length '%s'\n", length_val);
+        return -1;
+    }
+    size_t length = (size_t)length_ull;
 
-    uint8_t* body = calloc(length + 1, sizeof(uint8_t));
+    uint8_t* body = arena_alloc(arena, length + 1);
+    if (!body) {
+        fprintf(stderr, "error: could not allocate request body\n");
+        return -1;
+    }
+    body[length] = '\0';
     for (size_t i = 0; i < length; ++i) {
         uint8_t ch;
         if (next_u8(client, &ch) != 0)
@@ -67,7 +83,8 @@ static inline int recieve_request_body(Client* client, Request* request)
     return 0;
 }
 
-static inline int parse_request_header(Client* client, Request* request)
+static inline int parse_request_header(
+    Client* client, Request* request, Arena* arena)
 {
 
     StrSlice req_line;
@@ -136,9 +153,8 @@ static inline int parse_request_header(Client* client, Request* request)
         path_len += 1;
     }
 
-    char* path = calloc(path_len + 1, sizeof(char));
-    strncpy(path, uri_str.ptr, path_len);
-    path[path_len] = '\0';
+    char* path = arena_str_slice_copy(
+        arena, &(StrSlice) { .ptr = uri_str.ptr, .len = path_len });
 
     char* query = NULL;
     if (path_len < uri_str.len) {
@@ -147,9 +163,11 @@ static inline int parse_request_header(Client* client, Request* request)
             && uri_str.ptr[path_len + query_len] != '#') {
             query_len += 1;
         }
-        query = calloc(query_len + 1, sizeof(char));
-        strncpy(query, &uri_str.ptr[path_len + 1], query_len);
-        query[query_len] = '\0';
+        query = arena_str_slice_copy(arena,
+            &(StrSlice) {
+                .ptr = &uri_str.ptr[path_len + 1],
+                .len = query_len,
+            });
     }
 
     HeaderVec headers;
@@ -157,8 +175,10 @@ static inline int parse_request_header(Client* client, Request* request)
 
     while (headers.size < MAX_HEADERS_LEN) {
         StrSlice line;
-        if (next_line(client, &line) != 0)
+        if (next_line(client, &line) != 0) {
+            header_vec_destroy(&headers);
             return -1;
+        }
         if (line.len == 0) {
             break;
         }
@@ -169,6 +189,7 @@ static inline int parse_request_header(Client* client, Request* request)
         }
         if (key_len == 0 || key_len > MAX_HEADER_KEY_LEN) {
             fprintf(stderr, "error: header key too long\n");
+            header_vec_destroy(&headers);
             return -1;
         }
         size_t value_begin = key_len + 1;
@@ -178,14 +199,14 @@ static inline int parse_request_header(Client* client, Request* request)
         size_t value_len = line.len - value_begin;
         if (value_len == 0 || value_len > MAX_HEADER_VALUE_LEN) {
             fprintf(stderr, "error: header value too long, %ld\n", value_len);
+            header_vec_destroy(&headers);
             return -1;
         }
 
-        char* key = calloc(key_len + 1, sizeof(char));
-        strncpy(key, line.ptr, key_len);
-
-        char* value = calloc(value_len + 1, sizeof(char));
-        strncpy(value, &line.ptr[value_begin], value_len);
+        char* key = arena_str_slice_copy(
+            arena, &(StrSlice) { .ptr = line.ptr, .len = key_len });
+        char* value = arena_str_slice_copy(arena,
+            &(StrSlice) { .ptr = &line.ptr[value_begin], .len = value_len });
 
         header_vec_push(&headers, (Header) { key, value });
     }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../utils/arena.h"
 #include "client_connection.h"
 #include "request.h"
 #include <stdint.h>
@@ -17,4 +18,4 @@ Client* http_client_new(ClientConnection connection);
 void http_client_free(Client* client);
 
 // Returns not 0 on error
-int http_client_next(Client* client, Request* request);
+int http_client_next(Client* client, Request* request, Arena* arena);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../utils/arena.h"
 #include "../utils/str.h"
 #include <stdbool.h>
 #include <stddef.h>
@@ -30,6 +31,8 @@ void http_server_post(
 void http_server_set_not_found(HttpServer* server, HttpHandlerFn handler);
 
 void* http_ctx_user_ctx(HttpCtx* ctx);
+/// Allocations in the arena live until the request has been handled.
+Arena* http_ctx_arena(HttpCtx* ctx);
 const char* http_ctx_req_path(HttpCtx* ctx);
 bool http_ctx_req_headers_has(HttpCtx* ctx, const char* key);
 const char* http_ctx_req_headers_get(HttpCtx* ctx, const char* key);
@@ -48,3 +51,6 @@ HttpQueryParams* http_parse_query_params(const char* query);
 void http_query_params_free(HttpQueryParams* query_params);
 char* http_query_params_get(
     const HttpQueryParams* query_params, const char* key);
+/// Like `http_query_params_get`, but the value is allocated in `arena`.
+char* http_query_params_get_arena(
+    const HttpQueryParams* query_params, const char* key, Arena* arena);
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "../collections/vec.h"
+#include "../collections/small_vec.h"
 #include <stdbool.h>
 
 #define MAX_HEADER_BUFFER_SIZE 65536
@@ -10,6 +10,8 @@
 #define MAX_HEADERS_LEN 32
 #define MAX_HEADER_KEY_LEN 32 - 1
 #define MAX_HEADER_VALUE_LEN 512 - 1
+// Large enough for product images, see `/api/products/set-image`.
+#define MAX_BODY_SIZE (16 * 1024 * 1024)
 
 typedef enum {
     Method_GET,
@@ -21,4 +23,4 @@ typedef struct {
     char* value;
 } Header;
 
-DEFINE_VEC(Header, HeaderVec, header_vec)
+DEFINE_SMALL_VEC(Header, HeaderVec, header_vec, 16)
@@ -41,15 +41,34 @@ void http_query_params_free(HttpQueryParams* query_params)
     free(query_params);
 }
 
-char* http_query_params_get(
+static inline const Param* find_param(
     const HttpQueryParams* query_params, const char* key)
 {
     size_t key_len = strlen(key);
     for (size_t i = 0; i < query_params->vec.size; ++i) {
         const Param* entry = &query_params->vec.data[i];
-        if (key_len == entry->key.len && strcmp(key, entry->key.ptr)) {
-            return str_slice_copy(&entry->value);
+        if (key_len == entry->key.len
+            && strncmp(key, entry->key.ptr, key_len) == 0) {
+            return entry;
         }
     }
     return NULL;
 }
+
+char* http_query_params_get(
+    const HttpQueryParams* query_params, const char* key)
+{
+    const Param* entry = find_param(query_params, key);
+    if (!entry)
+        return NULL;
+    return str_slice_copy(&entry->value);
+}
+
+char* http_query_params_get_arena(
+    const HttpQueryParams* query_params, const char* key, Arena* arena)
+{
+    const Param* entry = find_param(query_params, key);
+    if (!entry)
+        return NULL;
+    return arena_str_slice_copy(arena, &entry->value);
+}
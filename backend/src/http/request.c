@@ -15,14 +15,7 @@
 
 void http_request_destroy(Request* req)
 {
-    free(req->path);
-    for (size_t i = 0; i < req->headers.size; ++i) {
-        free(req->headers.data[i].key);
-        free(req->headers.data[i].value);
-    }
     header_vec_destroy(&req->headers);
-    if (req->body)
-        free(req->body);
 }
 
 static inline int strcmp_lower(const char* a, const char* b)
@@ -42,7 +35,8 @@ static inline int strcmp_lower(const char* a, const char* b)
 bool http_request_has_header(const Request* req, const char* key)
 {
     for (size_t i = 0; i < req->headers.size; ++i) {
-        if (strcmp_lower(key, req->headers.data[i].key) == 0) {
+        const Header* header = header_vec_at_const(&req->headers, i);
+        if (strcmp_lower(key, header->key) == 0) {
             return true;
         }
     }
@@ -52,8 +46,9 @@ bool http_request_has_header(const Request* req, const char* key)
 const char* http_request_get_header(const Request* req, const char* key)
 {
     for (size_t i = 0; i < req->headers.size; ++i) {
-        if (strcmp_lower(key, req->headers.data[i].key) == 0) {
-            return req->headers.data[i].value;
+        const Header* header = header_vec_at_const(&req->headers, i);
+        if (strcmp_lower(key, header->key) == 0) {
+            return header->value;
         }
     }
     return NULL;
@@ -3,6 +3,8 @@
 #include "packet.h"
 #include <stdint.h>
 
+/// `path`, `query`, header keys and values and `body` are allocated in the
+/// arena passed to `http_client_next`.
 typedef struct {
     Method method;
     char* path;
@@ -140,6 +140,11 @@ void* http_ctx_user_ctx(HttpCtx* ctx)
     return ctx->user_ctx;
 }
 
+Arena* http_ctx_arena(HttpCtx* ctx)
+{
+    return ctx->arena;
+}
+
 const char* http_ctx_req_path(HttpCtx* ctx)
 {
     return ctx->req->path;
@@ -177,10 +182,8 @@ size_t http_ctx_req_body_size(HttpCtx* ctx)
 
 void http_ctx_res_headers_set(HttpCtx* ctx, const char* key, const char* value)
 {
-    char* key_copy = malloc(strlen(key) + 1);
-    strcpy(key_copy, key);
-    char* value_copy = malloc(strlen(value) + 1);
-    strcpy(value_copy, value);
+    char* key_copy = arena_str_dup(ctx->arena, key);
+    char* value_copy = arena_str_dup(ctx->arena, value);
 
     header_vec_push(&ctx->res_headers, (Header) { key_copy, value_copy });
 }
@@ -203,19 +206,19 @@ void http_ctx_respond(
     String res;
     string_construct(&res);
 
-    char first_line[32];
-    snprintf(first_line,
-        32 - 1,
-        "HTTP/1.1 %d %s\r\n",
-        status,
-        http_response_code_string(status));
-    string_push_str(&res, first_line);
+    string_reserve(&res, 256);
+    string_push_str(&res, "HTTP/1.1 ");
+    string_push_int(&res, status);
+    string_push(&res, ' ');
+    string_push_str(&res, http_response_code_string(status));
+    string_push_str(&res, "\r\n");
 
     for (size_t i = 0; i < ctx->res_headers.size; ++i) {
-        Header* header = &ctx->res_headers.data[i];
-        char line[96];
-        snprintf(line, 96 - 1, "%s: %s\r\n", header->key, header->value);
-        string_push_str(&res, line);
+        const Header* header = header_vec_at_const(&ctx->res_headers, i);
+        string_push_str(&res, header->key);
+        string_push_str(&res, ": ");
+        string_push_str(&res, header->value);
+        string_push_str(&res, "\r\n");
     }
     string_push_str(&res, "\r\n");
 
@@ -41,6 +41,7 @@ struct HttpCtx {
     size_t req_body_size;
     HeaderVec res_headers;
     void* user_ctx;
+    Arena* arena;
 };
 
 const char* http_response_code_string(int code);
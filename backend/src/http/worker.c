@@ -24,7 +24,9 @@ void http_worker_construct(Worker* worker, WorkerCtx* ctx)
     *worker = (Worker) {
         .thread = (pthread_t) { 0 },
         .ctx = ctx,
+        .arena = (Arena) { 0 },
     };
+    arena_construct(&worker->arena);
 
     pthread_create(&worker->thread, NULL, http_worker_thread_fn, worker);
 }
@@ -39,6 +41,7 @@ void http_worker_destroy(Worker* worker)
 
         pthread_join(worker->thread, NULL);
     }
+    arena_destroy(&worker->arena);
 }
 
 void* http_worker_thread_fn(void* data)
@@ -73,12 +76,10 @@ void http_worker_listen(Worker* worker)
 
 void http_worker_handle_connection(Worker* worker, ClientConnection connection)
 {
-    (void)worker;
-
     Client* client = http_client_new(connection);
     Request request;
 
-    int res = http_client_next(client, &request);
+    int res = http_client_next(client, &request, &worker->arena);
     if (res != 0) {
         fprintf(stderr,
             "warning: failed to parse request. sending 400 Bad Request "
@@ -100,6 +101,7 @@ void http_worker_handle_connection(Worker* worker, ClientConnection connection)
         .req_body_size = request.body_size,
         .res_headers = { 0 },
         .user_ctx = worker->ctx->server->user_ctx,
+        .arena = &worker->arena,
     };
 
     header_vec_construct(&handler_ctx.res_headers);
@@ -126,4 +128,5 @@ void http_worker_handle_connection(Worker* worker, ClientConnection connection)
 l0_return:
     close(client->connection.file);
     http_client_free(client);
+    arena_reset(&worker->arena);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../utils/arena.h"
 #include "client_connection.h"
 #include "http.h"
 #include <bits/pthreadtypes.h>
@@ -17,6 +18,8 @@ void http_worker_ctx_destroy(WorkerCtx* ctx);
 typedef struct {
     pthread_t thread;
     WorkerCtx* ctx;
+    /// Reset after each handled connection.
+    Arena arena;
 } Worker;
 
 void http_worker_construct(Worker* worker, WorkerCtx* ctx);
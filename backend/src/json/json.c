@@ -118,6 +118,15 @@ JsonValue* json_parse(const char* text, size_t text_len)
     return json;
 }
 
+JsonValue* json_parse_arena(const char* text, size_t text_len, Arena* arena)
+{
+    JsonParser p;
+    json_parser_construct_arena(&p, text, text_len, arena);
+    JsonValue* json = json_parser_parse(&p);
+    json_parser_destroy(&p);
+    return json;
+}
+
 #define TOK_EOF '\0'
 #define TOK_ERROR 'e'
 #define TOK_NULL 'n'
@@ -126,11 +135,18 @@ JsonValue* json_parse(const char* text, size_t text_len)
 #define TOK_NUMBER '0'
 #define TOK_STRING '"'
 
-static inline JsonValue* alloc(JsonValue init);
+static inline JsonValue* alloc(JsonParser* p, JsonValue init);
+static inline char* take_string(JsonParser* p, String* string);
 static inline void lex(JsonParser* p);
 static inline void lstep(JsonParser* p);
 
 void json_parser_construct(JsonParser* p, const char* text, size_t text_len)
+{
+    json_parser_construct_arena(p, text, text_len, NULL);
+}
+
+void json_parser_construct_arena(
+    JsonParser* p, const char* text, size_t text_len, Arena* arena)
 {
     *p = (JsonParser) {
         text,
@@ -139,6 +155,7 @@ void json_parser_construct(JsonParser* p, const char* text, size_t text_len)
         .ch = text[0],
         .curr_tok = TOK_EOF,
         .curr_val = NULL,
+        .arena = arena,
     };
     lex(p);
 }
@@ -148,23 +165,59 @@ void json_parser_destroy(JsonParser* p)
     (void)p;
 }
 
-static inline void free_unused_arr(Arr* arr)
+static inline void free_unused_arr(JsonParser* p, Arr* arr)
 {
-    for (size_t i = 0; i < arr->size; ++i) {
-        json_free(arr->data[i]);
+    if (!p->arena) {
+        for (size_t i = 0; i < arr->size; ++i) {
+            json_free(arr->data[i]);
+        }
     }
     arr_destroy(arr);
 }
 
-static inline void free_unused_obj(Obj* obj)
+static inline void free_unused_obj(JsonParser* p, Obj* obj)
 {
-    for (size_t i = 0; i < obj->size; ++i) {
-        free(obj->data[i].key);
-        json_free(obj->data[i].val);
+    if (!p->arena) {
+        for (size_t i = 0; i < obj->size; ++i) {
+            free(obj->data[i].key);
+            json_free(obj->data[i].val);
+        }
     }
     obj_destroy(obj);
 }
 
+// Moves the elements into the arena, so that the value can be forgotten
+// instead of freed.
+static inline int move_arr_to_arena(JsonParser* p, Arr* arr)
+{
+    if (!p->arena)
+        return 0;
+    JsonValue** data = arena_alloc(p->arena, sizeof(JsonValue*) * arr->size);
+    if (!data)
+        return -1;
+    // Empty vectors have no data to copy.
+    if (arr->size != 0)
+        memcpy(data, arr->data, sizeof(JsonValue*) * arr->size);
+    arr_destroy(arr);
+    *arr = (Arr) { .data = data, .capacity = arr->size, .size = arr->size };
+    return 0;
+}
+
+static inline int move_obj_to_arena(JsonParser* p, Obj* obj)
+{
+    if (!p->arena)
+        return 0;
+    KV* data = arena_alloc(p->arena, sizeof(KV) * obj->size);
+    if (!data)
+        return -1;
+    // Empty vectors have no data to copy.
+    if (obj->size != 0)
+        memcpy(data, obj->data, sizeof(KV) * obj->size);
+    obj_destroy(obj);
+    *obj = (Obj) { .data = data, .capacity = obj->size, .size = obj->size };
+    return 0;
+}
+
 JsonValue* json_parser_parse(JsonParser* p)
 {
     switch (p->curr_tok) {
@@ -176,26 +229,26 @@ JsonValue* json_parser_parse(JsonParser* p)
             return NULL;
         case TOK_NULL:
             lex(p);
-            return alloc((JsonValue) { .type = JsonType_Null });
+            return alloc(p, (JsonValue) { .type = JsonType_Null });
         case TOK_FALSE:
             lex(p);
             return alloc(
-                (JsonValue) { .type = JsonType_Bool, .bool_val = false });
+                p, (JsonValue) { .type = JsonType_Bool, .bool_val = false });
         case TOK_TRUE:
             lex(p);
             return alloc(
-                (JsonValue) { .type = JsonType_Null, .bool_val = true });
+                p, (JsonValue) { .type = JsonType_Null, .bool_val = true });
         case TOK_NUMBER: {
             char* val = p->curr_val;
             lex(p);
             return alloc(
-                (JsonValue) { .type = JsonType_Number, .str_val = val });
+                p, (JsonValue) { .type = JsonType_Number, .str_val = val });
         }
         case TOK_STRING: {
             char* val = p->curr_val;
             lex(p);
             return alloc(
-                (JsonValue) { .type = JsonType_String, .str_val = val });
+                p, (JsonValue) { .type = JsonType_String, .str_val = val });
         }
     }
 
@@ -206,7 +259,7 @@ JsonValue* json_parser_parse(JsonParser* p)
         {
             JsonValue* value = json_parser_parse(p);
             if (!value) {
-                free_unused_arr(&arr);
+                free_unused_arr(p, &arr);
                 return NULL;
             }
             arr_push(&arr, value);
@@ -214,24 +267,28 @@ JsonValue* json_parser_parse(JsonParser* p)
         while (p->curr_tok != TOK_EOF && p->curr_tok != ']') {
             if (p->curr_tok != ',') {
                 fprintf(stderr, "error: json: expected ',' in array\n");
-                free_unused_arr(&arr);
+                free_unused_arr(p, &arr);
                 return NULL;
             }
             lex(p);
             JsonValue* value = json_parser_parse(p);
             if (!value) {
-                free_unused_arr(&arr);
+                free_unused_arr(p, &arr);
                 return NULL;
             }
             arr_push(&arr, value);
         }
         if (p->curr_tok != ']') {
             fprintf(stderr, "error: json: expected ']' after array\n");
-            free_unused_arr(&arr);
+            free_unused_arr(p, &arr);
             return NULL;
         }
         lex(p);
-        return alloc((JsonValue) { .type = JsonType_Array, .arr_val = arr });
+        if (move_arr_to_arena(p, &arr) != 0) {
+            free_unused_arr(p, &arr);
+            return NULL;
+        }
+        return alloc(p, (JsonValue) { .type = JsonType_Array, .arr_val = arr });
     }
 
     if (p->curr_tok == '{') {
@@ -241,20 +298,20 @@ JsonValue* json_parser_parse(JsonParser* p)
         {
             if (p->curr_tok != '"') {
                 fprintf(stderr, "error: json: expected '\"' in kv\n");
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             char* key = p->curr_val;
             lex(p);
             if (p->curr_tok != ':') {
                 fprintf(stderr, "error: json: expected ':' in kv\n");
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             lex(p);
             JsonValue* value = json_parser_parse(p);
             if (!value) {
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             obj_push(&obj, (KV) { key, value });
@@ -262,51 +319,69 @@ JsonValue* json_parser_parse(JsonParser* p)
         while (p->curr_tok != TOK_EOF && p->curr_tok != '}') {
             if (p->curr_tok != ',') {
                 fprintf(stderr, "error: json: expected ',' in object\n");
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             lex(p);
 
             if (p->curr_tok != '"') {
                 fprintf(stderr, "error: json: expected '\"' in kv\n");
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             char* key = p->curr_val;
             lex(p);
             if (p->curr_tok != ':') {
                 fprintf(stderr, "error: json: expected ':' in kv\n");
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             lex(p);
             JsonValue* value = json_parser_parse(p);
             if (!value) {
-                free_unused_obj(&obj);
+                free_unused_obj(p, &obj);
                 return NULL;
             }
             obj_push(&obj, (KV) { key, value });
         }
         if (p->curr_tok != '}') {
             fprintf(stderr, "error: json: expected '}' after object\n");
-            free_unused_obj(&obj);
+            free_unused_obj(p, &obj);
             return NULL;
         }
         lex(p);
-        return alloc((JsonValue) { .type = JsonType_Object, .obj_val = obj });
+        if (move_obj_to_arena(p, &obj) != 0) {
+            free_unused_obj(p, &obj);
+            return NULL;
+        }
+        return alloc(
+            p, (JsonValue) { .type = JsonType_Object, .obj_val = obj });
     }
 
     fprintf(stderr, "error: json: unexpeted token\n");
     return NULL;
 }
 
-static inline JsonValue* alloc(JsonValue init)
+static inline JsonValue* alloc(JsonParser* p, JsonValue init)
 {
-    JsonValue* value = malloc(sizeof(JsonValue));
+    JsonValue* value = p->arena ? arena_alloc(p->arena, sizeof(JsonValue))
+                                : malloc(sizeof(JsonValue));
+    if (!value)
+        return NULL;
     *value = init;
     return value;
 }
 
+static inline char* take_string(JsonParser* p, String* string)
+{
+    if (!p->arena)
+        return string_take(string);
+    char* copy = arena_str_slice_copy(
+        p->arena, &(StrSlice) { .ptr = string->data, .len = string->size });
+    string_destroy(string);
+    return copy;
+}
+
 static inline void lex(JsonParser* p)
 {
     if (p->i >= p->text_len) {
@@ -333,7 +408,8 @@ static inline void lex(JsonParser* p)
         case '0':
             lstep(p);
             p->curr_tok = TOK_NUMBER;
-            p->curr_val = str_dup("0");
+            p->curr_val
+                = p->arena ? arena_str_dup(p->arena, "0") : str_dup("0");
             return;
     }
     if ((p->ch >= '1' && p->ch <= '9') || p->ch == '.') {
@@ -349,8 +425,7 @@ static inline void lex(JsonParser* p)
             string_push(&value, p->ch);
             lstep(p);
         }
-        char* copy = string_copy(&value);
-        string_destroy(&value);
+        char* copy = take_string(p, &value);
 
         p->curr_tok = TOK_NUMBER;
         p->curr_val = copy;
@@ -420,8 +495,7 @@ static inline void lex(JsonParser* p)
         }
         lstep(p);
 
-        char* copy = string_copy(&value);
-        string_destroy(&value);
+        char* copy = take_string(p, &value);
 
         p->curr_tok = '"';
         p->curr_val = copy;
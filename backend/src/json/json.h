@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../utils/arena.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -28,6 +29,9 @@ const JsonValue* json_object_get(const JsonValue* value, const char* key);
 
 void json_free(JsonValue* value);
 JsonValue* json_parse(const char* text, size_t text_len);
+/// Like `json_parse`, but the values are allocated in `arena`.
+/// The result must NOT be passed to `json_free`.
+JsonValue* json_parse_arena(const char* text, size_t text_len, Arena* arena);
 
 typedef struct {
     const char* text;
@@ -37,9 +41,14 @@ typedef struct {
 
     char curr_tok;
     char* curr_val;
+
+    /// If NULL, values are heap allocated.
+    Arena* arena;
 } JsonParser;
 
 void json_parser_construct(
     JsonParser* parser, const char* text, size_t text_len);
+void json_parser_construct_arena(
+    JsonParser* parser, const char* text, size_t text_len, Arena* arena);
 void json_parser_destroy(JsonParser* parser);
 JsonValue* json_parser_parse(JsonParser* parser);
@@ -1,4 +1,6 @@
+#include "collections/hash_map.h"
 #include "collections/kv_map.h"
+#include "collections/small_vec.h"
 #include "controllers/controllers.h"
 #include "db/db_sqlite.h"
 #include "http/http.h"
@@ -7,7 +9,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 typedef struct {
     bool run_tests;
@@ -20,8 +21,6 @@ HttpServer* server;
 
 int main(int argc, char** argv)
 {
-    srand((unsigned int)time(NULL));
-
     Args args = parse_args(argc, argv);
 
     if (args.run_tests) {
@@ -106,7 +105,11 @@ static inline void run_tests(void)
 {
 #ifdef INCLUDE_TESTS
     test_util_str();
+    test_util_arena();
+    test_collections_vec();
+    test_collections_small_vec();
     test_collections_kv_map();
+    test_collections_hash_map();
     printf("\n\x1b[1;97m ALL TESTS \x1b[1;92mPASSED"
            " \x1b[1;97mSUCCESSFULLY 💅\x1b[0m\n\n");
     exit(0);
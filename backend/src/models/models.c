@@ -140,9 +140,7 @@ char* user_to_json_string(const User* m)
         m->password_hash,
         m->balance_dkk_cent);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* coord_to_json_string(const Coord* m)
@@ -161,9 +159,7 @@ char* coord_to_json_string(const Coord* m)
         m->x,
         m->y);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* product_to_json_string(const Product* m)
@@ -188,9 +184,7 @@ char* product_to_json_string(const Product* m)
         m->coord_id,
         m->barcode);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* product_price_to_json_string(const ProductPrice* m)
@@ -209,9 +203,7 @@ char* product_price_to_json_string(const ProductPrice* m)
         m->product_id,
         m->price_dkk_cent);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* receipt_to_json_string(const Receipt* m)
@@ -249,9 +241,7 @@ char* receipt_to_json_string(const Receipt* m)
             m->products.data[i].amount);
     }
     string_pushf(&string, "]}");
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* receipt_header_to_json_string(const ReceiptHeader* m)
@@ -271,9 +261,7 @@ char* receipt_header_to_json_string(const ReceiptHeader* m)
         m->user_id,
         m->total_dkk_cent,
         m->timestamp);
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* users_register_req_to_json_string(const UsersRegisterReq* m)
@@ -292,9 +280,7 @@ char* users_register_req_to_json_string(const UsersRegisterReq* m)
         m->email,
         m->password);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* sessions_login_req_to_json_string(const SessionsLoginReq* m)
@@ -311,9 +297,7 @@ char* sessions_login_req_to_json_string(const SessionsLoginReq* m)
         m->email,
         m->password);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* carts_purchase_req_to_json_string(const CartsPurchaseReq* m)
@@ -341,9 +325,7 @@ char* receipts_one_res_product_to_json_string(const ReceiptsOneResProduct* m)
         m->price_dkk_cent,
         m->amount);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* receipts_one_res_to_json_string(const ReceiptsOneRes* m)
@@ -374,9 +356,7 @@ char* receipts_one_res_to_json_string(const ReceiptsOneRes* m)
 
     string_pushf(&string, "]}");
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* products_create_req_to_json_string(const ProductsCreateReq* m)
@@ -399,9 +379,7 @@ char* products_create_req_to_json_string(const ProductsCreateReq* m)
         m->coord_id,
         m->barcode);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 char* products_coords_set_req_to_json_string(const ProductsCoordsSetReq* m)
@@ -420,9 +398,7 @@ char* products_coords_set_req_to_json_string(const ProductsCoordsSetReq* m)
         m->x,
         m->y);
 
-    char* result = string_copy(&string);
-    string_destroy(&string);
-    return result;
+    return string_take(&string);
 }
 
 typedef struct {
@@ -607,6 +583,7 @@ int carts_purchase_req_from_json(CartsPurchaseReq* m, const JsonValue* json)
 
     const JsonValue* items = json_object_get(json, "items");
     size_t items_size = json_array_size(items);
+    carts_item_vec_reserve(&m->items, items_size);
 
     for (size_t i = 0; i < items_size; ++i) {
         const JsonValue* item = json_array_get(items, i);
@@ -0,0 +1,233 @@
+#include "arena.h"
+#include "panic.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    ArenaBlock* prev;
+    size_t capacity;
+    size_t size;
+};
+
+#define ALIGN_UP(VALUE)                                                        \
+    (((VALUE) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(ArenaBlock))
+
+static inline uint8_t* block_data(ArenaBlock* block)
+{
+    return (uint8_t*)block + BLOCK_HEADER_SIZE;
+}
+
+void arena_construct(Arena* arena)
+{
+    *arena = (Arena) { .head = NULL };
+}
+
+void arena_destroy(Arena* arena)
+{
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    arena->head = NULL;
+}
+
+void arena_reset(Arena* arena)
+{
+    ArenaBlock* kept = NULL;
+    ArenaBlock* block = arena->head;
+    while (block) {
+        ArenaBlock* prev = block->prev;
+        if (!kept && block->capacity == ARENA_BLOCK_SIZE) {
+            kept = block;
+        } else {
+            free(block);
+        }
+        block = prev;
+    }
+    if (kept) {
+        *kept = (ArenaBlock) {
+            .prev = NULL,
+            .capacity = ARENA_BLOCK_SIZE,
+            .size = 0,
+        };
+    }
+    arena->head = kept;
+}
+
+void* arena_alloc(Arena* arena, size_t size)
+{
+    // Sizes for which aligning or adding the block header would wrap can
+    // never be allocated.
+    if (size > SIZE_MAX - BLOCK_HEADER_SIZE - (ARENA_ALIGN - 1))
+        return NULL;
+    size = ALIGN_UP(size);
+
+    ArenaBlock* head = arena->head;
+    if (head && head->capacity - head->size >= size) {
+        void* ptr = block_data(head) + head->size;
+        head->size += size;
+        return ptr;
+    }
+
+    size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    ArenaBlock* block = malloc(BLOCK_HEADER_SIZE + capacity);
+    if (!block)
+        return NULL;
+    *block = (ArenaBlock) {
+        .prev = head,
+        .capacity = capacity,
+        .size = size,
+    };
+
+    // An oversized block is put behind the head, so that the space left in
+    // the head block is not thrown away.
+    if (head && capacity != ARENA_BLOCK_SIZE) {
+        block->prev = head->prev;
+        head->prev = block;
+    } else {
+        arena->head = block;
+    }
+    return block_data(block);
+}
+
+void* arena_calloc(Arena* arena, size_t amount, size_t size)
+{
+    if (size != 0 && amount > SIZE_MAX / size)
+        return NULL;
+    void* ptr = arena_alloc(arena, amount * size);
+    if (!ptr)
+        return NULL;
+    memset(ptr, 0, amount * size);
+    return ptr;
+}
+
+char* arena_str_dup(Arena* arena, const char* str)
+{
+    size_t len = strlen(str);
+    char* copy = arena_alloc(arena, len + 1);
+    if (!copy)
+        return NULL;
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+char* arena_str_slice_copy(Arena* arena, const StrSlice* slice)
+{
+    char* copy = arena_alloc(arena, slice->len + 1);
+    if (!copy)
+        return NULL;
+    memcpy(copy, slice->ptr, slice->len);
+    copy[slice->len] = '\0';
+    return copy;
+}
+
+char* arena_fmt(Arena* arena, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    va_list retry;
+    va_copy(retry, args);
+
+    // Format directly into the space left in the head block, and only
+    // format again if it did not fit.
+    ArenaBlock* head = arena->head;
+    char* dst = head ? (char*)block_data(head) + head->size : NULL;
+    size_t available = head ? head->capacity - head->size : 0;
+    char* res = NULL;
+    int len = vsnprintf(dst, available, fmt, args);
+    if (len < 0)
+        goto l0_return;
+    if ((size_t)len < available) {
+        head->size += ALIGN_UP((size_t)len + 1);
+        res = dst;
+        goto l0_return;
+    }
+    res = arena_alloc(arena, (size_t)len + 1);
+    if (!res)
+        goto l0_return;
+    vsnprintf(res, (size_t)len + 1, fmt, retry);
+
+l0_return:
+    va_end(retry);
+    va_end(args);
+    return res;
+}
+
+#ifdef INCLUDE_TESTS
+void test_util_arena(void)
+{
+    Arena arena;
+    arena_construct(&arena);
+
+    {
+        char* a = arena_str_dup(&arena, "foo");
+        char* b = arena_str_dup(&arena, "bar");
+        if (strcmp(a, "foo") != 0 || strcmp(b, "bar") != 0) {
+            PANIC("strings should be intact");
+        }
+        if ((uintptr_t)a % ARENA_ALIGN != 0
+            || (uintptr_t)b % ARENA_ALIGN != 0) {
+            PANIC("allocations should be aligned");
+        }
+        if (b - a != ARENA_ALIGN) {
+            PANIC("allocations should be bumped from the same block");
+        }
+    }
+    {
+        char* small = arena_alloc(&arena, 8);
+        uint8_t* big = arena_alloc(&arena, ARENA_BLOCK_SIZE * 2);
+        memset(big, 0xff, ARENA_BLOCK_SIZE * 2);
+        char* after = arena_alloc(&arena, 8);
+        if (after - small != ARENA_ALIGN) {
+            PANIC("oversized allocation should not waste the head block");
+        }
+    }
+    {
+        for (size_t i = 0; i < 64; ++i) {
+            arena_alloc(&arena, ARENA_BLOCK_SIZE / 4);
+        }
+        arena_reset(&arena);
+        if (!arena.head || arena.head->prev || arena.head->size != 0) {
+            PANIC("reset should keep exactly one empty block");
+        }
+        StrSlice slice = { "hello world", 5 };
+        char* copy = arena_str_slice_copy(&arena, &slice);
+        if (strcmp(copy, "hello") != 0) {
+            PANIC("slice copy should be null terminated");
+        }
+        if ((uint8_t*)copy != block_data(arena.head)) {
+            PANIC("reset should reuse the kept block");
+        }
+    }
+
+    {
+        char* a = arena_fmt(&arena, "%s-%d", "foo", 42);
+        char* b = arena_fmt(&arena, "%s", "bar");
+        if (strcmp(a, "foo-42") != 0 || b - a != ARENA_ALIGN) {
+            PANIC("formatted string should be bumped from the head block");
+        }
+        char* big = arena_fmt(&arena, "%*s", ARENA_BLOCK_SIZE, "x");
+        if (!big || strlen(big) != ARENA_BLOCK_SIZE) {
+            PANIC("formatting past the head block should retry");
+        }
+    }
+
+    {
+        // Volatile, so that the compiler doesn't see the sizes, and warn
+        // about the `memset` it would otherwise inline for them.
+        volatile size_t huge = SIZE_MAX;
+        if (arena_alloc(&arena, huge) || arena_alloc(&arena, huge - 8)
+            || arena_calloc(&arena, huge / 2 + 1, 2)) {
+            PANIC("allocations whose size wraps should fail");
+        }
+    }
+
+    arena_destroy(&arena);
+}
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "str.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_BLOCK_SIZE 16384
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock ArenaBlock;
+
+/// Bump allocator. Allocations are freed all at once by `arena_reset` or
+/// `arena_destroy`, never individually.
+///
+/// Allocations larger than `ARENA_BLOCK_SIZE` get a block of their own.
+typedef struct {
+    ArenaBlock* head;
+} Arena;
+
+void arena_construct(Arena* arena);
+void arena_destroy(Arena* arena);
+
+/// Frees all allocations. One standard sized block is kept, so an arena reset
+/// between requests does not hit malloc, unless the previous request
+/// overflowed the block.
+void arena_reset(Arena* arena);
+
+/// Returns NULL if out of memory.
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t amount, size_t size);
+
+char* arena_str_dup(Arena* arena, const char* str);
+char* arena_str_slice_copy(Arena* arena, const StrSlice* slice);
+/// Like `sprintf`, but the result is allocated in `arena`. Returns NULL if
+/// out of memory or on a format error.
+char* arena_fmt(Arena* arena, const char* fmt, ...);
+
+#ifdef INCLUDE_TESTS
+void test_util_arena(void);
+#endif
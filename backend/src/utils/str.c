@@ -1,11 +1,16 @@
 #include "str.h"
 #include "panic.h"
+#include <ctype.h>
+#include <errno.h>
 #include <openssl/rand.h>
 #include <openssl/sha.h>
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/random.h>
+#include <sys/types.h>
 
 char* str_dup(const char* str)
 {
@@ -71,59 +76,110 @@ void string_destroy(String* string)
     string_data_destroy(string);
 }
 
+int string_reserve(String* string, size_t additional)
+{
+    // Room for the null terminator is always kept.
+    size_t needed = string->size + additional + 1;
+    if (needed <= string->capacity)
+        return 0;
+    size_t capacity = string->capacity * 2;
+    if (capacity < needed)
+        capacity = needed;
+    return string_data_reserve(string, capacity);
+}
+
 int string_push(String* string, char value)
 {
-    int res = string_data_push(string, value);
-    if (res != 0)
-        return res;
-    res = string_data_push(string, '\0');
-    if (res != 0)
-        return res;
-    string->size -= 1;
+    if (string_reserve(string, 1) != 0)
+        return -1;
+    string->data[string->size] = value;
+    string->size += 1;
+    string->data[string->size] = '\0';
     return 0;
 }
 
 int string_push_str(String* string, const char* str)
 {
-    size_t len = strlen(str);
-    for (size_t i = 0; i < len; ++i) {
-        int res = string_data_push(string, str[i]);
-        if (res != 0)
-            return res;
-    }
+    return string_push_slice(string, str, strlen(str));
+}
 
-    int res = string_data_push(string, '\0');
-    if (res != 0)
-        return res;
-    string->size -= 1;
+int string_push_slice(String* string, const char* ptr, size_t len)
+{
+    if (string_reserve(string, len) != 0)
+        return -1;
+    memcpy(&string->data[string->size], ptr, len);
+    string->size += len;
+    string->data[string->size] = '\0';
     return 0;
 }
 
-int string_push_fmt_va(String* string, const char* fmt, ...)
+int string_push_int(String* string, int64_t value)
 {
-    va_list args1;
-    va_start(args1, fmt);
-    va_list args2;
-    va_copy(args2, args1);
-
-    size_t buffer_size = (size_t)vsnprintf(NULL, 0, fmt, args1) + 1;
-    char* buf = malloc(buffer_size);
-    va_end(args1);
+    // 19 digits and a sign.
+    char buffer[20];
+    size_t i = sizeof(buffer);
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do {
+        buffer[--i] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        buffer[--i] = '-';
+    }
+    return string_push_slice(string, &buffer[i], sizeof(buffer) - i);
+}
 
-    vsnprintf(buf, buffer_size, fmt, args2);
-    va_end(args2);
+int string_push_fmt_va(String* string, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    va_list retry;
+    va_copy(retry, args);
+
+    // Format directly into the spare capacity, and only format again if
+    // it did not fit.
+    int res = 0;
+    char* dst = &string->data[string->size];
+    size_t available = string->capacity - string->size;
+    int len = vsnprintf(dst, available, fmt, args);
+    if (len < 0) {
+        res = -1;
+        goto l0_return;
+    }
+    if ((size_t)len >= available) {
+        if (string_reserve(string, (size_t)len) != 0) {
+            res = -1;
+            goto l0_return;
+        }
+        dst = &string->data[string->size];
+        vsnprintf(dst, (size_t)len + 1, fmt, retry);
+    }
+    string->size += (size_t)len;
 
-    return string_push_str(string, buf);
+l0_return:
+    string->data[string->size] = '\0';
+    va_end(retry);
+    va_end(args);
+    return res;
 }
 
 char* string_copy(const String* string)
 {
     char* copy = malloc(string->size + 1);
-    strncpy(copy, string->data, string->size);
+    if (!copy)
+        return NULL;
+    memcpy(copy, string->data, string->size);
     copy[string->size] = '\0';
     return copy;
 }
 
+char* string_take(String* string)
+{
+    char* data = string->data;
+    *string = (String) { .data = NULL, .capacity = 0, .size = 0 };
+    return data;
+}
+
 DEFINE_VEC_IMPL(char*, RawStrVec, rawstr_vec, )
 
 #define STR_HASH_SALT_SIZE 32
@@ -304,23 +360,73 @@ static inline uint64_t chibihash64(
 
 uint64_t str_fast_hash(const char* input)
 {
-    return chibihash64(input, sizeof(char*), 0x80085);
+    return str_fast_hash_bytes(input, strlen(input));
+}
+
+uint64_t str_fast_hash_bytes(const void* data, size_t size)
+{
+    return chibihash64(data, (ptrdiff_t)size, 0x80085);
+}
+
+#define STR_RANDOM_POOL_SIZE 256
+
+/// Random bytes are fetched in batches and handed out from a per thread pool,
+/// so that most tokens don't need a syscall.
+typedef struct {
+    uint8_t bytes[STR_RANDOM_POOL_SIZE];
+    size_t i;
+} RandomPool;
+
+static _Thread_local RandomPool random_pool = { .i = STR_RANDOM_POOL_SIZE };
+
+static inline int random_pool_fill(RandomPool* pool)
+{
+    size_t filled = 0;
+    while (filled < STR_RANDOM_POOL_SIZE) {
+        ssize_t res = getrandom(
+            &pool->bytes[filled], STR_RANDOM_POOL_SIZE - filled, 0);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res < 0) {
+            if (RAND_bytes(pool->bytes, STR_RANDOM_POOL_SIZE) != 1)
+                return -1;
+            break;
+        }
+        filled += (size_t)res;
+    }
+    pool->i = 0;
+    return 0;
 }
 
 char* str_random(size_t length)
 {
-    char* string = calloc(length + 1, sizeof(char));
+    static const char alphabet[62]
+        = "0123456789"
+          "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+          "abcdefghijklmnopqrstuvwxyz";
+    // Largest multiple of 62 that fits in a byte. Bytes above it are
+    // rejected, so that every character is equally likely.
+    const uint8_t byte_limit = 62 * 4;
+
+    char* string = malloc(length + 1);
+    if (!string)
+        return NULL;
+
+    RandomPool* pool = &random_pool;
     size_t string_i = 0;
-    for (size_t i = 0; i < length; ++i) {
-        int r = rand() % (10 + 26 + 26);
-        if (r < 10) {
-            string[string_i++] = (char)r + '0';
-        } else if (r < 10 + 26) {
-            string[string_i++] = (char)(r - 10) + 'A';
-        } else {
-            string[string_i++] = (char)(r - 10 - 26) + 'a';
+    while (string_i < length) {
+        if (pool->i >= STR_RANDOM_POOL_SIZE && random_pool_fill(pool) != 0) {
+            free(string);
+            return NULL;
         }
+        uint8_t byte = pool->bytes[pool->i];
+        pool->bytes[pool->i] = 0;
+        pool->i += 1;
+        if (byte >= byte_limit)
+            continue;
+        string[string_i++] = alphabet[byte % 62];
     }
+    string[length] = '\0';
     return string;
 }
 
@@ -343,8 +449,51 @@ void test_util_str(void)
         if (strcmp(token_1, token_2) == 0) {
             PANIC("tokens should not be equal");
         }
+        for (size_t i = 0; i < 16; ++i) {
+            if (!isalnum((unsigned char)token_1[i])) {
+                PANIC("tokens should be alphanumeric");
+            }
+        }
+        if (token_1[16] != '\0') {
+            PANIC("token should be null terminated");
+        }
         free(token_1);
         free(token_2);
     }
+    {
+        String string;
+        string_construct(&string);
+        string_push_str(&string, "abc");
+        string_push_slice(&string, "defgh", 2);
+        string_push(&string, ' ');
+        string_push_int(&string, -1234);
+        string_push(&string, ' ');
+        string_push_int(&string, INT64_MIN);
+        string_pushf(&string, " %s=%d", "x", 5);
+        const char* expected = "abcde -1234 -9223372036854775808 x=5";
+        if (strcmp(string.data, expected) != 0
+            || string.size != strlen(expected)) {
+            PANIC("expected '%s', got '%s'", expected, string.data);
+        }
+
+        // Longer than the spare capacity, so formatting has to retry.
+        char long_str[300];
+        memset(long_str, 'a', sizeof(long_str) - 1);
+        long_str[sizeof(long_str) - 1] = '\0';
+        string_pushf(&string, "[%s]", long_str);
+        if (string.size != strlen(expected) + 301
+            || string.data[string.size - 1] != ']'
+            || string.data[string.size] != '\0') {
+            PANIC("formatting past capacity failed");
+        }
+
+        char* taken = string_take(&string);
+        if (strncmp(taken, expected, strlen(expected)) != 0
+            || string.data != NULL) {
+            PANIC("take should hand over the buffer");
+        }
+        free(taken);
+        string_destroy(&string);
+    }
 }
 #endif
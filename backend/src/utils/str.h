@@ -29,10 +29,17 @@ DECLARE_VEC_TYPE(char, String, string_data, )
 
 int string_construct(String* string);
 void string_destroy(String* string);
+/// Makes room for `additional` more characters.
+int string_reserve(String* string, size_t additional);
 int string_push(String* string, char value);
 int string_push_str(String* string, const char* str);
+int string_push_slice(String* string, const char* ptr, size_t len);
+int string_push_int(String* string, int64_t value);
 int string_push_fmt_va(String* string, const char* fmt, ...);
 char* string_copy(const String* string);
+/// Hands the null terminated buffer over to the caller, who must free it.
+/// The string is left empty, and must be constructed again before reuse.
+char* string_take(String* string);
 
 #define string_pushf(STRING, ...) string_push_fmt_va(STRING, __VA_ARGS__)
 
@@ -44,6 +51,7 @@ char* str_hash(const char* input);
 bool str_hash_equal(const char* hash, const char* input);
 
 uint64_t str_fast_hash(const char* input);
+uint64_t str_fast_hash_bytes(const void* data, size_t size);
 
 char* str_random(size_t length);
 
@@ -1,87 +1,78 @@
 import { AttrView } from "./attr.ts";
 import * as lir from "./lir.ts";
+import {
+    addrRegs,
+    argRegs,
+    lineSuccessors,
+    RegAlloc,
+    RegAllocation,
+    scratchRegs,
+} from "./reg_alloc.ts";
 
 export class AsmGen {
-    private writer = new AsmWriter();
-
-    private liveRegs = new Set<lir.Reg>();
-    private regSelect = new Map<lir.Reg, string>();
-
+    private regs!: RegAllocation;
     private layout!: StackLayout;
 
     public constructor(
         private lir: lir.Program,
+        private writer: AsmWriter,
     ) {}
 
-    public generate(): string {
-        this.writeln(`bits 64`);
-        this.writeln(`section .data`);
+    public generate() {
+        this.writer.section(".data");
         for (const [id, val] of this.lir.strings) {
-            this.writeln(`align 8`);
-            this.writeln(`sbc__string_${id}:`);
-            this.writeIns(`dq ${val.length}`);
-            const escaped = val
-                .replaceAll('"', '\\"')
-                .replaceAll("\n", "\\n")
-                .replaceAll("\t", "\\t");
-            this.writeIns(`db "${escaped}"`);
+            this.writer.string(`sbc__string_${id}`, val);
         }
-        this.writeln(`section .text`);
+        this.writer.section(".text");
 
+        for (const fn of this.lir.fns) {
+            const cFunctionQuery = this.queryCFunction(fn);
+            if (cFunctionQuery.found) {
+                this.writer.extern(cFunctionQuery.label);
+            }
+        }
         for (const fn of this.lir.fns) {
             this.generateFn(fn);
         }
-
-        this.writeln(`sbc__div:`);
-        this.writeIns(`mov rax, [rsp+16]`);
-        this.writeIns(`mov rdi, [rsp+8]`);
-        this.writeIns(`cqo`);
-        this.writeIns(`idiv rdi`);
-        this.writeIns(`ret`);
-        this.writeln(`sbc__mod:`);
-        this.writeIns(`mov rax, [rsp+16]`);
-        this.writeIns(`mov rdi, [rsp+8]`);
-        this.writeIns(`cqo`);
-        this.writeIns(`idiv rdi`);
-        this.writeIns(`mov rax, rdx`);
-        this.writeIns(`ret`);
-
-        this.writeln(`; vim: syntax=nasm commentstring=;\\ %s`);
-        this.writeln("");
-        return this.writer.finalize();
     }
 
     private generateFn(fn: lir.Fn) {
-        const cFunctionQuery = this.queryCFunction(fn);
-        if (cFunctionQuery.found) {
-            const { label, args } = cFunctionQuery;
-            this.generateCFunctionBody(fn, label, args);
+        // sbc functions use the System V calling convention, so C functions
+        // are called directly and exported functions are called from C
+        // directly.
+        if (this.queryCFunction(fn).found) {
             return;
         }
 
-        this.generateFnBody(fn);
-
         const cExportQuery = this.queryCExport(fn);
         if (cExportQuery.found) {
             const { label } = cExportQuery;
-            this.generateCExporter(fn, label);
+            this.writer.global(label);
+            this.writer.label(label);
+        }
+
+        this.generateFnBody(fn);
+    }
+
+    private fnLabel(fn: lir.Fn): string {
+        const cFunctionQuery = this.queryCFunction(fn);
+        if (cFunctionQuery.found) {
+            return cFunctionQuery.label;
         }
+        return fn.label;
     }
 
     private queryCFunction(
         fn: lir.Fn,
-    ): { found: false } | { found: true; label: string; args: number } {
+    ): { found: false } | { found: true; label: string } {
         const attrs = AttrView.fromStmt(fn.mir.stmt);
         if (attrs.has("c_function")) {
             const attr = attrs.get("c_function");
             if (attr.args !== 1 || !attr.isStr(0)) {
                 throw new Error("incorrect args for attribute");
             }
-            return {
-                found: true,
-                label: attr.strVal(0),
-                args: fn.mir.paramLocals.size,
-            };
+            const label = attr.strVal(0);
+            return { found: true, label };
         }
         return { found: false };
     }
@@ -101,95 +92,186 @@ export class AsmGen {
         return { found: false };
     }
 
-    private generateCFunctionBody(fn: lir.Fn, label: string, args: number) {
-        this.writeln(`extern ${label}`);
-        this.writeln(`${fn.label}:`);
-
-        this.writeIns(`push rbp`);
-        this.writeIns(`mov rbp, rsp`);
-        this.writeIns(`sub rsp, 8`);
-
-        // By doing this, we avoid having to maintain 16-byte stack alignment.
-        this.writeIns(`and rsp, 0xFFFFFFFFFFFFFFF0`);
-
-        for (let i = 0; i < args; ++i) {
-            this.writeIns(`mov rax, ${this.relative((i + 2) * 8)}`);
-            this.writeIns(`push rax`);
-        }
-
-        const argRegs = ["rdi", "rsi", "rdx", "rcx", "r8", "r9"];
-        for (const reg of argRegs.slice(0, args)) {
-            this.writeIns(`pop ${reg}`);
-        }
-
-        this.writeIns(`call ${label}`);
-        this.writeIns(`mov rsp, rbp`);
-        this.writeIns(`pop rbp`);
-        this.writeIns(`ret`);
-    }
-
-    private generateCExporter(fn: lir.Fn, label: string) {
-        this.writeln(`global ${label}`);
-        this.writeln(`${label}:`);
-
-        this.writeIns(`push rbp`);
-        this.writeIns(`mov rbp, rsp`);
-
-        const args = fn.mir.paramLocals.size;
-
-        const argRegs = ["rdi", "rsi", "rdx", "rcx", "r8", "r9"];
-        for (const reg of argRegs.slice(0, args)) {
-            this.writeIns(`push ${reg}`);
-        }
-
-        this.writeIns(`call ${fn.label}`);
-
-        this.writeIns(`mov rsp, rbp`);
-        this.writeIns(`pop rbp`);
-        this.writeIns(`ret`);
-    }
-
     private generateFnBody(fn: lir.Fn) {
         let bodyIdx = 0;
-        const allocator = new StackAllocator();
+        const params: lir.Reg[] = [];
+        const sizes = new Map<lir.Reg, number>();
         for (const [i, { ins }] of fn.lines.entries()) {
             if (ins.tag === "alloc_param") {
-                allocator.allocParam(ins.reg, ins.size);
+                params.push(ins.reg);
+                sizes.set(ins.reg, ins.size);
             } else if (ins.tag === "alloc_local") {
-                allocator.allocLocal(ins.reg, ins.size);
+                sizes.set(ins.reg, ins.size);
             } else {
                 bodyIdx = i;
                 break;
             }
         }
+        const body = fn.lines.slice(bodyIdx);
+        const returnReg = fn.localRegs.get(fn.mir.returnLocal.id)!;
+
+        this.regs = new RegAlloc(
+            body,
+            fn.mir.entry.id,
+            params,
+            returnReg,
+        ).allocate();
+
+        // Only spilled values get a stack slot. Params passed on the stack
+        // already have one.
+        const allocator = new StackAllocator();
+        const stackRegs = new Set<lir.Reg>();
+        for (const reg of params.slice(argRegs.length)) {
+            allocator.allocParam(reg, sizes.get(reg)!);
+            stackRegs.add(reg);
+        }
+        const regs = [
+            ...params,
+            ...body.flatMap(({ ins }) => insRegs(ins)),
+        ];
+        for (const reg of regs) {
+            if (!stackRegs.has(reg) && !this.regs.regs.has(reg)) {
+                allocator.allocLocal(reg, sizes.get(reg) ?? 8);
+                stackRegs.add(reg);
+            }
+        }
+        for (const reg of this.regs.usedCalleeSaved) {
+            allocator.allocSaved(reg);
+        }
         this.layout = allocator.finalize();
 
-        const returnLocalOffset = this.layout
-            .offset(fn.localRegs.get(fn.mir.returnLocal.id)!);
-
-        this.writeln(`${fn.label}:`);
+        this.writer.label(fn.label);
+        this.writer.srcLine(fn.mir.stmt.line);
         this.writeIns(`push rbp`);
         this.writeIns(`mov rbp, rsp`);
 
-        this.writeIns(`sub rsp, ${this.layout.frameSize}`);
+        if (this.layout.frameSize !== 0) {
+            this.writeIns(`sub rsp, ${this.layout.frameSize}`);
+        }
+        for (const reg of this.regs.usedCalleeSaved) {
+            this.writeIns(
+                `mov QWORD ${
+                    this.relative(this.layout.savedOffset(reg))
+                }, ${reg}`,
+            );
+        }
+        this.parallelMove(
+            params
+                .map((reg, i) => ({
+                    dst: this.operand(reg),
+                    src: i < argRegs.length
+                        ? argRegs[i]
+                        : `QWORD ${this.slot(reg)}`,
+                })),
+        );
         this.writeIns(`jmp .L${fn.mir.entry.id}`);
 
-        for (const line of fn.lines.slice(bodyIdx)) {
+        const depths = stackDepths(body, fn.mir.entry.id);
+        for (const [i, line] of body.entries()) {
             for (const label of line.labels) {
-                this.writeln(`.L${label}:`);
+                this.writer.label(`.L${label}`);
+            }
+            if (line.srcLine !== undefined) {
+                this.writer.srcLine(line.srcLine);
             }
-            this.generateIns(line.ins);
+            this.generateIns(line.ins, depths[i]);
         }
 
-        this.writeln(`.exit:`);
-        this.writeIns(`mov rax, QWORD ${this.relative(returnLocalOffset)}`);
+        this.writer.label(`.exit`);
+        if (this.regs.regs.get(returnReg) !== "rax") {
+            this.writeIns(`mov rax, ${this.operand(returnReg)}`);
+        }
+        for (const reg of this.regs.usedCalleeSaved) {
+            this.writeIns(
+                `mov ${reg}, QWORD ${
+                    this.relative(this.layout.savedOffset(reg))
+                }`,
+            );
+        }
         this.writeIns(`mov rsp, rbp`);
         this.writeIns(`pop rbp`);
         this.writeIns(`ret`);
     }
 
-    private generateIns(ins: lir.Ins) {
-        const r = (reg: lir.Reg) => this.reg(reg);
+    // Calls with arguments in registers, and further arguments pushed from
+    // last to first. `depth` is the number of values pushed by the function
+    // itself, which the stack is padded for to keep it 16-byte aligned.
+    private generateCall(
+        ins: lir.Ins & { tag: "call_reg" | "call_imm" },
+        depth: number,
+    ) {
+        const stackArgs = ins.args.slice(argRegs.length);
+        const padding = (depth + stackArgs.length) % 2 === 1 ? 8 : 0;
+        if (padding !== 0) {
+            this.writeIns(`sub rsp, ${padding}`);
+        }
+        for (const arg of stackArgs.toReversed()) {
+            this.writeIns(`push ${this.operand(arg)}`);
+        }
+
+        let target: string;
+        if (ins.tag === "call_reg") {
+            target = this.operand(ins.reg);
+            if (argRegs.includes(target)) {
+                const [, scratch] = scratchRegs;
+                this.writeIns(`mov ${scratch}, ${target}`);
+                target = scratch;
+            }
+        } else {
+            target = this.fnLabel(ins.fn);
+        }
+        this.parallelMove(
+            ins.args
+                .slice(0, argRegs.length)
+                .map((arg, i) => ({ dst: argRegs[i], src: this.operand(arg) })),
+        );
+        this.writeIns(`call ${target}`);
+
+        const cleanup = stackArgs.length * 8 + padding;
+        if (cleanup !== 0) {
+            this.writeIns(`add rsp, ${cleanup}`);
+        }
+        if (this.regs.regs.get(ins.dst) !== "rax") {
+            this.writeIns(`mov ${this.operand(ins.dst)}, rax`);
+        }
+    }
+
+    // Emits moves which read every source before writing any destination.
+    // A move may be between a register and a stack slot, but not between
+    // two stack slots.
+    private parallelMove(moves: { dst: string; src: string }[]) {
+        const isReg = (operand: string) => !operand.includes("[");
+
+        let pending = moves.filter(({ dst, src }) => dst !== src);
+        // Stack slots aren't read by any of the moves.
+        for (const { dst, src } of pending) {
+            if (!isReg(dst)) {
+                this.writeIns(`mov ${dst}, ${src}`);
+            }
+        }
+        pending = pending.filter(({ dst }) => isReg(dst));
+
+        while (pending.length > 0) {
+            const ready = pending
+                .find(({ dst }) => !pending.some(({ src }) => src === dst));
+            if (ready) {
+                this.writeIns(`mov ${ready.dst}, ${ready.src}`);
+                pending = pending.filter((move) => move !== ready);
+                continue;
+            }
+            // The remaining moves form cycles, one of which is broken by
+            // moving a destination aside.
+            const [scratch] = scratchRegs;
+            const { dst } = pending[0];
+            this.writeIns(`mov ${scratch}, ${dst}`);
+            pending = pending.map((move) =>
+                move.src === dst ? { ...move, src: scratch } : move
+            );
+        }
+    }
+
+    private generateIns(ins: lir.Ins, depth: number) {
+        const [dstScratch, srcScratch] = scratchRegs;
 
         switch (ins.tag) {
             case "error":
@@ -201,156 +283,279 @@ export class AsmGen {
             case "alloc_local":
                 // Handled elsewhere.
                 return;
-            case "mov_int":
-                this.writeIns(`mov ${r(ins.reg)}, ${ins.val}`);
+            case "mov_int": {
+                const dst = this.def(ins.reg, dstScratch);
+                this.writeIns(`mov ${dst}, ${ins.val}`);
+                this.writeBack(ins.reg, dst);
                 return;
-            case "mov_string":
-                this.writeIns(`mov ${r(ins.reg)}, sbc__string_${ins.stringId}`);
+            }
+            case "mov_string": {
+                const dst = this.def(ins.reg, dstScratch);
+                this.writeIns(`mov ${dst}, sbc__string_${ins.stringId}`);
+                this.writeBack(ins.reg, dst);
                 return;
-            case "mov_fn":
-                this.writeIns(`mov ${r(ins.reg)}, ${ins.fn.label}`);
+            }
+            case "mov_fn": {
+                const dst = this.def(ins.reg, dstScratch);
+                this.writeIns(`mov ${dst}, ${this.fnLabel(ins.fn)}`);
+                this.writeBack(ins.reg, dst);
                 return;
+            }
             case "push":
-                this.writeIns(`push ${r(ins.reg)}`);
+                this.writeIns(`push ${this.operand(ins.reg)}`);
                 return;
             case "pop":
-                this.writeIns(`pop ${r(ins.reg)}`);
+                this.writeIns(`pop ${this.operand(ins.reg)}`);
                 return;
             case "load":
-                this.writeIns(
-                    `mov ${r(ins.reg)}, QWORD ${
-                        this.relative(this.layout.offset(ins.sReg))
-                    }`,
-                );
+                this.move(ins.reg, ins.sReg);
                 return;
             case "store_reg":
-                this.writeIns(
-                    `mov QWORD ${
-                        this.relative(this.layout.offset(ins.sReg))
-                    }, ${r(ins.reg)}`,
-                );
+                this.move(ins.sReg, ins.reg);
                 return;
-            case "store_imm":
-                this.writeIns(
-                    `mov QWORD ${
-                        this.relative(this.layout.offset(ins.sReg))
-                    }, ${ins.val}`,
-                );
+            case "store_imm": {
+                const dst = this.def(ins.sReg, dstScratch);
+                this.writeIns(`mov ${dst}, ${ins.val}`);
+                this.writeBack(ins.sReg, dst);
                 return;
-            case "call_reg":
-                this.writeIns(`call ${r(ins.reg)}`);
-                this.writeIns(`push rax`);
+            }
+            case "load_mem": {
+                const addr = this.address(ins.addr);
+                const dst = this.def(ins.reg, dstScratch);
+                this.writeIns(`mov ${dst}, QWORD ${addr}`);
+                this.writeBack(ins.reg, dst);
+                return;
+            }
+            case "store_mem": {
+                let addr = this.address(ins.addr);
+                if (!this.regs.regs.has(ins.reg) && addr.includes(srcScratch)) {
+                    this.writeIns(`lea ${dstScratch}, ${addr}`);
+                    addr = `[${dstScratch}]`;
+                }
+                const src = this.use(ins.reg, srcScratch);
+                this.writeIns(`mov QWORD ${addr}, ${src}`);
                 return;
+            }
+            case "call_reg":
             case "call_imm":
-                this.writeIns(`call ${ins.fn.label}`);
-                this.writeIns(`push rax`);
+                this.generateCall(ins, depth);
                 return;
             case "jmp":
                 this.writeIns(`jmp .L${ins.target}`);
                 return;
             case "jnz_reg":
-                this.writeIns(`cmp ${r(ins.reg)}, 0`);
+                this.writeIns(`cmp ${this.operand(ins.reg)}, 0`);
                 this.writeIns(`jne .L${ins.target}`);
                 return;
             case "ret":
                 this.writeIns(`jmp .exit`);
                 return;
             case "lt":
-                this.writeIns(`cmp ${r(ins.dst)}, ${r(ins.src)}`);
-                this.writeIns(`setl ${this.reg8(ins.dst)}`);
-                return;
             case "gt":
-                this.writeIns(`cmp ${r(ins.dst)}, ${r(ins.src)}`);
-                this.writeIns(`setg ${this.reg8(ins.dst)}`);
-                return;
             case "le":
-                this.writeIns(`cmp ${r(ins.dst)}, ${r(ins.src)}`);
-                this.writeIns(`setle ${this.reg8(ins.dst)}`);
-                return;
             case "ge":
-                this.writeIns(`cmp ${r(ins.dst)}, ${r(ins.src)}`);
-                this.writeIns(`setge ${this.reg8(ins.dst)}`);
-                return;
             case "eq":
-                this.writeIns(`cmp ${r(ins.dst)}, ${r(ins.src)}`);
-                this.writeIns(`sete ${this.reg8(ins.dst)}`);
-                return;
-            case "ne":
-                this.writeIns(`cmp ${r(ins.dst)}, ${r(ins.src)}`);
-                this.writeIns(`setne ${this.reg8(ins.dst)}`);
+            case "ne": {
+                const setcc = {
+                    "lt": "setl",
+                    "gt": "setg",
+                    "le": "setle",
+                    "ge": "setge",
+                    "eq": "sete",
+                    "ne": "setne",
+                }[ins.tag];
+                const dst = this.use(ins.dst, dstScratch);
+                const src = this.use(ins.src, srcScratch);
+                this.writeIns(`cmp ${dst}, ${src}`);
+                // `setcc` only sets the low byte.
+                this.writeIns(`${setcc} ${reg8(dst)}`);
+                this.writeIns(`movzx ${dst}, ${reg8(dst)}`);
+                this.writeBack(ins.dst, dst);
                 return;
+            }
             case "add":
-                this.writeIns(`add ${r(ins.dst)}, ${r(ins.src)}`);
-                return;
             case "sub":
-                this.writeIns(`sub ${r(ins.dst)}, ${r(ins.src)}`);
-                return;
-            case "mul":
-                this.writeIns(`imul ${r(ins.dst)}, ${r(ins.src)}`);
+            case "mul": {
+                const op = {
+                    "add": "add",
+                    "sub": "sub",
+                    "mul": "imul",
+                }[ins.tag];
+                const dst = this.use(ins.dst, dstScratch);
+                const src = this.use(ins.src, srcScratch);
+                this.writeIns(`${op} ${dst}, ${src}`);
+                this.writeBack(ins.dst, dst);
                 return;
+            }
             case "div":
-                this.writeIns(`push ${r(ins.dst)}`);
-                this.writeIns(`push ${r(ins.src)}`);
-                this.writeIns(`call sbc__div`);
-                this.writeIns(`mov ${r(ins.dst)}, rax`);
+            case "mod": {
+                // `idiv` divides `rdx:rax`, which the register allocator
+                // keeps values live across divisions out of.
+                const [divisor] = scratchRegs;
+                this.writeIns(`mov ${divisor}, ${this.operand(ins.src)}`);
+                this.writeIns(`mov rax, ${this.operand(ins.dst)}`);
+                this.writeIns(`cqo`);
+                this.writeIns(`idiv ${divisor}`);
+                const result = ins.tag === "div" ? "rax" : "rdx";
+                this.writeIns(`mov ${this.operand(ins.dst)}, ${result}`);
                 return;
-            case "mod":
-                this.writeIns(`push ${r(ins.dst)}`);
-                this.writeIns(`push ${r(ins.src)}`);
-                this.writeIns(`call sbc__mod`);
-                this.writeIns(`mov ${r(ins.dst)}, rax`);
+            }
+            case "div_imm":
+            case "mod_imm":
+                this.generateDivImm(ins);
                 return;
             case "kill":
-                this.kill(ins.reg);
+                // Liveness is computed by the register allocator.
                 return;
         }
         const _: never = ins;
     }
 
-    private reg(reg: lir.Reg): string {
-        this.allocReg(reg);
-        return this.regSelect.get(reg)!;
-    }
-
-    private reg8(reg: lir.Reg): string {
-        this.allocReg(reg);
-        return {
-            "rax": "al",
-            "rdi": "dil",
-            "rsi": "sil",
-            "rdx": "dl",
-            "rcx": "cl",
-            "r8": "r8b",
-            "r9": "r9b",
-            "r10": "r10b",
-            "r11": "r11b",
-        }[this.regSelect.get(reg)!]!;
-    }
-
-    private allocReg(reg: lir.Reg) {
-        if (!this.liveRegs.has(reg)) {
-            const regSel = [
-                "rax",
-                "rdi",
-                "rsi",
-                "rdx",
-                "rcx",
-                "r8",
-                "r9",
-                "r10",
-                "r11",
-            ].at(this.liveRegs.size);
-            if (!regSel) {
-                throw new Error("ran out of registers");
+    // Division by a constant, as described in "Hacker's Delight" by Henry S.
+    // Warren. Powers of two are divided by shifting, with negative dividends
+    // biased to round towards zero. Other divisors are multiplied by their
+    // reciprocal, in fixed point.
+    private generateDivImm(
+        ins: lir.Ins & { tag: "div_imm" | "mod_imm" },
+    ) {
+        const [dividend, bias] = scratchRegs;
+        const dst = this.operand(ins.dst);
+        const divisor = ins.val;
+        const abs = Math.abs(divisor);
+        const isDiv = ins.tag === "div_imm";
+
+        if (abs === 1) {
+            if (!isDiv) {
+                this.writeIns(`mov ${dst}, 0`);
+            } else if (divisor < 0) {
+                this.writeIns(`neg ${dst}`);
+            }
+            return;
+        }
+
+        this.writeIns(`mov ${dividend}, ${dst}`);
+        if ((abs & (abs - 1)) === 0 && abs <= 2 ** 31) {
+            const shift = Math.log2(abs);
+            this.writeIns(`mov ${bias}, ${dividend}`);
+            this.writeIns(`sar ${bias}, 63`);
+            this.writeIns(`shr ${bias}, ${64 - shift}`);
+            this.writeIns(`add ${bias}, ${dividend}`);
+            if (isDiv) {
+                this.writeIns(`sar ${bias}, ${shift}`);
+                if (divisor < 0) {
+                    this.writeIns(`neg ${bias}`);
+                }
+                this.writeIns(`mov ${dst}, ${bias}`);
+            } else {
+                this.writeIns(`and ${bias}, ${-abs}`);
+                this.writeIns(`sub ${dividend}, ${bias}`);
+                this.writeIns(`mov ${dst}, ${dividend}`);
             }
-            this.liveRegs.add(reg);
-            this.regSelect.set(reg, regSel);
+            return;
+        }
+
+        // The quotient is the high half of the product, corrected for the
+        // magic number overflowing when taken as signed, and rounded
+        // towards zero by adding its sign bit.
+        const { magic, shift } = divisionMagic(BigInt(divisor));
+        this.writeIns(`mov rax, ${magic}`);
+        this.writeIns(`imul ${dividend}`);
+        if (divisor > 0 && magic < 0n) {
+            this.writeIns(`add rdx, ${dividend}`);
+        } else if (divisor < 0 && magic > 0n) {
+            this.writeIns(`sub rdx, ${dividend}`);
+        }
+        if (shift > 0) {
+            this.writeIns(`sar rdx, ${shift}`);
+        }
+        this.writeIns(`mov rax, rdx`);
+        this.writeIns(`shr rax, 63`);
+        this.writeIns(`add rdx, rax`);
+        if (isDiv) {
+            this.writeIns(`mov ${dst}, rdx`);
+            return;
+        }
+        this.writeIns(`mov rax, ${divisor}`);
+        this.writeIns(`imul rdx, rax`);
+        this.writeIns(`sub ${dividend}, rdx`);
+        this.writeIns(`mov ${dst}, ${dividend}`);
+    }
+
+    // Memory operand for `addr`, with a spilled base loaded into the first
+    // scratch register and the index into the second. Strides the
+    // addressing mode can't scale by are partly multiplied beforehand.
+    private address(addr: lir.Addr): string {
+        const [baseScratch, indexScratch] = scratchRegs;
+        const base = this.use(addr.base, baseScratch);
+        const offset = addr.offset !== 0 ? `+${addr.offset}` : "";
+        if (addr.index === undefined) {
+            return `[${base}${offset}]`;
+        }
+        let index = this.use(addr.index, indexScratch);
+        const scale = [8, 4, 2, 1].find((scale) => addr.stride % scale === 0)!;
+        const factor = addr.stride / scale;
+        const leaFactors: Record<number, string> = {
+            2: `${index}+${index}`,
+            3: `${index}+${index}*2`,
+            4: `${index}*4`,
+            5: `${index}+${index}*4`,
+            8: `${index}*8`,
+            9: `${index}+${index}*8`,
+        };
+        if (factor in leaFactors) {
+            this.writeIns(`lea ${indexScratch}, [${leaFactors[factor]}]`);
+            index = indexScratch;
+        } else if (factor !== 1) {
+            this.writeIns(`imul ${indexScratch}, ${index}, ${factor}`);
+            index = indexScratch;
+        }
+        return `[${base}+${index}*${scale}${offset}]`;
+    }
+
+    // Register or stack slot holding `reg`, for instructions that take
+    // either.
+    private operand(reg: lir.Reg): string {
+        return this.regs.regs.get(reg) ?? `QWORD ${this.slot(reg)}`;
+    }
+
+    // Register holding `reg`, which is loaded into `scratch` if spilled.
+    private use(reg: lir.Reg, scratch: string): string {
+        const sel = this.regs.regs.get(reg);
+        if (sel) {
+            return sel;
+        }
+        this.writeIns(`mov ${scratch}, QWORD ${this.slot(reg)}`);
+        return scratch;
+    }
+
+    // Register to write `reg` to, which is written back with `writeBack`.
+    private def(reg: lir.Reg, scratch: string): string {
+        return this.regs.regs.get(reg) ?? scratch;
+    }
+
+    private writeBack(reg: lir.Reg, sel: string) {
+        if (!this.regs.regs.has(reg)) {
+            this.writeIns(`mov QWORD ${this.slot(reg)}, ${sel}`);
+        }
+    }
+
+    private move(dst: lir.Reg, src: lir.Reg) {
+        const dstSel = this.regs.regs.get(dst);
+        const srcSel = this.regs.regs.get(src);
+        if (dstSel && dstSel === srcSel) {
+            return;
+        }
+        if (dstSel || srcSel) {
+            this.writeIns(`mov ${this.operand(dst)}, ${this.operand(src)}`);
+            return;
         }
+        const [scratch] = scratchRegs;
+        this.writeIns(`mov ${scratch}, QWORD ${this.slot(src)}`);
+        this.writeIns(`mov QWORD ${this.slot(dst)}, ${scratch}`);
     }
 
-    private kill(reg: lir.Reg) {
-        this.liveRegs.delete(reg);
-        this.regSelect.delete(reg);
+    private slot(reg: lir.Reg): string {
+        return this.relative(this.layout.offset(reg));
     }
 
     private relative(offset: number): string {
@@ -358,30 +563,89 @@ export class AsmGen {
     }
 
     private writeIns(ins: string) {
-        this.writer.writeln(`    ${ins}`);
+        this.writer.ins(ins);
     }
+}
 
-    private writeln(line: string) {
-        this.writer.writeln(line);
-    }
+// Destination of the generated code, which is either written as NASM
+// assembly or assembled directly into an object file.
+export interface AsmWriter {
+    section(name: ".data" | ".text"): void;
+    extern(label: string): void;
+    global(label: string): void;
+    // Labels starting with `.` are local to the preceding label, as in NASM.
+    label(label: string): void;
+    // String constant, 8-byte aligned and preceded by its length.
+    string(label: string, val: string): void;
+    // Source line the following instructions are generated from.
+    srcLine(line: number): void;
+    ins(ins: string): void;
 }
 
-class AsmWriter {
-    private result = "";
+// Writes NASM assembly, with `%line` directives mapping it to the source
+// file, which NASM puts in the debug info if assembling with `-g`.
+export class NasmWriter implements AsmWriter {
+    private result = "bits 64\n";
+    private currentSrcLine?: number;
 
-    public writeln(line: string) {
-        this.result += `${line}\n`;
+    public constructor(
+        private srcFile: string,
+    ) {}
+
+    public section(name: ".data" | ".text") {
+        this.writeln(`section ${name}`);
+    }
+
+    public extern(label: string) {
+        this.writeln(`extern ${label}`);
+    }
+
+    public global(label: string) {
+        this.writeln(`global ${label}`);
+    }
+
+    public label(label: string) {
+        this.writeln(`${label}:`);
+    }
+
+    public string(label: string, val: string) {
+        this.writeln(`align 8`);
+        this.writeln(`${label}:`);
+        this.ins(`dq ${val.length}`);
+        const escaped = val
+            .replaceAll('"', '\\"')
+            .replaceAll("\n", "\\n")
+            .replaceAll("\t", "\\t");
+        this.ins(`db "${escaped}"`);
+    }
+
+    public srcLine(line: number) {
+        if (line !== this.currentSrcLine) {
+            this.writeln(`%line ${line}+0 ${this.srcFile}`);
+            this.currentSrcLine = line;
+        }
+    }
+
+    public ins(ins: string) {
+        this.writeln(`    ${ins}`);
     }
 
     public finalize(): string {
+        this.writeln(`; vim: syntax=nasm commentstring=;\\ %s`);
+        this.writeln("");
         return this.result;
     }
+
+    private writeln(line: string) {
+        this.result += `${line}\n`;
+    }
 }
 
 class StackLayout {
     public constructor(
         public readonly frameSize: number,
         private regOffsets: Map<lir.Reg, number>,
+        private savedOffsets: Map<string, number>,
     ) {}
 
     public offset(reg: lir.Reg): number {
@@ -391,11 +655,20 @@ class StackLayout {
         }
         return offset;
     }
+
+    public savedOffset(reg: string): number {
+        const offset = this.savedOffsets.get(reg);
+        if (!offset) {
+            throw new Error("not found");
+        }
+        return offset;
+    }
 }
 
 class StackAllocator {
     private paramRegs = new Map<lir.Reg, number>();
     private localRegs = new Map<lir.Reg, number>();
+    private savedRegs: string[] = [];
 
     public allocParam(reg: lir.Reg, size: number) {
         this.paramRegs.set(reg, size);
@@ -403,22 +676,25 @@ class StackAllocator {
     public allocLocal(reg: lir.Reg, size: number) {
         this.localRegs.set(reg, size);
     }
+    // Slot for saving a callee saved register.
+    public allocSaved(reg: string) {
+        this.savedRegs.push(reg);
+    }
 
     public finalize(): StackLayout {
         const regOffsets = new Map<lir.Reg, number>();
 
-        // Last param is at [rbp+8]
-        // See: https://eli.thegreenplace.net/2011/09/06/stack-frame-layout-on-x86-64
-        let currentOffset = 8;
+        // Params passed on the stack start above the return address, with
+        // the first at [rbp+16].
+        let currentOffset = 16;
 
-        for (const [reg, size] of [...this.paramRegs].toReversed()) {
+        for (const [reg, size] of this.paramRegs) {
+            regOffsets.set(reg, currentOffset);
             // Parameters are by convention 8-byte aligned.
             currentOffset += align8(size);
-            regOffsets.set(reg, currentOffset);
         }
 
         // First local is at [rbp-8]
-        // See above.
         currentOffset = -8;
         let frameSize = 0;
 
@@ -428,7 +704,145 @@ class StackAllocator {
             frameSize += align8(size);
         }
 
-        return new StackLayout(frameSize, regOffsets);
+        const savedOffsets = new Map<string, number>();
+        for (const reg of this.savedRegs) {
+            savedOffsets.set(reg, currentOffset);
+            currentOffset -= 8;
+            frameSize += 8;
+        }
+
+        // Keeps the stack 16-byte aligned after the prologue, as calls
+        // require.
+        frameSize = align(frameSize, 16);
+
+        return new StackLayout(frameSize, regOffsets, savedOffsets);
+    }
+}
+
+// Number of values the function has pushed before each line.
+function stackDepths(lines: lir.Line[], entry: lir.Label): number[] {
+    const succs = lineSuccessors(lines);
+    const depths: number[] = lines.map(() => 0);
+    const visited = new Set<number>();
+    const entryLine = lines.findIndex(({ labels }) => labels.includes(entry));
+    const worklist = [Math.max(entryLine, 0)];
+    visited.add(worklist[0]);
+    while (worklist.length > 0) {
+        const i = worklist.pop()!;
+        const ins = lines[i].ins;
+        const depth = depths[i] +
+            (ins.tag === "push" ? 1 : ins.tag === "pop" ? -1 : 0);
+        for (const succ of succs[i]) {
+            if (!visited.has(succ)) {
+                visited.add(succ);
+                depths[succ] = depth;
+                worklist.push(succ);
+            }
+        }
+    }
+    return depths;
+}
+
+const legacyRegs8: Record<string, string> = {
+    "rax": "al",
+    "rbx": "bl",
+    "rcx": "cl",
+    "rdx": "dl",
+    "rsi": "sil",
+    "rdi": "dil",
+};
+
+// Low byte of a 64-bit register, which is `r8b` through `r15b` for the
+// numbered registers.
+function reg8(reg: string): string {
+    return legacyRegs8[reg] ?? `${reg}b`;
+}
+
+// Magic number and shift dividing 64-bit integers by `divisor`, which is
+// neither 0, 1 nor -1, as computed in "Hacker's Delight" figure 10-1.
+function divisionMagic(divisor: bigint): { magic: bigint; shift: number } {
+    const two63 = 1n << 63n;
+    const mask = (1n << 64n) - 1n;
+    const abs = divisor < 0n ? -divisor : divisor;
+    const t = two63 + (divisor < 0n ? 1n : 0n);
+    const absNc = t - 1n - t % abs;
+    let p = 63;
+    let q1 = two63 / absNc;
+    let r1 = two63 - q1 * absNc;
+    let q2 = two63 / abs;
+    let r2 = two63 - q2 * abs;
+    let delta: bigint;
+    do {
+        p += 1;
+        q1 = 2n * q1 & mask;
+        r1 = 2n * r1 & mask;
+        if (r1 >= absNc) {
+            q1 += 1n;
+            r1 -= absNc;
+        }
+        q2 = 2n * q2 & mask;
+        r2 = 2n * r2 & mask;
+        if (r2 >= abs) {
+            q2 += 1n;
+            r2 -= abs;
+        }
+        delta = abs - r2;
+    } while (q1 < delta || (q1 === delta && r1 === 0n));
+    const magic = BigInt.asIntN(64, q2 + 1n);
+    return {
+        magic: divisor < 0n ? BigInt.asIntN(64, -magic) : magic,
+        shift: p - 64,
+    };
+}
+
+export function insRegs(ins: lir.Ins): lir.Reg[] {
+    switch (ins.tag) {
+        case "error":
+        case "nop":
+            return [];
+        case "alloc_param":
+        case "alloc_local":
+        case "mov_int":
+        case "mov_string":
+        case "mov_fn":
+        case "push":
+        case "pop":
+            return [ins.reg];
+        case "load":
+        case "store_reg":
+            return [ins.reg, ins.sReg];
+        case "store_imm":
+            return [ins.sReg];
+        case "load_mem":
+        case "store_mem":
+            return [ins.reg, ...addrRegs(ins.addr)];
+        case "call_reg":
+            return [ins.reg, ...ins.args, ins.dst];
+        case "call_imm":
+            return [...ins.args, ins.dst];
+        case "jmp":
+            return [];
+        case "jnz_reg":
+            return [ins.reg];
+        case "ret":
+            return [];
+        case "lt":
+        case "gt":
+        case "le":
+        case "ge":
+        case "eq":
+        case "ne":
+        case "add":
+        case "sub":
+        case "mul":
+        case "div":
+        case "mod":
+            return [ins.dst, ins.src];
+        case "div_imm":
+        case "mod_imm":
+            return [ins.dst];
+        case "kill":
+            return [ins.reg];
     }
 }
 
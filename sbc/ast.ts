@@ -14,6 +14,7 @@ export type Stmt = {
 export type StmtKind =
     | { tag: "error" }
     | { tag: "fn" } & FnStmt
+    | { tag: "struct" } & StructStmt
     | { tag: "let" } & LetStmt
     | { tag: "loop"; body: Block }
     | { tag: "while"; expr: Expr; body: Block }
@@ -31,6 +32,17 @@ export type FnStmt = {
     body: Block;
 };
 
+export type StructStmt = {
+    ident: string;
+    fields: Field[];
+};
+
+export type Field = {
+    ident: string;
+    line: number;
+    ty: Ty;
+};
+
 export type LetStmt = {
     ident: string;
     ty?: Ty;
@@ -55,6 +67,8 @@ export type ExprKind =
     | { tag: "int"; val: number }
     | { tag: "str"; val: string }
     | { tag: "call"; expr: Expr; args: Expr[] }
+    | { tag: "field"; expr: Expr; ident: string }
+    | { tag: "index"; expr: Expr; index: Expr }
     | { tag: "not"; expr: Expr }
     | { tag: "negate"; expr: Expr }
     | { tag: "binary"; op: BinaryOp; left: Expr; right: Expr };
@@ -0,0 +1,150 @@
+import { assertEquals } from "jsr:@std/assert";
+import { AsmGen } from "./asm_gen.ts";
+import { compile } from "./compile.ts";
+import { ElfWriter } from "./elf.ts";
+
+// Compiles the cart total of the backend, which is linked into it from the
+// object file, see `backend/src/controllers/carts.c`.
+const cartsFile = new URL(
+    "../backend/src/controllers/carts.sbl",
+    import.meta.url,
+);
+const modelsDir = new URL("../backend/src/models/", import.meta.url);
+
+async function compileCarts(): Promise<Uint8Array> {
+    const text = await Deno.readTextFile(cartsFile);
+    const lir = compile(text, { optimize: true, unrollFactor: 4 });
+    const writer = new ElfWriter(cartsFile.pathname, Deno.cwd());
+    new AsmGen(lir, writer).generate();
+    return writer.finalize();
+}
+
+type Section = { name: string; type: number; offset: number; size: number };
+
+function elfSections(elf: DataView): Section[] {
+    const shoff = Number(elf.getBigUint64(0x28, true));
+    const shentsize = elf.getUint16(0x3a, true);
+    const shnum = elf.getUint16(0x3c, true);
+    const shstrndx = elf.getUint16(0x3e, true);
+    const headers = [];
+    for (let i = 0; i < shnum; ++i) {
+        const at = shoff + i * shentsize;
+        headers.push({
+            nameOffset: elf.getUint32(at, true),
+            type: elf.getUint32(at + 0x4, true),
+            offset: Number(elf.getBigUint64(at + 0x18, true)),
+            size: Number(elf.getBigUint64(at + 0x20, true)),
+        });
+    }
+    const names = headers[shstrndx].offset;
+    return headers.map(({ nameOffset, type, offset, size }) => ({
+        name: cString(elf, names + nameOffset),
+        type,
+        offset,
+        size,
+    }));
+}
+
+function cString(elf: DataView, offset: number): string {
+    let end = offset;
+    while (elf.getUint8(end) !== 0) {
+        end += 1;
+    }
+    return new TextDecoder().decode(elf.buffer.slice(offset, end));
+}
+
+Deno.test("compile carts.sbl to an object file", async () => {
+    const bytes = await compileCarts();
+    const elf = new DataView(bytes.buffer);
+
+    assertEquals([...bytes.slice(0, 4)], [0x7f, 0x45, 0x4c, 0x46]);
+    // Relocatable x86-64 object file.
+    assertEquals(elf.getUint16(0x10, true), 1);
+    assertEquals(elf.getUint16(0x12, true), 62);
+
+    const sections = elfSections(elf);
+    const section = (name: string) => sections.find((s) => s.name === name)!;
+    assertEquals(sections.map(({ name }) => name), [
+        "",
+        ".text",
+        ".data",
+        ".debug_abbrev",
+        ".debug_info",
+        ".debug_line",
+        ".symtab",
+        ".strtab",
+        ".rela.text",
+        ".rela.debug_info",
+        ".rela.debug_line",
+        ".note.GNU-stack",
+        ".shstrtab",
+    ]);
+
+    // The exported function is a global function symbol in `.text`.
+    const symtab = section(".symtab");
+    const strtab = section(".strtab");
+    const symbols = [];
+    for (let at = symtab.offset; at < symtab.offset + symtab.size; at += 24) {
+        symbols.push({
+            name: cString(elf, strtab.offset + elf.getUint32(at, true)),
+            info: elf.getUint8(at + 4),
+            shndx: elf.getUint16(at + 6, true),
+            size: Number(elf.getBigUint64(at + 16, true)),
+        });
+    }
+    const sym = symbols
+        .find(({ name }) => name === "sbc_calculate_total_price");
+    assertEquals(sym?.info, 1 << 4 | 2);
+    assertEquals(sym?.shndx, sections.indexOf(section(".text")));
+    assertEquals(sym!.size > 0, true);
+});
+
+Deno.test("link carts.sbl into a C program", async () => {
+    const dir = await Deno.makeTempDir();
+    try {
+        await Deno.writeFile(`${dir}/carts.o`, await compileCarts());
+        await Deno.writeTextFile(
+            `${dir}/main.c`,
+            `#include "models.h"
+#include <stdio.h>
+
+extern int64_t sbc_calculate_total_price(int64_t item_amount,
+    const CartsItemVec* items,
+    const ProductPriceVec* prices);
+
+int main(void)
+{
+    CartsItem items[] = { { 1, 2 }, { 2, 3 }, { 3, 1 }, { 4, 0 }, { 5, 7 } };
+    ProductPrice prices[] = {
+        { 11, 1, 1000 },
+        { 12, 2, 250 },
+        { 13, 3, 99 },
+        { 14, 4, 5000 },
+        { 15, 5, 1 },
+    };
+    CartsItemVec item_vec = { items, 5, 5 };
+    ProductPriceVec price_vec = { prices, 5, 5 };
+    printf("%ld\\n", sbc_calculate_total_price(5, &item_vec, &price_vec));
+}
+`,
+        );
+        const gcc = new Deno.Command("gcc", {
+            args: [
+                "-no-pie",
+                `-I${modelsDir.pathname}`,
+                `${dir}/main.c`,
+                `${dir}/carts.o`,
+                "-o",
+                `${dir}/carts`,
+            ],
+        });
+        assertEquals((await gcc.output()).code, 0);
+
+        const { code, stdout } = await new Deno.Command(`${dir}/carts`)
+            .output();
+        assertEquals(code, 0);
+        assertEquals(new TextDecoder().decode(stdout), "2856\n");
+    } finally {
+        await Deno.remove(dir, { recursive: true });
+    }
+});
@@ -0,0 +1,49 @@
+import * as yaml from "jsr:@std/yaml";
+import { Checker, Parser, Resolver } from "./front.ts";
+import { MirGen } from "./mir_gen.ts";
+import { FnStringifyer } from "./mir.ts";
+import { LirGen } from "./lir_gen.ts";
+import { Program, ProgramStringifyer } from "./lir.ts";
+import { optimizeLir } from "./lir_optimize.ts";
+
+export type CompileOptions = {
+    optimize: boolean;
+    // Copies of a loop body made by unrolling. 0 or 1 disables unrolling.
+    unrollFactor: number;
+};
+
+// Compiles the source `text` to LIR, from which the output is generated.
+export function compile(text: string, opts: CompileOptions): Program {
+    const { optimize, unrollFactor } = opts;
+
+    const ast = new Parser(text).parse();
+    // console.log("=== AST ===");
+    // console.log(yaml.stringify(ast));
+
+    const re = new Resolver(ast).resolve();
+    const ch = new Checker(re);
+
+    const mirGen = new MirGen(re, ch);
+
+    // console.log("=== MIR ===");
+    // for (const stmt of ast) {
+    //     if (stmt.kind.tag !== "fn") {
+    //         throw new Error("only functions can compile top level");
+    //     }
+    //     const fnMir = mirGen.fnMir(stmt, stmt.kind);
+    //     console.log(new FnStringifyer(fnMir).stringify());
+    // }
+
+    const lir = new LirGen(ast, mirGen, {
+        optimize,
+        unrollFactor,
+    }).generate();
+    // console.log("=== LIR ===");
+    // console.log(new ProgramStringifyer(lir).stringify());
+
+    if (optimize) {
+        optimizeLir(lir);
+    }
+
+    return lir;
+}
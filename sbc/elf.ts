@@ -0,0 +1,670 @@
+import { AsmWriter } from "./asm_gen.ts";
+import { Encoded, encodeIns, littleEndian } from "./x86.ts";
+
+// Assembles the generated code directly into an ELF64 relocatable object
+// file, as `nasm -f elf64` would from the `NasmWriter` output.
+export class ElfWriter implements AsmWriter {
+    private code: Encoded[] = [];
+    private data: number[] = [];
+    private section_: ".data" | ".text" = ".text";
+    // Label local labels are scoped under.
+    private scope = "";
+    private symbols = new Map<string, Sym>();
+    private globals = new Set<string>();
+    private externs = new Set<string>();
+    // Source lines of the instructions, from the instruction at `ins` until
+    // the next entry.
+    private srcLines: { ins: number; line: number }[] = [];
+
+    public constructor(
+        private srcFile: string,
+        private compDir: string,
+    ) {}
+
+    public section(name: ".data" | ".text") {
+        this.section_ = name;
+    }
+
+    public extern(label: string) {
+        this.externs.add(label);
+    }
+
+    public global(label: string) {
+        this.globals.add(label);
+    }
+
+    public label(label: string) {
+        if (!label.startsWith(".")) {
+            this.scope = label;
+        }
+        const name = this.qualify(label);
+        if (this.symbols.has(name)) {
+            throw new Error(`label '${name}' defined twice`);
+        }
+        this.symbols.set(
+            name,
+            this.section_ === ".text"
+                ? { section: ".text", ins: this.code.length }
+                : { section: ".data", offset: this.data.length },
+        );
+    }
+
+    public string(label: string, val: string) {
+        while (this.data.length % 8 !== 0) {
+            this.data.push(0);
+        }
+        this.label(label);
+        const bytes = new TextEncoder().encode(val);
+        this.data.push(...littleEndian(BigInt(bytes.length), 8));
+        for (const byte of bytes) {
+            this.data.push(byte);
+        }
+    }
+
+    public srcLine(line: number) {
+        const last = this.srcLines.at(-1);
+        if (last?.ins === this.code.length) {
+            last.line = line;
+        } else if (last?.line !== line) {
+            this.srcLines.push({ ins: this.code.length, line });
+        }
+    }
+
+    public ins(ins: string) {
+        if (this.section_ !== ".text") {
+            throw new Error("instructions outside .text");
+        }
+        const encoded = encodeIns(ins);
+        for (const fixup of encoded.fixups) {
+            fixup.sym = this.qualify(fixup.sym);
+        }
+        this.code.push(encoded);
+    }
+
+    public finalize(): Uint8Array {
+        const { text, offsets, short } = this.layoutText();
+        const symOffset = (sym: Sym) =>
+            sym.section === ".text" ? offsets[sym.ins] : sym.offset;
+        const sectionSizes = {
+            ".text": text.length,
+            ".data": this.data.length,
+        };
+
+        // Local symbols precede global ones, as the symbol table requires.
+        // Local labels aren't included.
+        const locals = this.symbols.keys()
+            .filter((name) => !name.includes(".") && !this.globals.has(name))
+            .toArray();
+        const globals = [...this.globals, ...this.externs];
+
+        // Symbols extend to the next symbol in their section, so that
+        // profilers and debuggers attribute the code of a function to it.
+        const starts = (section: ".data" | ".text") =>
+            this.symbols.entries()
+                .filter(([name, sym]) =>
+                    !name.includes(".") && sym.section === section
+                )
+                .map(([, sym]) => symOffset(sym))
+                .toArray()
+                .toSorted((a, b) => a - b);
+        const sectionStarts = {
+            ".text": starts(".text"),
+            ".data": starts(".data"),
+        };
+        const symSize = (sym: Sym) => {
+            const offset = symOffset(sym);
+            const next = sectionStarts[sym.section]
+                .find((start) => start > offset);
+            return (next ?? sectionSizes[sym.section]) - offset;
+        };
+
+        const strtab = new StringTable();
+        const symtab = new Bytes();
+        const symIndices = new Map<string, number>();
+        const addSym = (
+            name: string,
+            info: number,
+            shndx: number,
+            value: number,
+            size: number,
+        ) => {
+            symIndices.set(name, symtab.bytes.length / 24);
+            // Section symbols are named by their section.
+            symtab.u32(info === STT_SECTION ? 0 : strtab.add(name));
+            symtab.u8(info);
+            symtab.u8(0);
+            symtab.u16(shndx);
+            symtab.u64(BigInt(value));
+            symtab.u64(BigInt(size));
+        };
+        symtab.zeros(24);
+        for (const section of sectionSyms) {
+            addSym(section, STT_SECTION, sectionIndex(section), 0, 0);
+        }
+        for (const name of [...locals, ...globals]) {
+            const sym = this.symbols.get(name);
+            const bind = this.globals.has(name) || !sym ? STB_GLOBAL : 0;
+            if (!sym) {
+                if (!this.externs.has(name)) {
+                    throw new Error(`global label '${name}' not defined`);
+                }
+                addSym(name, bind << 4, SHN_UNDEF, 0, 0);
+                continue;
+            }
+            const type = sym.section === ".text" ? STT_FUNC : STT_OBJECT;
+            addSym(
+                name,
+                bind << 4 | type,
+                sectionIndex(sym.section),
+                symOffset(sym),
+                symSize(sym),
+            );
+        }
+        const firstGlobal = 1 + sectionSyms.length + locals.length;
+
+        // Jumps and calls within .text are resolved here. Everything else
+        // is left to the linker.
+        const textRela = new Relocations(symIndices);
+        for (const [i, { fixups }] of this.code.entries()) {
+            if (short[i]) {
+                continue;
+            }
+            for (const fixup of fixups) {
+                const offset = offsets[i] + fixup.offset;
+                const sym = this.symbols.get(fixup.sym);
+                if (fixup.kind === "rel32" && sym?.section === ".text") {
+                    const rel = symOffset(sym) - (offset + 4);
+                    text.splice(offset, 4, ...littleEndian(BigInt(rel), 4));
+                    continue;
+                }
+                if (fixup.kind === "abs64") {
+                    textRela.add(offset, fixup.sym, R_X86_64_64, 0);
+                } else {
+                    const type = this.externs.has(fixup.sym)
+                        ? R_X86_64_PLT32
+                        : R_X86_64_PC32;
+                    textRela.add(offset, fixup.sym, type, -4);
+                }
+            }
+        }
+
+        const infoRela = new Relocations(symIndices);
+        const lineRela = new Relocations(symIndices);
+        const debugAbbrev = this.debugAbbrev();
+        const debugInfo = this.debugInfo(text.length, infoRela);
+        const debugLine = this.debugLine(offsets, text.length, lineRela);
+
+        const sections: Section[] = [
+            {
+                name: ".text",
+                type: SHT_PROGBITS,
+                flags: SHF_ALLOC | SHF_EXECINSTR,
+                bytes: text,
+                align: 16,
+            },
+            {
+                name: ".data",
+                type: SHT_PROGBITS,
+                flags: SHF_WRITE | SHF_ALLOC,
+                bytes: this.data,
+                align: 8,
+            },
+            {
+                name: ".debug_abbrev",
+                type: SHT_PROGBITS,
+                bytes: debugAbbrev,
+            },
+            {
+                name: ".debug_info",
+                type: SHT_PROGBITS,
+                bytes: debugInfo,
+            },
+            {
+                name: ".debug_line",
+                type: SHT_PROGBITS,
+                bytes: debugLine,
+            },
+            {
+                name: ".symtab",
+                type: SHT_SYMTAB,
+                bytes: symtab.bytes,
+                link: sectionIndex(".strtab"),
+                info: firstGlobal,
+                align: 8,
+                entsize: 24,
+            },
+            {
+                name: ".strtab",
+                type: SHT_STRTAB,
+                bytes: strtab.bytes.bytes,
+            },
+            ...[
+                { name: ".text", rela: textRela },
+                { name: ".debug_info", rela: infoRela },
+                { name: ".debug_line", rela: lineRela },
+            ].map(({ name, rela }) => ({
+                name: `.rela${name}`,
+                type: SHT_RELA,
+                flags: SHF_INFO_LINK,
+                bytes: rela.bytes.bytes,
+                link: sectionIndex(".symtab"),
+                info: sectionIndex(name),
+                align: 8,
+                entsize: 24,
+            })),
+            // Marks the stack as not executable.
+            { name: ".note.GNU-stack", type: SHT_PROGBITS, bytes: [] },
+        ];
+        if (sections.some(({ name }, i) => sectionIndex(name) !== i + 1)) {
+            throw new Error("sections not in order");
+        }
+        return writeElf(sections);
+    }
+
+    // The debug info is a single compile unit, which only describes the
+    // source file and the code it covers, for the line table.
+    private debugAbbrev(): number[] {
+        const out = new Bytes();
+        out.uleb(1);
+        out.uleb(DW_TAG_compile_unit);
+        out.u8(DW_CHILDREN_no);
+        for (
+            const [attr, form] of [
+                [DW_AT_name, DW_FORM_string],
+                [DW_AT_comp_dir, DW_FORM_string],
+                [DW_AT_producer, DW_FORM_string],
+                [DW_AT_stmt_list, DW_FORM_sec_offset],
+                [DW_AT_low_pc, DW_FORM_addr],
+                [DW_AT_high_pc, DW_FORM_data8],
+            ]
+        ) {
+            out.uleb(attr);
+            out.uleb(form);
+        }
+        out.uleb(0);
+        out.uleb(0);
+        out.uleb(0);
+        return out.bytes;
+    }
+
+    private debugInfo(textSize: number, rela: Relocations): number[] {
+        const out = new Bytes();
+        out.u32(0); // unit length, filled in below
+        out.u16(dwarfVersion);
+        rela.add(out.bytes.length, ".debug_abbrev", R_X86_64_32, 0);
+        out.u32(0);
+        out.u8(8); // address size
+        out.uleb(1);
+        out.cstr(this.srcFile);
+        out.cstr(this.compDir);
+        out.cstr("sbc");
+        rela.add(out.bytes.length, ".debug_line", R_X86_64_32, 0);
+        out.u32(0);
+        rela.add(out.bytes.length, ".text", R_X86_64_64, 0);
+        out.u64(0n);
+        out.u64(BigInt(textSize));
+        out.patchU32(0, out.bytes.length - 4);
+        return out.bytes;
+    }
+
+    // Line table mapping every instruction to the source line it was
+    // generated from.
+    private debugLine(
+        offsets: number[],
+        textSize: number,
+        rela: Relocations,
+    ): number[] {
+        const out = new Bytes();
+        out.u32(0); // unit length, filled in below
+        out.u16(dwarfVersion);
+        out.u32(0); // header length, filled in below
+        const headerStart = out.bytes.length;
+        out.u8(1); // minimum instruction length
+        out.u8(1); // maximum operations per instruction
+        out.u8(1); // default is_stmt
+        out.u8(lineBase);
+        out.u8(lineRange);
+        out.u8(opcodeBase);
+        out.append(standardOpcodeLengths);
+        out.u8(0); // no include directories
+        out.cstr(this.srcFile);
+        out.uleb(0); // directory, being the compilation directory
+        out.uleb(0); // modification time
+        out.uleb(0); // length
+        out.u8(0);
+        out.patchU32(headerStart - 4, out.bytes.length - headerStart);
+
+        out.u8(0);
+        out.uleb(9);
+        out.u8(DW_LNE_set_address);
+        rela.add(out.bytes.length, ".text", R_X86_64_64, 0);
+        out.u64(0n);
+        let address = 0;
+        let line = 1;
+        for (const srcLine of this.srcLines) {
+            const offset = offsets[srcLine.ins];
+            if (srcLine.line !== line) {
+                out.u8(DW_LNS_advance_line);
+                out.sleb(srcLine.line - line);
+                line = srcLine.line;
+            }
+            if (offset !== address) {
+                out.u8(DW_LNS_advance_pc);
+                out.uleb(offset - address);
+                address = offset;
+            }
+            out.u8(DW_LNS_copy);
+        }
+        if (textSize !== address) {
+            out.u8(DW_LNS_advance_pc);
+            out.uleb(textSize - address);
+        }
+        out.u8(0);
+        out.uleb(1);
+        out.u8(DW_LNE_end_sequence);
+        out.patchU32(0, out.bytes.length - 4);
+        return out.bytes;
+    }
+
+    // Lays out the instructions, with jumps shortened where their target is
+    // in range. Jumps start out short and are lengthened until every target
+    // is in range, since lengthening one may put others out of range.
+    // Returns the code, with short jumps resolved, the offset of every
+    // instruction and which jumps are short.
+    private layoutText(): {
+        text: number[];
+        offsets: number[];
+        short: boolean[];
+    } {
+        // Instructions jumps within .text jump to.
+        const targets = this.code.map(({ shortOpcode, fixups }) => {
+            const sym = shortOpcode && this.symbols.get(fixups[0].sym);
+            return sym?.section === ".text" ? sym.ins : undefined;
+        });
+        const short = targets.map((target) => target !== undefined);
+        const size = (i: number) =>
+            short[i]
+                ? this.code[i].shortOpcode!.length + 1
+                : this.code[i].bytes.length;
+        const shortRel = (i: number, offsets: number[]) =>
+            offsets[targets[i]!] - (offsets[i] + size(i));
+
+        let offsets: number[];
+        let changed: boolean;
+        do {
+            offsets = [];
+            let offset = 0;
+            for (let i = 0; i <= this.code.length; ++i) {
+                offsets.push(offset);
+                offset += i < this.code.length ? size(i) : 0;
+            }
+            changed = false;
+            for (const i of this.code.keys()) {
+                const rel = short[i] ? shortRel(i, offsets) : 0;
+                if (rel < -128 || rel > 127) {
+                    short[i] = false;
+                    changed = true;
+                }
+            }
+        } while (changed);
+
+        const text: number[] = [];
+        for (const [i, { bytes, shortOpcode }] of this.code.entries()) {
+            if (short[i]) {
+                text.push(...shortOpcode!, shortRel(i, offsets) & 0xff);
+            } else {
+                text.push(...bytes);
+            }
+        }
+        return { text, offsets, short };
+    }
+
+    private qualify(label: string): string {
+        return label.startsWith(".") ? `${this.scope}${label}` : label;
+    }
+}
+
+// Labels in .text refer to the instruction following them, which is only
+// placed once every instruction is known.
+type Sym =
+    | { section: ".text"; ins: number }
+    | { section: ".data"; offset: number };
+
+type Section = {
+    name: string;
+    type: number;
+    flags?: number;
+    bytes: number[];
+    link?: number;
+    info?: number;
+    align?: number;
+    entsize?: number;
+};
+
+// Order of the sections in the section header table, following the null
+// section.
+const sectionOrder = [
+    ".text",
+    ".data",
+    ".debug_abbrev",
+    ".debug_info",
+    ".debug_line",
+    ".symtab",
+    ".strtab",
+    ".rela.text",
+    ".rela.debug_info",
+    ".rela.debug_line",
+    ".note.GNU-stack",
+];
+
+const sectionIndex = (name: string): number =>
+    sectionOrder.indexOf(name) + 1;
+
+// Sections referred to by the debug info, which is done through their
+// section symbols.
+const sectionSyms = [".text", ".debug_abbrev", ".debug_line"];
+
+const SHN_UNDEF = 0;
+const STB_GLOBAL = 1;
+const STT_OBJECT = 1;
+const STT_FUNC = 2;
+const STT_SECTION = 3;
+
+const SHT_PROGBITS = 1;
+const SHT_SYMTAB = 2;
+const SHT_STRTAB = 3;
+const SHT_RELA = 4;
+
+const SHF_WRITE = 0x1;
+const SHF_ALLOC = 0x2;
+const SHF_EXECINSTR = 0x4;
+const SHF_INFO_LINK = 0x40;
+
+const R_X86_64_64 = 1;
+const R_X86_64_PC32 = 2;
+const R_X86_64_PLT32 = 4;
+const R_X86_64_32 = 10;
+
+const dwarfVersion = 4;
+const DW_TAG_compile_unit = 0x11;
+const DW_CHILDREN_no = 0;
+const DW_AT_name = 0x03;
+const DW_AT_stmt_list = 0x10;
+const DW_AT_low_pc = 0x11;
+const DW_AT_high_pc = 0x12;
+const DW_AT_comp_dir = 0x1b;
+const DW_AT_producer = 0x25;
+const DW_FORM_addr = 0x01;
+const DW_FORM_data8 = 0x07;
+const DW_FORM_string = 0x08;
+const DW_FORM_sec_offset = 0x17;
+
+// Only the standard opcodes are used, so the parameters of the special
+// opcodes are the ones commonly used.
+const lineBase = -5;
+const lineRange = 14;
+const opcodeBase = 13;
+const standardOpcodeLengths = [0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1];
+const DW_LNS_copy = 0x01;
+const DW_LNS_advance_pc = 0x02;
+const DW_LNS_advance_line = 0x03;
+const DW_LNE_end_sequence = 0x01;
+const DW_LNE_set_address = 0x02;
+
+const ehdrSize = 64;
+const shdrSize = 64;
+
+function writeElf(sections: Section[]): Uint8Array {
+    const shstrtab = new StringTable();
+    const names = sections.map(({ name }) => shstrtab.add(name));
+    const shstrtabName = shstrtab.add(".shstrtab");
+    sections = [
+        ...sections,
+        { name: ".shstrtab", type: SHT_STRTAB, bytes: shstrtab.bytes.bytes },
+    ];
+    names.push(shstrtabName);
+
+    const out = new Bytes();
+    out.zeros(ehdrSize);
+    const offsets = sections.map(({ bytes, align }) => {
+        out.align(align ?? 1);
+        const offset = out.bytes.length;
+        out.append(bytes);
+        return offset;
+    });
+    out.align(8);
+    const shoff = out.bytes.length;
+
+    // The null section.
+    out.zeros(shdrSize);
+    for (const [i, section] of sections.entries()) {
+        out.u32(names[i]);
+        out.u32(section.type);
+        out.u64(BigInt(section.flags ?? 0));
+        out.u64(0n);
+        out.u64(BigInt(offsets[i]));
+        out.u64(BigInt(section.bytes.length));
+        out.u32(section.link ?? 0);
+        out.u32(section.info ?? 0);
+        out.u64(BigInt(section.align ?? 1));
+        out.u64(BigInt(section.entsize ?? 0));
+    }
+
+    const ehdr = new Bytes();
+    // Magic, 64-bit, little endian, version 1, System V ABI.
+    ehdr.bytes.push(0x7f, 0x45, 0x4c, 0x46, 2, 1, 1, 0);
+    ehdr.zeros(8);
+    ehdr.u16(1); // ET_REL
+    ehdr.u16(62); // EM_X86_64
+    ehdr.u32(1);
+    ehdr.u64(0n); // entry
+    ehdr.u64(0n); // program headers
+    ehdr.u64(BigInt(shoff));
+    ehdr.u32(0); // flags
+    ehdr.u16(ehdrSize);
+    ehdr.u16(0);
+    ehdr.u16(0);
+    ehdr.u16(shdrSize);
+    ehdr.u16(sections.length + 1);
+    ehdr.u16(sections.length);
+    out.bytes.splice(0, ehdrSize, ...ehdr.bytes);
+
+    return new Uint8Array(out.bytes);
+}
+
+class Relocations {
+    public bytes = new Bytes();
+
+    public constructor(
+        private symIndices: Map<string, number>,
+    ) {}
+
+    public add(offset: number, sym: string, type: number, addend: number) {
+        const index = this.symIndices.get(sym);
+        if (index === undefined) {
+            throw new Error(`label '${sym}' not defined`);
+        }
+        this.bytes.u64(BigInt(offset));
+        this.bytes.u64(BigInt(index) << 32n | BigInt(type));
+        this.bytes.u64(BigInt(addend));
+    }
+}
+
+export class Bytes {
+    public bytes: number[] = [];
+
+    public u8(val: number) {
+        this.bytes.push(val & 0xff);
+    }
+    public u16(val: number) {
+        this.bytes.push(...littleEndian(BigInt(val), 2));
+    }
+    public u32(val: number) {
+        this.bytes.push(...littleEndian(BigInt(val), 4));
+    }
+    public u64(val: bigint) {
+        this.bytes.push(...littleEndian(val, 8));
+    }
+    public uleb(val: number) {
+        do {
+            const byte = val & 0x7f;
+            val = Math.floor(val / 128);
+            this.u8(val !== 0 ? byte | 0x80 : byte);
+        } while (val !== 0);
+    }
+    public sleb(val: number) {
+        for (;;) {
+            const byte = val & 0x7f;
+            val = Math.floor(val / 128);
+            const done = val === 0 && (byte & 0x40) === 0 ||
+                val === -1 && (byte & 0x40) !== 0;
+            this.u8(done ? byte : byte | 0x80);
+            if (done) {
+                return;
+            }
+        }
+    }
+    public cstr(str: string) {
+        this.append(new TextEncoder().encode(str));
+        this.u8(0);
+    }
+    public patchU32(offset: number, val: number) {
+        this.bytes.splice(offset, 4, ...littleEndian(BigInt(val), 4));
+    }
+    public append(bytes: ArrayLike<number>) {
+        for (let i = 0; i < bytes.length; ++i) {
+            this.bytes.push(bytes[i]);
+        }
+    }
+    public zeros(count: number) {
+        for (let i = 0; i < count; ++i) {
+            this.bytes.push(0);
+        }
+    }
+    public align(alignment: number) {
+        while (this.bytes.length % alignment !== 0) {
+            this.bytes.push(0);
+        }
+    }
+}
+
+// String table, which starts with an empty string.
+export class StringTable {
+    public bytes = new Bytes();
+    private offsets = new Map<string, number>();
+
+    public constructor() {
+        this.bytes.u8(0);
+    }
+
+    public add(str: string): number {
+        const existing = this.offsets.get(str);
+        if (existing !== undefined) {
+            return existing;
+        }
+        const offset = this.bytes.bytes.length;
+        this.bytes.cstr(str);
+        this.offsets.set(str, offset);
+        return offset;
+    }
+}
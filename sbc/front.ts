@@ -4,18 +4,20 @@ import {
     Block,
     Expr,
     ExprKind,
+    Field,
     Param,
     Stmt,
     StmtKind,
     Ty as AstTy,
     TyKind,
 } from "./ast.ts";
-import { Ty, tyToString } from "./ty.ts";
+import { structField, Ty, tyLayout, tyToString } from "./ty.ts";
 
 export class Checker {
     private stmtTys = new Map<number, Ty>();
     private exprTys = new Map<number, Ty>();
     private tyTys = new Map<number, Ty>();
+    private structsLayingOut = new Set<number>();
 
     public errorOccured = false;
 
@@ -34,11 +36,76 @@ export class Checker {
         const params = k.params
             .map((param): Ty => this.tyTy(param.ty));
         const returnTy: Ty = this.tyTy(k.returnTy);
+        for (const [i, param] of params.entries()) {
+            if (param.tag === "struct") {
+                this.report(
+                    `struct '${tyToString(param)}' must be passed by pointer`,
+                    k.params[i].line,
+                );
+            }
+        }
+        if (returnTy.tag === "struct") {
+            this.report(
+                `struct '${tyToString(returnTy)}' must be returned by pointer`,
+                stmt.line,
+            );
+        }
         const ty: Ty = { tag: "fn", stmt, params, returnTy };
         this.stmtTys.set(stmt.id, ty);
         return ty;
     }
 
+    public structTy(stmt: Stmt): Ty {
+        const k = stmt.kind;
+        if (k.tag !== "struct") {
+            throw new Error();
+        }
+        if (this.stmtTys.has(stmt.id)) {
+            return this.stmtTys.get(stmt.id)!;
+        }
+        // The type is defined before the fields are checked, so that fields
+        // can point to the struct itself.
+        const ty: Ty & { tag: "struct" } = {
+            tag: "struct",
+            stmt,
+            fields: [],
+            size: 0,
+            align: 1,
+        };
+        this.stmtTys.set(stmt.id, ty);
+        this.structsLayingOut.add(stmt.id);
+
+        let offset = 0;
+        for (const field of k.fields) {
+            if (ty.fields.some(({ ident }) => ident === field.ident)) {
+                this.report(`field '${field.ident}' defined twice`, field.line);
+            }
+            const fieldTy = this.tyTy(field.ty);
+            const layout = tyLayout(fieldTy);
+            if (
+                !layout ||
+                fieldTy.tag === "struct" &&
+                    this.structsLayingOut.has(fieldTy.stmt.id)
+            ) {
+                this.report(
+                    `field '${field.ident}' of type '${
+                        tyToString(fieldTy)
+                    }' has no size`,
+                    field.line,
+                );
+                return { tag: "error" };
+            }
+            offset = alignTo(offset, layout.align);
+            ty.fields.push({ ident: field.ident, ty: fieldTy, offset });
+            offset += layout.size;
+            ty.align = Math.max(ty.align, layout.align);
+        }
+        ty.size = alignTo(offset, ty.align);
+
+        this.structsLayingOut.delete(stmt.id);
+        return ty;
+    }
+
     public paramTy(stmt: Stmt, i: number): Ty {
         const ty = this.fnStmtTy(stmt);
         if (ty.tag !== "fn") {
@@ -140,6 +207,39 @@ export class Checker {
                     }
                     return callee.returnTy;
                 }
+                case "field": {
+                    const subject = this.exprTy(k.expr);
+                    const field = structField(subject, k.ident);
+                    if (!field) {
+                        this.report(
+                            `no field '${k.ident}' on type '${
+                                tyToString(subject)
+                            }'`,
+                            expr.line,
+                        );
+                        return { tag: "error" };
+                    }
+                    return field.ty;
+                }
+                case "index": {
+                    const subject = this.exprTy(k.expr);
+                    const index = this.exprTy(k.index);
+                    if (subject.tag !== "ptr" || !tyLayout(subject.ty)) {
+                        this.report(
+                            `cannot index type '${tyToString(subject)}'`,
+                            expr.line,
+                        );
+                        return { tag: "error" };
+                    }
+                    if (!this.assignable(index, { tag: "int" })) {
+                        this.report(
+                            `cannot index with type '${tyToString(index)}'`,
+                            expr.line,
+                        );
+                        return { tag: "error" };
+                    }
+                    return subject.ty;
+                }
                 case "not":
                 case "negate":
                     throw new Error("todo");
@@ -196,13 +296,13 @@ export class Checker {
                             return { tag: "int" };
                         case "str":
                             return { tag: "str" };
-                        default:
-                            this.report(
-                                `unknown type '${k.ident}'`,
-                                astTy.line,
-                            );
-                            return { tag: "error" };
                     }
+                    const re = this.re.ty(astTy);
+                    if (!re) {
+                        this.report(`unknown type '${k.ident}'`, astTy.line);
+                        return { tag: "error" };
+                    }
+                    return this.structTy(re);
                 }
                 case "ptr": {
                     const ty = this.tyTy(k.ty);
@@ -240,6 +340,11 @@ export class Checker {
             return ok(a);
         } else if (both("str")) {
             return ok(a);
+        } else if (
+            a.tag === "struct" && b.tag === "struct" &&
+            a.stmt.id === b.stmt.id
+        ) {
+            return ok(a);
         } else if (
             a.tag === "ptr" && b.tag === "ptr"
         ) {
@@ -270,6 +375,10 @@ export class Checker {
     }
 }
 
+function alignTo(value: number, alignment: number): number {
+    return Math.ceil(value / alignment) * alignment;
+}
+
 export type Resolve =
     | { tag: "fn"; stmt: Stmt }
     | { tag: "param"; stmt: Stmt; param: Param; i: number }
@@ -293,6 +402,7 @@ export class Resols {
     public constructor(
         private stmtResols: Map<number, Resolve>,
         private exprResols: Map<number, Resolve>,
+        private tyResols: Map<number, Stmt>,
     ) {}
 
     public stmt(stmt: Stmt): Resolve | undefined {
@@ -302,15 +412,22 @@ export class Resols {
     public expr(expr: Expr): Resolve | undefined {
         return this.exprResols.get(expr.id);
     }
+
+    public ty(ty: AstTy): Stmt | undefined {
+        return this.tyResols.get(ty.id);
+    }
 }
 
 interface Syms {
     val(ident: string): Resolve | undefined;
     defineVal(ident: string, res: Resolve): void;
+    ty(ident: string): Stmt | undefined;
+    defineTy(ident: string, stmt: Stmt): void;
 }
 
 export class RootSyms implements Syms {
     private exprResols = new Map<string, Resolve>();
+    private tyResols = new Map<string, Stmt>();
 
     val(ident: string): Resolve | undefined {
         return this.exprResols.get(ident);
@@ -319,10 +436,19 @@ export class RootSyms implements Syms {
     defineVal(ident: string, re: Resolve): void {
         this.exprResols.set(ident, re);
     }
+
+    ty(ident: string): Stmt | undefined {
+        return this.tyResols.get(ident);
+    }
+
+    defineTy(ident: string, stmt: Stmt): void {
+        this.tyResols.set(ident, stmt);
+    }
 }
 
 export class FnSyms implements Syms {
     private exprResols = new Map<string, Resolve>();
+    private tyResols = new Map<string, Stmt>();
 
     public constructor(
         private parent: Syms,
@@ -346,10 +472,20 @@ export class FnSyms implements Syms {
     defineVal(ident: string, re: Resolve): void {
         this.exprResols.set(ident, re);
     }
+
+    // Types of outer scopes are visible, unlike their locals.
+    ty(ident: string): Stmt | undefined {
+        return this.tyResols.get(ident) ?? this.parent.ty(ident);
+    }
+
+    defineTy(ident: string, stmt: Stmt): void {
+        this.tyResols.set(ident, stmt);
+    }
 }
 
 export class NormalSyms implements Syms {
     private exprResols = new Map<string, Resolve>();
+    private tyResols = new Map<string, Stmt>();
 
     public constructor(
         private parent: Syms,
@@ -362,12 +498,21 @@ export class NormalSyms implements Syms {
     defineVal(ident: string, re: Resolve): void {
         this.exprResols.set(ident, re);
     }
+
+    ty(ident: string): Stmt | undefined {
+        return this.tyResols.get(ident) ?? this.parent.ty(ident);
+    }
+
+    defineTy(ident: string, stmt: Stmt): void {
+        this.tyResols.set(ident, stmt);
+    }
 }
 
 export class Resolver {
     private syms: Syms = new RootSyms();
     private stmtResols = new Map<number, Resolve>();
     private exprResols = new Map<number, Resolve>();
+    private tyResols = new Map<number, Stmt>();
 
     private blockFnsStack: Stmt[][] = [];
     private loopStack: Stmt[] = [];
@@ -383,6 +528,7 @@ export class Resolver {
         return new Resols(
             this.stmtResols,
             this.exprResols,
+            this.tyResols,
         );
     }
 
@@ -391,6 +537,15 @@ export class Resolver {
         for (const stmt of stmts) {
             this.resolveStmt(stmt);
         }
+        // Types are resolved once every struct in the block is defined, so
+        // that structs can refer to those defined after them.
+        for (const stmt of stmts) {
+            if (stmt.kind.tag === "struct") {
+                for (const field of stmt.kind.fields) {
+                    this.resolveTy(field.ty);
+                }
+            }
+        }
         const blockFns = this.blockFnsStack.pop()!;
         for (const fn of blockFns) {
             const outerLoops = this.loopStack;
@@ -404,6 +559,7 @@ export class Resolver {
                 throw new Error();
             }
             for (const [i, param] of k.params.entries()) {
+                this.resolveTy(param.ty);
                 this.syms.defineVal(param.ident, {
                     tag: "param",
                     stmt: fn,
@@ -411,6 +567,7 @@ export class Resolver {
                     i,
                 });
             }
+            this.resolveTy(k.returnTy);
             this.resolveBlock(k.body);
 
             this.syms = outerSyms;
@@ -434,8 +591,12 @@ export class Resolver {
                 this.syms.defineVal(k.ident, { tag: "fn", stmt });
                 this.blockFnsStack.at(-1)!.push(stmt);
                 return;
+            case "struct":
+                this.syms.defineTy(k.ident, stmt);
+                return;
             case "let":
                 this.syms.defineVal(k.ident, { tag: "let", stmt });
+                k.ty && this.resolveTy(k.ty);
                 k.expr && this.resolveExpr(k.expr);
                 return;
             case "loop":
@@ -500,6 +661,13 @@ export class Resolver {
                     this.resolveExpr(arg);
                 }
                 return;
+            case "field":
+                this.resolveExpr(k.expr);
+                return;
+            case "index":
+                this.resolveExpr(k.expr);
+                this.resolveExpr(k.index);
+                return;
             case "not":
             case "negate":
                 throw new Error("todo");
@@ -511,6 +679,31 @@ export class Resolver {
         const _: never = k;
     }
 
+    private resolveTy(ty: AstTy) {
+        const k = ty.kind;
+        switch (k.tag) {
+            case "error":
+            case "void":
+                return;
+            case "ident": {
+                if (k.ident === "int" || k.ident === "str") {
+                    return;
+                }
+                const stmt = this.syms.ty(k.ident);
+                if (!stmt) {
+                    this.report(`type '${k.ident}' not defined`, ty.line);
+                    return;
+                }
+                this.tyResols.set(ty.id, stmt);
+                return;
+            }
+            case "ptr":
+                this.resolveTy(k.ty);
+                return;
+        }
+        const _: never = k;
+    }
+
     private report(msg: string, line: number) {
         this.errorOccured = true;
         //console.error(`Resolver: ${msg} on line ${line}`);
@@ -572,6 +765,8 @@ export class Parser {
         const attrs = this.parseAttrs();
         if (this.test("fn")) {
             return this.parseFnStmt(attrs);
+        } else if (this.test("struct")) {
+            return this.parseStructStmt();
         } else if (this.test("let")) {
             return this.parseLetStmt();
         } else if (this.test("loop")) {
@@ -716,6 +911,37 @@ export class Parser {
         return { ok: true, param: { ident, line, ty } };
     }
 
+    private parseStructStmt(): Stmt {
+        const line = this.curr().line;
+        this.step();
+        if (!this.eat("ident")) {
+            this.report("expected 'ident'");
+            return this.stmt({ tag: "error" }, line);
+        }
+        const ident = this.eaten!.identVal!;
+        if (!this.eat("{")) {
+            this.report("expected '{'");
+            return this.stmt({ tag: "error" }, line);
+        }
+        const fields: Field[] = [];
+        while (!this.done() && !this.test("}")) {
+            // Fields have the same syntax as params.
+            const fieldRes = this.parseParam();
+            if (!fieldRes.ok) {
+                return this.stmt({ tag: "error" }, line);
+            }
+            fields.push(fieldRes.param);
+            if (!this.eat(",")) {
+                break;
+            }
+        }
+        if (!this.eat("}")) {
+            this.report("expected '}'");
+            return this.stmt({ tag: "error" }, line);
+        }
+        return this.stmt({ tag: "struct", ident, fields }, line);
+    }
+
     private parseLetStmt(): Stmt {
         const line = this.curr().line;
         this.step();
@@ -886,6 +1112,20 @@ export class Parser {
                     return this.expr({ tag: "error" }, this.last.line);
                 }
                 expr = this.expr({ tag: "call", expr, args }, expr.line);
+            } else if (this.eat(".")) {
+                if (!this.eat("ident")) {
+                    this.report("expected 'ident'");
+                    return this.expr({ tag: "error" }, this.last.line);
+                }
+                const ident = this.eaten!.identVal!;
+                expr = this.expr({ tag: "field", expr, ident }, expr.line);
+            } else if (this.eat("[")) {
+                const index = this.parseExpr();
+                if (!this.eat("]")) {
+                    this.report("expected ']'");
+                    return this.expr({ tag: "error" }, this.last.line);
+                }
+                expr = this.expr({ tag: "index", expr, index }, expr.line);
             } else {
                 break;
             }
@@ -992,10 +1232,11 @@ export type Tok = {
 };
 
 export function lex(text: string): Tok[] {
-    const ops = "(){}[]<>+-*/%=!:,;#\n";
+    const ops = "(){}[]<>+-*/%=!:,;#.\n";
     const kws = [
         "let",
         "fn",
+        "struct",
         "return",
         "if",
         "else",
@@ -17,6 +17,8 @@ export type Fn = {
 export type Line = {
     labels: Label[];
     ins: Ins;
+    // Source line the instruction was generated from, if known.
+    srcLine?: number;
 };
 
 export type Ins =
@@ -32,14 +34,27 @@ export type Ins =
     | { tag: "load"; reg: Reg; sReg: Reg }
     | { tag: "store_reg"; sReg: Reg; reg: Reg }
     | { tag: "store_imm"; sReg: Reg; val: number }
-    | { tag: "call_reg"; reg: Reg; args: number }
-    | { tag: "call_imm"; fn: Fn; args: number }
+    | { tag: "load_mem"; reg: Reg; addr: Addr }
+    | { tag: "store_mem"; addr: Addr; reg: Reg }
+    | { tag: "call_reg"; reg: Reg; args: Reg[]; dst: Reg }
+    | { tag: "call_imm"; fn: Fn; args: Reg[]; dst: Reg }
     | { tag: "jmp"; target: Label }
     | { tag: "jnz_reg"; reg: Reg; target: Label }
     | { tag: "ret" }
     | { tag: BinaryOp; dst: Reg; src: Reg }
+    // Division and modulo by a constant.
+    | { tag: "div_imm" | "mod_imm"; dst: Reg; val: number }
     | { tag: "kill"; reg: Reg };
 
+// Memory at `base + index * stride + offset`, or `base + offset` without an
+// index.
+export type Addr = {
+    base: Reg;
+    index?: Reg;
+    stride: number;
+    offset: number;
+};
+
 export type BinaryOp =
     | "lt"
     | "gt"
@@ -105,10 +120,18 @@ export class ProgramStringifyer {
                 return `store_reg [%${ins.sReg}], %${ins.reg}`;
             case "store_imm":
                 return `store_val [%${ins.sReg}], ${ins.val}`;
+            case "load_mem":
+                return `load_mem %${ins.reg}, ${this.addr(ins.addr)}`;
+            case "store_mem":
+                return `store_mem ${this.addr(ins.addr)}, %${ins.reg}`;
             case "call_reg":
-                return `call_reg %${ins.reg}, ${ins.args}`;
+                return `call_reg %${ins.dst}, %${ins.reg}(${
+                    ins.args.map((reg) => `%${reg}`).join(", ")
+                })`;
             case "call_imm":
-                return `call_fn ${ins.fn.label}, ${ins.args}`;
+                return `call_fn %${ins.dst}, ${ins.fn.label}(${
+                    ins.args.map((reg) => `%${reg}`).join(", ")
+                })`;
             case "jmp":
                 return `jmp .L${ins.target}`;
             case "jnz_reg":
@@ -127,9 +150,19 @@ export class ProgramStringifyer {
             case "mul":
             case "mod":
                 return `${ins.tag} %${ins.dst}, %${ins.src}`;
+            case "div_imm":
+            case "mod_imm":
+                return `${ins.tag} %${ins.dst}, ${ins.val}`;
             case "kill":
                 return `kill %${ins.reg}`;
         }
         const _: never = ins;
     }
+
+    private addr(addr: Addr): string {
+        const index = addr.index !== undefined
+            ? ` + %${addr.index} * ${addr.stride}`
+            : "";
+        return `[%${addr.base}${index} + ${addr.offset}]`;
+    }
 }
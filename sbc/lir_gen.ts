@@ -1,4 +1,5 @@
 import {
+    Addr,
     Fn,
     Ins,
     Label,
@@ -10,10 +11,12 @@ import {
 import { MirGen } from "./mir_gen.ts";
 import * as ast from "./ast.ts";
 import * as mir from "./mir.ts";
+import { inlineCalls } from "./mir_inline.ts";
 import { optimizeMirFn } from "./mir_optimize.ts";
 
 export type LirGenOpts = {
     optimize?: boolean;
+    unrollFactor?: number;
 };
 
 export class LirGen {
@@ -30,13 +33,27 @@ export class LirGen {
     ) {}
 
     public generate(): Program {
+        const mirs: mir.Fn[] = [];
         for (const stmt of this.ast) {
+            if (stmt.kind.tag === "struct") {
+                continue;
+            }
             if (stmt.kind.tag !== "fn") {
                 throw new Error("only functions can compile top level");
             }
-            const mir = this.mirGen.fnMir(stmt, stmt.kind);
+            mirs.push(this.mirGen.fnMir(stmt, stmt.kind));
+        }
+        if (this.opts.optimize !== false) {
+            inlineCalls(mirs);
+        }
+
+        for (const mir of mirs) {
+            const stmt = mir.stmt;
+            if (stmt.kind.tag !== "fn") {
+                throw new Error();
+            }
             if (this.opts.optimize !== false) {
-                optimizeMirFn(mir);
+                optimizeMirFn(mir, { unrollFactor: this.opts.unrollFactor });
             }
             const id = this.fnIds++;
             const label = `sbc__${stmt.kind.ident}`;
@@ -83,6 +100,7 @@ class FnGen {
     private blockLabels = new Map<number, Label>();
 
     private currentLabels: Label[] = [];
+    private currentSrcLine?: number;
 
     private localRegs = new Map<number, Reg>();
 
@@ -132,6 +150,7 @@ class FnGen {
     }
 
     private lowerStmt(stmt: mir.Stmt) {
+        this.currentSrcLine = stmt.line;
         const k = stmt.kind;
         switch (k.tag) {
             case "error":
@@ -191,21 +210,44 @@ class FnGen {
                 this.pushIns({ tag: "kill", reg });
                 return;
             }
-            case "call": {
+            case "load_field":
+            case "load_index": {
+                const addr = this.popAddr(k);
+                const reg = this.reg();
+                this.pushIns({ tag: "load_mem", reg, addr });
+                this.pushIns({ tag: "push", reg });
+                this.killAddr(addr);
+                this.pushIns({ tag: "kill", reg });
+                return;
+            }
+            case "store_field":
+            case "store_index": {
                 const reg = this.reg();
                 this.pushIns({ tag: "pop", reg });
-                this.pushIns({ tag: "call_reg", reg, args: k.args });
+                const addr = this.popAddr(k);
+                this.pushIns({ tag: "store_mem", addr, reg });
+                this.killAddr(addr);
                 this.pushIns({ tag: "kill", reg });
-
-                const rval = this.reg();
-                this.pushIns({ tag: "pop", reg: rval });
+                return;
+            }
+            case "call": {
+                const reg = this.reg();
+                this.pushIns({ tag: "pop", reg });
+                // The last argument is on top of the stack.
+                const args: Reg[] = [];
                 for (let i = 0; i < k.args; ++i) {
-                    const reg = this.reg();
-                    this.pushIns({ tag: "pop", reg });
-                    this.pushIns({ tag: "kill", reg });
+                    const arg = this.reg();
+                    this.pushIns({ tag: "pop", reg: arg });
+                    args.unshift(arg);
                 }
-                this.pushIns({ tag: "push", reg: rval });
-                this.pushIns({ tag: "kill", reg: rval });
+                const dst = this.reg();
+                this.pushIns({ tag: "call_reg", reg, args, dst });
+                this.pushIns({ tag: "kill", reg });
+                for (const arg of args) {
+                    this.pushIns({ tag: "kill", reg: arg });
+                }
+                this.pushIns({ tag: "push", reg: dst });
+                this.pushIns({ tag: "kill", reg: dst });
                 return;
             }
             case "lt":
@@ -270,8 +312,33 @@ class FnGen {
         const _: never = k;
     }
 
+    private popAddr(k: { offset: number; stride?: number }): Addr {
+        const { offset } = k;
+        if (k.stride === undefined) {
+            const base = this.reg();
+            this.pushIns({ tag: "pop", reg: base });
+            return { base, stride: 0, offset };
+        }
+        const index = this.reg();
+        const base = this.reg();
+        this.pushIns({ tag: "pop", reg: index });
+        this.pushIns({ tag: "pop", reg: base });
+        return { base, index, stride: k.stride, offset };
+    }
+
+    private killAddr(addr: Addr) {
+        if (addr.index !== undefined) {
+            this.pushIns({ tag: "kill", reg: addr.index });
+        }
+        this.pushIns({ tag: "kill", reg: addr.base });
+    }
+
     private pushIns(ins: Ins) {
-        this.fn.lines.push({ labels: this.currentLabels, ins });
+        this.fn.lines.push({
+            labels: this.currentLabels,
+            ins,
+            srcLine: this.currentSrcLine,
+        });
         this.currentLabels = [];
     }
 
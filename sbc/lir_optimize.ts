@@ -23,6 +23,7 @@ export function optimizeLir(program: Program) {
             eliminatePushPop(fn);
             eliminateMovFnCall(fn);
             eliminateMovIntStoreReg(fn);
+            eliminateMovIntDiv(fn);
             eliminatePushPopShadowed(fn);
         }
         const sizeAfter = program.fns
@@ -106,9 +107,9 @@ function eliminateMovFnCall(fn: Fn) {
             throw new Error();
         }
         const fnVal = movFn.ins.fn;
-        const args = callReg.ins.args;
+        const { args, dst } = callReg.ins;
         fn.lines.splice(i + 1, 2);
-        fn.lines[i].ins = { tag: "call_imm", fn: fnVal, args };
+        fn.lines[i].ins = { tag: "call_imm", fn: fnVal, args, dst };
     }
 }
 
@@ -148,6 +149,73 @@ function eliminateMovIntStoreReg(fn: Fn) {
     }
 }
 
+// Divides by constants directly, which is done without `idiv` for most
+// divisors.
+function eliminateMovIntDiv(fn: Fn) {
+    const candidates: number[] = [];
+
+    for (let i = 0; i < fn.lines.length - 1; ++i) {
+        const [movInt, div] = fn.lines.slice(i);
+        if (
+            movInt.ins.tag === "mov_int" &&
+            (div.ins.tag === "div" || div.ins.tag === "mod") &&
+            div.labels.length === 0 &&
+            movInt.ins.reg === div.ins.src &&
+            movInt.ins.reg !== div.ins.dst &&
+            movInt.ins.val !== 0 &&
+            regMentions(fn, movInt.ins.reg) === 2
+        ) {
+            candidates.push(i);
+        }
+    }
+
+    for (const i of candidates.toReversed()) {
+        const [movInt, div] = fn.lines.slice(i);
+        if (
+            !(
+                movInt.ins.tag === "mov_int" &&
+                (div.ins.tag === "div" || div.ins.tag === "mod")
+            )
+        ) {
+            throw new Error();
+        }
+        const reg = movInt.ins.reg;
+        const val = movInt.ins.val;
+        const tag = div.ins.tag === "div" ? "div_imm" : "mod_imm";
+        div.labels.push(...movInt.labels);
+        div.ins = { tag, dst: div.ins.dst, val };
+        fn.lines.splice(i, 1);
+        const kill = fn.lines
+            .findIndex(({ ins }) => ins.tag === "kill" && ins.reg === reg);
+        if (kill === -1) {
+            continue;
+        }
+        const labels = fn.lines[kill].labels;
+        if (kill === fn.lines.length - 1 && labels.length !== 0) {
+            // Labels at the end of the function need an instruction.
+            fn.lines[kill].ins = { tag: "nop" };
+        } else {
+            fn.lines[kill + 1]?.labels.push(...labels);
+            fn.lines.splice(kill, 1);
+        }
+    }
+}
+
+// Times a register is read or written, other than being killed.
+function regMentions(fn: Fn, reg: Reg): number {
+    let mentions = 0;
+    const r = (other: Reg): Reg => {
+        mentions += other === reg ? 1 : 0;
+        return other;
+    };
+    for (const { ins } of fn.lines) {
+        if (ins.tag !== "kill") {
+            mapRegs(ins, r);
+        }
+    }
+    return mentions;
+}
+
 function eliminatePushPopShadowed(fn: Fn) {
     type Cand = { push: number; pop: number };
     const candidates: Cand[] = [];
@@ -198,64 +266,84 @@ function replaceReg(fn: Fn, cand: Reg, replacement: Reg) {
     const r = (reg: Reg): Reg => reg === cand ? replacement : reg;
 
     for (const { ins } of fn.lines) {
-        switch (ins.tag) {
-            case "error":
-                break;
-            case "nop":
-                break;
-            case "alloc_param":
-            case "alloc_local":
-                ins.reg = r(ins.reg);
-                break;
-            case "mov_int":
-            case "mov_string":
-            case "mov_fn":
-                ins.reg = r(ins.reg);
-                break;
-            case "push":
-            case "pop":
-                ins.reg = r(ins.reg);
-                break;
-            case "load":
-            case "store_reg":
-                ins.reg = r(ins.reg);
-                ins.sReg = r(ins.sReg);
-                break;
-            case "store_imm":
-                ins.sReg = r(ins.sReg);
-                break;
-            case "call_reg":
-                ins.reg = r(ins.reg);
-                break;
-            case "call_imm":
-                break;
-            case "jmp":
-                break;
-            case "jnz_reg":
-                ins.reg = r(ins.reg);
-                break;
-            case "ret":
-                break;
-            case "lt":
-            case "gt":
-            case "le":
-            case "ge":
-            case "eq":
-            case "ne":
-            case "add":
-            case "sub":
-            case "mul":
-            case "div":
-            case "mod":
-                ins.dst = r(ins.dst);
-                ins.src = r(ins.src);
-                break;
-            case "kill":
-                ins.reg = r(ins.reg);
-                break;
-            default: {
-                const _: never = ins;
+        mapRegs(ins, r);
+    }
+}
+
+function mapRegs(ins: Ins, r: (reg: Reg) => Reg) {
+    switch (ins.tag) {
+        case "error":
+            break;
+        case "nop":
+            break;
+        case "alloc_param":
+        case "alloc_local":
+            ins.reg = r(ins.reg);
+            break;
+        case "mov_int":
+        case "mov_string":
+        case "mov_fn":
+            ins.reg = r(ins.reg);
+            break;
+        case "push":
+        case "pop":
+            ins.reg = r(ins.reg);
+            break;
+        case "load":
+        case "store_reg":
+            ins.reg = r(ins.reg);
+            ins.sReg = r(ins.sReg);
+            break;
+        case "store_imm":
+            ins.sReg = r(ins.sReg);
+            break;
+        case "load_mem":
+        case "store_mem":
+            ins.reg = r(ins.reg);
+            ins.addr.base = r(ins.addr.base);
+            if (ins.addr.index !== undefined) {
+                ins.addr.index = r(ins.addr.index);
             }
+            break;
+        case "call_reg":
+            ins.reg = r(ins.reg);
+            ins.args = ins.args.map(r);
+            ins.dst = r(ins.dst);
+            break;
+        case "call_imm":
+            ins.args = ins.args.map(r);
+            ins.dst = r(ins.dst);
+            break;
+        case "jmp":
+            break;
+        case "jnz_reg":
+            ins.reg = r(ins.reg);
+            break;
+        case "ret":
+            break;
+        case "lt":
+        case "gt":
+        case "le":
+        case "ge":
+        case "eq":
+        case "ne":
+        case "add":
+        case "sub":
+        case "mul":
+        case "div":
+        case "mod":
+            ins.dst = r(ins.dst);
+            ins.src = r(ins.src);
+            break;
+        case "div_imm":
+        case "mod_imm":
+            ins.dst = r(ins.dst);
+            break;
+        case "kill":
+            ins.reg = r(ins.reg);
+            break;
+        default: {
+            const _: never = ins;
         }
     }
 }
@@ -276,10 +364,13 @@ function pollutesStack(ins: Ins): boolean {
         case "load":
         case "store_reg":
         case "store_imm":
+        case "load_mem":
+        case "store_mem":
             return false;
         case "call_reg":
         case "call_imm":
-            return true;
+            // Arguments and the result are passed in registers.
+            return false;
         case "jmp":
         case "jnz_reg":
         case "ret":
@@ -295,6 +386,8 @@ function pollutesStack(ins: Ins): boolean {
         case "mul":
         case "div":
         case "mod":
+        case "div_imm":
+        case "mod_imm":
             return true;
         case "kill":
             return false;
@@ -1,56 +1,58 @@
-import * as yaml from "jsr:@std/yaml";
-import { Checker, Parser, Resolver } from "./front.ts";
-import { MirGen } from "./mir_gen.ts";
-import { FnStringifyer } from "./mir.ts";
-import { LirGen } from "./lir_gen.ts";
-import { ProgramStringifyer } from "./lir.ts";
-import { AsmGen } from "./asm_gen.ts";
-import { optimizeLir } from "./lir_optimize.ts";
-
-async function main() {
-    const inputFile = Deno.args[0];
-    const outputFile = Deno.args[1];
-    if (!inputFile || !outputFile) {
+import { AsmGen, NasmWriter } from "./asm_gen.ts";
+import { compile } from "./compile.ts";
+import { ElfWriter } from "./elf.ts";
+import { VmGen } from "./vm_gen.ts";
+
+// Usage: main.ts [--unroll <factor>] <input> <output>
+type Options = {
+    inputFile: string;
+    outputFile: string;
+    // See `CompileOptions`.
+    unrollFactor: number;
+};
+
+function parseArgs(args: string[]): Options {
+    const files: string[] = [];
+    let unrollFactor = 4;
+    for (let i = 0; i < args.length; ++i) {
+        if (args[i] !== "--unroll") {
+            files.push(args[i]);
+            continue;
+        }
+        const factor = args[++i];
+        if (factor === undefined || !/^[0-9]+$/.test(factor)) {
+            throw new Error("--unroll takes a number");
+        }
+        unrollFactor = parseInt(factor);
+    }
+    const [inputFile, outputFile] = files;
+    if (files.length !== 2) {
         throw new Error("incorrect arguments");
     }
+    return { inputFile, outputFile, unrollFactor };
+}
 
-    const text = await Deno.readTextFile(inputFile);
-
-    const ast = new Parser(text).parse();
-    // console.log("=== AST ===");
-    // console.log(yaml.stringify(ast));
-
-    const re = new Resolver(ast).resolve();
-    const ch = new Checker(re);
-
-    const optimize = true;
-
-    const mirGen = new MirGen(re, ch);
-
-    // console.log("=== MIR ===");
-    // for (const stmt of ast) {
-    //     if (stmt.kind.tag !== "fn") {
-    //         throw new Error("only functions can compile top level");
-    //     }
-    //     const fnMir = mirGen.fnMir(stmt, stmt.kind);
-    //     console.log(new FnStringifyer(fnMir).stringify());
-    // }
+async function main() {
+    const { inputFile, outputFile, unrollFactor } = parseArgs(Deno.args);
 
-    const lir = new LirGen(ast, mirGen, {
-        optimize,
-    }).generate();
-    // console.log("=== LIR ===");
-    // console.log(new ProgramStringifyer(lir).stringify());
+    const text = await Deno.readTextFile(inputFile);
 
-    if (optimize) {
-        optimizeLir(lir);
+    const lir = compile(text, { optimize: true, unrollFactor });
+
+    // Object files are assembled directly, and `.slgm` files get a module
+    // for the Slige VM. Any other output file gets the NASM assembly, which
+    // is mostly useful for reading the generated code.
+    if (outputFile.endsWith(".o")) {
+        const writer = new ElfWriter(inputFile, Deno.cwd());
+        new AsmGen(lir, writer).generate();
+        await Deno.writeFile(outputFile, writer.finalize());
+    } else if (outputFile.endsWith(".slgm")) {
+        await Deno.writeFile(outputFile, new VmGen(lir).generate());
+    } else {
+        const writer = new NasmWriter(inputFile);
+        new AsmGen(lir, writer).generate();
+        await Deno.writeTextFile(outputFile, writer.finalize());
     }
-
-    const asm = new AsmGen(lir).generate();
-    // console.log("=== ASM ===");
-    // console.log(asm);
-
-    await Deno.writeTextFile(outputFile, asm);
 }
 
 main();
@@ -27,9 +27,11 @@ export type Local = {
 
 export type Stmt = {
     kind: StmtKind;
+    // Source line the statement was generated from, if known.
+    line?: number;
 };
 
-export const Stmt = (kind: StmtKind): Stmt => ({ kind });
+export const Stmt = (kind: StmtKind, line?: number): Stmt => ({ kind, line });
 
 export type StmtKind =
     | { tag: "error" }
@@ -37,6 +39,15 @@ export type StmtKind =
     | { tag: "pop" }
     | { tag: "load"; local: Local }
     | { tag: "store"; local: Local }
+    // Pops a pointer and pushes the value `offset` bytes past it.
+    | { tag: "load_field"; offset: number; ty: Ty }
+    // Pops an index and a pointer, and pushes the value `offset` bytes past
+    // the element of size `stride` at the index.
+    | { tag: "load_index"; stride: number; offset: number; ty: Ty }
+    // Pops a value, then addresses memory as `load_field` and `load_index`,
+    // and stores the value there.
+    | { tag: "store_field"; offset: number }
+    | { tag: "store_index"; stride: number; offset: number }
     | { tag: "call"; args: number }
     | { tag: BinaryOp };
 
@@ -120,6 +131,12 @@ export class FnStringifyer {
                 return `load %${k.local.id}`;
             case "store":
                 return `store %${k.local.id}`;
+            case "load_field":
+            case "store_field":
+                return `${k.tag} +${k.offset}`;
+            case "load_index":
+            case "store_index":
+                return `${k.tag} *${k.stride} +${k.offset}`;
             case "call":
                 return `call ${k.args}`;
             case "lt":
@@ -1,7 +1,11 @@
 import { Checker, Resols } from "./front.ts";
 import * as ast from "./ast.ts";
 import { Block, Fn, Local, Stmt, StmtKind, Ter, TerKind, Val } from "./mir.ts";
-import { Ty } from "./ty.ts";
+import { structField, Ty, tyLayout } from "./ty.ts";
+
+// Memory addressed by a field or index expression, relative to the pointer,
+// and the index if any, pushed by `lowerPlace`.
+type Place = { stride?: number; offset: number };
 
 export class MirGen {
     public constructor(
@@ -27,6 +31,7 @@ export class FnMirGen {
 
     private returnBlock!: Block;
     private currentBlock!: Block;
+    private currentLine?: number;
     private loopExitBlocks = new Map<number, Block>();
 
     public constructor(
@@ -76,12 +81,15 @@ export class FnMirGen {
     }
 
     private lowerStmt(stmt: ast.Stmt) {
+        this.currentLine = stmt.line;
         const k = stmt.kind;
         switch (k.tag) {
             case "error":
                 throw new Error();
             case "fn":
                 throw new Error("cannot lower");
+            case "struct":
+                return;
             case "let": {
                 const ty = this.ch.letStmtTy(stmt);
                 const local = this.local(ty);
@@ -190,6 +198,17 @@ export class FnMirGen {
                 return;
             }
             case "assign": {
+                const subjectTag = k.subject.kind.tag;
+                if (subjectTag === "field" || subjectTag === "index") {
+                    const { stride, offset } = this.lowerPlace(k.subject);
+                    this.lowerExpr(k.expr);
+                    this.pushStmt(
+                        stride !== undefined
+                            ? { tag: "store_index", stride, offset }
+                            : { tag: "store_field", offset },
+                    );
+                    return;
+                }
                 const re = this.re.expr(k.subject)!;
                 let local: Local;
                 switch (re.tag) {
@@ -287,6 +306,19 @@ export class FnMirGen {
                 });
                 return;
             }
+            case "field":
+            case "index": {
+                if (ty.tag === "struct") {
+                    throw new Error("cannot load struct value");
+                }
+                const { stride, offset } = this.lowerPlace(expr);
+                this.pushStmt(
+                    stride !== undefined
+                        ? { tag: "load_index", stride, offset, ty }
+                        : { tag: "load_field", offset, ty },
+                );
+                return;
+            }
             case "not":
             case "negate":
                 throw new Error("todo");
@@ -339,6 +371,33 @@ export class FnMirGen {
         const _: never = k;
     }
 
+    // Pushes the pointer, and the index if any, of the memory a field or
+    // index expression refers to. Fields of struct fields and of indexed
+    // structs are folded into the offset.
+    private lowerPlace(expr: ast.Expr): Place {
+        const k = expr.kind;
+        switch (k.tag) {
+            case "field": {
+                const subjectTy = this.ch.exprTy(k.expr);
+                const field = structField(subjectTy, k.ident)!;
+                if (subjectTy.tag === "ptr") {
+                    this.lowerExpr(k.expr);
+                    return { offset: field.offset };
+                }
+                const place = this.lowerPlace(k.expr);
+                return { ...place, offset: place.offset + field.offset };
+            }
+            case "index": {
+                this.lowerExpr(k.expr);
+                this.lowerExpr(k.index);
+                const stride = tyLayout(this.ch.exprTy(expr))!.size;
+                return { stride, offset: 0 };
+            }
+            default:
+                throw new Error("cannot address expression");
+        }
+    }
+
     private local(ty: Ty, ident?: string, stmt?: ast.Stmt): Local {
         const id = this.localIds++;
         const local: Local = { id, ty, ident, stmt };
@@ -354,6 +413,6 @@ export class FnMirGen {
     }
 
     private pushStmt(kind: StmtKind) {
-        this.currentBlock.stmts.push(Stmt(kind));
+        this.currentBlock.stmts.push(Stmt(kind, this.currentLine));
     }
 }
@@ -0,0 +1,323 @@
+import { AttrView } from "./attr.ts";
+import { Block, Fn, Local, Stmt, StmtKind, Ter, TerKind } from "./mir.ts";
+import { Ty } from "./ty.ts";
+
+// Callee size, in statements and blocks, up to which calls are inlined.
+const inlineBudget = 24;
+// Budget for calls in loops, which are run many times per call of the
+// caller.
+const loopInlineBudget = 64;
+// Size callers aren't grown beyond by inlining.
+const maxCallerSize = 2000;
+
+// Inlines calls to small functions into their callers. Callees are inlined
+// into before their callers, so that the calls inlined into them count
+// towards their size.
+export function inlineCalls(fns: Fn[]) {
+    const stmtFns = new Map(fns.map((fn) => [fn.stmt.id, fn]));
+    const done = new Set<Fn>();
+    const visit = (fn: Fn) => {
+        if (done.has(fn)) {
+            return;
+        }
+        done.add(fn);
+        for (const callee of calledFns(fn, stmtFns)) {
+            visit(callee);
+        }
+        new Inliner(fn, stmtFns).inline();
+    };
+    for (const fn of fns) {
+        visit(fn);
+    }
+}
+
+function calledFns(fn: Fn, stmtFns: Map<number, Fn>): Fn[] {
+    return fn.blocks.flatMap((block) =>
+        block.stmts.flatMap(({ kind }) =>
+            kind.tag === "push" && kind.val.tag === "fn"
+                ? [stmtFns.get(kind.val.stmt.id)].filter((fn) => fn)
+                : []
+        )
+    ) as Fn[];
+}
+
+function fnSize(fn: Fn): number {
+    return fn.blocks
+        .reduce((acc, block) => acc + 1 + block.stmts.length, 0);
+}
+
+class Inliner {
+    private localIds: number;
+    private blockIds: number;
+    private loopBlocks: Set<Block>;
+
+    public constructor(
+        private fn: Fn,
+        private stmtFns: Map<number, Fn>,
+    ) {
+        this.localIds = Math.max(...fn.locals.map(({ id }) => id)) + 1;
+        this.blockIds = Math.max(...fn.blocks.map(({ id }) => id)) + 1;
+        this.loopBlocks = blocksInLoops(fn);
+    }
+
+    // Only calls in the function before inlining are inlined, so that
+    // recursive calls in inlined functions aren't inlined indefinitely.
+    public inline() {
+        for (const block of [...this.fn.blocks]) {
+            this.inlineInBlock(block, this.loopBlocks.has(block));
+        }
+    }
+
+    private inlineInBlock(block: Block, inLoop: boolean) {
+        // Types of the values on the stack, which is empty at the start of
+        // a block.
+        const stack: Ty[] = [];
+        for (const [i, stmt] of block.stmts.entries()) {
+            const k = stmt.kind;
+            if (k.tag === "call") {
+                const callee = this.inlinableCallee(block.stmts[i - 1], inLoop);
+                if (callee) {
+                    // The callee is pushed after the arguments.
+                    stack.pop();
+                    const continuation = this.inlineCall(
+                        block,
+                        i,
+                        callee,
+                        stack.slice(0, stack.length - k.args),
+                    );
+                    this.inlineInBlock(continuation, inLoop);
+                    return;
+                }
+            }
+            if (!simulateStmt(k, stack)) {
+                return;
+            }
+        }
+    }
+
+    private inlinableCallee(
+        push: Stmt | undefined,
+        inLoop: boolean,
+    ): Fn | undefined {
+        const k = push?.kind;
+        if (k?.tag !== "push" || k.val.tag !== "fn") {
+            return undefined;
+        }
+        const callee = this.stmtFns.get(k.val.stmt.id);
+        if (
+            !callee || callee === this.fn ||
+            callee.stmt.kind.tag !== "fn" ||
+            AttrView.fromStmt(callee.stmt).has("c_function")
+        ) {
+            return undefined;
+        }
+        const hasErrors = callee.blocks.some((block) =>
+            block.ter.kind.tag === "error" ||
+            block.stmts.some((stmt) => stmt.kind.tag === "error")
+        );
+        const size = fnSize(callee);
+        if (
+            hasErrors ||
+            size > (inLoop ? loopInlineBudget : inlineBudget) ||
+            fnSize(this.fn) + size > maxCallerSize
+        ) {
+            return undefined;
+        }
+        return callee;
+    }
+
+    // Replaces the call at `i` and the push of the callee before it by the
+    // blocks of the callee. Values on the stack below the arguments are
+    // kept in locals meanwhile, since the stack is empty between blocks.
+    // Returns the block continuing after the call.
+    private inlineCall(
+        block: Block,
+        i: number,
+        callee: Fn,
+        below: Ty[],
+    ): Block {
+        const locals = new Map<Local, Local>(
+            callee.locals.map((local) => [local, this.local(local.ty)]),
+        );
+        const belowLocals = below.map((ty) => this.local(ty));
+        const line = block.stmts[i].line;
+
+        const continuation: Block = {
+            id: this.blockIds++,
+            stmts: [
+                ...belowLocals.map((local) =>
+                    Stmt({ tag: "load", local }, line)
+                ),
+                Stmt(
+                    { tag: "load", local: locals.get(callee.returnLocal)! },
+                    line,
+                ),
+                ...block.stmts.slice(i + 1),
+            ],
+            ter: block.ter,
+        };
+
+        const blocks = new Map<Block, Block>(
+            callee.blocks.map((calleeBlock) => [calleeBlock, {
+                id: this.blockIds++,
+                stmts: [],
+                ter: Ter({ tag: "unset" }),
+            }]),
+        );
+        for (const [calleeBlock, inlined] of blocks) {
+            inlined.stmts = calleeBlock.stmts
+                .map((stmt) => Stmt(mapLocals(stmt.kind, locals), stmt.line));
+            const k = calleeBlock.ter.kind;
+            inlined.ter = Ter(
+                k.tag === "return"
+                    ? { tag: "goto", target: continuation }
+                    : mapTargets(k, blocks),
+            );
+        }
+
+        const params = callee.paramLocals.values().toArray();
+        block.stmts = [
+            ...block.stmts.slice(0, i - 1),
+            ...params.toReversed().map((param) =>
+                Stmt({ tag: "store", local: locals.get(param)! }, line)
+            ),
+            ...belowLocals.toReversed().map((local) =>
+                Stmt({ tag: "store", local }, line)
+            ),
+        ];
+        block.ter = Ter({
+            tag: "goto",
+            target: blocks.get(callee.entry)!,
+        });
+
+        const idx = this.fn.blocks.indexOf(block);
+        this.fn.blocks.splice(idx + 1, 0, ...blocks.values(), continuation);
+        if (this.fn.exit === block) {
+            this.fn.exit = continuation;
+        }
+        if (this.loopBlocks.has(block)) {
+            for (const inlined of [...blocks.values(), continuation]) {
+                this.loopBlocks.add(inlined);
+            }
+        }
+        return continuation;
+    }
+
+    private local(ty: Ty): Local {
+        const local: Local = { id: this.localIds++, ty };
+        this.fn.locals.push(local);
+        return local;
+    }
+}
+
+function mapLocals(k: StmtKind, locals: Map<Local, Local>): StmtKind {
+    switch (k.tag) {
+        case "load":
+        case "store":
+            return { ...k, local: locals.get(k.local)! };
+        default:
+            return k;
+    }
+}
+
+function mapTargets(k: TerKind, blocks: Map<Block, Block>): TerKind {
+    switch (k.tag) {
+        case "goto":
+            return { tag: "goto", target: blocks.get(k.target)! };
+        case "if":
+            return {
+                tag: "if",
+                truthy: blocks.get(k.truthy)!,
+                falsy: blocks.get(k.falsy)!,
+            };
+        default:
+            return k;
+    }
+}
+
+// Applies the effect of a statement to the types on the stack. Returns
+// false for statements with unknown effects.
+function simulateStmt(k: StmtKind, stack: Ty[]): boolean {
+    const int: Ty = { tag: "int" };
+    const popN = (n: number) => stack.splice(stack.length - n);
+    switch (k.tag) {
+        case "error":
+            return false;
+        case "push":
+            stack.push(k.ty);
+            return true;
+        case "pop":
+        case "store":
+            popN(1);
+            return true;
+        case "load":
+            stack.push(k.local.ty);
+            return true;
+        case "load_field":
+            popN(1);
+            stack.push(k.ty);
+            return true;
+        case "load_index":
+            popN(2);
+            stack.push(k.ty);
+            return true;
+        case "store_field":
+            popN(2);
+            return true;
+        case "store_index":
+            popN(3);
+            return true;
+        case "call": {
+            const [callee] = popN(1);
+            popN(k.args);
+            stack.push(callee?.tag === "fn" ? callee.returnTy : int);
+            return true;
+        }
+        case "lt":
+        case "gt":
+        case "le":
+        case "ge":
+        case "eq":
+        case "ne":
+        case "add":
+        case "sub":
+        case "mul":
+        case "div":
+        case "mod":
+            popN(2);
+            stack.push(int);
+            return true;
+    }
+}
+
+// Blocks which can reach themselves.
+function blocksInLoops(fn: Fn): Set<Block> {
+    const successors = (block: Block): Block[] => {
+        const k = block.ter.kind;
+        switch (k.tag) {
+            case "goto":
+                return [k.target];
+            case "if":
+                return [k.truthy, k.falsy];
+            default:
+                return [];
+        }
+    };
+    const inLoops = new Set<Block>();
+    for (const block of fn.blocks) {
+        const visited = new Set<Block>();
+        const worklist = successors(block);
+        while (worklist.length > 0) {
+            const succ = worklist.pop()!;
+            if (succ === block) {
+                inLoops.add(block);
+                break;
+            }
+            if (!visited.has(succ)) {
+                visited.add(succ);
+                worklist.push(...successors(succ));
+            }
+        }
+    }
+    return inLoops;
+}
@@ -0,0 +1,512 @@
+import {
+    constInt,
+    dominators,
+    hasSideEffects,
+    mapOperands,
+    newBlock,
+    newValue,
+    operands,
+    replaceValues,
+    setSuccessor,
+    SsaBlock,
+    SsaFn,
+    succEdges,
+    successors,
+    Value,
+    ValueKind,
+} from "./mir_ssa.ts";
+import { Ty } from "./ty.ts";
+
+// Loop optimizations on the SSA form of a function.
+
+export type Loop = {
+    header: SsaBlock;
+    blocks: Set<SsaBlock>;
+    // Blocks of the loop continuing at the header.
+    latches: SsaBlock[];
+};
+
+type LoopEntry = {
+    loop: Loop;
+    // Block before the header, which is the only way into the loop.
+    preheader: SsaBlock;
+};
+
+type InductionVar = {
+    phi: Value;
+    // Value of the phi entering the loop.
+    init: Value;
+    // Added to the phi every iteration.
+    step: number;
+};
+
+// Values in the body of an unrolled loop, above which loops aren't
+// unrolled as much.
+const maxUnrolledSize = 64;
+
+// Natural loops of a function, with loops sharing a header merged. Inner
+// loops come before the loops enclosing them.
+export function findLoops(fn: SsaFn): Loop[] {
+    const idoms = dominators(fn);
+    const dominates = (a: SsaBlock, b: SsaBlock): boolean => {
+        while (b !== a) {
+            const idom = idoms.get(b)!;
+            if (idom === b) {
+                return false;
+            }
+            b = idom;
+        }
+        return true;
+    };
+
+    const loops = new Map<SsaBlock, Loop>();
+    for (const block of fn.blocks) {
+        for (const header of successors(block)) {
+            if (!dominates(header, block)) {
+                continue;
+            }
+            const loop = loops.get(header) ??
+                { header, blocks: new Set([header]), latches: [] };
+            loops.set(header, loop);
+            if (!loop.latches.includes(block)) {
+                loop.latches.push(block);
+            }
+            const worklist = [block];
+            while (worklist.length > 0) {
+                const block = worklist.pop()!;
+                if (loop.blocks.has(block)) {
+                    continue;
+                }
+                loop.blocks.add(block);
+                worklist.push(...block.preds);
+            }
+        }
+    }
+    return loops
+        .values()
+        .toArray()
+        .toSorted((a, b) => a.blocks.size - b.blocks.size);
+}
+
+// Finds the loops of a function, giving every loop a preheader.
+function loopEntries(fn: SsaFn): LoopEntry[] {
+    while (true) {
+        const loops = findLoops(fn);
+        const loop = loops.find((loop) => !preheader(loop));
+        if (!loop) {
+            return loops
+                .map((loop) => ({ loop, preheader: preheader(loop)! }));
+        }
+        insertPreheader(fn, loop);
+    }
+}
+
+function preheader(loop: Loop): SsaBlock | undefined {
+    const outside = loop.header.preds
+        .filter((pred) => !loop.blocks.has(pred));
+    if (outside.length !== 1 || outside[0].ter.tag !== "goto") {
+        return undefined;
+    }
+    return outside[0];
+}
+
+function insertPreheader(fn: SsaFn, loop: Loop) {
+    const header = loop.header;
+    const preheader = newBlock(fn, { tag: "goto", target: header });
+
+    const outside = header.preds
+        .map((pred, i) => ({ pred, i }))
+        .filter(({ pred }) => !loop.blocks.has(pred));
+    const slots = outside.map(({ pred, i }) =>
+        succEdges(pred)
+            .findIndex((edge) => edge.succ === header && edge.pred === i)
+    );
+    for (const [j, { pred }] of outside.entries()) {
+        setSuccessor(pred, slots[j], preheader);
+        preheader.preds.push(pred);
+    }
+
+    for (const phi of header.phis) {
+        const k = phi.kind as ValueKind & { tag: "phi" };
+        const args = outside.map(({ i }) => k.args[i]);
+        let arg = args[0];
+        if (new Set(args).size > 1) {
+            arg = newValue(fn, preheader, { tag: "phi", args }, phi.ty);
+            preheader.phis.push(arg);
+        }
+        k.args = [
+            ...k.args.filter((_, i) => loop.blocks.has(header.preds[i])),
+            arg,
+        ];
+    }
+    header.preds = [
+        ...header.preds.filter((pred) => loop.blocks.has(pred)),
+        preheader,
+    ];
+    fn.blocks.splice(fn.blocks.indexOf(header), 0, preheader);
+}
+
+// Moves values computed the same every iteration of a loop to its
+// preheader. Loads are only moved out of loops without memory writes, and
+// only from the header, which runs whenever the preheader does.
+export function hoistInvariants(fn: SsaFn) {
+    for (const { loop, preheader } of loopEntries(fn)) {
+        const hasWrites = loop.blocks
+            .values()
+            .some((block) => block.insts.some(hasSideEffects));
+
+        let changed = true;
+        while (changed) {
+            changed = false;
+            for (const block of fn.blocks) {
+                if (!loop.blocks.has(block)) {
+                    continue;
+                }
+                const loadsInvariant = block === loop.header && !hasWrites;
+                for (const inst of [...block.insts]) {
+                    if (
+                        !hoistable(inst, loadsInvariant) ||
+                        operands(inst)
+                            .some((operand) => loop.blocks.has(operand.block))
+                    ) {
+                        continue;
+                    }
+                    block.insts.splice(block.insts.indexOf(inst), 1);
+                    inst.block = preheader;
+                    preheader.insts.push(inst);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// Values which can be computed before the loop, even if the loop wouldn't
+// have computed them.
+function hoistable(value: Value, loadsInvariant: boolean): boolean {
+    const k = value.kind;
+    switch (k.tag) {
+        case "const":
+            return true;
+        case "binary": {
+            if (k.op !== "div" && k.op !== "mod") {
+                return true;
+            }
+            const divisor = constInt(k.right);
+            return divisor !== undefined && divisor !== 0 && divisor !== -1;
+        }
+        case "load_mem":
+            return loadsInvariant;
+        default:
+            return false;
+    }
+}
+
+// Replaces multiplications of induction variables, and addressing with
+// them, by variables incremented every iteration. Only indices needing
+// more than an address scale are replaced, since the rest are free.
+export function reduceStrength(fn: SsaFn) {
+    for (const { loop, preheader } of loopEntries(fn)) {
+        const header = loop.header;
+        if (loop.latches.length !== 1 || header.preds.length !== 2) {
+            continue;
+        }
+        const latch = loop.latches[0];
+        const ivs = new Map(
+            inductionVars(loop, preheader).map((iv) => [iv.phi, iv]),
+        );
+        const invariant = (value: Value) => !loop.blocks.has(value.block);
+
+        const pre = (kind: ValueKind, ty?: Ty): Value => {
+            const value = newValue(fn, preheader, kind, ty);
+            preheader.insts.push(value);
+            return value;
+        };
+        const preConst = (val: number) =>
+            pre({ tag: "const", val: { tag: "int", val } });
+        const deriveVar = (start: Value, step: Value, ty: Ty): Value => {
+            const phi = newValue(fn, header, { tag: "phi", args: [] }, ty);
+            const next = newValue(fn, latch, {
+                tag: "binary",
+                op: "add",
+                left: phi,
+                right: step,
+            }, ty);
+            (phi.kind as ValueKind & { tag: "phi" }).args = header.preds
+                .map((pred) => pred === preheader ? start : next);
+            header.phis.push(phi);
+            latch.insts.push(next);
+            return phi;
+        };
+
+        const replacements = new Map<Value, Value>();
+        const pointers = new Map<string, Value>();
+        for (const block of fn.blocks) {
+            if (!loop.blocks.has(block)) {
+                continue;
+            }
+            for (const inst of block.insts) {
+                const k = inst.kind;
+                if (k.tag === "binary" && k.op === "mul") {
+                    const [iv, factor] = ivs.has(k.left)
+                        ? [ivs.get(k.left)!, k.right]
+                        : [ivs.get(k.right), k.left];
+                    if (!iv || !invariant(factor)) {
+                        continue;
+                    }
+                    const constFactor = constInt(factor);
+                    const constStep = constFactor !== undefined
+                        ? iv.step * constFactor
+                        : undefined;
+                    const step = constStep !== undefined &&
+                            Number.isSafeInteger(constStep)
+                        ? preConst(constStep)
+                        : iv.step === 1
+                        ? factor
+                        : pre({
+                            tag: "binary",
+                            op: "mul",
+                            left: factor,
+                            right: preConst(iv.step),
+                        });
+                    const start = pre({
+                        tag: "binary",
+                        op: "mul",
+                        left: iv.init,
+                        right: factor,
+                    });
+                    replacements.set(inst, deriveVar(start, step, inst.ty));
+                } else if (k.tag === "load_mem" || k.tag === "store_mem") {
+                    const { base, index, stride } = k.addr;
+                    const iv = index && ivs.get(index);
+                    const step = iv && iv.step * stride;
+                    if (
+                        !iv || !invariant(base) ||
+                        [1, 2, 4, 8].includes(stride) ||
+                        !Number.isSafeInteger(step)
+                    ) {
+                        continue;
+                    }
+                    const key = `${base.id} ${index.id} ${stride}`;
+                    if (!pointers.has(key)) {
+                        const start = pre({
+                            tag: "binary",
+                            op: "add",
+                            left: base,
+                            right: pre({
+                                tag: "binary",
+                                op: "mul",
+                                left: iv.init,
+                                right: preConst(stride),
+                            }),
+                        }, base.ty);
+                        pointers.set(
+                            key,
+                            deriveVar(start, preConst(step!), base.ty),
+                        );
+                    }
+                    k.addr = {
+                        base: pointers.get(key)!,
+                        stride: 0,
+                        offset: k.addr.offset,
+                    };
+                }
+            }
+        }
+        replaceValues(fn, replacements);
+    }
+}
+
+// Header phis incremented by a constant every iteration, of loops entered
+// through the preheader and continued through a single latch.
+function inductionVars(loop: Loop, preheader: SsaBlock): InductionVar[] {
+    const header = loop.header;
+    const entryIdx = header.preds.indexOf(preheader);
+    const latchIdx = header.preds.indexOf(loop.latches[0]);
+    return header.phis.flatMap((phi): InductionVar[] => {
+        const args = (phi.kind as ValueKind & { tag: "phi" }).args;
+        const next = args[latchIdx].kind;
+        if (next.tag !== "binary") {
+            return [];
+        }
+        let step: number | undefined;
+        if (next.op === "add" && next.left === phi) {
+            step = constInt(next.right);
+        } else if (next.op === "add" && next.right === phi) {
+            step = constInt(next.left);
+        } else if (next.op === "sub" && next.left === phi) {
+            const right = constInt(next.right);
+            step = right !== undefined ? -right : undefined;
+        }
+        return step !== undefined
+            ? [{ phi, init: args[entryIdx], step }]
+            : [];
+    });
+}
+
+// Unrolls counted loops of a header and a body, `while i < n { ...; i = i +
+// c; }`, by up to `factor`. The unrolled loop runs while all its copies of
+// the body would run, then the original loop runs the remaining iterations.
+//
+// The unrolled loop runs while `i < n - lookahead`, which would wrap for `n`
+// close to the smallest integer. Unless `n` is a constant for which it
+// doesn't, the unrolled loop is skipped when `n - lookahead < n` is false.
+export function unrollLoops(fn: SsaFn, factor: number) {
+    if (factor < 2) {
+        return;
+    }
+    // Unrolling an inner loop doesn't change other loops which can be
+    // unrolled, since those don't enclose it.
+    for (const { loop, preheader } of loopEntries(fn)) {
+        unrollLoop(fn, loop, preheader, factor);
+    }
+}
+
+function unrollLoop(
+    fn: SsaFn,
+    loop: Loop,
+    preheader: SsaBlock,
+    factor: number,
+) {
+    const header = loop.header;
+    const body = loop.latches[0];
+    if (
+        loop.blocks.size !== 2 || loop.latches.length !== 1 ||
+        body === header || header.preds.length !== 2 ||
+        header.ter.tag !== "if" || header.ter.truthy !== body
+    ) {
+        return;
+    }
+    const cond = header.ter.cond;
+    const k = cond.kind;
+    if (k.tag !== "binary" || (k.op !== "lt" && k.op !== "le")) {
+        return;
+    }
+    const iv = inductionVars(loop, preheader)
+        .find((iv) => iv.phi === k.left);
+    if (!iv || iv.step <= 0 || loop.blocks.has(k.right.block)) {
+        return;
+    }
+    const size = header.insts.length + body.insts.length;
+    const copies = Math.min(factor, Math.floor(maxUnrolledSize / size));
+    const lookahead = (copies - 1) * iv.step;
+    if (copies < 2 || !Number.isSafeInteger(lookahead)) {
+        return;
+    }
+    const entryIdx = header.preds.indexOf(preheader);
+    const latchIdx = header.preds.indexOf(body);
+    const phiArg = (phi: Value, i: number) =>
+        (phi.kind as ValueKind & { tag: "phi" }).args[i];
+
+    const pre = (kind: ValueKind): Value => {
+        const value = newValue(fn, preheader, kind);
+        preheader.insts.push(value);
+        return value;
+    };
+    const limit = pre({
+        tag: "binary",
+        op: "sub",
+        left: k.right,
+        right: pre({ tag: "const", val: { tag: "int", val: lookahead } }),
+    });
+    const bound = constInt(k.right);
+    const checkWrap = bound === undefined ||
+        !Number.isSafeInteger(bound - lookahead);
+
+    const unrolledHeader = newBlock(fn, undefined!);
+    const unrolledBody = newBlock(fn, { tag: "goto", target: unrolledHeader });
+    unrolledHeader.preds = [preheader, unrolledBody];
+    unrolledBody.preds = [unrolledHeader];
+
+    const phis = new Map(header.phis.map((phi) => [
+        phi,
+        newValue(fn, unrolledHeader, { tag: "phi", args: [] }, phi.ty),
+    ]));
+    unrolledHeader.phis = [...phis.values()];
+    const guard = newValue(fn, unrolledHeader, {
+        tag: "binary",
+        op: k.op,
+        left: phis.get(iv.phi)!,
+        right: limit,
+    });
+    unrolledHeader.insts.push(guard);
+    unrolledHeader.ter = {
+        tag: "if",
+        cond: guard,
+        truthy: unrolledBody,
+        falsy: header,
+    };
+
+    // Each copy runs the header and the body of an iteration, with the
+    // header phis being the values the previous copy continues with.
+    let current = new Map(phis);
+    for (let i = 0; i < copies; ++i) {
+        const copied = new Map(current);
+        const copy = (value: Value) => copied.get(value) ?? value;
+        for (const inst of [...header.insts, ...body.insts]) {
+            const clone = newValue(
+                fn,
+                unrolledBody,
+                cloneKind(inst.kind),
+                inst.ty,
+            );
+            clone.line = inst.line;
+            mapOperands(clone, copy);
+            unrolledBody.insts.push(clone);
+            copied.set(inst, clone);
+        }
+        current = new Map(
+            header.phis.map((phi) => [phi, copy(phiArg(phi, latchIdx))]),
+        );
+    }
+    for (const [phi, unrolled] of phis) {
+        const init = phiArg(phi, entryIdx);
+        (unrolled.kind as ValueKind & { tag: "phi" }).args = [
+            init,
+            current.get(phi)!,
+        ];
+        const args = (phi.kind as ValueKind & { tag: "phi" }).args;
+        args[entryIdx] = unrolled;
+        if (checkWrap) {
+            args.push(init);
+        }
+    }
+
+    header.preds[entryIdx] = unrolledHeader;
+    if (checkWrap) {
+        const noWrap = pre({
+            tag: "binary",
+            op: "lt",
+            left: limit,
+            right: k.right,
+        });
+        preheader.ter = {
+            tag: "if",
+            cond: noWrap,
+            truthy: unrolledHeader,
+            falsy: header,
+        };
+        header.preds.push(preheader);
+    } else {
+        setSuccessor(preheader, 0, unrolledHeader);
+    }
+    fn.blocks.splice(
+        fn.blocks.indexOf(header),
+        0,
+        unrolledHeader,
+        unrolledBody,
+    );
+}
+
+function cloneKind(kind: ValueKind): ValueKind {
+    switch (kind.tag) {
+        case "phi":
+        case "call":
+            return { ...kind, args: [...kind.args] };
+        case "load_mem":
+        case "store_mem":
+            return { ...kind, addr: { ...kind.addr } };
+        default:
+            return { ...kind };
+    }
+}
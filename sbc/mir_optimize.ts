@@ -1,11 +1,68 @@
 import * as ast from "./ast.ts";
-import { Block, Fn, FnStringifyer } from "./mir.ts";
+import { BinaryOp, Block, Fn, FnStringifyer, Val } from "./mir.ts";
+import { hoistInvariants, reduceStrength, unrollLoops } from "./mir_loop.ts";
+import {
+    buildSsa,
+    constInt,
+    dominatorChildren,
+    dominators,
+    hasSideEffects,
+    lowerSsa,
+    mapOperands,
+    newValue,
+    operands,
+    replaceValues,
+    reversePostorder,
+    SsaBlock,
+    SsaFn,
+    SsaStringifyer,
+    succEdges,
+    terOperands,
+    Value,
+} from "./mir_ssa.ts";
+import { tyToString } from "./ty.ts";
 
-export function optimizeMirFn(fn: Fn) {
+export type MirOptimizeOpts = {
+    // Copies of the body of small counted loops run per iteration.
+    unrollFactor?: number;
+};
+
+export function optimizeMirFn(fn: Fn, opts: MirOptimizeOpts = {}) {
     // console.log(`=== OPTIMIZING ${(fn.stmt.kind as ast.FnStmt).ident} ===`);
     // console.log("=== BEFORE OPTIMIZATION ===");
     // console.log(new FnStringifyer(fn).stringify());
 
+    simplifyCfg(fn);
+
+    const ssa = buildSsa(fn);
+    if (ssa) {
+        // console.log("=== SSA ===");
+        // console.log(new SsaStringifyer(ssa).stringify());
+
+        propagateConstants(ssa);
+        propagateCopies(ssa);
+        numberValues(ssa);
+        hoistInvariants(ssa);
+        reduceStrength(ssa);
+        unrollLoops(ssa, opts.unrollFactor ?? 4);
+        propagateConstants(ssa);
+        propagateCopies(ssa);
+        foldConstantOffsets(ssa);
+        numberValues(ssa);
+        eliminateDeadValues(ssa);
+
+        // console.log("=== OPTIMIZED SSA ===");
+        // console.log(new SsaStringifyer(ssa).stringify());
+
+        lowerSsa(ssa);
+        simplifyCfg(fn);
+    }
+
+    // console.log("=== AFTER OPTIMIZATION ===");
+    // console.log(new FnStringifyer(fn).stringify());
+}
+
+function simplifyCfg(fn: Fn) {
     const blockSize = fn.blocks
         .map((block) => block.stmts.length)
         .toSorted()
@@ -26,9 +83,456 @@ export function optimizeMirFn(fn: Fn) {
         }
         sizeHistory.add(sizeBefore);
     }
+}
 
-    // console.log("=== AFTER OPTIMIZATION ===");
-    // console.log(new FnStringifyer(fn).stringify());
+type Lattice =
+    | { tag: "top" }
+    | { tag: "const"; val: number }
+    | { tag: "bottom" };
+
+// Sparse conditional constant propagation, as described in "Constant
+// Propagation with Conditional Branches" by Wegman and Zadeck. Values found
+// constant are replaced by constants, branches on them by gotos, and blocks
+// never reached are removed.
+function propagateConstants(fn: SsaFn) {
+    const lattice = new Map<Value, Lattice>();
+    const latticeOf = (value: Value): Lattice =>
+        lattice.get(value) ?? { tag: "top" };
+
+    const users = new Map<Value, (Value | SsaBlock)[]>();
+    for (const block of fn.blocks) {
+        for (const value of [...block.phis, ...block.insts]) {
+            for (const operand of operands(value)) {
+                users.set(operand, [...(users.get(operand) ?? []), value]);
+            }
+        }
+        for (const operand of terOperands(block.ter)) {
+            users.set(operand, [...(users.get(operand) ?? []), block]);
+        }
+    }
+
+    // Edges are identified by the successor and the index of the
+    // predecessor in it, since a block may branch to a block twice.
+    const executableEdges = new Set<string>();
+    const executableBlocks = new Set<SsaBlock>();
+    const edgeKey = (succ: SsaBlock, i: number) => `${succ.id}:${i}`;
+
+    const blockWorklist: SsaBlock[] = [fn.entry];
+    const valueWorklist: (Value | SsaBlock)[] = [];
+
+    const markEdge = (block: SsaBlock, slot: number) => {
+        const { succ, pred } = succEdges(block)[slot];
+        const key = edgeKey(succ, pred);
+        if (executableEdges.has(key)) {
+            return;
+        }
+        executableEdges.add(key);
+        if (!executableBlocks.has(succ)) {
+            blockWorklist.push(succ);
+        } else {
+            valueWorklist.push(...succ.phis);
+        }
+    };
+
+    const visitValue = (value: Value) => {
+        const old = latticeOf(value);
+        if (old.tag === "bottom") {
+            return;
+        }
+        const val = evaluate(value);
+        if (
+            val.tag === old.tag &&
+            (val.tag !== "const" || val.val === (old as typeof val).val)
+        ) {
+            return;
+        }
+        lattice.set(value, val);
+        valueWorklist.push(...(users.get(value) ?? []));
+    };
+
+    const evaluate = (value: Value): Lattice => {
+        const k = value.kind;
+        switch (k.tag) {
+            case "const":
+                return k.val.tag === "int"
+                    ? { tag: "const", val: k.val.val }
+                    : { tag: "bottom" };
+            case "undef":
+                // Locals read before being assigned are zero.
+                return { tag: "const", val: 0 };
+            case "phi": {
+                let val: Lattice = { tag: "top" };
+                for (const [i, arg] of k.args.entries()) {
+                    if (executableEdges.has(edgeKey(value.block, i))) {
+                        val = meet(val, latticeOf(arg));
+                    }
+                }
+                return val;
+            }
+            case "binary": {
+                const left = latticeOf(k.left);
+                const right = latticeOf(k.right);
+                const isZero = (val: Lattice) =>
+                    val.tag === "const" && val.val === 0;
+                if (k.op === "mul" && (isZero(left) || isZero(right))) {
+                    return { tag: "const", val: 0 };
+                }
+                if (left.tag === "bottom" || right.tag === "bottom") {
+                    return { tag: "bottom" };
+                }
+                if (left.tag === "top" || right.tag === "top") {
+                    return { tag: "top" };
+                }
+                const val = foldBinary(k.op, left.val, right.val);
+                return val !== undefined
+                    ? { tag: "const", val }
+                    : { tag: "bottom" };
+            }
+            case "param":
+            case "call":
+            case "load_mem":
+            case "store_mem":
+                return { tag: "bottom" };
+        }
+    };
+
+    const visitTer = (block: SsaBlock) => {
+        const ter = block.ter;
+        switch (ter.tag) {
+            case "return":
+                return;
+            case "goto":
+                markEdge(block, 0);
+                return;
+            case "if": {
+                const cond = latticeOf(ter.cond);
+                if (cond.tag === "top") {
+                    return;
+                }
+                if (cond.tag === "bottom" || cond.val !== 0) {
+                    markEdge(block, 0);
+                }
+                if (cond.tag === "bottom" || cond.val === 0) {
+                    markEdge(block, 1);
+                }
+                return;
+            }
+        }
+    };
+
+    while (blockWorklist.length > 0 || valueWorklist.length > 0) {
+        while (blockWorklist.length > 0) {
+            const block = blockWorklist.pop()!;
+            if (executableBlocks.has(block)) {
+                continue;
+            }
+            executableBlocks.add(block);
+            for (const value of [...block.phis, ...block.insts]) {
+                visitValue(value);
+            }
+            visitTer(block);
+        }
+        while (valueWorklist.length > 0 && blockWorklist.length === 0) {
+            const user = valueWorklist.pop()!;
+            if ("kind" in user) {
+                if (executableBlocks.has(user.block)) {
+                    visitValue(user);
+                }
+            } else if (executableBlocks.has(user)) {
+                visitTer(user);
+            }
+        }
+    }
+
+    const replacements = new Map<Value, Value>();
+    for (const block of fn.blocks) {
+        if (!executableBlocks.has(block)) {
+            continue;
+        }
+        for (const value of [...block.phis, ...block.insts]) {
+            const val = latticeOf(value);
+            const k = value.kind;
+            if (val.tag !== "const" || k.tag === "const" || k.tag === "undef") {
+                continue;
+            }
+            const constKind = {
+                tag: "const" as const,
+                val: { tag: "int" as const, val: val.val },
+            };
+            if (k.tag !== "phi") {
+                value.kind = constKind;
+                continue;
+            }
+            const constant = newValue(fn, block, constKind, value.ty);
+            block.insts.unshift(constant);
+            replacements.set(value, constant);
+        }
+        block.phis = block.phis.filter((phi) => !replacements.has(phi));
+
+        const ter = block.ter;
+        const cond = ter.tag === "if" ? latticeOf(ter.cond) : undefined;
+        if (ter.tag === "if" && cond?.tag === "const") {
+            block.ter = {
+                tag: "goto",
+                target: cond.val !== 0 ? ter.truthy : ter.falsy,
+            };
+        }
+    }
+
+    for (const block of fn.blocks) {
+        const executable = block.preds
+            .map((_, i) => executableEdges.has(edgeKey(block, i)));
+        block.preds = block.preds.filter((_, i) => executable[i]);
+        for (const phi of block.phis) {
+            const k = phi.kind;
+            if (k.tag === "phi") {
+                k.args = k.args.filter((_, i) => executable[i]);
+            }
+        }
+    }
+    fn.blocks = fn.blocks.filter((block) => executableBlocks.has(block));
+    replaceValues(fn, replacements);
+}
+function meet(a: Lattice, b: Lattice): Lattice {
+    if (a.tag === "top") {
+        return b;
+    }
+    if (b.tag === "top") {
+        return a;
+    }
+    if (a.tag === "const" && b.tag === "const" && a.val === b.val) {
+        return a;
+    }
+    return { tag: "bottom" };
+}
+
+// Evaluates an operation as the generated code does, on 64-bit integers.
+// Returns undefined for division by zero, which is left to trap at runtime,
+// and for results not representable as constants.
+function foldBinary(
+    op: BinaryOp,
+    left: number,
+    right: number,
+): number | undefined {
+    const l = BigInt(left);
+    const r = BigInt(right);
+    if ((op === "div" || op === "mod") && r === 0n) {
+        return undefined;
+    }
+    const result = {
+        "lt": l < r ? 1n : 0n,
+        "gt": l > r ? 1n : 0n,
+        "le": l <= r ? 1n : 0n,
+        "ge": l >= r ? 1n : 0n,
+        "eq": l === r ? 1n : 0n,
+        "ne": l !== r ? 1n : 0n,
+        "add": l + r,
+        "sub": l - r,
+        "mul": l * r,
+        "div": r !== 0n ? l / r : 0n,
+        "mod": r !== 0n ? l % r : 0n,
+    }[op];
+    const val = Number(BigInt.asIntN(64, result));
+    return Number.isSafeInteger(val) ? val : undefined;
+}
+
+// Removes phis choosing between a single value and themselves.
+function propagateCopies(fn: SsaFn) {
+    let changed = true;
+    while (changed) {
+        changed = false;
+        const replacements = new Map<Value, Value>();
+        for (const block of fn.blocks) {
+            for (const phi of block.phis) {
+                const args = new Set(operands(phi));
+                args.delete(phi);
+                if (args.size === 1) {
+                    replacements.set(phi, [...args][0]);
+                }
+            }
+            block.phis = block.phis.filter((phi) => !replacements.has(phi));
+        }
+        replaceValues(fn, replacements);
+        changed = replacements.size > 0;
+    }
+}
+
+// Global value numbering over the dominator tree. A value computing the
+// same as a value dominating it is replaced by that value. Loads are only
+// numbered the same between memory writes in the same block.
+function numberValues(fn: SsaFn) {
+    const children = dominatorChildren(dominators(fn));
+    const numbers = new Map<string, Value>();
+    const replacements = new Map<Value, Value>();
+    const resolve = (value: Value) => replacements.get(value) ?? value;
+    let memoryEpoch = 0;
+
+    const visit = (block: SsaBlock) => {
+        memoryEpoch += 1;
+        const numbered: string[] = [];
+        for (const value of [...block.phis, ...block.insts]) {
+            mapOperands(value, resolve);
+            if (hasSideEffects(value)) {
+                memoryEpoch += 1;
+            }
+            const key = valueKey(value, memoryEpoch);
+            if (key === undefined) {
+                continue;
+            }
+            const existing = numbers.get(key);
+            if (existing) {
+                replacements.set(value, existing);
+                continue;
+            }
+            numbers.set(key, value);
+            numbered.push(key);
+        }
+        block.phis = block.phis.filter((phi) => !replacements.has(phi));
+        block.insts = block.insts
+            .filter((inst) => !replacements.has(inst));
+
+        for (const child of children.get(block) ?? []) {
+            visit(child);
+        }
+        for (const key of numbered) {
+            numbers.delete(key);
+        }
+    };
+    visit(fn.entry);
+    replaceValues(fn, replacements);
+}
+
+function valueKey(value: Value, memoryEpoch: number): string | undefined {
+    const k = value.kind;
+    const ty = tyToString(value.ty);
+    switch (k.tag) {
+        case "const":
+            return `const ${ty} ${valKey(k.val)}`;
+        case "undef":
+            return `undef ${ty}`;
+        case "phi":
+            return `phi ${value.block.id} ${k.args.map(({ id }) => id)}`;
+        case "binary": {
+            const commutative = ["eq", "ne", "add", "mul"].includes(k.op);
+            const [left, right] = commutative && k.left.id > k.right.id
+                ? [k.right, k.left]
+                : [k.left, k.right];
+            return `${k.op} ${left.id} ${right.id}`;
+        }
+        case "load_mem": {
+            const { base, index, stride, offset } = k.addr;
+            return `load_mem ${memoryEpoch} ${ty} ${base.id} ${
+                index?.id ?? "-"
+            } ${stride} ${offset}`;
+        }
+        case "param":
+        case "call":
+        case "store_mem":
+            return undefined;
+    }
+}
+
+function valKey(val: Val): string {
+    switch (val.tag) {
+        case "int":
+            return `${val.val}`;
+        case "str":
+            return JSON.stringify(val.val);
+        case "fn":
+            return `fn ${val.stmt.id}`;
+    }
+}
+
+// Folds constants added to values into the additions and addresses using
+// them, such as the indices and pointers of unrolled loops.
+function foldConstantOffsets(fn: SsaFn) {
+    const addedConst = (value: Value): [Value, number] | undefined => {
+        const k = value.kind;
+        if (k.tag !== "binary" || k.op !== "add") {
+            return undefined;
+        }
+        const right = constInt(k.right);
+        if (right !== undefined) {
+            return [k.left, right];
+        }
+        const left = constInt(k.left);
+        return left !== undefined ? [k.right, left] : undefined;
+    };
+    // Displacements of x86-64 addresses are 32-bit.
+    const isDisplacement = (offset: number) =>
+        offset >= -(2 ** 31) && offset < 2 ** 31;
+
+    // Blocks are visited in reverse postorder, so that the values added to
+    // are folded before the values using them.
+    for (const block of reversePostorder(fn)) {
+        for (const inst of [...block.insts]) {
+            const k = inst.kind;
+            if (k.tag === "binary") {
+                const outer = addedConst(inst);
+                const inner = outer && addedConst(outer[0]);
+                if (!outer || !inner) {
+                    continue;
+                }
+                const val = Number(
+                    BigInt.asIntN(64, BigInt(outer[1]) + BigInt(inner[1])),
+                );
+                if (!Number.isSafeInteger(val)) {
+                    continue;
+                }
+                const constant = newValue(fn, block, {
+                    tag: "const",
+                    val: { tag: "int", val },
+                });
+                block.insts.splice(block.insts.indexOf(inst), 0, constant);
+                inst.kind = {
+                    tag: "binary",
+                    op: "add",
+                    left: inner[0],
+                    right: constant,
+                };
+            } else if (k.tag === "load_mem" || k.tag === "store_mem") {
+                const addr = k.addr;
+                while (true) {
+                    const base = addedConst(addr.base);
+                    const index = addr.index && addedConst(addr.index);
+                    if (base && isDisplacement(addr.offset + base[1])) {
+                        addr.base = base[0];
+                        addr.offset += base[1];
+                    } else if (
+                        index &&
+                        isDisplacement(addr.offset + index[1] * addr.stride)
+                    ) {
+                        addr.index = index[0];
+                        addr.offset += index[1] * addr.stride;
+                    } else {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Removes values without side effects which no terminator depends on.
+function eliminateDeadValues(fn: SsaFn) {
+    const live = new Set<Value>();
+    const worklist: Value[] = [];
+    for (const block of fn.blocks) {
+        worklist.push(...block.insts.filter(hasSideEffects));
+        worklist.push(...terOperands(block.ter));
+    }
+    while (worklist.length > 0) {
+        const value = worklist.pop()!;
+        if (live.has(value)) {
+            continue;
+        }
+        live.add(value);
+        worklist.push(...operands(value));
+    }
+    for (const block of fn.blocks) {
+        block.phis = block.phis.filter((phi) => live.has(phi));
+        block.insts = block.insts.filter((inst) => live.has(inst));
+    }
 }
 
 function fnSize(fn: Fn, blockSize: number): number {
@@ -0,0 +1,1023 @@
+import { BinaryOp, Block, Fn, Local, Stmt, StmtKind, Ter, Val } from "./mir.ts";
+import { Ty, tyToString } from "./ty.ts";
+
+// SSA form of a MIR function, which the optimizations in `mir_optimize.ts`
+// work on.
+//
+// MIR is a stack machine, so every value pushed becomes a value here, and
+// loads and stores of locals are replaced by the values stored. The stack
+// is empty between blocks, except for the condition of an `if`, which is
+// the block's last value.
+
+export type SsaFn = {
+    mir: Fn;
+    blocks: SsaBlock[];
+    entry: SsaBlock;
+    valueIds: number;
+    blockIds: number;
+};
+
+export type SsaBlock = {
+    id: number;
+    preds: SsaBlock[];
+    phis: Value[];
+    // Values in the order they are computed, which is kept for the values
+    // accessing memory.
+    insts: Value[];
+    ter: SsaTer;
+};
+
+export type Value = {
+    id: number;
+    kind: ValueKind;
+    ty: Ty;
+    block: SsaBlock;
+    // Source line the value is computed for, if known.
+    line?: number;
+};
+
+export type ValueKind =
+    | { tag: "const"; val: Val }
+    | { tag: "param"; local: Local }
+    // Value of a local read before it's assigned.
+    | { tag: "undef" }
+    // Arguments are in the order of the block's predecessors.
+    | { tag: "phi"; args: Value[] }
+    | { tag: "binary"; op: BinaryOp; left: Value; right: Value }
+    | { tag: "call"; callee: Value; args: Value[] }
+    | { tag: "load_mem"; addr: Addr }
+    | { tag: "store_mem"; addr: Addr; val: Value };
+
+export type Addr = {
+    base: Value;
+    index?: Value;
+    stride: number;
+    offset: number;
+};
+
+export type SsaTer =
+    | { tag: "return"; val: Value }
+    | { tag: "goto"; target: SsaBlock }
+    | { tag: "if"; cond: Value; truthy: SsaBlock; falsy: SsaBlock };
+
+// Values which are read or written in order with the memory accesses of
+// other values.
+export function accessesMemory(value: Value): boolean {
+    const tag = value.kind.tag;
+    return tag === "call" || tag === "load_mem" || tag === "store_mem";
+}
+
+// Values which must be computed even if unused.
+export function hasSideEffects(value: Value): boolean {
+    const tag = value.kind.tag;
+    return tag === "call" || tag === "store_mem";
+}
+
+export function constInt(value: Value): number | undefined {
+    const k = value.kind;
+    return k.tag === "const" && k.val.tag === "int" ? k.val.val : undefined;
+}
+
+export function operands(value: Value): Value[] {
+    const k = value.kind;
+    switch (k.tag) {
+        case "const":
+        case "param":
+        case "undef":
+            return [];
+        case "phi":
+            return k.args;
+        case "binary":
+            return [k.left, k.right];
+        case "call":
+            return [...k.args, k.callee];
+        case "load_mem":
+            return addrOperands(k.addr);
+        case "store_mem":
+            return [...addrOperands(k.addr), k.val];
+    }
+}
+
+function addrOperands(addr: Addr): Value[] {
+    return addr.index ? [addr.base, addr.index] : [addr.base];
+}
+
+export function mapOperands(value: Value, f: (value: Value) => Value) {
+    const k = value.kind;
+    const mapAddr = (addr: Addr) => {
+        addr.base = f(addr.base);
+        addr.index = addr.index && f(addr.index);
+    };
+    switch (k.tag) {
+        case "const":
+        case "param":
+        case "undef":
+            return;
+        case "phi":
+            k.args = k.args.map(f);
+            return;
+        case "binary":
+            k.left = f(k.left);
+            k.right = f(k.right);
+            return;
+        case "call":
+            k.args = k.args.map(f);
+            k.callee = f(k.callee);
+            return;
+        case "load_mem":
+            mapAddr(k.addr);
+            return;
+        case "store_mem":
+            mapAddr(k.addr);
+            k.val = f(k.val);
+            return;
+    }
+}
+
+export function terOperands(ter: SsaTer): Value[] {
+    switch (ter.tag) {
+        case "return":
+            return [ter.val];
+        case "goto":
+            return [];
+        case "if":
+            return [ter.cond];
+    }
+}
+
+export function mapTerOperands(ter: SsaTer, f: (value: Value) => Value) {
+    switch (ter.tag) {
+        case "return":
+            ter.val = f(ter.val);
+            return;
+        case "goto":
+            return;
+        case "if":
+            ter.cond = f(ter.cond);
+            return;
+    }
+}
+
+export function successors(block: SsaBlock): SsaBlock[] {
+    const ter = block.ter;
+    switch (ter.tag) {
+        case "return":
+            return [];
+        case "goto":
+            return [ter.target];
+        case "if":
+            return [ter.truthy, ter.falsy];
+    }
+}
+
+// Successors of a block, along with the index of the block in the
+// predecessors of each, in the order of `successors`.
+export function succEdges(
+    block: SsaBlock,
+): { succ: SsaBlock; pred: number }[] {
+    const seen = new Map<SsaBlock, number>();
+    return successors(block).map((succ) => {
+        const nth = seen.get(succ) ?? 0;
+        seen.set(succ, nth + 1);
+        const pred = succ.preds
+            .map((pred, i) => pred === block ? i : -1)
+            .filter((i) => i !== -1)[nth];
+        return { succ, pred };
+    });
+}
+
+export function newValue(
+    fn: SsaFn,
+    block: SsaBlock,
+    kind: ValueKind,
+    ty: Ty = { tag: "int" },
+): Value {
+    return { id: fn.valueIds++, kind, ty, block };
+}
+
+export function newBlock(fn: SsaFn, ter: SsaTer): SsaBlock {
+    return { id: fn.blockIds++, preds: [], phis: [], insts: [], ter };
+}
+
+// Redirects the edge to the successor at `slot` in `successors` to another
+// block. Predecessors are left for the caller to update.
+export function setSuccessor(block: SsaBlock, slot: number, succ: SsaBlock) {
+    const ter = block.ter;
+    switch (ter.tag) {
+        case "return":
+            throw new Error();
+        case "goto":
+            ter.target = succ;
+            return;
+        case "if":
+            if (slot === 0) {
+                ter.truthy = succ;
+            } else {
+                ter.falsy = succ;
+            }
+            return;
+    }
+}
+
+// Replaces every use of the keys with their values, following chains of
+// replacements.
+export function replaceValues(fn: SsaFn, replacements: Map<Value, Value>) {
+    if (replacements.size === 0) {
+        return;
+    }
+    const resolve = (value: Value): Value => {
+        while (replacements.has(value)) {
+            value = replacements.get(value)!;
+        }
+        return value;
+    };
+    for (const block of fn.blocks) {
+        for (const value of [...block.phis, ...block.insts]) {
+            mapOperands(value, resolve);
+        }
+        mapTerOperands(block.ter, resolve);
+    }
+}
+
+export function reversePostorder(fn: SsaFn): SsaBlock[] {
+    const order: SsaBlock[] = [];
+    const visited = new Set<SsaBlock>();
+    const visit = (block: SsaBlock) => {
+        visited.add(block);
+        for (const succ of successors(block)) {
+            if (!visited.has(succ)) {
+                visit(succ);
+            }
+        }
+        order.push(block);
+    };
+    visit(fn.entry);
+    return order.toReversed();
+}
+
+// Immediate dominator of each block, using the algorithm from "A Simple,
+// Fast Dominance Algorithm" by Cooper, Harvey and Kennedy. The entry block
+// is its own immediate dominator.
+export function dominators(fn: SsaFn): Map<SsaBlock, SsaBlock> {
+    const order = reversePostorder(fn);
+    const orderIdx = new Map(order.map((block, i) => [block, i]));
+    const idoms = new Map<SsaBlock, SsaBlock>([[fn.entry, fn.entry]]);
+
+    const intersect = (a: SsaBlock, b: SsaBlock): SsaBlock => {
+        while (a !== b) {
+            while (orderIdx.get(a)! > orderIdx.get(b)!) {
+                a = idoms.get(a)!;
+            }
+            while (orderIdx.get(b)! > orderIdx.get(a)!) {
+                b = idoms.get(b)!;
+            }
+        }
+        return a;
+    };
+
+    let changed = true;
+    while (changed) {
+        changed = false;
+        for (const block of order.slice(1)) {
+            const [first, ...rest] = block.preds
+                .filter((pred) => idoms.has(pred));
+            const idom = rest.reduce(intersect, first);
+            if (idoms.get(block) !== idom) {
+                idoms.set(block, idom);
+                changed = true;
+            }
+        }
+    }
+    return idoms;
+}
+
+export function dominatorChildren(
+    idoms: Map<SsaBlock, SsaBlock>,
+): Map<SsaBlock, SsaBlock[]> {
+    const children = new Map<SsaBlock, SsaBlock[]>();
+    for (const [block, idom] of idoms) {
+        if (block !== idom) {
+            children.set(idom, [...(children.get(idom) ?? []), block]);
+        }
+    }
+    return children;
+}
+
+// Builds the SSA form of a function, placing phis at the dominance
+// frontiers of the stores to each local, as described in "Efficiently
+// Computing Static Single Assignment Form and the Control Dependence Graph"
+// by Cytron et al. Returns undefined for functions with errors.
+export function buildSsa(fn: Fn): SsaFn | undefined {
+    const hasErrors = fn.blocks.some((block) =>
+        block.ter.kind.tag === "error" || block.ter.kind.tag === "unset" ||
+        block.stmts.some((stmt) => stmt.kind.tag === "error")
+    );
+    // Phis can't be placed in a block without a dominator.
+    const entryHasPreds = fn.blocks
+        .some((block) => mirSuccessors(block).includes(fn.entry));
+    if (hasErrors || entryHasPreds) {
+        return undefined;
+    }
+    return new SsaBuilder(fn).build();
+}
+
+class SsaBuilder {
+    private ssa!: SsaFn;
+    private blocks = new Map<number, SsaBlock>();
+    private mirBlocks = new Map<SsaBlock, Block>();
+
+    private phiLocals = new Map<Value, Local>();
+    private defs = new Map<Local, Value[]>();
+    private undef?: Value;
+
+    private entry!: SsaBlock;
+    private domChildren = new Map<SsaBlock, SsaBlock[]>();
+
+    public constructor(
+        private fn: Fn,
+    ) {}
+
+    public build(): SsaFn {
+        for (const mirBlock of this.fn.blocks) {
+            const block: SsaBlock = {
+                id: mirBlock.id,
+                preds: [],
+                phis: [],
+                insts: [],
+                ter: { tag: "return", val: undefined! },
+            };
+            this.blocks.set(mirBlock.id, block);
+            this.mirBlocks.set(block, mirBlock);
+        }
+        // The values of terminators are set when their block is renamed.
+        for (const [block, mirBlock] of this.mirBlocks) {
+            const k = mirBlock.ter.kind;
+            if (k.tag === "goto") {
+                block.ter = {
+                    tag: "goto",
+                    target: this.blocks.get(k.target.id)!,
+                };
+            } else if (k.tag === "if") {
+                block.ter = {
+                    tag: "if",
+                    cond: undefined!,
+                    truthy: this.blocks.get(k.truthy.id)!,
+                    falsy: this.blocks.get(k.falsy.id)!,
+                };
+            }
+        }
+        this.entry = this.blocks.get(this.fn.entry.id)!;
+
+        // Only blocks reachable from the entry are kept, so that every
+        // predecessor has a dominator.
+        const reachable = new Set<Block>();
+        const worklist = [this.fn.entry];
+        while (worklist.length > 0) {
+            const mirBlock = worklist.pop()!;
+            if (reachable.has(mirBlock)) {
+                continue;
+            }
+            reachable.add(mirBlock);
+            for (const succ of mirSuccessors(mirBlock)) {
+                this.blocks.get(succ.id)!.preds.push(
+                    this.blocks.get(mirBlock.id)!,
+                );
+                worklist.push(succ);
+            }
+        }
+        const blocks = this.fn.blocks
+            .filter((mirBlock) => reachable.has(mirBlock))
+            .map((mirBlock) => this.blocks.get(mirBlock.id)!);
+        const ssa: SsaFn = {
+            mir: this.fn,
+            blocks,
+            entry: this.entry,
+            valueIds: 0,
+            blockIds: Math.max(...this.fn.blocks.map(({ id }) => id)) + 1,
+        };
+        this.ssa = ssa;
+
+        const idoms = dominators(ssa);
+        this.domChildren = dominatorChildren(idoms);
+        this.placePhis(blocks, idoms);
+
+        for (const local of this.fn.paramLocals.values()) {
+            const param = this.value(this.entry, { tag: "param", local });
+            this.entry.insts.push(param);
+            this.defs.set(local, [param]);
+        }
+        this.rename(this.entry);
+
+        return ssa;
+    }
+
+    private placePhis(blocks: SsaBlock[], idoms: Map<SsaBlock, SsaBlock>) {
+        const frontiers = new Map<SsaBlock, Set<SsaBlock>>(
+            blocks.map((block) => [block, new Set()]),
+        );
+        for (const block of blocks) {
+            if (block.preds.length < 2) {
+                continue;
+            }
+            for (const pred of block.preds) {
+                let runner = pred;
+                while (runner !== idoms.get(block)) {
+                    frontiers.get(runner)!.add(block);
+                    runner = idoms.get(runner)!;
+                }
+            }
+        }
+
+        const defSites = new Map<Local, Set<SsaBlock>>();
+        for (const block of blocks) {
+            for (const stmt of this.mirBlocks.get(block)!.stmts) {
+                if (stmt.kind.tag === "store") {
+                    const sites = defSites.get(stmt.kind.local) ?? new Set();
+                    defSites.set(stmt.kind.local, sites.add(block));
+                }
+            }
+        }
+
+        for (const [local, sites] of defSites) {
+            const hasPhi = new Set<SsaBlock>();
+            const worklist = [...sites];
+            while (worklist.length > 0) {
+                const block = worklist.pop()!;
+                for (const frontier of frontiers.get(block)!) {
+                    if (hasPhi.has(frontier)) {
+                        continue;
+                    }
+                    const phi = this.value(frontier, {
+                        tag: "phi",
+                        args: frontier.preds.map(() => this.undefValue()),
+                    }, local.ty);
+                    frontier.phis.push(phi);
+                    this.phiLocals.set(phi, local);
+                    hasPhi.add(frontier);
+                    if (!sites.has(frontier)) {
+                        worklist.push(frontier);
+                    }
+                }
+            }
+        }
+    }
+
+    private rename(block: SsaBlock) {
+        const defined: Local[] = [];
+        const define = (local: Local, value: Value) => {
+            this.defs.set(local, [...(this.defs.get(local) ?? []), value]);
+            defined.push(local);
+        };
+
+        for (const phi of block.phis) {
+            define(this.phiLocals.get(phi)!, phi);
+        }
+
+        const stack: Value[] = [];
+        let line: number | undefined;
+        const inst = (kind: ValueKind, ty: Ty): Value => {
+            const value = this.value(block, kind, ty);
+            value.line = line;
+            block.insts.push(value);
+            return value;
+        };
+        const popAddr = (k: { offset: number; stride?: number }): Addr => {
+            const index = k.stride !== undefined ? stack.pop() : undefined;
+            const base = stack.pop()!;
+            return { base, index, stride: k.stride ?? 0, offset: k.offset };
+        };
+
+        for (const stmt of this.mirBlocks.get(block)!.stmts) {
+            const k = stmt.kind;
+            line = stmt.line;
+            switch (k.tag) {
+                case "error":
+                    throw new Error();
+                case "push":
+                    stack.push(inst({ tag: "const", val: k.val }, k.ty));
+                    break;
+                case "pop":
+                    stack.pop();
+                    break;
+                case "load":
+                    stack.push(this.current(k.local));
+                    break;
+                case "store":
+                    define(k.local, stack.pop()!);
+                    break;
+                case "load_field":
+                case "load_index":
+                    stack.push(
+                        inst({ tag: "load_mem", addr: popAddr(k) }, k.ty),
+                    );
+                    break;
+                case "store_field":
+                case "store_index": {
+                    const val = stack.pop()!;
+                    const addr = popAddr(k);
+                    inst({ tag: "store_mem", addr, val }, { tag: "void" });
+                    break;
+                }
+                case "call": {
+                    const callee = stack.pop()!;
+                    const args = stack.splice(stack.length - k.args);
+                    const ty: Ty = callee.ty.tag === "fn"
+                        ? callee.ty.returnTy
+                        : { tag: "int" };
+                    stack.push(inst({ tag: "call", callee, args }, ty));
+                    break;
+                }
+                case "lt":
+                case "gt":
+                case "le":
+                case "ge":
+                case "eq":
+                case "ne":
+                case "add":
+                case "sub":
+                case "mul":
+                case "div":
+                case "mod": {
+                    const right = stack.pop()!;
+                    const left = stack.pop()!;
+                    stack.push(inst(
+                        { tag: "binary", op: k.tag, left, right },
+                        { tag: "int" },
+                    ));
+                    break;
+                }
+                default: {
+                    const _: never = k;
+                }
+            }
+        }
+
+        const ter = block.ter;
+        if (ter.tag === "return") {
+            ter.val = this.current(this.fn.returnLocal);
+        } else if (ter.tag === "if") {
+            ter.cond = stack.pop()!;
+        }
+        if (stack.length !== 0) {
+            throw new Error("stack not empty at end of block");
+        }
+
+        for (const succ of successors(block)) {
+            for (const [i, pred] of succ.preds.entries()) {
+                if (pred !== block) {
+                    continue;
+                }
+                for (const phi of succ.phis) {
+                    const k = phi.kind as ValueKind & { tag: "phi" };
+                    k.args[i] = this.current(this.phiLocals.get(phi)!);
+                }
+            }
+        }
+
+        for (const child of this.domChildren.get(block) ?? []) {
+            this.rename(child);
+        }
+
+        for (const local of defined) {
+            this.defs.get(local)!.pop();
+        }
+    }
+
+    private current(local: Local): Value {
+        return this.defs.get(local)?.at(-1) ?? this.undefValue();
+    }
+
+    private undefValue(): Value {
+        if (!this.undef) {
+            this.undef = this.value(this.entry, { tag: "undef" });
+            this.entry.insts.unshift(this.undef);
+        }
+        return this.undef;
+    }
+
+    private value(
+        block: SsaBlock,
+        kind: ValueKind,
+        ty: Ty = { tag: "int" },
+    ): Value {
+        return newValue(this.ssa, block, kind, ty);
+    }
+}
+
+function mirSuccessors(block: Block): Block[] {
+    const k = block.ter.kind;
+    switch (k.tag) {
+        case "error":
+        case "unset":
+        case "return":
+            return [];
+        case "goto":
+            return [k.target];
+        case "if":
+            return [k.truthy, k.falsy];
+    }
+}
+
+// Lowers a function out of SSA form, back into its MIR function.
+//
+// Values used once, by a later value of the same block, are computed where
+// they are used, as MIR did before. Every other value is stored in a local
+// of its own, where it's computed. Phis are assigned at the end of each
+// predecessor.
+export function lowerSsa(fn: SsaFn) {
+    new SsaLowerer(fn).lower();
+}
+
+class SsaLowerer {
+    private uses = new Map<Value, number>();
+    // Position of the single use of values used once in their own block,
+    // where the block's terminator is after the last value.
+    private usePositions = new Map<Value, number>();
+    private inlined = new Set<Value>();
+    private valueLocals = new Map<Value, Local>();
+    private locals: Local[] = [];
+    private localIds: number;
+
+    private stmts: Stmt[] = [];
+    // Line of the statements lowered, which is kept for values without
+    // one.
+    private line?: number;
+
+    public constructor(
+        private fn: SsaFn,
+    ) {
+        this.localIds = Math.max(...fn.mir.locals.map(({ id }) => id)) + 1;
+    }
+
+    public lower() {
+        this.splitCriticalEdges();
+        this.countUses();
+        for (const block of this.fn.blocks) {
+            this.decideInlining(block);
+        }
+        this.allocateLocals();
+
+        const blocks = new Map<SsaBlock, Block>(
+            this.fn.blocks.map((block) => [block, {
+                id: block.id,
+                stmts: [],
+                ter: Ter({ tag: "unset" }),
+            }]),
+        );
+        for (const block of this.fn.blocks) {
+            const mirBlock = blocks.get(block)!;
+            this.stmts = mirBlock.stmts;
+            mirBlock.ter = this.lowerBlock(block, blocks);
+        }
+
+        const mir = this.fn.mir;
+        mir.blocks = this.fn.blocks.map((block) => blocks.get(block)!);
+        mir.entry = blocks.get(this.fn.entry)!;
+        mir.exit = mir.blocks
+            .find((block) => block.ter.kind.tag === "return") ?? mir.exit;
+        mir.locals = [
+            ...mir.paramLocals.values(),
+            mir.returnLocal,
+            ...this.locals,
+        ];
+    }
+
+    // Phis are assigned at the end of each predecessor, which mustn't be
+    // done on the way to another successor.
+    private splitCriticalEdges() {
+        for (const block of [...this.fn.blocks]) {
+            if (block.phis.length === 0) {
+                continue;
+            }
+            for (const [i, pred] of block.preds.entries()) {
+                if (pred.ter.tag !== "if") {
+                    continue;
+                }
+                const split = newBlock(this.fn, { tag: "goto", target: block });
+                split.preds.push(pred);
+                if (pred.ter.truthy === block) {
+                    pred.ter.truthy = split;
+                } else {
+                    pred.ter.falsy = split;
+                }
+                block.preds[i] = split;
+                this.fn.blocks.splice(
+                    this.fn.blocks.indexOf(pred) + 1,
+                    0,
+                    split,
+                );
+            }
+        }
+    }
+
+    private countUses() {
+        const use = (value: Value, position?: number) => {
+            this.uses.set(value, (this.uses.get(value) ?? 0) + 1);
+            if (position !== undefined) {
+                this.usePositions.set(value, position);
+            }
+        };
+        for (const block of this.fn.blocks) {
+            for (const phi of block.phis) {
+                for (const arg of operands(phi)) {
+                    use(arg);
+                }
+            }
+            for (const [i, inst] of block.insts.entries()) {
+                for (const operand of operands(inst)) {
+                    use(operand, operand.block === block ? i : undefined);
+                }
+            }
+            for (const operand of terOperands(block.ter)) {
+                use(
+                    operand,
+                    operand.block === block ? block.insts.length : undefined,
+                );
+            }
+        }
+    }
+
+    // A value used once later in its block is inlined into its use, unless
+    // that would move a memory access past another.
+    private decideInlining(block: SsaBlock) {
+        const accessesBefore = [0];
+        for (const inst of block.insts) {
+            accessesBefore.push(
+                accessesBefore.at(-1)! + (accessesMemory(inst) ? 1 : 0),
+            );
+        }
+        const hasAccesses = new Set<Value>();
+
+        for (const [i, inst] of block.insts.entries()) {
+            if (
+                accessesMemory(inst) ||
+                operands(inst).some((operand) => hasAccesses.has(operand))
+            ) {
+                hasAccesses.add(inst);
+            }
+            const position = this.usePositions.get(inst);
+            if (
+                rematerializable(inst) ||
+                this.uses.get(inst) !== 1 ||
+                position === undefined
+            ) {
+                continue;
+            }
+            const accessesBetween = accessesBefore[position] -
+                accessesBefore[i + 1];
+            if (hasAccesses.has(inst) && accessesBetween !== 0) {
+                continue;
+            }
+            this.inlined.add(inst);
+        }
+    }
+
+    private allocateLocals() {
+        const returnLocal = this.fn.mir.returnLocal;
+        for (const block of this.fn.blocks) {
+            for (const phi of block.phis) {
+                // Phis only returned are assigned the return value directly.
+                const onlyReturned = block.ter.tag === "return" &&
+                    block.ter.val === phi && this.uses.get(phi) === 1;
+                this.valueLocals.set(
+                    phi,
+                    onlyReturned ? returnLocal : this.local(phi.ty),
+                );
+            }
+            for (const inst of block.insts) {
+                if (
+                    !rematerializable(inst) && !this.inlined.has(inst) &&
+                    (this.uses.get(inst) ?? 0) > 0
+                ) {
+                    this.valueLocals.set(inst, this.local(inst.ty));
+                }
+            }
+        }
+    }
+
+    private lowerBlock(block: SsaBlock, blocks: Map<SsaBlock, Block>): Ter {
+        for (const inst of block.insts) {
+            if (rematerializable(inst) || this.inlined.has(inst)) {
+                continue;
+            }
+            this.line = inst.line ?? this.line;
+            const local = this.valueLocals.get(inst);
+            if (local) {
+                this.lowerInst(inst);
+                this.pushStmt({ tag: "store", local });
+            } else if (accessesMemory(inst)) {
+                this.lowerInst(inst);
+                if (inst.kind.tag !== "store_mem") {
+                    this.pushStmt({ tag: "pop" });
+                }
+            }
+        }
+
+        const ter = block.ter;
+        switch (ter.tag) {
+            case "return": {
+                const local = this.fn.mir.returnLocal;
+                if (this.valueLocals.get(ter.val) !== local) {
+                    this.pushValue(ter.val);
+                    this.pushStmt({ tag: "store", local });
+                }
+                return Ter({ tag: "return" });
+            }
+            case "goto":
+                this.assignPhis(block, ter.target);
+                return Ter({ tag: "goto", target: blocks.get(ter.target)! });
+            case "if":
+                this.pushValue(ter.cond);
+                return Ter({
+                    tag: "if",
+                    truthy: blocks.get(ter.truthy)!,
+                    falsy: blocks.get(ter.falsy)!,
+                });
+        }
+    }
+
+    // Values are pushed before any phi is assigned, since phis may be
+    // assigned each other.
+    private assignPhis(pred: SsaBlock, block: SsaBlock) {
+        const i = block.preds.indexOf(pred);
+        const assigns = block.phis
+            .map((phi) => ({
+                local: this.valueLocals.get(phi)!,
+                val: (phi.kind as ValueKind & { tag: "phi" }).args[i],
+            }))
+            .filter(({ local, val }) => this.valueLocals.get(val) !== local);
+        for (const { val } of assigns) {
+            this.pushValue(val);
+        }
+        for (const { local } of assigns.toReversed()) {
+            this.pushStmt({ tag: "store", local });
+        }
+    }
+
+    private pushValue(value: Value) {
+        const k = value.kind;
+        switch (k.tag) {
+            case "const":
+                this.pushStmt({ tag: "push", val: k.val, ty: value.ty });
+                return;
+            case "undef":
+                this.pushStmt({
+                    tag: "push",
+                    val: { tag: "int", val: 0 },
+                    ty: value.ty,
+                });
+                return;
+            case "param":
+                this.pushStmt({ tag: "load", local: k.local });
+                return;
+        }
+        const local = this.valueLocals.get(value);
+        if (local) {
+            this.pushStmt({ tag: "load", local });
+            return;
+        }
+        if (!this.inlined.has(value)) {
+            throw new Error("value not computed");
+        }
+        this.lowerInst(value);
+    }
+
+    private lowerInst(value: Value) {
+        const k = value.kind;
+        const pushAddr = (addr: Addr) => {
+            this.pushValue(addr.base);
+            if (addr.index) {
+                this.pushValue(addr.index);
+            }
+        };
+        switch (k.tag) {
+            case "const":
+            case "param":
+            case "undef":
+            case "phi":
+                throw new Error();
+            case "binary":
+                this.pushValue(k.left);
+                this.pushValue(k.right);
+                this.pushStmt({ tag: k.op });
+                return;
+            case "call":
+                for (const arg of k.args) {
+                    this.pushValue(arg);
+                }
+                this.pushValue(k.callee);
+                this.pushStmt({ tag: "call", args: k.args.length });
+                return;
+            case "load_mem": {
+                const { stride, offset } = k.addr;
+                pushAddr(k.addr);
+                this.pushStmt(
+                    k.addr.index
+                        ? { tag: "load_index", stride, offset, ty: value.ty }
+                        : { tag: "load_field", offset, ty: value.ty },
+                );
+                return;
+            }
+            case "store_mem": {
+                const { stride, offset } = k.addr;
+                pushAddr(k.addr);
+                this.pushValue(k.val);
+                this.pushStmt(
+                    k.addr.index
+                        ? { tag: "store_index", stride, offset }
+                        : { tag: "store_field", offset },
+                );
+                return;
+            }
+        }
+        const _: never = k;
+    }
+
+    private local(ty: Ty): Local {
+        const local: Local = { id: this.localIds++, ty };
+        this.locals.push(local);
+        return local;
+    }
+
+    private pushStmt(kind: StmtKind) {
+        this.stmts.push(Stmt(kind, this.line));
+    }
+}
+
+// Values which are cheaper to compute again than to keep in a local.
+function rematerializable(value: Value): boolean {
+    const tag = value.kind.tag;
+    return tag === "const" || tag === "param" || tag === "undef";
+}
+
+export class SsaStringifyer {
+    public constructor(
+        private fn: SsaFn,
+    ) {}
+
+    public stringify(): string {
+        return this.fn.blocks
+            .map((block) =>
+                `    .b${block.id}: (${
+                    block.preds.map((pred) => `.b${pred.id}`).join(", ")
+                })\n${
+                    [...block.phis, ...block.insts]
+                        .map((value) =>
+                            `        %${value.id} :: ${
+                                tyToString(value.ty, { short: true })
+                            } = ${this.value(value)}\n`
+                        )
+                        .join("")
+                }        ${this.ter(block.ter)}\n`
+            )
+            .join("");
+    }
+
+    private value(value: Value): string {
+        const k = value.kind;
+        const r = (value: Value) => `%${value.id}`;
+        const addr = (addr: Addr) =>
+            `[${r(addr.base)}${
+                addr.index ? ` + ${r(addr.index)} * ${addr.stride}` : ""
+            } + ${addr.offset}]`;
+        switch (k.tag) {
+            case "const":
+                switch (k.val.tag) {
+                    case "int":
+                        return `${k.val.val}`;
+                    case "str":
+                        return JSON.stringify(k.val.val);
+                    case "fn":
+                        return `fn #${k.val.stmt.id}`;
+                }
+                break;
+            case "param":
+                return `param %${k.local.id}`;
+            case "undef":
+                return "undef";
+            case "phi":
+                return `phi ${k.args.map(r).join(", ")}`;
+            case "binary":
+                return `${k.op} ${r(k.left)}, ${r(k.right)}`;
+            case "call":
+                return `call ${r(k.callee)}(${k.args.map(r).join(", ")})`;
+            case "load_mem":
+                return `load_mem ${addr(k.addr)}`;
+            case "store_mem":
+                return `store_mem ${addr(k.addr)}, ${r(k.val)}`;
+        }
+    }
+
+    private ter(ter: SsaTer): string {
+        switch (ter.tag) {
+            case "return":
+                return `return %${ter.val.id}`;
+            case "goto":
+                return `goto .b${ter.target.id}`;
+            case "if":
+                return `if %${ter.cond.id} .b${ter.truthy.id}, .b${
+                    ter.falsy.id
+                }`;
+        }
+    }
+}
@@ -0,0 +1,436 @@
+import * as lir from "./lir.ts";
+
+// Registers preserved across calls, which values live across a call must be
+// kept in.
+export const calleeSavedRegs = ["rbx", "r12", "r13", "r14", "r15"];
+// Registers clobbered by calls. These are preferred for values which are not
+// live across a call, since they don't have to be saved in the prologue.
+export const callerSavedRegs = ["rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9"];
+// Registers never allocated, which spilled values are loaded into.
+export const scratchRegs = ["r10", "r11"];
+// System V argument registers. Further arguments are passed on the stack.
+export const argRegs = ["rdi", "rsi", "rdx", "rcx", "r8", "r9"];
+// Registers clobbered by division, which `idiv` divides and returns in.
+export const divisionRegs = ["rax", "rdx"];
+
+// Registers of the target machine the allocator assigns values to.
+export type TargetRegs = {
+    calleeSaved: string[];
+    callerSaved: string[];
+    args: string[];
+    // Register results are returned in.
+    ret: string;
+    division: string[];
+};
+
+export const x86Regs: TargetRegs = {
+    calleeSaved: calleeSavedRegs,
+    callerSaved: callerSavedRegs,
+    args: argRegs,
+    ret: "rax",
+    division: divisionRegs,
+};
+
+export type RegAllocation = {
+    // Registers of the values kept in registers. Every other value is
+    // spilled to its stack slot.
+    regs: Map<lir.Reg, string>;
+    // Callee saved registers in use, which must be saved in the prologue.
+    usedCalleeSaved: string[];
+};
+
+type Interval = {
+    reg: lir.Reg;
+    start: number;
+    end: number;
+    weight: number;
+    crossesCall: boolean;
+    crossesDivision: boolean;
+    // Register the value is passed in or returned in, which is preferred
+    // to save moves.
+    hint?: string;
+};
+
+// Linear scan register allocation over a function body.
+//
+// Stack locals (params and locals) and temporaries are all treated as values.
+// Each value gets a single live interval spanning every point it's live at,
+// in line order. Position `2 * i` is where line `i` reads its operands and
+// `2 * i + 1` where it writes its result, so a value used for the last time
+// on a line can share its register with the value the line defines.
+export class RegAlloc {
+    private uses: lir.Reg[][] = [];
+    private defs: lir.Reg[][] = [];
+    private liveIn: Set<lir.Reg>[] = [];
+    private liveOut: Set<lir.Reg>[] = [];
+    private loopDepths: number[] = [];
+
+    public constructor(
+        private lines: lir.Line[],
+        private entry: lir.Label,
+        private paramRegs: lir.Reg[],
+        private returnReg: lir.Reg,
+        private target: TargetRegs = x86Regs,
+    ) {}
+
+    public allocate(): RegAllocation {
+        for (const { ins } of this.lines) {
+            this.uses.push(insUses(ins, this.returnReg));
+            this.defs.push(insDefs(ins));
+        }
+        this.computeLiveness();
+        this.computeLoopDepths();
+        return this.linearScan(this.intervals());
+    }
+
+    private computeLiveness() {
+        const succs = lineSuccessors(this.lines);
+        this.liveIn = this.lines.map(() => new Set());
+        this.liveOut = this.lines.map(() => new Set());
+
+        let changed = true;
+        while (changed) {
+            changed = false;
+            for (let i = this.lines.length - 1; i >= 0; --i) {
+                const liveOut = this.liveOut[i];
+                for (const succ of succs[i]) {
+                    for (const reg of this.liveIn[succ]) {
+                        liveOut.add(reg);
+                    }
+                }
+                const liveIn = new Set(this.uses[i]);
+                for (const reg of liveOut) {
+                    if (!this.defs[i].includes(reg)) {
+                        liveIn.add(reg);
+                    }
+                }
+                if (liveIn.size !== this.liveIn[i].size) {
+                    this.liveIn[i] = liveIn;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Lines enclosed by a backward jump are counted as a loop, which is exact
+    // for the loops lowered from `while` and `loop`.
+    private computeLoopDepths() {
+        const labelLines = this.labelLines();
+        this.loopDepths = this.lines.map(() => 0);
+        for (const [i, { ins }] of this.lines.entries()) {
+            if (ins.tag !== "jmp" && ins.tag !== "jnz_reg") {
+                continue;
+            }
+            const target = labelLines.get(ins.target)!;
+            for (let j = target; j <= i; ++j) {
+                this.loopDepths[j] += 1;
+            }
+        }
+    }
+
+    private intervals(): Interval[] {
+        const intervals = new Map<lir.Reg, Interval>();
+        const cover = (reg: lir.Reg, pos: number) => {
+            const interval = intervals.get(reg);
+            if (!interval) {
+                intervals.set(reg, {
+                    reg,
+                    start: pos,
+                    end: pos,
+                    weight: 0,
+                    crossesCall: false,
+                    crossesDivision: false,
+                });
+                return;
+            }
+            interval.start = Math.min(interval.start, pos);
+            interval.end = Math.max(interval.end, pos);
+        };
+
+        // Params are loaded in the prologue, before the first line.
+        const entryLine = this.labelLines().get(this.entry) ?? 0;
+        for (const reg of this.paramRegs) {
+            if (this.liveIn[entryLine]?.has(reg)) {
+                cover(reg, -1);
+            }
+        }
+        const hints = new Map<lir.Reg, string>();
+        const { args } = this.target;
+        for (const [i, reg] of this.paramRegs.entries()) {
+            if (i < args.length) {
+                hints.set(reg, args[i]);
+            }
+        }
+        for (const { ins } of this.lines) {
+            if (ins.tag === "call_reg" || ins.tag === "call_imm") {
+                for (const [i, reg] of ins.args.entries()) {
+                    if (i < args.length) {
+                        hints.set(reg, args[i]);
+                    }
+                }
+                hints.set(ins.dst, this.target.ret);
+            }
+        }
+
+        for (let i = 0; i < this.lines.length; ++i) {
+            for (const reg of this.liveIn[i]) {
+                cover(reg, 2 * i);
+            }
+            for (const reg of this.uses[i]) {
+                cover(reg, 2 * i);
+            }
+            for (const reg of this.defs[i]) {
+                cover(reg, 2 * i + 1);
+            }
+            for (const reg of this.liveOut[i]) {
+                cover(reg, 2 * i + 1);
+            }
+
+            const weight = 10 ** Math.min(this.loopDepths[i], 6);
+            for (const reg of [...this.uses[i], ...this.defs[i]]) {
+                intervals.get(reg)!.weight += weight;
+            }
+
+            const ins = this.lines[i].ins;
+            for (const reg of this.liveOut[i]) {
+                if (this.defs[i].includes(reg)) {
+                    continue;
+                }
+                const interval = intervals.get(reg)!;
+                interval.crossesCall ||= ins.tag === "call_reg" ||
+                    ins.tag === "call_imm";
+                interval.crossesDivision ||= isDivision(ins);
+            }
+        }
+
+        for (const [reg, hint] of hints) {
+            const interval = intervals.get(reg);
+            if (interval) {
+                interval.hint = hint;
+            }
+        }
+
+        return intervals
+            .values()
+            .toArray()
+            .toSorted((a, b) => a.start - b.start || a.reg - b.reg);
+    }
+
+    private linearScan(intervals: Interval[]): RegAllocation {
+        const { calleeSaved, callerSaved, division } = this.target;
+        const regs = new Map<lir.Reg, string>();
+        const usedCalleeSaved = new Set<string>();
+        const free = new Set([...callerSaved, ...calleeSaved]);
+        let active: Interval[] = [];
+
+        for (const current of intervals) {
+            for (const interval of active) {
+                if (interval.end < current.start) {
+                    free.add(regs.get(interval.reg)!);
+                }
+            }
+            active = active.filter((interval) =>
+                interval.end >= current.start
+            );
+
+            const candidates = (current.crossesCall
+                ? calleeSaved
+                : [...callerSaved, ...calleeSaved])
+                .filter((reg) =>
+                    !current.crossesDivision || !division.includes(reg)
+                );
+
+            let sel = current.hint && candidates.includes(current.hint) &&
+                    free.has(current.hint)
+                ? current.hint
+                : candidates.find((reg) => free.has(reg));
+            if (sel) {
+                free.delete(sel);
+            } else {
+                // Spills the cheapest of the values competing for the
+                // registers, preferring the one live the longest.
+                const victim = active
+                    .filter((interval) =>
+                        candidates.includes(regs.get(interval.reg)!)
+                    )
+                    .toSorted((a, b) => a.weight - b.weight || b.end - a.end)
+                    .at(0);
+                if (
+                    !victim ||
+                    victim.weight > current.weight ||
+                    victim.weight === current.weight &&
+                        victim.end <= current.end
+                ) {
+                    continue;
+                }
+                sel = regs.get(victim.reg)!;
+                regs.delete(victim.reg);
+                active = active.filter((interval) => interval !== victim);
+            }
+
+            regs.set(current.reg, sel);
+            active.push(current);
+            if (calleeSaved.includes(sel)) {
+                usedCalleeSaved.add(sel);
+            }
+        }
+
+        return {
+            regs,
+            usedCalleeSaved: calleeSaved
+                .filter((reg) => usedCalleeSaved.has(reg)),
+        };
+    }
+
+    private labelLines(): Map<lir.Label, number> {
+        return labelLines(this.lines);
+    }
+}
+
+function labelLines(lines: lir.Line[]): Map<lir.Label, number> {
+    const labelLines = new Map<lir.Label, number>();
+    for (const [i, line] of lines.entries()) {
+        for (const label of line.labels) {
+            labelLines.set(label, i);
+        }
+    }
+    return labelLines;
+}
+
+// Indices of the lines each line may continue at.
+export function lineSuccessors(lines: lir.Line[]): number[][] {
+    const labels = labelLines(lines);
+    return lines.map(({ ins }, i) => {
+        const next = i + 1 < lines.length ? [i + 1] : [];
+        switch (ins.tag) {
+            case "jmp":
+                return [labels.get(ins.target)!];
+            case "jnz_reg":
+                return [labels.get(ins.target)!, ...next];
+            case "ret":
+                return [];
+            default:
+                return next;
+        }
+    });
+}
+
+function insUses(ins: lir.Ins, returnReg: lir.Reg): lir.Reg[] {
+    switch (ins.tag) {
+        case "error":
+        case "nop":
+        case "alloc_param":
+        case "alloc_local":
+        case "mov_int":
+        case "mov_string":
+        case "mov_fn":
+            return [];
+        case "push":
+            return [ins.reg];
+        case "pop":
+            return [];
+        case "load":
+            return [ins.sReg];
+        case "store_reg":
+            return [ins.reg];
+        case "store_imm":
+            return [];
+        case "load_mem":
+            return addrRegs(ins.addr);
+        case "store_mem":
+            return [...addrRegs(ins.addr), ins.reg];
+        case "call_reg":
+            return [ins.reg, ...ins.args];
+        case "call_imm":
+            return ins.args;
+        case "jmp":
+            return [];
+        case "jnz_reg":
+            return [ins.reg];
+        case "ret":
+            // The return value is read at the exit.
+            return [returnReg];
+        case "lt":
+        case "gt":
+        case "le":
+        case "ge":
+        case "eq":
+        case "ne":
+        case "add":
+        case "sub":
+        case "mul":
+        case "div":
+        case "mod":
+            return [ins.dst, ins.src];
+        case "div_imm":
+        case "mod_imm":
+            return [ins.dst];
+        case "kill":
+            return [];
+    }
+}
+
+function insDefs(ins: lir.Ins): lir.Reg[] {
+    switch (ins.tag) {
+        case "error":
+        case "nop":
+        case "alloc_param":
+        case "alloc_local":
+            return [];
+        case "mov_int":
+        case "mov_string":
+        case "mov_fn":
+            return [ins.reg];
+        case "push":
+            return [];
+        case "pop":
+        case "load":
+            return [ins.reg];
+        case "store_reg":
+        case "store_imm":
+            return [ins.sReg];
+        case "load_mem":
+            return [ins.reg];
+        case "store_mem":
+            return [];
+        case "call_reg":
+        case "call_imm":
+            return [ins.dst];
+        case "jmp":
+        case "jnz_reg":
+        case "ret":
+            return [];
+        case "lt":
+        case "gt":
+        case "le":
+        case "ge":
+        case "eq":
+        case "ne":
+        case "add":
+        case "sub":
+        case "mul":
+        case "div":
+        case "mod":
+        case "div_imm":
+        case "mod_imm":
+            return [ins.dst];
+        case "kill":
+            return [];
+    }
+}
+
+export function addrRegs(addr: lir.Addr): lir.Reg[] {
+    return addr.index !== undefined ? [addr.base, addr.index] : [addr.base];
+}
+
+function isDivision(ins: lir.Ins): boolean {
+    switch (ins.tag) {
+        case "div":
+        case "mod":
+        case "div_imm":
+        case "mod_imm":
+            return true;
+        default:
+            return false;
+    }
+}
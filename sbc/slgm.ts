@@ -0,0 +1,124 @@
+import { Bytes, StringTable } from "./elf.ts";
+
+// Section kinds, as `ModuleSectionKind` in `slige/runtime/src/module.h`.
+const sectionCode = 1;
+const sectionRoData = 2;
+const sectionStrings = 3;
+const sectionFunctions = 4;
+const sectionRelocs = 5;
+const sectionImports = 6;
+
+const moduleMagic = "SLGM";
+const moduleVersion = 1;
+const headerSize = 24;
+const sectionHeaderSize = 24;
+
+// Writes a module for the Slige runtime, in the format described in
+// `slige/runtime/src/module.h`. The runtime maps the module and runs its
+// code in place, with the addresses of read-only data patched into the
+// instructions through relocations.
+export class SlgmWriter {
+    // Instructions, in 32-bit words.
+    public code: number[] = [];
+    private roData = new Bytes();
+    private strings = new StringTable();
+    private functions = new Bytes();
+    private relocs = new Bytes();
+    private imports = new Map<string, number>();
+    private functionCount = 0;
+    private entry = 0;
+
+    // Function starting at `word`, which the host calls by `name`.
+    public fn(name: string, word: number, isEntry: boolean) {
+        if (isEntry) {
+            this.entry = this.functionCount;
+        }
+        this.functions.u32(this.strings.add(name));
+        this.functions.u32(word);
+        this.functionCount += 1;
+    }
+
+    // String constant in the read-only data, 8-byte aligned and preceded by
+    // its length, as sbc strings are laid out. Returns its offset.
+    public string(val: string): number {
+        this.roData.align(8);
+        const offset = this.roData.bytes.length;
+        const bytes = new TextEncoder().encode(val);
+        this.roData.u64(BigInt(bytes.length));
+        this.roData.append(bytes);
+        return offset;
+    }
+
+    // Adds the address of the read-only data to the `%i64` immediate of the
+    // instruction at `word`.
+    public roDataReloc(word: number) {
+        this.relocs.u32(word);
+        this.relocs.u32(sectionRoData);
+    }
+
+    // Index of the host function imported by `name`.
+    public import(name: string): number {
+        const existing = this.imports.get(name);
+        if (existing !== undefined) {
+            return existing;
+        }
+        const index = this.imports.size;
+        this.imports.set(name, index);
+        return index;
+    }
+
+    public finalize(): Uint8Array {
+        const code = new Bytes();
+        for (const word of this.code) {
+            code.u32(word);
+        }
+        const imports = new Bytes();
+        for (const name of this.imports.keys()) {
+            imports.u32(this.strings.add(name));
+        }
+
+        // The string table is added last, since the other sections add
+        // their names to it.
+        const sections = [
+            { kind: sectionCode, bytes: code },
+            { kind: sectionRoData, bytes: this.roData },
+            { kind: sectionFunctions, bytes: this.functions },
+            { kind: sectionRelocs, bytes: this.relocs },
+            { kind: sectionImports, bytes: imports },
+            { kind: sectionStrings, bytes: this.strings.bytes },
+        ].filter(({ kind, bytes }) =>
+            kind === sectionCode || kind === sectionStrings ||
+            bytes.bytes.length !== 0
+        );
+
+        let offset = headerSize + sections.length * sectionHeaderSize;
+        const offsets = sections.map(({ bytes }) => {
+            const sectionOffset = offset;
+            offset = align8(offset + bytes.bytes.length);
+            return sectionOffset;
+        });
+        const fileSize = offset;
+
+        const out = new Bytes();
+        out.append(new TextEncoder().encode(moduleMagic));
+        out.u16(moduleVersion);
+        out.u16(0);
+        out.u32(sections.length);
+        out.u32(this.entry);
+        out.u64(BigInt(fileSize));
+        for (const [i, { kind, bytes }] of sections.entries()) {
+            out.u32(kind);
+            out.u32(0);
+            out.u64(BigInt(offsets[i]));
+            out.u64(BigInt(bytes.bytes.length));
+        }
+        for (const { bytes } of sections) {
+            out.append(bytes.bytes);
+            out.align(8);
+        }
+        return new Uint8Array(out.bytes);
+    }
+}
+
+const align8 = (value: number): number =>
+    value % 8 === 0 ? value : value + (8 - value % 8);
@@ -7,7 +7,22 @@ export type Ty =
     | { tag: "int" }
     | { tag: "str" }
     | { tag: "ptr"; ty: Ty }
-    | { tag: "fn"; stmt: ast.Stmt; params: Ty[]; returnTy: Ty };
+    | { tag: "fn"; stmt: ast.Stmt; params: Ty[]; returnTy: Ty }
+    | { tag: "struct"; stmt: ast.Stmt } & StructLayout;
+
+// Fields are laid out like the equivalent C struct, so that structs can be
+// shared with C code through pointers.
+export type StructLayout = {
+    fields: StructField[];
+    size: number;
+    align: number;
+};
+
+export type StructField = {
+    ident: string;
+    ty: Ty;
+    offset: number;
+};
 
 type TyToStringOpts = {
     short?: boolean;
@@ -27,6 +42,10 @@ export function tyToString(ty: Ty, opts: TyToStringOpts = {}): string {
             return `str`;
         case "ptr":
             return `*${tyToString(ty.ty)}`;
+        case "struct": {
+            const k = ty.stmt.kind as ast.StmtKind & { tag: "struct" };
+            return k.ident;
+        }
         case "fn": {
             if (!opts.short) {
                 const k = ty.stmt.kind as ast.StmtKind & { tag: "fn" };
@@ -48,3 +67,30 @@ export function tyToString(ty: Ty, opts: TyToStringOpts = {}): string {
         }
     }
 }
+
+// Size and alignment of values of the type, or undefined for types which
+// have no values in memory.
+export function tyLayout(ty: Ty): { size: number; align: number } | undefined {
+    switch (ty.tag) {
+        case "error":
+        case "unknown":
+        case "void":
+        case "str":
+            return undefined;
+        case "int":
+        case "ptr":
+        case "fn":
+            return { size: 8, align: 8 };
+        case "struct":
+            return { size: ty.size, align: ty.align };
+    }
+}
+
+// Field of a struct, or of the struct pointed to.
+export function structField(ty: Ty, ident: string): StructField | undefined {
+    const structTy = ty.tag === "ptr" ? ty.ty : ty;
+    if (structTy.tag !== "struct") {
+        return undefined;
+    }
+    return structTy.fields.find((field) => field.ident === ident);
+}
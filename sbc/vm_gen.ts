@@ -0,0 +1,789 @@
+import { insRegs } from "./asm_gen.ts";
+import { AttrView } from "./attr.ts";
+import * as lir from "./lir.ts";
+import { RegAlloc, RegAllocation, TargetRegs } from "./reg_alloc.ts";
+import { SlgmWriter } from "./slgm.ts";
+
+// Ops in the encoding order of `VM_OP_LIST` in `slige/runtime/src/vm.h`,
+// which this must be kept in sync with. The float ops following them aren't
+// generated.
+const ops = [
+    "Nop",
+    "Halt",
+    "Builtin",
+    "Call",
+    "CallI",
+    "Ret",
+    "Alloca",
+    "Jmp",
+    "Jnz",
+    "Jz",
+    "Load8",
+    "LoadI8",
+    "LoadA8",
+    "Load16",
+    "LoadI16",
+    "LoadA16",
+    "Load32",
+    "LoadI32",
+    "LoadA32",
+    "Load64",
+    "LoadI64",
+    "LoadA64",
+    "LoadF",
+    "LoadIF",
+    "LoadAF",
+    "Store8",
+    "StoreA8",
+    "Store16",
+    "StoreA16",
+    "Store32",
+    "StoreA32",
+    "Store64",
+    "StoreA64",
+    "StoreF",
+    "StoreAF",
+    "LoadImm32",
+    "LoadImm64",
+    "LoadImmF",
+    "LoadSb",
+    "LoadSp",
+    "MovII",
+    "MovIF",
+    "MovFI",
+    "MovFF",
+    "Push",
+    "Pop",
+    "PushF",
+    "PopF",
+    "Eq",
+    "Ne",
+    "Lt",
+    "Gt",
+    "Lte",
+    "Gte",
+    "And",
+    "Or",
+    "Xor",
+    "Add",
+    "Sub",
+    "Mul",
+    "Div",
+    "Rem",
+    "IMul",
+    "IDiv",
+    "EqI",
+    "NeI",
+    "LtI",
+    "GtI",
+    "LteI",
+    "GteI",
+    "AndI",
+    "OrI",
+    "XorI",
+    "AddI",
+    "SubI",
+    "RSubI",
+    "MulI",
+    "DivI",
+    "RemI",
+    "IMulI",
+    "IDivI",
+] as const;
+
+type Op = typeof ops[number];
+
+// `Builtin_HostCall` in `slige/runtime/src/vm.h`, which calls the host
+// function imported at the index in `%ireg` 1 with the arguments from
+// `%ireg` 2 and up.
+const builtinHostCall = 9;
+// `HOST_ARGS` in `slige/runtime/src/vm.h`.
+const hostArgs = 6;
+
+const ireg = (index: number): string => `%${index}`;
+const iregIndex = (reg: string): number => Number(reg.slice(1));
+const iregRange = (start: number, end: number): string[] =>
+    Array.from({ length: end - start }, (_, i) => ireg(start + i));
+
+// Arguments are passed in `%ireg` 1 and up, and results returned in `%ireg`
+// 0, as the embedding API calls functions, so that exported functions can be
+// called by the host directly. The registers are shared by every frame, so
+// the rest of them are split into caller and callee saved registers, as for
+// native code.
+const vmRegs: TargetRegs = {
+    calleeSaved: iregRange(16, 26),
+    callerSaved: iregRange(0, 16),
+    args: iregRange(1, 16),
+    ret: ireg(0),
+    division: [],
+};
+// Registers never allocated, which spilled values are loaded into.
+const scratchRegs = [26, 27, 28, 29];
+// Holds 1, so that `LoadA64` and `StoreA64`, which scale an index register,
+// can address memory at a constant offset from a base register.
+const oneReg = 30;
+// Holds the stack base of the current frame, which stack slots are addressed
+// from. It's reloaded after calls, which change it.
+const frameReg = 31;
+
+const signBit = 1n << 63n;
+
+// Operand of a value, which is either a register or a stack slot at an
+// offset in bytes from the frame base.
+type Loc = { tag: "reg"; reg: number } | { tag: "slot"; offset: number };
+
+const regLoc = (reg: number): Loc => ({ tag: "reg", reg });
+
+// Generates bytecode for the Slige VM, as a module for the runtime in
+// `slige/runtime`.
+export class VmGen {
+    private writer = new SlgmWriter();
+    private stringOffsets = new Map<number, number>();
+    private fnWords = new Map<lir.Fn, number>();
+    // Immediates holding the word offset of a function.
+    private fnFixups: { word: number; fn: lir.Fn }[] = [];
+
+    private regs!: RegAllocation;
+    private slots = new Map<lir.Reg, number>();
+    private savedSlots = new Map<string, number>();
+    private frameSize = 0;
+    private labelWords = new Map<lir.Label | "exit", number>();
+    private labelFixups: { word: number; label: lir.Label | "exit" }[] = [];
+
+    public constructor(
+        private lir: lir.Program,
+    ) {}
+
+    public generate(): Uint8Array {
+        for (const [id, val] of this.lir.strings) {
+            this.stringOffsets.set(id, this.writer.string(val));
+        }
+
+        const exported = this.lir.fns
+            .find((fn) => this.queryCExport(fn).found);
+        for (const fn of this.lir.fns) {
+            this.generateFn(fn, fn === exported);
+        }
+
+        for (const { word, fn } of this.fnFixups) {
+            this.code[word] = this.fnWords.get(fn)!;
+        }
+        return this.writer.finalize();
+    }
+
+    private get code(): number[] {
+        return this.writer.code;
+    }
+
+    // C functions are imported from the host. The first exported function
+    // is run by the runtime.
+    private generateFn(fn: lir.Fn, isEntry: boolean) {
+        if (this.queryCFunction(fn).found) {
+            return;
+        }
+        const cExportQuery = this.queryCExport(fn);
+        const name = cExportQuery.found ? cExportQuery.label : fn.label;
+        this.writer.fn(name, this.code.length, isEntry);
+        this.fnWords.set(fn, this.code.length);
+
+        this.generateFnBody(fn);
+    }
+
+    private queryCFunction(
+        fn: lir.Fn,
+    ): { found: false } | { found: true; label: string } {
+        const attrs = AttrView.fromStmt(fn.mir.stmt);
+        if (attrs.has("c_function")) {
+            const attr = attrs.get("c_function");
+            if (attr.args !== 1 || !attr.isStr(0)) {
+                throw new Error("incorrect args for attribute");
+            }
+            const label = attr.strVal(0);
+            return { found: true, label };
+        }
+        return { found: false };
+    }
+
+    private queryCExport(
+        fn: lir.Fn,
+    ): { found: false } | { found: true; label: string } {
+        const attrs = AttrView.fromStmt(fn.mir.stmt);
+        if (attrs.has("c_export")) {
+            const attr = attrs.get("c_export");
+            if (attr.args !== 1 || !attr.isStr(0)) {
+                throw new Error("incorrect args for attribute");
+            }
+            const label = attr.strVal(0);
+            return { found: true, label };
+        }
+        return { found: false };
+    }
+
+    private generateFnBody(fn: lir.Fn) {
+        let bodyIdx = 0;
+        const params: lir.Reg[] = [];
+        const sizes = new Map<lir.Reg, number>();
+        for (const [i, { ins }] of fn.lines.entries()) {
+            if (ins.tag === "alloc_param") {
+                params.push(ins.reg);
+                sizes.set(ins.reg, ins.size);
+            } else if (ins.tag === "alloc_local") {
+                sizes.set(ins.reg, ins.size);
+            } else {
+                bodyIdx = i;
+                break;
+            }
+        }
+        if (params.length > vmRegs.args.length) {
+            throw new Error(`too many parameters in '${fn.label}'`);
+        }
+        const body = fn.lines.slice(bodyIdx);
+        const returnReg = fn.localRegs.get(fn.mir.returnLocal.id)!;
+
+        this.regs = new RegAlloc(
+            body,
+            fn.mir.entry.id,
+            params,
+            returnReg,
+            vmRegs,
+        ).allocate();
+
+        // Spilled values and saved registers get a stack slot in the frame,
+        // which starts at the stack base.
+        this.slots = new Map();
+        this.savedSlots = new Map();
+        this.frameSize = 0;
+        const regs = [
+            ...params,
+            ...body.flatMap(({ ins }) => insRegs(ins)),
+        ];
+        for (const reg of regs) {
+            if (!this.slots.has(reg) && !this.regs.regs.has(reg)) {
+                this.slots.set(reg, this.frameSize * 8);
+                this.frameSize += Math.ceil((sizes.get(reg) ?? 8) / 8);
+            }
+        }
+        for (const reg of this.regs.usedCalleeSaved) {
+            this.savedSlots.set(reg, this.frameSize * 8);
+            this.frameSize += 1;
+        }
+
+        this.labelWords = new Map();
+        this.labelFixups = [];
+
+        if (this.frameSize !== 0) {
+            this.insI32("Alloca", {}, this.frameSize);
+            this.ins("LoadSb", { dst: frameReg });
+        }
+        // The function may be called by the host, which doesn't set it.
+        this.insI32("LoadImm32", { dst: oneReg }, 1);
+        for (const reg of this.regs.usedCalleeSaved) {
+            this.storeSlot(this.savedSlots.get(reg)!, iregIndex(reg));
+        }
+        this.parallelMove(
+            params.map((reg, i) => ({
+                dst: this.operand(reg),
+                src: regLoc(iregIndex(vmRegs.args[i])),
+            })),
+        );
+        this.jump("Jmp", fn.mir.entry.id);
+
+        for (const line of body) {
+            for (const label of line.labels) {
+                this.labelWords.set(label, this.code.length);
+            }
+            this.generateIns(line.ins);
+        }
+
+        this.labelWords.set("exit", this.code.length);
+        this.parallelMove([{
+            dst: regLoc(0),
+            src: this.operand(returnReg),
+        }]);
+        for (const reg of this.regs.usedCalleeSaved) {
+            this.loadSlot(iregIndex(reg), this.savedSlots.get(reg)!);
+        }
+        // `Ret` frees the frame.
+        this.ins("Ret");
+
+        for (const { word, label } of this.labelFixups) {
+            this.code[word] = this.labelWords.get(label)!;
+        }
+    }
+
+    private generateIns(ins: lir.Ins) {
+        const [dstScratch, srcScratch, tmpScratch] = scratchRegs;
+
+        switch (ins.tag) {
+            case "error":
+                throw new Error();
+            case "nop":
+                this.ins("Nop");
+                return;
+            case "alloc_param":
+            case "alloc_local":
+                // Handled elsewhere.
+                return;
+            case "mov_int": {
+                const dst = this.def(ins.reg, dstScratch);
+                this.loadImm(dst, BigInt(ins.val));
+                this.writeBack(ins.reg, dst);
+                return;
+            }
+            case "mov_string": {
+                const dst = this.def(ins.reg, dstScratch);
+                this.writer.roDataReloc(this.code.length);
+                this.insI64(
+                    "LoadImm64",
+                    { dst },
+                    BigInt(this.stringOffsets.get(ins.stringId)!),
+                );
+                this.writeBack(ins.reg, dst);
+                return;
+            }
+            case "mov_fn": {
+                if (this.queryCFunction(ins.fn).found) {
+                    throw new Error(
+                        `C function '${ins.fn.label}' can only be called`,
+                    );
+                }
+                const dst = this.def(ins.reg, dstScratch);
+                this.fnFixups.push({ word: this.code.length + 1, fn: ins.fn });
+                this.insI32("LoadImm32", { dst }, 0);
+                this.writeBack(ins.reg, dst);
+                return;
+            }
+            case "push":
+                this.ins("Push", { left: this.use(ins.reg, dstScratch) });
+                return;
+            case "pop": {
+                const dst = this.def(ins.reg, dstScratch);
+                this.ins("Pop", { dst });
+                this.writeBack(ins.reg, dst);
+                return;
+            }
+            case "load":
+                this.move(ins.reg, ins.sReg);
+                return;
+            case "store_reg":
+                this.move(ins.sReg, ins.reg);
+                return;
+            case "store_imm": {
+                const dst = this.def(ins.sReg, dstScratch);
+                this.loadImm(dst, BigInt(ins.val));
+                this.writeBack(ins.sReg, dst);
+                return;
+            }
+            case "load_mem": {
+                const { base, index, incr } = this.address(ins.addr);
+                const dst = this.def(ins.reg, dstScratch);
+                if (index === undefined) {
+                    this.ins("Load64", { dst, left: base });
+                } else {
+                    this.insI32(
+                        "LoadA64",
+                        { dst, left: base, right: index },
+                        incr,
+                    );
+                }
+                this.writeBack(ins.reg, dst);
+                return;
+            }
+            case "store_mem": {
+                const { base, index, incr } = this.address(ins.addr);
+                const [, , , valScratch] = scratchRegs;
+                const src = this.use(ins.reg, valScratch);
+                if (index === undefined) {
+                    this.ins("Store64", { dst: base, left: src });
+                } else {
+                    this.insI32(
+                        "StoreA64",
+                        { dst: base, left: src, right: index },
+                        incr,
+                    );
+                }
+                return;
+            }
+            case "call_reg":
+            case "call_imm":
+                this.generateCall(ins);
+                return;
+            case "jmp":
+                this.jump("Jmp", ins.target);
+                return;
+            case "jnz_reg":
+                this.jump("Jnz", ins.target, this.use(ins.reg, dstScratch));
+                return;
+            case "ret":
+                this.jump("Jmp", "exit");
+                return;
+            case "eq":
+            case "ne": {
+                const dst = this.use(ins.dst, dstScratch);
+                const src = this.use(ins.src, srcScratch);
+                const op = ins.tag === "eq" ? "Eq" : "Ne";
+                this.ins(op, { dst, left: dst, right: src });
+                this.writeBack(ins.dst, dst);
+                return;
+            }
+            case "lt":
+            case "gt":
+            case "le":
+            case "ge": {
+                // The VM compares unsigned. Flipping the sign bits of both
+                // operands maps the signed order onto the unsigned one.
+                const op = ({
+                    "lt": "Lt",
+                    "gt": "Gt",
+                    "le": "Lte",
+                    "ge": "Gte",
+                } as const)[ins.tag];
+                const dst = this.use(ins.dst, dstScratch);
+                const src = this.use(ins.src, srcScratch);
+                this.insI64("LoadImm64", { dst: tmpScratch }, signBit);
+                this.ins("Xor", {
+                    dst: srcScratch,
+                    left: src,
+                    right: tmpScratch,
+                });
+                this.ins("Xor", { dst, left: dst, right: tmpScratch });
+                this.ins(op, { dst, left: dst, right: srcScratch });
+                this.writeBack(ins.dst, dst);
+                return;
+            }
+            case "add":
+            case "sub":
+            case "mul":
+            case "div": {
+                // The low 64 bits of a product are the same signed and
+                // unsigned.
+                const op = ({
+                    "add": "Add",
+                    "sub": "Sub",
+                    "mul": "Mul",
+                    "div": "IDiv",
+                } as const)[ins.tag];
+                const dst = this.use(ins.dst, dstScratch);
+                const src = this.use(ins.src, srcScratch);
+                this.ins(op, { dst, left: dst, right: src });
+                this.writeBack(ins.dst, dst);
+                return;
+            }
+            case "mod": {
+                // There is no signed remainder, so it's computed from the
+                // quotient, which rounds towards zero as for `idiv`.
+                const dst = this.use(ins.dst, dstScratch);
+                const src = this.use(ins.src, srcScratch);
+                this.ins("IDiv", { dst: tmpScratch, left: dst, right: src });
+                this.ins("Mul", {
+                    dst: tmpScratch,
+                    left: tmpScratch,
+                    right: src,
+                });
+                this.ins("Sub", { dst, left: dst, right: tmpScratch });
+                this.writeBack(ins.dst, dst);
+                return;
+            }
+            case "div_imm":
+            case "mod_imm":
+                this.generateDivImm(ins);
+                return;
+            case "kill":
+                // Liveness is computed by the register allocator.
+                return;
+        }
+        const _: never = ins;
+    }
+
+    // Divisors fitting the zero-extended `%i32` of `IDivI` are divided by
+    // directly. Other divisors are loaded into a register first.
+    private generateDivImm(ins: lir.Ins & { tag: "div_imm" | "mod_imm" }) {
+        const [dstScratch, srcScratch, tmpScratch] = scratchRegs;
+        const dst = this.use(ins.dst, dstScratch);
+        const quotient = ins.tag === "div_imm" ? dst : tmpScratch;
+        if (fitsImm(BigInt(ins.val))) {
+            this.insI32("IDivI", { dst: quotient, left: dst }, ins.val);
+            if (ins.tag === "mod_imm") {
+                this.insI32(
+                    "MulI",
+                    { dst: quotient, left: quotient },
+                    ins.val,
+                );
+                this.ins("Sub", { dst, left: dst, right: quotient });
+            }
+        } else {
+            this.loadImm(srcScratch, BigInt(ins.val));
+            this.ins("IDiv", { dst: quotient, left: dst, right: srcScratch });
+            if (ins.tag === "mod_imm") {
+                this.ins("Mul", {
+                    dst: quotient,
+                    left: quotient,
+                    right: srcScratch,
+                });
+                this.ins("Sub", { dst, left: dst, right: quotient });
+            }
+        }
+        this.writeBack(ins.dst, dst);
+    }
+
+    // Calls sbc functions with `CallI` or `Call`, and C functions through
+    // the host, with `Builtin_HostCall`.
+    private generateCall(ins: lir.Ins & { tag: "call_reg" | "call_imm" }) {
+        const [, srcScratch] = scratchRegs;
+        const cFunctionQuery = ins.tag === "call_imm"
+            ? this.queryCFunction(ins.fn)
+            : { found: false as const };
+        const args = cFunctionQuery.found
+            ? iregRange(2, 2 + hostArgs)
+            : vmRegs.args;
+        if (ins.args.length > args.length) {
+            throw new Error("too many arguments");
+        }
+
+        // The target is moved aside, if it's in a register the arguments
+        // are moved into.
+        let target: number | undefined;
+        if (ins.tag === "call_reg") {
+            const sel = this.regs.regs.get(ins.reg);
+            if (sel !== undefined && !args.includes(sel)) {
+                target = iregIndex(sel);
+            } else if (sel !== undefined) {
+                this.ins("MovII", { dst: srcScratch, left: iregIndex(sel) });
+                target = srcScratch;
+            }
+        }
+        this.parallelMove(
+            ins.args.map((arg, i) => ({
+                dst: regLoc(iregIndex(args[i])),
+                src: this.operand(arg),
+            })),
+        );
+
+        if (cFunctionQuery.found) {
+            const index = this.writer.import(cFunctionQuery.label);
+            this.insI32("LoadImm32", { dst: 1 }, index);
+            this.insI32("Builtin", {}, builtinHostCall);
+        } else {
+            if (ins.tag === "call_reg") {
+                if (target === undefined) {
+                    target = this.use(ins.reg, srcScratch);
+                }
+                this.ins("Call", { left: target });
+            } else {
+                this.fnFixups.push({ word: this.code.length + 1, fn: ins.fn });
+                this.insI32("CallI", {}, 0);
+            }
+            if (this.frameSize !== 0) {
+                this.ins("LoadSb", { dst: frameReg });
+            }
+        }
+
+        this.parallelMove([{
+            dst: this.operand(ins.dst),
+            src: regLoc(0),
+        }]);
+    }
+
+    // Emits moves which read every source before writing any destination.
+    // A move may be between a register and a stack slot, but not between
+    // two stack slots.
+    private parallelMove(moves: { dst: Loc; src: Loc }[]) {
+        const pending = moves.filter(({ dst, src }) => !sameLoc(dst, src));
+        // Stack slots aren't read by any of the moves.
+        for (const { dst, src } of pending) {
+            if (dst.tag === "slot" && src.tag === "reg") {
+                this.storeSlot(dst.offset, src.reg);
+            }
+        }
+        let regMoves = pending.flatMap(({ dst, src }) =>
+            dst.tag === "reg" ? [{ dst: dst.reg, src }] : []
+        );
+
+        while (regMoves.length > 0) {
+            const ready = regMoves.find(({ dst }) =>
+                !regMoves.some(({ src }) =>
+                    src.tag === "reg" && src.reg === dst
+                )
+            );
+            if (ready) {
+                this.moveTo(ready.dst, ready.src);
+                regMoves = regMoves.filter((move) => move !== ready);
+                continue;
+            }
+            // The remaining moves form cycles, one of which is broken by
+            // moving a destination aside.
+            const [scratch] = scratchRegs;
+            const { dst } = regMoves[0];
+            this.ins("MovII", { dst: scratch, left: dst });
+            regMoves = regMoves.map((move) =>
+                move.src.tag === "reg" && move.src.reg === dst
+                    ? { ...move, src: regLoc(scratch) }
+                    : move
+            );
+        }
+    }
+
+    private moveTo(dst: number, src: Loc) {
+        if (src.tag === "reg") {
+            this.ins("MovII", { dst, left: src.reg });
+        } else {
+            this.loadSlot(dst, src.offset);
+        }
+    }
+
+    // Registers and the `%i32` scale addressing `addr` with `LoadA64` or
+    // `StoreA64`, or only a base register for `Load64` and `Store64`. The
+    // base is loaded into the first scratch register if spilled, the index
+    // into the second, and the base plus the offset into the third.
+    private address(
+        addr: lir.Addr,
+    ): { base: number; index?: number; incr: number } {
+        const [baseScratch, indexScratch, offsetScratch] = scratchRegs;
+        let base = this.use(addr.base, baseScratch);
+        if (addr.index === undefined) {
+            if (addr.offset === 0) {
+                return { base, incr: 0 };
+            }
+            if (fitsImm(BigInt(addr.offset))) {
+                return { base, index: oneReg, incr: addr.offset };
+            }
+            this.loadImm(indexScratch, BigInt(addr.offset));
+            return { base, index: indexScratch, incr: 1 };
+        }
+        if (!fitsImm(BigInt(addr.stride))) {
+            throw new Error(`unsupported stride ${addr.stride}`);
+        }
+        const index = this.use(addr.index, indexScratch);
+        if (addr.offset !== 0) {
+            if (fitsImm(BigInt(addr.offset))) {
+                this.insI32(
+                    "AddI",
+                    { dst: offsetScratch, left: base },
+                    addr.offset,
+                );
+            } else {
+                this.loadImm(offsetScratch, BigInt(addr.offset));
+                this.ins("Add", {
+                    dst: offsetScratch,
+                    left: base,
+                    right: offsetScratch,
+                });
+            }
+            base = offsetScratch;
+        }
+        return { base, index, incr: addr.stride };
+    }
+
+    private operand(reg: lir.Reg): Loc {
+        const sel = this.regs.regs.get(reg);
+        if (sel !== undefined) {
+            return regLoc(iregIndex(sel));
+        }
+        return { tag: "slot", offset: this.slot(reg) };
+    }
+
+    // Register holding `reg`, which is loaded into `scratch` if spilled.
+    private use(reg: lir.Reg, scratch: number): number {
+        const sel = this.regs.regs.get(reg);
+        if (sel !== undefined) {
+            return iregIndex(sel);
+        }
+        this.loadSlot(scratch, this.slot(reg));
+        return scratch;
+    }
+
+    // Register to write `reg` to, which is written back with `writeBack`.
+    private def(reg: lir.Reg, scratch: number): number {
+        const sel = this.regs.regs.get(reg);
+        return sel !== undefined ? iregIndex(sel) : scratch;
+    }
+
+    private writeBack(reg: lir.Reg, sel: number) {
+        if (!this.regs.regs.has(reg)) {
+            this.storeSlot(this.slot(reg), sel);
+        }
+    }
+
+    private move(dst: lir.Reg, src: lir.Reg) {
+        const dstLoc = this.operand(dst);
+        const srcLoc = this.operand(src);
+        if (dstLoc.tag === "reg") {
+            if (!sameLoc(dstLoc, srcLoc)) {
+                this.moveTo(dstLoc.reg, srcLoc);
+            }
+            return;
+        }
+        const [scratch] = scratchRegs;
+        this.storeSlot(dstLoc.offset, this.use(src, scratch));
+    }
+
+    private slot(reg: lir.Reg): number {
+        const offset = this.slots.get(reg);
+        if (offset === undefined) {
+            throw new Error("not found");
+        }
+        return offset;
+    }
+
+    private loadSlot(dst: number, offset: number) {
+        this.insI32(
+            "LoadA64",
+            { dst, left: frameReg, right: oneReg },
+            offset,
+        );
+    }
+
+    private storeSlot(offset: number, src: number) {
+        this.insI32(
+            "StoreA64",
+            { dst: frameReg, left: src, right: oneReg },
+            offset,
+        );
+    }
+
+    // Loads a 64-bit value with the shortest encoding.
+    private loadImm(dst: number, val: bigint) {
+        if (fitsImm(val)) {
+            this.insI32("LoadImm32", { dst }, Number(val));
+        } else {
+            this.insI64("LoadImm64", { dst }, val);
+        }
+    }
+
+    private jump(op: "Jmp" | "Jnz", label: lir.Label | "exit", left = 0) {
+        this.labelFixups.push({ word: this.code.length + 1, label });
+        this.insI32(op, { left }, 0);
+    }
+
+    // Instruction header, as laid out in `slige/runtime/src/vm.h`: the op
+    // in the lowest byte, then the destination, right and left registers.
+    private ins(op: Op, { dst = 0, left = 0, right = 0 }: Operands = {}) {
+        const header = ops.indexOf(op) | dst << 8 | right << 16 | left << 24;
+        this.code.push(header >>> 0);
+    }
+
+    // Instruction with a `%i32` immediate, or a jump target.
+    private insI32(op: Op, operands: Operands, imm: number) {
+        if (!fitsImm(BigInt(imm))) {
+            throw new Error(`immediate ${imm} out of range`);
+        }
+        this.ins(op, operands);
+        this.code.push(imm);
+    }
+
+    // Instruction with a `%i64` immediate, which is stored little endian.
+    private insI64(op: Op, operands: Operands, imm: bigint) {
+        const val = BigInt.asUintN(64, imm);
+        this.ins(op, operands);
+        this.code.push(Number(val & 0xffffffffn), Number(val >> 32n));
+    }
+}
+
+type Operands = { dst?: number; left?: number; right?: number };
+
+// Whether `val` fits an immediate, which is a zero-extended `%i32`.
+const fitsImm = (val: bigint): boolean => val >= 0n && val < 1n << 32n;
+
+const sameLoc = (a: Loc, b: Loc): boolean =>
+    a.tag === "reg" && b.tag === "reg" && a.reg === b.reg ||
+    a.tag === "slot" && b.tag === "slot" && a.offset === b.offset;
@@ -0,0 +1,463 @@
+// Encoder for the x86-64 instructions `AsmGen` generates, which are given in
+// the NASM syntax it writes. Only 64-bit operations, with the exception of
+// `setcc` and `movzx` reading the low byte of a register, are supported.
+
+export type Operand =
+    | { tag: "reg"; reg: number; byte: boolean }
+    | { tag: "imm"; val: bigint }
+    | { tag: "mem"; base?: number; index?: number; scale: number; disp: number }
+    | { tag: "sym"; name: string };
+
+// Reference to a symbol in an encoded instruction, which is filled in when
+// the symbol's address is known. `rel32` is relative to the end of the
+// instruction, which every `rel32` field is the last part of.
+export type Fixup = {
+    offset: number;
+    kind: "rel32" | "abs64";
+    sym: string;
+};
+
+export type Encoded = {
+    bytes: number[];
+    fixups: Fixup[];
+    // Opcode of the form of a jump taking an 8-bit displacement instead,
+    // for targets close enough.
+    shortOpcode?: number[];
+};
+
+const regs64 = [
+    "rax",
+    "rcx",
+    "rdx",
+    "rbx",
+    "rsp",
+    "rbp",
+    "rsi",
+    "rdi",
+    "r8",
+    "r9",
+    "r10",
+    "r11",
+    "r12",
+    "r13",
+    "r14",
+    "r15",
+];
+
+const regs8 = [
+    "al",
+    "cl",
+    "dl",
+    "bl",
+    "spl",
+    "bpl",
+    "sil",
+    "dil",
+    "r8b",
+    "r9b",
+    "r10b",
+    "r11b",
+    "r12b",
+    "r13b",
+    "r14b",
+    "r15b",
+];
+
+// `/digit` opcode extensions and opcodes of the arithmetic instructions,
+// `rm` being the form writing to the r/m operand, `r` the one writing to
+// the register, and `acc` the one taking `rax` and a 32-bit immediate.
+type AluOp = { ext: number; rm: number; r: number; acc: number };
+const aluOps: Record<string, AluOp> = {
+    "add": { ext: 0, rm: 0x01, r: 0x03, acc: 0x05 },
+    "and": { ext: 4, rm: 0x21, r: 0x23, acc: 0x25 },
+    "sub": { ext: 5, rm: 0x29, r: 0x2b, acc: 0x2d },
+    "cmp": { ext: 7, rm: 0x39, r: 0x3b, acc: 0x3d },
+};
+
+const shiftExts: Record<string, number> = {
+    "shl": 4,
+    "shr": 5,
+    "sar": 7,
+};
+
+const unaryExts: Record<string, number> = {
+    "neg": 3,
+    "imul": 5,
+    "idiv": 7,
+};
+
+const conditionCodes: Record<string, number> = {
+    "e": 0x4,
+    "ne": 0x5,
+    "l": 0xc,
+    "ge": 0xd,
+    "le": 0xe,
+    "g": 0xf,
+};
+
+export function parseOperand(text: string): Operand {
+    text = text.trim();
+    if (regs64.includes(text)) {
+        return { tag: "reg", reg: regs64.indexOf(text), byte: false };
+    }
+    if (regs8.includes(text)) {
+        return { tag: "reg", reg: regs8.indexOf(text), byte: true };
+    }
+    if (/^-?\d+$/.test(text)) {
+        return { tag: "imm", val: BigInt(text) };
+    }
+    const mem = /^(?:QWORD\s+)?\[(.*)\]$/.exec(text);
+    if (mem) {
+        return parseMem(mem[1]);
+    }
+    if (/^[\w.]+$/.test(text)) {
+        return { tag: "sym", name: text };
+    }
+    throw new Error(`unsupported operand '${text}'`);
+}
+
+// Parses `base+index*scale+disp`, in which every part is optional.
+function parseMem(text: string): Operand & { tag: "mem" } {
+    const mem: Operand & { tag: "mem" } = { tag: "mem", scale: 1, disp: 0 };
+    for (const [, sign, term] of text.matchAll(/([+-]?)\s*([^+-]+)/g)) {
+        const [name, scale] = term.trim().split("*");
+        if (/^\d+$/.test(name)) {
+            mem.disp += (sign === "-" ? -1 : 1) * Number(name);
+            continue;
+        }
+        const reg = regs64.indexOf(name);
+        if (reg === -1 || sign === "-") {
+            throw new Error(`unsupported address '${text}'`);
+        }
+        if (mem.base === undefined && scale === undefined) {
+            mem.base = reg;
+        } else if (mem.index === undefined) {
+            mem.index = reg;
+            mem.scale = Number(scale ?? 1);
+        } else {
+            throw new Error(`unsupported address '${text}'`);
+        }
+    }
+    return mem;
+}
+
+// Encodes one instruction, written as `mnemonic op, op, ...`.
+export function encodeIns(text: string): Encoded {
+    const match = /^(\w+)\s*(.*)$/.exec(text.trim());
+    if (!match) {
+        throw new Error(`unsupported instruction '${text}'`);
+    }
+    const [, mnemonic, rest] = match;
+    const operands = rest === "" ? [] : rest.split(",").map(parseOperand);
+    return new Encoder(mnemonic, operands, text).encode();
+}
+
+class Encoder {
+    private bytes: number[] = [];
+    private fixups: Fixup[] = [];
+    private shortOpcode?: number[];
+
+    public constructor(
+        private mnemonic: string,
+        private ops: Operand[],
+        private text: string,
+    ) {}
+
+    public encode(): Encoded {
+        this.encodeIns();
+        return {
+            bytes: this.bytes,
+            fixups: this.fixups,
+            shortOpcode: this.shortOpcode,
+        };
+    }
+
+    private encodeIns() {
+        const m = this.mnemonic;
+        const [a, b, c] = this.ops;
+        const n = this.ops.length;
+        if (n === 0) {
+            const bytes = ({
+                "ret": [0xc3],
+                "nop": [0x90],
+                "cqo": [0x48, 0x99],
+            } as Record<string, number[]>)[m];
+            if (!bytes) {
+                this.unsupported();
+            }
+            this.bytes.push(...bytes);
+            return;
+        }
+        switch (m) {
+            case "mov":
+                return this.encodeMov(a, b);
+            case "movzx":
+                if (isReg(a) && !a.byte && isReg(b) && b.byte) {
+                    return this.modrm([0x0f, 0xb6], a.reg, b);
+                }
+                break;
+            case "lea":
+                if (isReg(a) && b?.tag === "mem") {
+                    return this.modrm([0x8d], a.reg, b);
+                }
+                break;
+            case "push":
+            case "pop":
+                if (n !== 1) {
+                    break;
+                }
+                if (isReg(a)) {
+                    this.rex(false, 0, 0, a.reg);
+                    this.bytes.push((m === "push" ? 0x50 : 0x58) | a.reg & 7);
+                    return;
+                }
+                if (a.tag === "mem") {
+                    return m === "push"
+                        ? this.modrm([0xff], 6, a, false)
+                        : this.modrm([0x8f], 0, a, false);
+                }
+                break;
+            case "call":
+                if (n === 1 && a.tag === "sym") {
+                    return this.rel32([0xe8], a.name);
+                }
+                if (n === 1 && (isReg(a) || a.tag === "mem")) {
+                    return this.modrm([0xff], 2, a, false);
+                }
+                break;
+            case "jmp":
+                if (n === 1 && a.tag === "sym") {
+                    this.shortOpcode = [0xeb];
+                    return this.rel32([0xe9], a.name);
+                }
+                break;
+            case "imul":
+                if (n === 1 && isRm(a)) {
+                    return this.modrm([0xf7], unaryExts[m], a);
+                }
+                if (n === 2 && isReg(a) && isRm(b)) {
+                    return this.modrm([0x0f, 0xaf], a.reg, b);
+                }
+                if (n === 3 && isReg(a) && isRm(b) && c.tag === "imm") {
+                    if (isInt8(c.val)) {
+                        this.modrm([0x6b], a.reg, b);
+                        return this.imm(c.val, 1);
+                    }
+                    this.modrm([0x69], a.reg, b);
+                    return this.imm32(c.val);
+                }
+                break;
+        }
+        if (m in aluOps && n === 2) {
+            return this.encodeAlu(aluOps[m], a, b);
+        }
+        if (m in unaryExts && n === 1 && isRm(a)) {
+            return this.modrm([0xf7], unaryExts[m], a);
+        }
+        if (m in shiftExts && n === 2 && isRm(a) && b.tag === "imm") {
+            if (b.val === 1n) {
+                return this.modrm([0xd1], shiftExts[m], a);
+            }
+            this.modrm([0xc1], shiftExts[m], a);
+            return this.imm(b.val, 1);
+        }
+        if (m.startsWith("set") && n === 1 && isReg(a) && a.byte) {
+            const cc = conditionCodes[m.slice(3)];
+            if (cc !== undefined) {
+                return this.modrm([0x0f, 0x90 | cc], 0, a, false);
+            }
+        }
+        if (m.startsWith("j") && n === 1 && a.tag === "sym") {
+            const cc = conditionCodes[m.slice(1)];
+            if (cc !== undefined) {
+                this.shortOpcode = [0x70 | cc];
+                return this.rel32([0x0f, 0x80 | cc], a.name);
+            }
+        }
+        this.unsupported();
+    }
+
+    private encodeMov(dst: Operand, src: Operand) {
+        // Moves between registers use the form writing to the r/m operand,
+        // as NASM does.
+        if (isRm(dst) && isReg(src)) {
+            return this.modrm([0x89], src.reg, dst);
+        }
+        if (isReg(dst) && src?.tag === "mem") {
+            return this.modrm([0x8b], dst.reg, src);
+        }
+        if (isReg(dst) && src?.tag === "imm") {
+            // Picks the shortest encoding, as NASM does. Writing the 32-bit
+            // register clears the upper half.
+            if (src.val >= 0n && src.val < 1n << 32n) {
+                this.rex(false, 0, 0, dst.reg);
+                this.bytes.push(0xb8 | dst.reg & 7);
+                return this.imm(src.val, 4);
+            }
+            if (isInt32(src.val)) {
+                this.modrm([0xc7], 0, dst);
+                return this.imm(src.val, 4);
+            }
+            this.rex(true, 0, 0, dst.reg);
+            this.bytes.push(0xb8 | dst.reg & 7);
+            return this.imm(src.val, 8);
+        }
+        if (dst.tag === "mem" && src?.tag === "imm") {
+            this.modrm([0xc7], 0, dst);
+            return this.imm32(src.val);
+        }
+        if (isReg(dst) && src?.tag === "sym") {
+            this.rex(true, 0, 0, dst.reg);
+            this.bytes.push(0xb8 | dst.reg & 7);
+            this.fixups.push({
+                offset: this.bytes.length,
+                kind: "abs64",
+                sym: src.name,
+            });
+            return this.imm(0n, 8);
+        }
+        this.unsupported();
+    }
+
+    private encodeAlu(op: AluOp, dst: Operand, src: Operand) {
+        if (isRm(dst) && isReg(src)) {
+            return this.modrm([op.rm], src.reg, dst);
+        }
+        if (isReg(dst) && src.tag === "mem") {
+            return this.modrm([op.r], dst.reg, src);
+        }
+        if (isRm(dst) && src.tag === "imm") {
+            if (isInt8(src.val)) {
+                this.modrm([0x83], op.ext, dst);
+                return this.imm(src.val, 1);
+            }
+            if (isReg(dst) && dst.reg === 0) {
+                this.rex(true, 0, 0, 0);
+                this.bytes.push(op.acc);
+                return this.imm32(src.val);
+            }
+            this.modrm([0x81], op.ext, dst);
+            return this.imm32(src.val);
+        }
+        this.unsupported();
+    }
+
+    // Emits `opcode` with a ModRM byte, and SIB byte and displacement if
+    // needed, encoding `reg` and the register or memory operand `rm`.
+    // Operands are 64-bit if `wide`.
+    private modrm(
+        opcode: number[],
+        reg: number,
+        rm: Operand,
+        wide = true,
+    ) {
+        if (rm.tag === "reg") {
+            // Without a REX prefix, byte registers 4 through 7 are the high
+            // bytes `ah` through `bh` instead of `spl` through `dil`.
+            const forceRex = rm.byte && rm.reg >= 4;
+            this.rex(wide, reg, 0, rm.reg, forceRex);
+            this.bytes.push(...opcode, 0xc0 | (reg & 7) << 3 | rm.reg & 7);
+            return;
+        }
+        if (rm.tag !== "mem") {
+            this.unsupported();
+        }
+        const scaleBits = { 1: 0, 2: 1, 4: 2, 8: 3 }[rm.scale];
+        if (scaleBits === undefined || rm.index === 4) {
+            this.unsupported();
+        }
+        // Index 4 in the SIB byte means no index.
+        const index = rm.index ?? 4;
+        if (rm.base === undefined) {
+            // Base 5 with mod 0 means no base, but a 32-bit displacement.
+            this.rex(wide, reg, index, 0);
+            this.bytes.push(
+                ...opcode,
+                (reg & 7) << 3 | 4,
+                scaleBits << 6 | (index & 7) << 3 | 5,
+            );
+            return this.imm(BigInt(rm.disp), 4);
+        }
+        const base = rm.base;
+        // `rbp` and `r13` as base without displacement mean no base, so
+        // they're given a zero displacement.
+        const mod = rm.disp === 0 && (base & 7) !== 5
+            ? 0
+            : isInt8(BigInt(rm.disp))
+            ? 1
+            : 2;
+        this.rex(wide, reg, index, base);
+        this.bytes.push(...opcode);
+        // `rsp` and `r12` as base require a SIB byte.
+        if (rm.index !== undefined || (base & 7) === 4) {
+            this.bytes.push(
+                mod << 6 | (reg & 7) << 3 | 4,
+                scaleBits << 6 | (index & 7) << 3 | base & 7,
+            );
+        } else {
+            this.bytes.push(mod << 6 | (reg & 7) << 3 | base & 7);
+        }
+        if (mod === 1) {
+            this.imm(BigInt(rm.disp), 1);
+        } else if (mod === 2) {
+            this.imm(BigInt(rm.disp), 4);
+        }
+    }
+
+    private rex(
+        wide: boolean,
+        reg: number,
+        index: number,
+        base: number,
+        force = false,
+    ) {
+        const rex = 0x40 | (wide ? 8 : 0) | (reg >> 3 & 1) << 2 |
+            (index >> 3 & 1) << 1 | base >> 3 & 1;
+        if (rex !== 0x40 || force) {
+            this.bytes.push(rex);
+        }
+    }
+
+    private rel32(opcode: number[], sym: string) {
+        this.bytes.push(...opcode);
+        this.fixups.push({ offset: this.bytes.length, kind: "rel32", sym });
+        this.imm(0n, 4);
+    }
+
+    // Immediates are sign extended from 32 bits by 64-bit operations.
+    private imm32(val: bigint) {
+        if (!isInt32(val)) {
+            throw new Error(
+                `immediate out of range in '${this.text.trim()}'`,
+            );
+        }
+        this.imm(val, 4);
+    }
+
+    private imm(val: bigint, size: number) {
+        this.bytes.push(...littleEndian(val, size));
+    }
+
+    private unsupported(): never {
+        throw new Error(`unsupported instruction '${this.text.trim()}'`);
+    }
+}
+
+const isReg = (op: Operand | undefined): op is Operand & { tag: "reg" } =>
+    op?.tag === "reg";
+const isRm = (
+    op: Operand | undefined,
+): op is Operand & { tag: "reg" | "mem" } =>
+    op?.tag === "reg" && !op.byte || op?.tag === "mem";
+
+const isInt8 = (val: bigint): boolean => val >= -128n && val < 128n;
+const isInt32 = (val: bigint): boolean =>
+    val >= -(1n << 31n) && val < 1n << 31n;
+
+export function littleEndian(val: bigint, size: number): number[] {
+    const bytes: number[] = [];
+    for (let i = 0; i < size; ++i) {
+        bytes.push(Number(BigInt.asUintN(8, val >> BigInt(8 * i))));
+    }
+    return bytes;
+}
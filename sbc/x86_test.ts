@@ -0,0 +1,124 @@
+import { assertEquals } from "jsr:@std/assert";
+import { encodeIns } from "./x86.ts";
+
+// Encodings of the instructions `AsmGen` generates, as assembled by
+// `nasm -f elf64`, so that object files written directly match the ones
+// assembled from the `NasmWriter` output.
+const nasm: [string, string][] = [
+    ["mov rbp, rsp", "48 89 e5"],
+    ["mov rax, rbx", "48 89 d8"],
+    ["mov r12, rax", "49 89 c4"],
+    ["mov rax, r15", "4c 89 f8"],
+    ["mov rax, QWORD [rbp-8]", "48 8b 45 f8"],
+    ["mov r13, QWORD [rbp+16]", "4c 8b 6d 10"],
+    ["mov rdx, QWORD [rbp-200]", "48 8b 95 38 ff ff ff"],
+    ["mov rcx, QWORD [rsi+rdi*8+8]", "48 8b 4c fe 08"],
+    ["mov rax, QWORD [r12]", "49 8b 04 24"],
+    ["mov rax, QWORD [r13]", "49 8b 45 00"],
+    ["mov QWORD [rbp-8], rax", "48 89 45 f8"],
+    ["mov QWORD [rax+rcx*8], r14", "4c 89 34 c8"],
+    ["mov QWORD [r13], rdi", "49 89 7d 00"],
+    ["mov QWORD [rsp+8], rax", "48 89 44 24 08"],
+    ["mov QWORD [rbp-8], 0", "48 c7 45 f8 00 00 00 00"],
+    ["mov rax, 0", "b8 00 00 00 00"],
+    ["mov rcx, 1000", "b9 e8 03 00 00"],
+    ["mov r9, 5", "41 b9 05 00 00 00"],
+    ["mov r9, -1", "49 c7 c1 ff ff ff ff"],
+    ["mov rax, 4294967295", "b8 ff ff ff ff"],
+    ["mov rax, -2147483648", "48 c7 c0 00 00 00 80"],
+    ["mov rdx, 9223372036854775807", "48 ba ff ff ff ff ff ff ff 7f"],
+    ["mov rax, -6148914691236517205", "48 b8 ab aa aa aa aa aa aa aa"],
+    ["movzx rax, al", "48 0f b6 c0"],
+    ["movzx rsi, sil", "48 0f b6 f6"],
+    ["movzx r8, r8b", "4d 0f b6 c0"],
+    ["lea rcx, [rsi+rsi*2]", "48 8d 0c 76"],
+    ["lea rax, [rdi*8]", "48 8d 04 fd 00 00 00 00"],
+    ["lea rdx, [rbp-16]", "48 8d 55 f0"],
+    ["lea r11, [r12+r13*4+24]", "4f 8d 5c ac 18"],
+    ["push rbp", "55"],
+    ["push r12", "41 54"],
+    ["push QWORD [rbp-24]", "ff 75 e8"],
+    ["pop rbp", "5d"],
+    ["pop r15", "41 5f"],
+    ["pop QWORD [rbp-24]", "8f 45 e8"],
+    ["call rax", "ff d0"],
+    ["call r11", "41 ff d3"],
+    ["imul rcx", "48 f7 e9"],
+    ["imul rax, rbx", "48 0f af c3"],
+    ["imul r10, QWORD [rbp-8]", "4c 0f af 55 f8"],
+    ["imul rcx, rsi, 24", "48 6b ce 18"],
+    ["imul rcx, rsi, 1000", "48 69 ce e8 03 00 00"],
+    ["add rsp, 16", "48 83 c4 10"],
+    ["sub rsp, 8", "48 83 ec 08"],
+    ["sub rsp, 4096", "48 81 ec 00 10 00 00"],
+    ["add rax, 1000", "48 05 e8 03 00 00"],
+    ["sub rax, 1000", "48 2d e8 03 00 00"],
+    ["cmp rax, 1000", "48 3d e8 03 00 00"],
+    ["and rax, -4096", "48 25 00 f0 ff ff"],
+    ["and rcx, -2147483648", "48 81 e1 00 00 00 80"],
+    ["and rax, -2", "48 83 e0 fe"],
+    ["add rdx, rcx", "48 01 ca"],
+    ["sub rcx, rdx", "48 29 d1"],
+    ["add r8, r9", "4d 01 c8"],
+    ["cmp rax, QWORD [rbp-8]", "48 3b 45 f8"],
+    ["add rax, QWORD [rbp-8]", "48 03 45 f8"],
+    ["sub rdx, QWORD [rbp+24]", "48 2b 55 18"],
+    ["cmp QWORD [rbp-8], 0", "48 83 7d f8 00"],
+    ["cmp rdi, 0", "48 83 ff 00"],
+    ["sar rdx, 1", "48 d1 fa"],
+    ["sar rax, 63", "48 c1 f8 3f"],
+    ["shr rax, 63", "48 c1 e8 3f"],
+    ["shr rcx, 62", "48 c1 e9 3e"],
+    ["shl rax, 1", "48 d1 e0"],
+    ["shl r10, 4", "49 c1 e2 04"],
+    ["idiv rcx", "48 f7 f9"],
+    ["idiv r11", "49 f7 fb"],
+    ["neg rax", "48 f7 d8"],
+    ["neg QWORD [rbp-8]", "48 f7 5d f8"],
+    ["sete al", "0f 94 c0"],
+    ["setne cl", "0f 95 c1"],
+    ["setl dl", "0f 9c c2"],
+    ["setge bl", "0f 9d c3"],
+    ["setle sil", "40 0f 9e c6"],
+    ["setg dil", "40 0f 9f c7"],
+    ["setl r8b", "41 0f 9c c0"],
+    ["setg r15b", "41 0f 9f c7"],
+    ["ret", "c3"],
+    ["nop", "90"],
+    ["cqo", "48 99"],
+];
+
+// Instructions referring to symbols are encoded with zeros in place of the
+// addresses, and the fixups filling them in.
+const nasmSym: [string, string, number, "rel32" | "abs64"][] = [
+    ["call sbc__main", "e8 00 00 00 00", 1, "rel32"],
+    ["jmp .L1", "e9 00 00 00 00", 1, "rel32"],
+    ["jne .L1", "0f 85 00 00 00 00", 2, "rel32"],
+    ["mov rax, sbc__string_0", "48 b8 00 00 00 00 00 00 00 00", 2, "abs64"],
+    ["mov r12, sbc__main", "49 bc 00 00 00 00 00 00 00 00", 2, "abs64"],
+];
+
+function hex(bytes: number[]): string {
+    return bytes.map((byte) => byte.toString(16).padStart(2, "0")).join(" ");
+}
+
+Deno.test("encode instructions as nasm does", () => {
+    for (const [ins, bytes] of nasm) {
+        const encoded = encodeIns(ins);
+        assertEquals(hex(encoded.bytes), bytes, ins);
+        assertEquals(encoded.fixups, [], ins);
+    }
+});
+
+Deno.test("encode symbol references", () => {
+    for (const [ins, bytes, offset, kind] of nasmSym) {
+        const encoded = encodeIns(ins);
+        const sym = ins.slice(ins.lastIndexOf(" ") + 1);
+        assertEquals(hex(encoded.bytes), bytes, ins);
+        assertEquals(encoded.fixups, [{ offset, kind, sym }], ins);
+    }
+    // Jumps to close targets take an 8-bit displacement.
+    assertEquals(encodeIns("jmp .L1").shortOpcode, [0xeb]);
+    assertEquals(encodeIns("jne .L1").shortOpcode, [0x75]);
+    assertEquals(encodeIns("call sbc__main").shortOpcode, undefined);
+});
@@ -0,0 +1 @@
+export * from "./vm_gen.ts";
@@ -0,0 +1,122 @@
+// Section kinds, as `ModuleSectionKind` in `slige/runtime/src/module.h`.
+const sectionCode = 1;
+const sectionStrings = 3;
+const sectionFunctions = 4;
+
+const moduleMagic = "SLGM";
+const moduleVersion = 1;
+const headerSize = 24;
+const sectionHeaderSize = 24;
+
+// Writes a module for the Slige runtime, in the format described in
+// `slige/runtime/src/module.h`.
+export class ModuleWriter {
+    // Instructions, in 32-bit words.
+    public code: number[] = [];
+    private strings = new Bytes();
+    private stringOffsets = new Map<string, number>();
+    private functions = new Bytes();
+    private functionCount = 0;
+    private entry = 0;
+
+    public constructor() {
+        // The string table starts with an empty string.
+        this.strings.u8(0);
+    }
+
+    // Function starting at `word`, which the host calls by `name`.
+    public fn(name: string, word: number, isEntry: boolean) {
+        if (isEntry) {
+            this.entry = this.functionCount;
+        }
+        this.functions.u32(this.string(name));
+        this.functions.u32(word);
+        this.functionCount += 1;
+    }
+
+    private string(val: string): number {
+        const existing = this.stringOffsets.get(val);
+        if (existing !== undefined) {
+            return existing;
+        }
+        const offset = this.strings.bytes.length;
+        this.strings.append(new TextEncoder().encode(val));
+        this.strings.u8(0);
+        this.stringOffsets.set(val, offset);
+        return offset;
+    }
+
+    public finalize(): Uint8Array {
+        const code = new Bytes();
+        for (const word of this.code) {
+            code.u32(word);
+        }
+        const sections = [
+            { kind: sectionCode, bytes: code },
+            { kind: sectionFunctions, bytes: this.functions },
+            { kind: sectionStrings, bytes: this.strings },
+        ];
+
+        let offset = headerSize + sections.length * sectionHeaderSize;
+        const offsets = sections.map(({ bytes }) => {
+            const sectionOffset = offset;
+            offset = align8(offset + bytes.bytes.length);
+            return sectionOffset;
+        });
+        const fileSize = offset;
+
+        const out = new Bytes();
+        out.append(new TextEncoder().encode(moduleMagic));
+        out.u16(moduleVersion);
+        out.u16(0);
+        out.u32(sections.length);
+        out.u32(this.entry);
+        out.u64(BigInt(fileSize));
+        for (const [i, { kind, bytes }] of sections.entries()) {
+            out.u32(kind);
+            out.u32(0);
+            out.u64(BigInt(offsets[i]));
+            out.u64(BigInt(bytes.bytes.length));
+        }
+        for (const { bytes } of sections) {
+            out.append(bytes.bytes);
+            out.align(8);
+        }
+        return new Uint8Array(out.bytes);
+    }
+}
+
+class Bytes {
+    public bytes: number[] = [];
+
+    public u8(val: number) {
+        this.bytes.push(val & 0xff);
+    }
+    public u16(val: number) {
+        this.littleEndian(BigInt(val), 2);
+    }
+    public u32(val: number) {
+        this.littleEndian(BigInt(val), 4);
+    }
+    public u64(val: bigint) {
+        this.littleEndian(val, 8);
+    }
+    public append(bytes: ArrayLike<number>) {
+        for (let i = 0; i < bytes.length; ++i) {
+            this.bytes.push(bytes[i]);
+        }
+    }
+    public align(alignment: number) {
+        while (this.bytes.length % alignment !== 0) {
+            this.bytes.push(0);
+        }
+    }
+    private littleEndian(val: bigint, size: number) {
+        for (let i = 0; i < size; ++i) {
+            this.u8(Number(val >> BigInt(i * 8) & 0xffn));
+        }
+    }
+}
+
+const align8 = (value: number): number =>
+    value % 8 === 0 ? value : value + (8 - value % 8);
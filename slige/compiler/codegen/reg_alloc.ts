@@ -0,0 +1,363 @@
+import { lir } from "@slige/middle";
+import {
+    isConstDef,
+    rvalLocals,
+    successors,
+    terLocals,
+    Value,
+    value,
+} from "./ssa.ts";
+
+export type RegClass = "int" | "float";
+
+// Location of a value, which is either a register of its class or a stack
+// slot at an offset in bytes from the frame base.
+export type Loc =
+    | { tag: "reg"; cls: RegClass; reg: number }
+    | { tag: "slot"; cls: RegClass; offset: number };
+
+export type RegLoc = Loc & { tag: "reg" };
+
+// Registers of a class, which are allocated preferring caller saved
+// registers, except for values live across calls, which only get callee
+// saved registers.
+export type TargetRegs = {
+    callerSaved: number[];
+    calleeSaved: number[];
+};
+
+export type RegAllocation = {
+    locs: Map<Value, Loc>;
+    // Callee saved registers allocated, which the function saves.
+    usedCalleeSaved: RegLoc[];
+    // Stack slots of spilled values, in 8-byte words.
+    slots: number;
+};
+
+type Interval = {
+    local: lir.LocalId;
+    cls: RegClass;
+    start: number;
+    end: number;
+    crossesCall: boolean;
+    hint?: number;
+};
+
+// Linear scan register allocation over a function in SSA form, as left by
+// `simplify`. Blocks are laid out in order, and every value gets a single
+// interval spanning every position it's live at, so that a value keeps its
+// location throughout the function. Phis and parameters are defined at the
+// start of their block, and the sources of phis are read at the end of the
+// branching blocks, where they're moved into the phis.
+//
+// Constants get no location, since they're loaded where they're read.
+//
+// When registers run out, the value whose interval ends last is spilled to
+// a stack slot for its whole lifetime.
+export class RegAlloc {
+    private blockStarts = new Map<number, number>();
+    private blockEnds = new Map<number, number>();
+    private stmtPositions = new Map<lir.Stmt, number>();
+    private calls: number[] = [];
+    private consts = new Set<Value>();
+    // Phis and their sources, which are preferably given the same register,
+    // so that no move is needed between them.
+    private related = new Map<Value, Value[]>();
+
+    public constructor(
+        private order: lir.Block[],
+        private target: Record<RegClass, TargetRegs>,
+        private localClass: (local: lir.LocalId) => RegClass,
+        // Registers preferred for values, such as the registers parameters
+        // are passed in.
+        private hints: Map<Value, number>,
+    ) {}
+
+    public allocate(): RegAllocation {
+        for (const block of this.order) {
+            for (const { kind } of block.stmts) {
+                if (kind.tag !== "assign") {
+                    continue;
+                }
+                if (isConstDef(kind.rval)) {
+                    this.consts.add(value(kind.local));
+                } else if (kind.rval.tag === "phi") {
+                    for (const { local } of kind.rval.sources) {
+                        this.relate(value(kind.local), value(local));
+                        this.relate(value(local), value(kind.local));
+                    }
+                }
+            }
+        }
+        this.numberPositions();
+        const intervals = this.buildIntervals();
+        return this.linearScan(intervals);
+    }
+
+    private relate(a: Value, b: Value) {
+        const related = this.related.get(a);
+        if (related) {
+            related.push(b);
+        } else {
+            this.related.set(a, [b]);
+        }
+    }
+
+    private numberPositions() {
+        let pos = 0;
+        for (const block of this.order) {
+            this.blockStarts.set(block.id.rawId, pos);
+            pos += 2;
+            for (const stmt of block.stmts) {
+                if (!isBlockStartDef(stmt)) {
+                    this.stmtPositions.set(stmt, pos);
+                    if (
+                        stmt.kind.tag === "assign" &&
+                        stmt.kind.rval.tag === "call"
+                    ) {
+                        this.calls.push(pos);
+                    }
+                    pos += 2;
+                }
+            }
+            this.blockEnds.set(block.id.rawId, pos);
+            pos += 2;
+        }
+    }
+
+    // Values live at the start and the end of every block.
+    private liveness(): {
+        liveIn: Map<number, Set<Value>>;
+        liveOut: Map<number, Set<Value>>;
+    } {
+        const blocks = new Map(this.order.map((b) => [b.id.rawId, b]));
+        const uses = new Map<number, Set<Value>>();
+        const defs = new Map<number, Set<Value>>();
+        for (const block of this.order) {
+            const blockUses = new Set<Value>();
+            const blockDefs = new Set<Value>();
+            const use = (locals: lir.LocalId[]) => {
+                for (const local of locals) {
+                    if (!blockDefs.has(value(local))) {
+                        blockUses.add(value(local));
+                    }
+                }
+            };
+            for (const { kind } of block.stmts) {
+                if (kind.tag === "assign") {
+                    use(rvalLocals(kind.rval));
+                    blockDefs.add(value(kind.local));
+                }
+            }
+            use(terLocals(block.ter));
+            uses.set(block.id.rawId, blockUses);
+            defs.set(block.id.rawId, blockDefs);
+        }
+
+        const liveIn = new Map(
+            this.order.map((b) => [b.id.rawId, new Set<Value>()]),
+        );
+        const liveOut = new Map(
+            this.order.map((b) => [b.id.rawId, new Set<Value>()]),
+        );
+        let changed = true;
+        while (changed) {
+            changed = false;
+            for (const block of this.order.toReversed()) {
+                const id = block.id.rawId;
+                const out = new Set<Value>();
+                for (const succId of successors(block)) {
+                    const succ = blocks.get(succId.rawId)!;
+                    const phis = new Set<Value>();
+                    for (const { kind } of succ.stmts) {
+                        if (kind.tag !== "assign" || kind.rval.tag !== "phi") {
+                            continue;
+                        }
+                        phis.add(value(kind.local));
+                        for (const { local, branch } of kind.rval.sources) {
+                            if (branch.rawId === id) {
+                                out.add(value(local));
+                            }
+                        }
+                    }
+                    for (const val of liveIn.get(succId.rawId)!) {
+                        if (!phis.has(val)) {
+                            out.add(val);
+                        }
+                    }
+                }
+                const in_ = new Set(uses.get(id)!);
+                for (const val of out) {
+                    if (!defs.get(id)!.has(val)) {
+                        in_.add(val);
+                    }
+                }
+                if (
+                    out.size !== liveOut.get(id)!.size ||
+                    in_.size !== liveIn.get(id)!.size
+                ) {
+                    changed = true;
+                }
+                liveOut.set(id, out);
+                liveIn.set(id, in_);
+            }
+        }
+        return { liveIn, liveOut };
+    }
+
+    private buildIntervals(): Interval[] {
+        const { liveIn, liveOut } = this.liveness();
+        const intervals = new Map<Value, Interval>();
+        const locals = new Map<Value, lir.LocalId>();
+        for (const block of this.order) {
+            for (const { kind } of block.stmts) {
+                if (kind.tag === "assign") {
+                    locals.set(value(kind.local), kind.local);
+                }
+            }
+        }
+        const touch = (val: Value, pos: number) => {
+            if (this.consts.has(val)) {
+                return;
+            }
+            const interval = intervals.get(val);
+            if (interval) {
+                interval.start = Math.min(interval.start, pos);
+                interval.end = Math.max(interval.end, pos);
+                return;
+            }
+            const local = locals.get(val)!;
+            intervals.set(val, {
+                local,
+                cls: this.localClass(local),
+                start: pos,
+                end: pos,
+                crossesCall: false,
+                hint: this.hints.get(val),
+            });
+        };
+
+        for (const block of this.order) {
+            const start = this.blockStarts.get(block.id.rawId)!;
+            const end = this.blockEnds.get(block.id.rawId)!;
+            for (const val of liveIn.get(block.id.rawId)!) {
+                touch(val, start);
+            }
+            for (const val of liveOut.get(block.id.rawId)!) {
+                touch(val, end);
+            }
+            for (const stmt of block.stmts) {
+                const k = stmt.kind;
+                if (k.tag !== "assign") {
+                    continue;
+                }
+                if (isBlockStartDef(stmt)) {
+                    touch(value(k.local), start);
+                    continue;
+                }
+                const pos = this.stmtPositions.get(stmt)!;
+                touch(value(k.local), pos);
+                for (const local of rvalLocals(k.rval)) {
+                    touch(value(local), pos);
+                }
+            }
+            for (const local of terLocals(block.ter)) {
+                touch(value(local), end);
+            }
+        }
+
+        for (const interval of intervals.values()) {
+            interval.crossesCall = this.calls
+                .some((pos) => interval.start < pos && pos < interval.end);
+        }
+        return intervals.values()
+            .toArray()
+            .toSorted((a, b) => a.start - b.start);
+    }
+
+    private linearScan(intervals: Interval[]): RegAllocation {
+        const locs = new Map<Value, Loc>();
+        const usedCalleeSaved = new Map<string, RegLoc>();
+        let slots = 0;
+        let active: Interval[] = [];
+
+        const regOf = (interval: Interval): number => {
+            const loc = locs.get(value(interval.local))!;
+            return loc.tag === "reg" ? loc.reg : -1;
+        };
+        const assign = (interval: Interval, reg: number) => {
+            const loc: RegLoc = { tag: "reg", cls: interval.cls, reg };
+            locs.set(value(interval.local), loc);
+            if (this.target[interval.cls].calleeSaved.includes(reg)) {
+                usedCalleeSaved.set(`${interval.cls}${reg}`, loc);
+            }
+            active.push(interval);
+        };
+        const spill = (interval: Interval) => {
+            locs.set(value(interval.local), {
+                tag: "slot",
+                cls: interval.cls,
+                offset: slots * 8,
+            });
+            slots += 1;
+        };
+
+        for (const interval of intervals) {
+            // Values whose last read is where this one is written may share
+            // its register, since instructions read their operands before
+            // writing their results.
+            active = active.filter(({ end }) => end > interval.start);
+
+            const { callerSaved, calleeSaved } = this.target[interval.cls];
+            const allowed = interval.crossesCall
+                ? calleeSaved
+                : [...callerSaved, ...calleeSaved];
+            const taken = new Set(
+                active
+                    .filter(({ cls }) => cls === interval.cls)
+                    .map(regOf),
+            );
+            const free = allowed.filter((reg) => !taken.has(reg));
+            if (free.length > 0) {
+                const hints = [
+                    interval.hint,
+                    ...(this.related.get(value(interval.local)) ?? [])
+                        .map((val) => locs.get(val))
+                        .map((loc) => loc?.tag === "reg" ? loc.reg : undefined),
+                ];
+                const hint = hints
+                    .find((reg) => reg !== undefined && free.includes(reg));
+                assign(interval, hint ?? free[0]);
+                continue;
+            }
+
+            const victim = active
+                .filter(({ cls }) => cls === interval.cls)
+                .filter((other) => allowed.includes(regOf(other)))
+                .reduce<Interval | undefined>(
+                    (acc, other) => !acc || other.end > acc.end ? other : acc,
+                    undefined,
+                );
+            if (victim && victim.end > interval.end) {
+                const reg = regOf(victim);
+                active = active.filter((other) => other !== victim);
+                spill(victim);
+                assign(interval, reg);
+            } else {
+                spill(interval);
+            }
+        }
+        return {
+            locs,
+            usedCalleeSaved: usedCalleeSaved.values().toArray(),
+            slots,
+        };
+    }
+}
+
+// Phis and parameters are defined at the start of their block.
+export function isBlockStartDef(stmt: lir.Stmt): boolean {
+    const k = stmt.kind;
+    return k.tag === "assign" &&
+        (k.rval.tag === "phi" || k.rval.tag === "param");
+}
@@ -0,0 +1,321 @@
+import { exhausted, IdMap } from "@slige/common";
+import { BlockId, lir } from "@slige/middle";
+
+// Locals are keyed by their raw id, since ids aren't compared by value.
+export type Value = number;
+
+export const value = (local: lir.LocalId): Value => local.rawId;
+
+export function successors(block: lir.Block): BlockId[] {
+    const k = block.ter.kind;
+    switch (k.tag) {
+        case "goto":
+            return [k.target];
+        case "switch":
+            return [...k.targets.map(({ target }) => target), k.otherwise];
+        case "error":
+        case "return":
+            return [];
+    }
+    exhausted(k);
+}
+
+// Locals read by an rval, except the sources of phis, which are read on
+// the branches into their block.
+export function rvalLocals(rval: lir.RVal): lir.LocalId[] {
+    switch (rval.tag) {
+        case "error":
+        case "phi":
+        case "param":
+        case "const":
+            return [];
+        case "use":
+            return [rval.local];
+        case "binary":
+            return [...rvalLocals(rval.left), ...rvalLocals(rval.right)];
+        case "unary":
+            return rvalLocals(rval.operand);
+        case "call":
+            return [
+                ...rvalLocals(rval.func),
+                ...rval.args.flatMap((arg) => rvalLocals(arg)),
+            ];
+    }
+    exhausted(rval);
+}
+
+// Constants, except strings, are propagated into the operands reading them,
+// and loaded into phis on the branches into their blocks, so they're never
+// kept in a location of their own.
+export const isConstDef = (rval: lir.RVal): boolean =>
+    rval.tag === "const" && rval.val.tag !== "str";
+
+export function terLocals(ter: lir.Ter): lir.LocalId[] {
+    const k = ter.kind;
+    switch (k.tag) {
+        case "switch":
+            return rvalLocals(k.discr);
+        case "return":
+            return rvalLocals(k.val);
+        case "error":
+        case "goto":
+            return [];
+    }
+    exhausted(k);
+}
+
+// Simplifies a function lowered to SSA, which has a phi for every local at
+// the start of every block, and a new version of a local for every
+// assignment.
+//
+// Copies are propagated, and phis with a single source, besides themselves
+// and undefined locals, are replaced by that source, which leaves phis only
+// where values from different branches meet. Constants are propagated into
+// the operands reading them. Assignments whose values are never read are
+// then removed, except calls.
+export function simplify(fn: lir.Fn): lir.Fn {
+    const defs = new Map<Value, lir.RVal>();
+    for (const block of fn.blocks.values()) {
+        for (const { kind } of block.stmts) {
+            if (kind.tag === "assign") {
+                defs.set(value(kind.local), kind.rval);
+            }
+        }
+    }
+
+    const alias = new Map<Value, lir.LocalId>();
+    const removed = new Set<Value>();
+    const find = (local: lir.LocalId): lir.LocalId => {
+        while (alias.has(value(local))) {
+            local = alias.get(value(local))!;
+        }
+        return local;
+    };
+    const isDefined = (local: lir.LocalId): boolean =>
+        defs.has(value(local)) && !removed.has(value(local));
+
+    let changed = true;
+    while (changed) {
+        changed = false;
+        for (const [dst, rval] of defs) {
+            if (alias.has(dst) || removed.has(dst)) {
+                continue;
+            }
+            if (rval.tag === "use") {
+                alias.set(dst, find(rval.local));
+                changed = true;
+            } else if (rval.tag === "phi") {
+                const sources = uniqueLocals(
+                    rval.sources
+                        .map((source) => find(source.local))
+                        .filter((local) =>
+                            value(local) !== dst && isDefined(local)
+                        ),
+                );
+                if (sources.length === 0) {
+                    removed.add(dst);
+                    changed = true;
+                } else if (sources.length === 1) {
+                    alias.set(dst, sources[0]);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Undefined locals are read as null.
+    const operand = (rval: lir.RVal): lir.RVal => {
+        switch (rval.tag) {
+            case "use": {
+                const local = find(rval.local);
+                if (!isDefined(local)) {
+                    return { tag: "const", val: { tag: "null" } };
+                }
+                const def = defs.get(value(local))!;
+                if (isConstDef(def)) {
+                    return def;
+                }
+                return { tag: "use", local };
+            }
+            case "binary":
+                return {
+                    ...rval,
+                    left: operand(rval.left),
+                    right: operand(rval.right),
+                };
+            case "unary":
+                return { ...rval, operand: operand(rval.operand) };
+            case "call":
+                return {
+                    ...rval,
+                    func: operand(rval.func),
+                    args: rval.args.map(operand),
+                };
+            case "phi":
+                return {
+                    tag: "phi",
+                    sources: rval.sources
+                        .map(({ local, branch }) => ({
+                            local: find(local),
+                            branch,
+                        }))
+                        .filter(({ local }) => isDefined(local)),
+                };
+            case "error":
+            case "param":
+            case "const":
+                return rval;
+        }
+        exhausted(rval);
+    };
+
+    const blocks = new IdMap<BlockId, lir.Block>();
+    for (const [id, block] of fn.blocks) {
+        const stmts = block.stmts.flatMap((stmt): lir.Stmt[] => {
+            const k = stmt.kind;
+            if (k.tag !== "assign") {
+                return [stmt];
+            }
+            if (alias.has(value(k.local)) || removed.has(value(k.local))) {
+                return [];
+            }
+            return [{ kind: { ...k, rval: operand(k.rval) } }];
+        });
+        const k = block.ter.kind;
+        const ter: lir.Ter = {
+            kind: k.tag === "switch"
+                ? { ...k, discr: operand(k.discr) }
+                : k.tag === "return"
+                ? { tag: "return", val: operand(k.val) }
+                : k,
+        };
+        blocks.set(id, { id: block.id, stmts, ter });
+    }
+    removeDeadStmts(blocks);
+    return { mirFn: fn.mirFn, blocks, locals: fn.locals };
+}
+
+// Removes the assignments of locals not read by calls or terminators,
+// directly or through other locals.
+function removeDeadStmts(blocks: IdMap<BlockId, lir.Block>) {
+    const defs = new Map<Value, lir.RVal>();
+    const live = new Set<Value>();
+    const worklist: lir.LocalId[] = [];
+    const markLive = (locals: lir.LocalId[]) => {
+        for (const local of locals) {
+            if (!live.has(value(local))) {
+                live.add(value(local));
+                worklist.push(local);
+            }
+        }
+    };
+    for (const block of blocks.values()) {
+        for (const { kind } of block.stmts) {
+            if (kind.tag !== "assign") {
+                continue;
+            }
+            defs.set(value(kind.local), kind.rval);
+            if (kind.rval.tag === "call") {
+                markLive(rvalLocals(kind.rval));
+            }
+        }
+        markLive(terLocals(block.ter));
+    }
+    while (worklist.length > 0) {
+        const rval = defs.get(value(worklist.pop()!));
+        if (rval?.tag === "phi") {
+            markLive(rval.sources.map(({ local }) => local));
+        } else if (rval) {
+            markLive(rvalLocals(rval));
+        }
+    }
+    for (const block of blocks.values()) {
+        block.stmts = block.stmts.filter(({ kind }) =>
+            kind.tag !== "assign" || live.has(value(kind.local)) ||
+            kind.rval.tag === "call"
+        );
+    }
+}
+
+// Locals known to hold non-negative values, which can be compared unsigned,
+// as the VM does. Locals are assumed non-negative until an assignment
+// shows otherwise, so that loop counters, which are phis of themselves,
+// are found. Sums of non-negative values are assumed not to overflow.
+export function nonNegativeLocals(fn: lir.Fn): Set<Value> {
+    const defs = new Map<Value, lir.RVal>();
+    for (const block of fn.blocks.values()) {
+        for (const { kind } of block.stmts) {
+            if (kind.tag === "assign") {
+                defs.set(value(kind.local), kind.rval);
+            }
+        }
+    }
+    const nonNegative = new Set(defs.keys());
+    const isNonNegative = (rval: lir.RVal): boolean => {
+        switch (rval.tag) {
+            case "const":
+                return rval.val.tag !== "int" || rval.val.value >= 0;
+            case "use":
+                return nonNegative.has(value(rval.local));
+            case "phi":
+                return rval.sources
+                    .every(({ local }) => nonNegative.has(value(local)));
+            case "binary": {
+                const left = isNonNegative(rval.left);
+                const right = isNonNegative(rval.right);
+                switch (rval.binaryType) {
+                    case "eq":
+                    case "ne":
+                    case "lt":
+                    case "lte":
+                    case "gt":
+                    case "gte":
+                        return true;
+                    case "and":
+                        return left || right;
+                    case "add":
+                    case "mul":
+                    case "div":
+                    case "rem":
+                    case "or":
+                    case "xor":
+                    case "shr":
+                        return left && right;
+                    case "sub":
+                    case "shl":
+                        return false;
+                }
+                return exhausted(rval.binaryType);
+            }
+            case "unary":
+                return rval.unaryType === "not" && isNonNegative(rval.operand);
+            case "error":
+            case "param":
+            case "call":
+                return false;
+        }
+        exhausted(rval);
+    };
+    let changed = true;
+    while (changed) {
+        changed = false;
+        for (const [local, rval] of defs) {
+            if (nonNegative.has(local) && !isNonNegative(rval)) {
+                nonNegative.delete(local);
+                changed = true;
+            }
+        }
+    }
+    return nonNegative;
+}
+
+function uniqueLocals(locals: lir.LocalId[]): lir.LocalId[] {
+    const values = new Set<Value>();
+    return locals.filter((local) => {
+        if (values.has(value(local))) {
+            return false;
+        }
+        values.add(value(local));
+        return true;
+    });
+}
@@ -0,0 +1,962 @@
+import * as ast from "@slige/ast";
+import { exhausted, todo } from "@slige/common";
+import { BlockId, lir, mir } from "@slige/middle";
+import { Ty } from "@slige/ty";
+import { ModuleWriter } from "./module.ts";
+import {
+    isBlockStartDef,
+    Loc,
+    RegAlloc,
+    RegAllocation,
+    RegClass,
+    RegLoc,
+    TargetRegs,
+} from "./reg_alloc.ts";
+import {
+    isConstDef,
+    nonNegativeLocals,
+    simplify,
+    Value,
+    value,
+} from "./ssa.ts";
+
+// Ops in the encoding order of `VM_OP_LIST` in `slige/runtime/src/vm.h`,
+// which this must be kept in sync with. The float arithmetic ops following
+// them aren't generated.
+const ops = [
+    "Nop",
+    "Halt",
+    "Builtin",
+    "Call",
+    "CallI",
+    "Ret",
+    "Alloca",
+    "Jmp",
+    "Jnz",
+    "Jz",
+    "Load8",
+    "LoadI8",
+    "LoadA8",
+    "Load16",
+    "LoadI16",
+    "LoadA16",
+    "Load32",
+    "LoadI32",
+    "LoadA32",
+    "Load64",
+    "LoadI64",
+    "LoadA64",
+    "LoadF",
+    "LoadIF",
+    "LoadAF",
+    "Store8",
+    "StoreA8",
+    "Store16",
+    "StoreA16",
+    "Store32",
+    "StoreA32",
+    "Store64",
+    "StoreA64",
+    "StoreF",
+    "StoreAF",
+    "LoadImm32",
+    "LoadImm64",
+    "LoadImmF",
+    "LoadSb",
+    "LoadSp",
+    "MovII",
+    "MovIF",
+    "MovFI",
+    "MovFF",
+    "Push",
+    "Pop",
+    "PushF",
+    "PopF",
+    "Eq",
+    "Ne",
+    "Lt",
+    "Gt",
+    "Lte",
+    "Gte",
+    "And",
+    "Or",
+    "Xor",
+    "Add",
+    "Sub",
+    "Mul",
+    "Div",
+    "Rem",
+    "IMul",
+    "IDiv",
+    "EqI",
+    "NeI",
+    "LtI",
+    "GtI",
+    "LteI",
+    "GteI",
+    "AndI",
+    "OrI",
+    "XorI",
+    "AddI",
+    "SubI",
+    "RSubI",
+    "MulI",
+    "DivI",
+    "RemI",
+    "IMulI",
+    "IDivI",
+] as const;
+
+type Op = typeof ops[number];
+
+const regRange = (start: number, end: number): number[] =>
+    Array.from({ length: end - start }, (_, i) => start + i);
+
+// Arguments are passed in `%ireg` 1 and up, and results returned in `%ireg`
+// 0, as the embedding API in `slige/runtime/src/slige.h` calls functions,
+// so that every function can be called by the host directly. The registers
+// are shared by every frame, so the rest of them are split into caller and
+// callee saved registers.
+const argRegs = regRange(1, 16);
+const retReg = 0;
+const vmRegs: Record<RegClass, TargetRegs> = {
+    int: { callerSaved: regRange(0, 16), calleeSaved: regRange(16, 26) },
+    float: { callerSaved: regRange(0, 8), calleeSaved: regRange(8, 14) },
+};
+// Registers never allocated, which spilled values and operands are loaded
+// into. The first of a class also holds values moved between stack slots,
+// and the second values moved aside to break cycles of moves.
+const scratchRegs: Record<RegClass, number[]> = {
+    int: [26, 27, 28, 29],
+    float: [14, 15],
+};
+// Holds 1, so that `LoadA64` and `StoreA64`, which scale an index register,
+// can address stack slots at a constant offset from the frame base.
+const oneReg = 30;
+// Holds the stack base of the current frame, which stack slots are addressed
+// from. It's reloaded after calls, which change it.
+const frameReg = 31;
+
+const signBit = 1n << 63n;
+
+// Ops of binary operations, with a register and with an immediate as the
+// right operand.
+const binaryOps = {
+    "add": ["Add", "AddI"],
+    "sub": ["Sub", "SubI"],
+    "mul": ["Mul", "MulI"],
+    "div": ["IDiv", "IDivI"],
+    "and": ["And", "AndI"],
+    "or": ["Or", "OrI"],
+    "xor": ["Xor", "XorI"],
+    "eq": ["Eq", "EqI"],
+    "ne": ["Ne", "NeI"],
+    "lt": ["Lt", "LtI"],
+    "gt": ["Gt", "GtI"],
+    "lte": ["Lte", "LteI"],
+    "gte": ["Gte", "GteI"],
+    "rem": ["Rem", "RemI"],
+} as const satisfies Partial<Record<mir.BinaryType, readonly [Op, Op]>>;
+
+// Binary operations with their operands swapped, for moving constants to
+// the right.
+const swappedBinaryTypes: Partial<Record<mir.BinaryType, mir.BinaryType>> = {
+    "add": "add",
+    "mul": "mul",
+    "and": "and",
+    "or": "or",
+    "xor": "xor",
+    "eq": "eq",
+    "ne": "ne",
+    "lt": "gt",
+    "gt": "lt",
+    "lte": "gte",
+    "gte": "lte",
+};
+
+const intReg = (reg: number): RegLoc => ({ tag: "reg", cls: "int", reg });
+
+// Generates bytecode for the Slige VM from functions lowered to LIR, as a
+// module for the runtime in `slige/runtime`.
+//
+// Functions are taken out of SSA form by moving the sources of phis into
+// their locations on the branches into their blocks, after registers are
+// allocated. Branches from switches into blocks with phis go through stubs
+// doing the moves, since the moves only belong on that branch. Stubs are
+// placed after the last block of the function, out of the way of blocks
+// falling through.
+export class VmGen {
+    private writer = new ModuleWriter();
+    private fnWords = new Map<number, number>();
+    // Immediates holding the word offset of a function.
+    private fnFixups: { word: number; item: ast.Item }[] = [];
+
+    private fn!: lir.Fn;
+    private regs!: RegAllocation;
+    private defs = new Map<Value, lir.RVal>();
+    private nonNegative = new Set<Value>();
+    private savedSlots: { loc: RegLoc; offset: number }[] = [];
+    private frameSize = 0;
+    private labelWords = new Map<string, number>();
+    private labelFixups: { word: number; label: string }[] = [];
+    private stubs: { label: string; block: lir.Block; target: BlockId }[] =
+        [];
+
+    public constructor(
+        private fns: lir.Fn[],
+    ) {}
+
+    // The function named `main` is run by the runtime.
+    public generate(): Uint8Array {
+        const entry = this.fns.find((fn) => fn.mirFn.label === "main") ??
+            this.fns.at(0);
+        for (const fn of this.fns) {
+            this.writer.fn(fn.mirFn.label, this.code.length, fn === entry);
+            this.fnWords.set(fn.mirFn.astItem.id.rawId, this.code.length);
+            this.generateFn(simplify(fn));
+        }
+
+        for (const { word, item } of this.fnFixups) {
+            const fnWord = this.fnWords.get(item.id.rawId);
+            if (fnWord === undefined) {
+                throw new Error(`function '${item.ident.text}' not lowered`);
+            }
+            this.code[word] = fnWord;
+        }
+        return this.writer.finalize();
+    }
+
+    private get code(): number[] {
+        return this.writer.code;
+    }
+
+    private generateFn(fn: lir.Fn) {
+        this.fn = fn;
+        this.defs = new Map();
+        for (const block of fn.blocks.values()) {
+            for (const { kind } of block.stmts) {
+                if (kind.tag === "assign") {
+                    this.defs.set(value(kind.local), kind.rval);
+                }
+            }
+        }
+        this.nonNegative = nonNegativeLocals(fn);
+
+        const blocks = fn.blocks.values().toArray();
+        const params = blocks[0].stmts.flatMap(({ kind }) =>
+            kind.tag === "assign" && kind.rval.tag === "param"
+                ? [{ local: kind.local, idx: kind.rval.idx }]
+                : []
+        );
+        if (params.some(({ idx }) => idx >= argRegs.length)) {
+            throw new Error(`too many parameters in '${fn.mirFn.label}'`);
+        }
+        this.regs = new RegAlloc(
+            blocks,
+            vmRegs,
+            (local) => tyRegClass(this.localTy(local)),
+            new Map(
+                params.map(({ local, idx }) => [value(local), argRegs[idx]]),
+            ),
+        ).allocate();
+
+        // Spilled values and saved registers get a stack slot in the frame,
+        // which starts at the stack base.
+        this.savedSlots = this.regs.usedCalleeSaved.map((loc, i) => ({
+            loc,
+            offset: (this.regs.slots + i) * 8,
+        }));
+        this.frameSize = this.regs.slots + this.savedSlots.length;
+        this.labelWords = new Map();
+        this.labelFixups = [];
+        this.stubs = [];
+
+        if (this.frameSize !== 0) {
+            this.insI32("Alloca", {}, this.frameSize);
+            this.ins("LoadSb", { dst: frameReg });
+            this.insI32("LoadImm32", { dst: oneReg }, 1);
+        }
+        for (const { loc, offset } of this.savedSlots) {
+            this.storeSlot(loc, offset);
+        }
+        this.parallelMove(
+            params.map(({ local, idx }) => ({
+                dst: this.loc(local),
+                src: intReg(argRegs[idx]),
+            })),
+        );
+
+        for (const [i, block] of blocks.entries()) {
+            this.labelWords.set(blockLabel(block.id), this.code.length);
+            for (const stmt of block.stmts) {
+                if (!isBlockStartDef(stmt)) {
+                    this.generateStmt(stmt);
+                }
+            }
+            this.generateTer(block, blocks.at(i + 1));
+        }
+        for (const { label, block, target } of this.stubs) {
+            this.labelWords.set(label, this.code.length);
+            this.moveIntoPhis(block, target);
+            this.jump("Jmp", blockLabel(target));
+        }
+
+        for (const { word, label } of this.labelFixups) {
+            this.code[word] = this.labelWords.get(label)!;
+        }
+    }
+
+    private generateStmt(stmt: lir.Stmt) {
+        const k = stmt.kind;
+        switch (k.tag) {
+            case "error":
+                throw new Error();
+            case "assign":
+                this.generateAssign(k.local, k.rval);
+                return;
+        }
+        exhausted(k);
+    }
+
+    private generateAssign(local: lir.LocalId, rval: lir.RVal) {
+        switch (rval.tag) {
+            case "error":
+                throw new Error();
+            case "phi":
+            case "param":
+                // Moved into on the branches into the block, or on entry.
+                return;
+            case "use":
+                this.moveRVal(this.loc(local), rval);
+                return;
+            case "const":
+                if (!isConstDef(rval)) {
+                    this.moveRVal(this.loc(local), rval);
+                }
+                return;
+            case "binary":
+                this.generateBinary(local, rval);
+                return;
+            case "unary": {
+                const [dstScratch, srcScratch] = scratchRegs.int;
+                const dst = this.def(local, dstScratch);
+                const src = this.use(rval.operand, srcScratch);
+                switch (rval.unaryType) {
+                    case "not":
+                        this.insI32("XorI", { dst, left: src }, 1);
+                        break;
+                    case "neg":
+                        this.insI32("RSubI", { dst, right: src }, 0);
+                        break;
+                    default:
+                        exhausted(rval.unaryType);
+                }
+                this.writeBack(local, dst);
+                return;
+            }
+            case "call":
+                this.generateCall(local, rval);
+                return;
+        }
+        exhausted(rval);
+    }
+
+    private generateBinary(
+        local: lir.LocalId,
+        rval: lir.RVal & { tag: "binary" },
+    ) {
+        let { binaryType, left, right } = rval;
+        const leftImm = this.imm(left);
+        if (leftImm !== undefined && this.imm(right) === undefined) {
+            const swapped = swappedBinaryTypes[binaryType];
+            if (swapped) {
+                [binaryType, left, right] = [swapped, right, left];
+            } else if (binaryType === "sub" && fitsImm(leftImm)) {
+                const [dstScratch, , rightScratch] = scratchRegs.int;
+                const dst = this.def(local, dstScratch);
+                this.insI32(
+                    "RSubI",
+                    { dst, right: this.use(right, rightScratch) },
+                    Number(leftImm),
+                );
+                this.writeBack(local, dst);
+                return;
+            }
+        }
+        // Negative constants don't fit an immediate, but their negation
+        // may.
+        const rightImm = this.imm(right);
+        if (
+            (binaryType === "add" || binaryType === "sub") &&
+            rightImm !== undefined && rightImm < 0n && fitsImm(-rightImm)
+        ) {
+            binaryType = binaryType === "add" ? "sub" : "add";
+            right = {
+                tag: "const",
+                val: { tag: "int", value: Number(-rightImm) },
+            };
+        }
+
+        const unsigned = this.isNonNegative(left) &&
+            this.isNonNegative(right);
+        switch (binaryType) {
+            case "add":
+            case "sub":
+            case "mul":
+            case "div":
+            case "and":
+            case "or":
+            case "xor":
+            case "eq":
+            case "ne":
+                this.generateBinaryOp(
+                    local,
+                    binaryOps[binaryType],
+                    left,
+                    right,
+                );
+                return;
+            case "lt":
+            case "gt":
+            case "lte":
+            case "gte":
+                if (unsigned) {
+                    this.generateBinaryOp(
+                        local,
+                        binaryOps[binaryType],
+                        left,
+                        right,
+                    );
+                } else {
+                    this.generateSignedCmp(
+                        local,
+                        binaryOps[binaryType][0],
+                        left,
+                        right,
+                    );
+                }
+                return;
+            case "rem":
+                if (unsigned) {
+                    this.generateBinaryOp(
+                        local,
+                        binaryOps[binaryType],
+                        left,
+                        right,
+                    );
+                } else {
+                    this.generateSignedRem(local, left, right);
+                }
+                return;
+            case "shl":
+            case "shr":
+                return todo(binaryType);
+        }
+        exhausted(binaryType);
+    }
+
+    // Constants fitting the zero-extended `%i32` are given as the immediate
+    // of the immediate form of the op. The runtime rejects immediate
+    // divisors of 0 when loading, so dividing by a constant 0 uses the
+    // register form, which fails when run.
+    private generateBinaryOp(
+        local: lir.LocalId,
+        [op, opImm]: readonly [Op, Op],
+        left: lir.RVal,
+        right: lir.RVal,
+    ) {
+        const [dstScratch, leftScratch, rightScratch] = scratchRegs.int;
+        const dst = this.def(local, dstScratch);
+        const leftReg = this.use(left, leftScratch);
+        const imm = this.imm(right);
+        const isDivision = op === "IDiv" || op === "Rem";
+        if (imm !== undefined && fitsImm(imm) && !(isDivision && imm === 0n)) {
+            this.insI32(opImm, { dst, left: leftReg }, Number(imm));
+        } else {
+            const rightReg = this.use(right, rightScratch);
+            this.ins(op, { dst, left: leftReg, right: rightReg });
+        }
+        this.writeBack(local, dst);
+    }
+
+    // The VM compares unsigned. Flipping the sign bits of both operands
+    // maps the signed order onto the unsigned one.
+    private generateSignedCmp(
+        local: lir.LocalId,
+        op: Op,
+        left: lir.RVal,
+        right: lir.RVal,
+    ) {
+        const [dstScratch, leftScratch, rightScratch, tmpScratch] =
+            scratchRegs.int;
+        const dst = this.def(local, dstScratch);
+        const leftReg = this.use(left, leftScratch);
+        const rightReg = this.use(right, rightScratch);
+        this.insI64("LoadImm64", { dst: tmpScratch }, signBit);
+        this.ins("Xor", { dst: leftScratch, left: leftReg, right: tmpScratch });
+        this.ins("Xor", {
+            dst: rightScratch,
+            left: rightReg,
+            right: tmpScratch,
+        });
+        this.ins(op, { dst, left: leftScratch, right: rightScratch });
+        this.writeBack(local, dst);
+    }
+
+    // There is no signed remainder, so it's computed from the quotient,
+    // which rounds towards zero.
+    private generateSignedRem(
+        local: lir.LocalId,
+        left: lir.RVal,
+        right: lir.RVal,
+    ) {
+        const [dstScratch, leftScratch, rightScratch, tmpScratch] =
+            scratchRegs.int;
+        const dst = this.def(local, dstScratch);
+        const leftReg = this.use(left, leftScratch);
+        const imm = this.imm(right);
+        if (imm !== undefined && fitsImm(imm) && imm !== 0n) {
+            this.insI32(
+                "IDivI",
+                { dst: tmpScratch, left: leftReg },
+                Number(imm),
+            );
+            this.insI32(
+                "MulI",
+                { dst: tmpScratch, left: tmpScratch },
+                Number(imm),
+            );
+        } else {
+            const rightReg = this.use(right, rightScratch);
+            this.ins("IDiv", {
+                dst: tmpScratch,
+                left: leftReg,
+                right: rightReg,
+            });
+            this.ins("Mul", {
+                dst: tmpScratch,
+                left: tmpScratch,
+                right: rightReg,
+            });
+        }
+        this.ins("Sub", { dst, left: leftReg, right: tmpScratch });
+        this.writeBack(local, dst);
+    }
+
+    // Calls functions known at compile time with `CallI`, and others with
+    // `Call`.
+    private generateCall(
+        local: lir.LocalId,
+        rval: lir.RVal & { tag: "call" },
+    ) {
+        const [, , , targetScratch] = scratchRegs.int;
+        if (rval.args.length > argRegs.length) {
+            throw new Error("too many arguments");
+        }
+
+        // The target is moved aside, if it's in a register the arguments
+        // are moved into.
+        const { func } = rval;
+        const isDirect = func.tag === "const" && func.val.tag === "fn";
+        let target = targetScratch;
+        if (!isDirect) {
+            const loc = func.tag === "use" ? this.loc(func.local) : undefined;
+            if (loc?.tag === "reg" && !argRegs.includes(loc.reg)) {
+                target = loc.reg;
+            } else {
+                this.moveRVal(intReg(targetScratch), func);
+            }
+        }
+        this.parallelMove(
+            rval.args.flatMap((arg, i) =>
+                arg.tag === "use"
+                    ? [{ dst: intReg(argRegs[i]), src: this.loc(arg.local) }]
+                    : []
+            ),
+        );
+        for (const [i, arg] of rval.args.entries()) {
+            if (arg.tag !== "use") {
+                this.moveRVal(intReg(argRegs[i]), arg);
+            }
+        }
+
+        if (func.tag === "const" && func.val.tag === "fn") {
+            this.fnFixups.push({
+                word: this.code.length + 1,
+                item: func.val.item,
+            });
+            this.insI32("CallI", {}, 0);
+        } else {
+            this.ins("Call", { left: target });
+        }
+        if (this.frameSize !== 0) {
+            this.ins("LoadSb", { dst: frameReg });
+        }
+        this.parallelMove([{ dst: this.loc(local), src: intReg(retReg) }]);
+    }
+
+    // Branches fall through into the next block where possible.
+    private generateTer(block: lir.Block, next: lir.Block | undefined) {
+        const k = block.ter.kind;
+        switch (k.tag) {
+            case "error":
+                throw new Error();
+            case "goto":
+                this.generateBranch(block, k.target, next);
+                return;
+            case "switch":
+                this.generateSwitch(block, k, next);
+                return;
+            case "return":
+                this.moveRVal(intReg(retReg), k.val);
+                for (const { loc, offset } of this.savedSlots) {
+                    this.loadSlot(loc, offset);
+                }
+                // `Ret` frees the frame.
+                this.ins("Ret");
+                return;
+        }
+        exhausted(k);
+    }
+
+    private generateSwitch(
+        block: lir.Block,
+        ter: lir.TerKind & { tag: "switch" },
+        next: lir.Block | undefined,
+    ) {
+        const [discrScratch, , , cmpScratch] = scratchRegs.int;
+        const imm = this.imm(ter.discr);
+        if (imm !== undefined) {
+            const target = ter.targets
+                .find(({ value }) => BigInt(value) === imm)?.target ??
+                ter.otherwise;
+            this.generateBranch(block, target, next);
+            return;
+        }
+
+        const branchLabel = (target: BlockId): string => {
+            if (this.phiSources(block, target).length === 0) {
+                return blockLabel(target);
+            }
+            const label = `s${this.stubs.length}`;
+            this.stubs.push({ label, block, target });
+            return label;
+        };
+
+        const discr = this.use(ter.discr, discrScratch);
+        const isBool = ter.discr.tag === "use" &&
+            this.localTy(ter.discr.local).kind.tag === "bool";
+        if (
+            isBool && ter.targets.length === 1 &&
+            (ter.targets[0].value === 0 || ter.targets[0].value === 1)
+        ) {
+            let [op, target, otherwise]: ["Jnz" | "Jz", BlockId, BlockId] = [
+                ter.targets[0].value === 1 ? "Jnz" : "Jz",
+                ter.targets[0].target,
+                ter.otherwise,
+            ];
+            if (
+                next && target.rawId === next.id.rawId &&
+                this.phiSources(block, target).length === 0
+            ) {
+                [op, target, otherwise] = [
+                    op === "Jnz" ? "Jz" : "Jnz",
+                    otherwise,
+                    target,
+                ];
+            }
+            this.jump(op, branchLabel(target), discr);
+            this.generateBranch(block, otherwise, next);
+        } else {
+            for (const { value, target } of ter.targets) {
+                if (!fitsImm(BigInt(value))) {
+                    throw new Error(`switch value ${value} out of range`);
+                }
+                this.insI32("EqI", { dst: cmpScratch, left: discr }, value);
+                this.jump("Jnz", branchLabel(target), cmpScratch);
+            }
+            this.generateBranch(block, ter.otherwise, next);
+        }
+    }
+
+    private generateBranch(
+        block: lir.Block,
+        target: BlockId,
+        next: lir.Block | undefined,
+    ) {
+        this.moveIntoPhis(block, target);
+        if (target.rawId !== next?.id.rawId) {
+            this.jump("Jmp", blockLabel(target));
+        }
+    }
+
+    // Locations of the phis of `target` and their sources on the branch
+    // from `block`, which are locals or constants.
+    private phiSources(
+        block: lir.Block,
+        target: BlockId,
+    ): { dst: Loc; src: lir.RVal }[] {
+        return this.fn.blocks.get(target)!.stmts.flatMap(({ kind }) =>
+            kind.tag === "assign" && kind.rval.tag === "phi"
+                ? kind.rval.sources
+                    .filter(({ branch }) => branch.rawId === block.id.rawId)
+                    .map(({ local }) => {
+                        const def = this.defs.get(value(local))!;
+                        return {
+                            dst: this.loc(kind.local),
+                            src: isConstDef(def)
+                                ? def
+                                : { tag: "use" as const, local },
+                        };
+                    })
+                : []
+        );
+    }
+
+    // Constants are loaded after the moves, since they don't read any
+    // location.
+    private moveIntoPhis(block: lir.Block, target: BlockId) {
+        const sources = this.phiSources(block, target);
+        this.parallelMove(
+            sources.flatMap(({ dst, src }) =>
+                src.tag === "use" ? [{ dst, src: this.loc(src.local) }] : []
+            ),
+        );
+        for (const { dst, src } of sources) {
+            if (src.tag !== "use") {
+                this.moveRVal(dst, src);
+            }
+        }
+    }
+
+    // Emits moves which read every source before writing any destination.
+    private parallelMove(moves: { dst: Loc; src: Loc }[]) {
+        let pending = moves.filter(({ dst, src }) => !sameLoc(dst, src));
+        while (pending.length > 0) {
+            const ready = pending.find(({ dst }) =>
+                !pending.some(({ src }) => sameLoc(src, dst))
+            );
+            if (ready) {
+                this.move(ready.dst, ready.src);
+                pending = pending.filter((move) => move !== ready);
+                continue;
+            }
+            // The remaining moves form cycles, one of which is broken by
+            // moving a destination aside.
+            const { dst } = pending[0];
+            const aside: RegLoc = {
+                tag: "reg",
+                cls: dst.cls,
+                reg: scratchRegs[dst.cls][1],
+            };
+            this.move(aside, dst);
+            pending = pending.map((move) =>
+                sameLoc(move.src, dst) ? { ...move, src: aside } : move
+            );
+        }
+    }
+
+    private move(dst: Loc, src: Loc) {
+        if (sameLoc(dst, src)) {
+            return;
+        }
+        if (dst.tag === "reg" && src.tag === "reg") {
+            const op = dst.cls === "int" ? "MovII" : "MovFF";
+            this.ins(op, { dst: dst.reg, left: src.reg });
+        } else if (dst.tag === "reg" && src.tag === "slot") {
+            this.loadSlot(dst, src.offset);
+        } else if (dst.tag === "slot" && src.tag === "reg") {
+            this.storeSlot(src, dst.offset);
+        } else if (dst.tag === "slot" && src.tag === "slot") {
+            const scratch: RegLoc = {
+                tag: "reg",
+                cls: src.cls,
+                reg: scratchRegs[src.cls][0],
+            };
+            this.loadSlot(scratch, src.offset);
+            this.storeSlot(scratch, dst.offset);
+        }
+    }
+
+    // Moves a local or a constant into `dst`.
+    private moveRVal(dst: Loc, rval: lir.RVal) {
+        if (rval.tag === "use") {
+            this.move(dst, this.loc(rval.local));
+            return;
+        }
+        if (rval.tag !== "const" || dst.cls !== "int") {
+            throw new Error();
+        }
+        const [scratch] = scratchRegs.int;
+        const reg = dst.tag === "reg" ? dst.reg : scratch;
+        this.loadConst(reg, rval.val);
+        if (dst.tag === "slot") {
+            this.storeSlot(intReg(reg), dst.offset);
+        }
+    }
+
+    private loadConst(dst: number, val: mir.Const) {
+        switch (val.tag) {
+            case "null":
+                this.loadImm(dst, 0n);
+                return;
+            case "int":
+                this.loadImm(dst, BigInt(val.value));
+                return;
+            case "str":
+                return todo(val.tag);
+            case "fn":
+                this.fnFixups.push({
+                    word: this.code.length + 1,
+                    item: val.item,
+                });
+                this.insI32("LoadImm32", { dst }, 0);
+                return;
+        }
+        exhausted(val);
+    }
+
+    private loc(local: lir.LocalId): Loc {
+        return this.regs.locs.get(value(local))!;
+    }
+
+    // Register holding the value of an int local or constant, which is
+    // loaded into `scratch` if spilled or constant.
+    private use(rval: lir.RVal, scratch: number): number {
+        if (rval.tag === "use") {
+            const loc = this.loc(rval.local);
+            if (loc.tag === "reg") {
+                return loc.reg;
+            }
+            this.loadSlot(intReg(scratch), loc.offset);
+            return scratch;
+        }
+        this.moveRVal(intReg(scratch), rval);
+        return scratch;
+    }
+
+    // Register to write an int local to, which is written back with
+    // `writeBack`.
+    private def(local: lir.LocalId, scratch: number): number {
+        const loc = this.loc(local);
+        return loc.tag === "reg" ? loc.reg : scratch;
+    }
+
+    private writeBack(local: lir.LocalId, reg: number) {
+        const loc = this.loc(local);
+        if (loc.tag === "slot") {
+            this.storeSlot(intReg(reg), loc.offset);
+        }
+    }
+
+    private imm(rval: lir.RVal): bigint | undefined {
+        if (rval.tag !== "const") {
+            return undefined;
+        }
+        switch (rval.val.tag) {
+            case "null":
+                return 0n;
+            case "int":
+                return BigInt(rval.val.value);
+            case "str":
+            case "fn":
+                return undefined;
+        }
+        exhausted(rval.val);
+    }
+
+    private isNonNegative(rval: lir.RVal): boolean {
+        const imm = this.imm(rval);
+        if (imm !== undefined) {
+            return imm >= 0n;
+        }
+        return rval.tag === "use" && this.nonNegative.has(value(rval.local));
+    }
+
+    private localTy(local: lir.LocalId): Ty {
+        const base = this.fn.locals.get(local)!.base;
+        return this.fn.mirFn.locals.get(base)!.ty;
+    }
+
+    private loadSlot(dst: RegLoc, offset: number) {
+        this.insI32(
+            dst.cls === "int" ? "LoadA64" : "LoadAF",
+            { dst: dst.reg, left: frameReg, right: oneReg },
+            offset,
+        );
+    }
+
+    private storeSlot(src: RegLoc, offset: number) {
+        this.insI32(
+            src.cls === "int" ? "StoreA64" : "StoreAF",
+            { dst: frameReg, left: src.reg, right: oneReg },
+            offset,
+        );
+    }
+
+    // Loads a 64-bit value with the shortest encoding.
+    private loadImm(dst: number, val: bigint) {
+        if (fitsImm(val)) {
+            this.insI32("LoadImm32", { dst }, Number(val));
+        } else {
+            this.insI64("LoadImm64", { dst }, val);
+        }
+    }
+
+    private jump(op: "Jmp" | "Jnz" | "Jz", label: string, left = 0) {
+        this.labelFixups.push({ word: this.code.length + 1, label });
+        this.insI32(op, { left }, 0);
+    }
+
+    // Instruction header, as laid out in `slige/runtime/src/vm.h`: the op
+    // in the lowest byte, then the destination, right and left registers.
+    private ins(op: Op, { dst = 0, left = 0, right = 0 }: Operands = {}) {
+        const header = ops.indexOf(op) | dst << 8 | right << 16 | left << 24;
+        this.code.push(header >>> 0);
+    }
+
+    // Instruction with a `%i32` immediate, or a jump target.
+    private insI32(op: Op, operands: Operands, imm: number) {
+        if (!fitsImm(BigInt(imm))) {
+            throw new Error(`immediate ${imm} out of range`);
+        }
+        this.ins(op, operands);
+        this.code.push(imm);
+    }
+
+    // Instruction with a `%i64` immediate, which is stored little endian.
+    private insI64(op: Op, operands: Operands, imm: bigint) {
+        const val = BigInt.asUintN(64, imm);
+        this.ins(op, operands);
+        this.code.push(Number(val & 0xffffffffn), Number(val >> 32n));
+    }
+}
+
+type Operands = { dst?: number; left?: number; right?: number };
+
+// Slige 2 has no float type yet, so every value is in the int class.
+function tyRegClass(ty: Ty): RegClass {
+    switch (ty.kind.tag) {
+        case "error":
+        case "unknown":
+        case "null":
+        case "int":
+        case "bool":
+        case "fn":
+        case "enum":
+        case "struct":
+            return "int";
+    }
+    exhausted(ty.kind);
+}
+
+const blockLabel = (id: BlockId): string => `b${id.rawId}`;
+
+// Whether `val` fits an immediate, which is a zero-extended `%i32`.
+const fitsImm = (val: bigint): boolean => val >= 0n && val < 1n << 32n;
+
+const sameLoc = (a: Loc, b: Loc): boolean =>
+    a.cls === b.cls && (
+        a.tag === "reg" && b.tag === "reg" && a.reg === b.reg ||
+        a.tag === "slot" && b.tag === "slot" && a.offset === b.offset
+    );
@@ -4,18 +4,21 @@ import * as ast from "@slige/ast";
 import { Ctx, File } from "@slige/common";
 import { Resolver } from "./resolve/resolver.ts";
 import { Checker } from "./check/checker.ts";
-import { ast_lower, mir_lower } from "@slige/middle";
+import { ast_lower, lir, mir_lower } from "@slige/middle";
 import { HirStringifyer } from "@slige/stringify";
+import { VmGen } from "@slige/codegen";
 
 async function main() {
     const filePath = Deno.args[0];
-    const compiler = new PackCompiler(filePath, new NullEmitter());
+    const outPath = Deno.args[1] ?? "out.slgm";
+    const compiler = new PackCompiler(filePath, new VmEmitter(outPath));
     compiler.enableDebug();
     await compiler.compile();
 }
 
 export type Pack = {
     rootMod: Mod;
+    fns: lir.Fn[];
 };
 
 export type Mod = null;
@@ -29,6 +32,17 @@ export class NullEmitter implements PackEmitter {
     }
 }
 
+// Writes the pack as a module for the runtime in `slige/runtime`.
+export class VmEmitter implements PackEmitter {
+    public constructor(
+        private outPath: string,
+    ) {}
+
+    emit(pack: Pack): void {
+        Deno.writeFileSync(this.outPath, new VmGen(pack.fns).generate());
+    }
+}
+
 export class PackCompiler {
     private ctx = new Ctx();
     private astCx = new ast.Cx();
@@ -75,6 +89,7 @@ export class PackCompiler {
         );
         mirLowerer.lower();
         console.log("=== LIR ===\n" + mirLowerer.lirString());
+        this.emitter.emit({ rootMod: null, fns: mirLowerer.toArray() });
     }
 
     public enableDebug() {
@@ -92,6 +92,7 @@ export class FnLowerer {
             blocks: this.blocks,
             entry: entry.id,
             paramLocals: this.paramLocals,
+            returnLocal: returnPlace,
             astItem: this.item,
             astItemKind: this.kind,
         });
@@ -481,7 +482,7 @@ export class FnLowerer {
                 case "<":
                     return "lt";
                 case ">":
-                    return "lte";
+                    return "gt";
                 case "<=":
                     return "lte";
                 case ">=":
@@ -510,6 +511,7 @@ export class FnLowerer {
                 place: { local, proj: [] },
                 rval: truthy,
             });
+            const truthEnd = this.currentBlock!;
 
             const falsyBlock = this.pushBlock();
             const falsy = this.lowerExpr(kind.falsy);
@@ -518,10 +520,11 @@ export class FnLowerer {
                 place: { local, proj: [] },
                 rval: falsy,
             });
+            const falsyEnd = this.currentBlock!;
 
             const exit = this.pushBlock();
-            this.setTer({ tag: "goto", target: exit.id }, truthBlock);
-            this.setTer({ tag: "goto", target: exit.id }, falsyBlock);
+            this.setTer({ tag: "goto", target: exit.id }, truthEnd);
+            this.setTer({ tag: "goto", target: exit.id }, falsyEnd);
 
             this.setTer({
                 tag: "switch",
@@ -811,6 +814,7 @@ export class FnLowerer {
             place: { local: condLocal, proj: [] },
             rval: condVal,
         });
+        const condEnd = this.currentBlock!;
 
         if (this.ch.exprTy(expr).kind.tag !== "null") {
             throw new Error();
@@ -833,7 +837,7 @@ export class FnLowerer {
             discr: this.copyOrMoveLocal(condLocal, condTy),
             targets: [{ value: 1, target: bodyBlock.id }],
             otherwise: exitBlock.id,
-        }, condBlock);
+        }, condEnd);
         return {
             tag: "use",
             operand: { tag: "const", val: { tag: "null" } },
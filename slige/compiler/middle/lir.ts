@@ -43,7 +43,7 @@ export type TerKind =
         targets: SwitchTarget[];
         otherwise: BlockId;
     }
-    | { tag: "return" };
+    | { tag: "return"; val: RVal };
 
 export type SwitchTarget = {
     value: number;
@@ -58,5 +58,14 @@ export type PhiSource = {
 export type RVal =
     | { tag: "error" }
     | { tag: "phi"; sources: PhiSource[] }
+    | { tag: "param"; idx: number }
     | { tag: "use"; local: LocalId }
-    | { tag: "const"; val: mir.Const };
+    | { tag: "const"; val: mir.Const }
+    | {
+        tag: "binary";
+        binaryType: mir.BinaryType;
+        left: RVal;
+        right: RVal;
+    }
+    | { tag: "unary"; unaryType: mir.UnaryType; operand: RVal }
+    | { tag: "call"; func: RVal; args: RVal[] };
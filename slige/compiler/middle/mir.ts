@@ -8,6 +8,7 @@ export type Fn = {
     blocks: IdMap<BlockId, Block>;
     entry: BlockId;
     paramLocals: IdMap<LocalId, number>;
+    returnLocal: LocalId;
     astItem: ast.Item;
     astItemKind: ast.FnItem;
 };
@@ -18,6 +18,10 @@ export class MirLowerer {
         }
     }
 
+    public toArray(): lir.Fn[] {
+        return this.lirFns;
+    }
+
     public lirString(): string {
         return this.lirFns
             .values()
@@ -39,6 +43,14 @@ export class FnLowerer {
 
     private currentBlockId?: BlockId;
 
+    // Phis, whose sources are resolved once every block is lowered, since
+    // a branch may come from a block lowered after them.
+    private phis: {
+        rval: lir.RVal & { tag: "phi" };
+        base: mir.LocalId;
+        superBlocks: BlockId[];
+    }[] = [];
+
     public constructor(
         private fn: mir.Fn,
     ) {}
@@ -48,6 +60,12 @@ export class FnLowerer {
             const lirBlock = this.lowerBlock(mirBlock);
             this.blocks.set(lirBlock.id, lirBlock);
         }
+        for (const { rval, base, superBlocks } of this.phis) {
+            for (const superBlock of superBlocks) {
+                const local = this.blockLocals.get(superBlock)!.get(base)!;
+                rval.sources.push({ branch: superBlock, local: local.id });
+            }
+        }
         return {
             mirFn: this.fn,
             blocks: this.blocks,
@@ -77,22 +95,31 @@ export class FnLowerer {
         const superBlocks = this.fn.blocks
             .values()
             .filter((b) => blockHasTarget(b, block.id))
+            .map((b) => b.id)
             .toArray();
 
         if (block.id.rawId !== 0) {
             for (const mirId of locals.keys()) {
-                const sources: lir.PhiSource[] = [];
-                for (const superBlock of superBlocks) {
-                    const local = this.blockLocals.get(superBlock.id)!.get(
-                        mirId,
-                    )!;
-                    sources.push({ branch: superBlock.id, local: local.id });
-                }
+                const rval: lir.RVal & { tag: "phi" } = {
+                    tag: "phi",
+                    sources: [],
+                };
+                this.phis.push({ rval, base: mirId, superBlocks });
                 stmts.push(
                     this.stmt({
                         tag: "assign",
                         local: locals.get(mirId)!.id,
-                        rval: { tag: "phi", sources },
+                        rval,
+                    }),
+                );
+            }
+        } else {
+            for (const [mirId, idx] of this.fn.paramLocals.entries()) {
+                stmts.push(
+                    this.stmt({
+                        tag: "assign",
+                        local: locals.get(mirId)!.id,
+                        rval: { tag: "param", idx },
                     }),
                 );
             }
@@ -137,13 +164,15 @@ export class FnLowerer {
         this.localVersionCounter.set(kind.place.local, version + 1);
 
         const lirId = this.localIds.nextThenStep();
+        const local: lir.Local = {
+            id: lirId,
+            base: kind.place.local,
+            version,
+        };
+        this.locals.set(lirId, local);
         this.blockLocals
             .get(this.currentBlockId!)!
-            .set(kind.place.local, {
-                id: lirId,
-                base: kind.place.local,
-                version,
-            });
+            .set(kind.place.local, local);
 
         return [...s1, this.stmt({ tag: "assign", local: lirId, rval })];
     }
@@ -152,37 +181,45 @@ export class FnLowerer {
         switch (rval.tag) {
             case "error":
                 return [[], { tag: "error" }];
-            case "use": {
-                switch (rval.operand.tag) {
-                    case "error":
-                        return [[], { tag: "error" }];
-                    case "copy":
-                    case "move":
-                        return [[], {
-                            tag: "use",
-                            local: this.blockLocals
-                                .get(this.currentBlockId!)!
-                                .get(rval.operand.place.local)!.id,
-                        }];
-                    case "const":
-                        return [[], {
-                            tag: "const",
-                            val: rval.operand.val,
-                        }];
-                }
-                return exhausted(rval.operand);
-            }
+            case "use":
+                return this.lowerOperand(rval.operand);
             case "repeat":
             case "ref":
             case "ptr":
-            case "binary":
-            case "unary":
                 return todo();
+            case "binary": {
+                const [s1, left] = this.lowerOperand(rval.left);
+                const [s2, right] = this.lowerOperand(rval.right);
+                return [[...s1, ...s2], {
+                    tag: "binary",
+                    binaryType: rval.binaryType,
+                    left,
+                    right,
+                }];
+            }
+            case "unary": {
+                const [s1, operand] = this.lowerOperand(rval.operand);
+                return [s1, {
+                    tag: "unary",
+                    unaryType: rval.unaryType,
+                    operand,
+                }];
+            }
             case "adt": {
                 console.log(rval);
                 return todo();
             }
-            case "call":
+            case "call": {
+                const [s1, func] = this.lowerOperand(rval.func);
+                const stmts = [...s1];
+                const args: lir.RVal[] = [];
+                for (const arg of rval.args) {
+                    const [s2, val] = this.lowerOperand(arg);
+                    stmts.push(...s2);
+                    args.push(val);
+                }
+                return [stmts, { tag: "call", func, args }];
+            }
             case "builtin":
                 return todo();
         }
@@ -209,8 +246,13 @@ export class FnLowerer {
                     }),
                 ];
             }
-            case "return":
-                return [[], this.ter({ tag: "return" })];
+            case "return": {
+                const [s1, val] = this.lowerOperand({
+                    tag: "copy",
+                    place: { local: this.fn.returnLocal, proj: [] },
+                });
+                return [s1, this.ter({ tag: "return", val })];
+            }
             case "unreachable":
                 return [[], this.ter({ tag: "error" })];
             case "drop":
@@ -225,7 +267,15 @@ export class FnLowerer {
                 return [[], { tag: "error" }];
             case "copy":
             case "move":
-                return todo(operand.tag);
+                if (operand.place.proj.length !== 0) {
+                    return todo();
+                }
+                return [[], {
+                    tag: "use",
+                    local: this.blockLocals
+                        .get(this.currentBlockId!)!
+                        .get(operand.place.local)!.id,
+                }];
             case "const":
                 return [[], { tag: "const", val: operand.val }];
         }
@@ -681,7 +681,7 @@ export class Parser {
     private parseWhile(): Expr {
         const pos = this.span();
         this.step();
-        const cond = this.parseExpr();
+        const cond = this.parseExpr(ExprRestricts.NoStructs);
         if (!this.test("{")) {
             this.report("expected '{'");
             return this.expr({ tag: "error" }, pos);
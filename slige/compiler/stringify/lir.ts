@@ -77,7 +77,7 @@ export class LirFnStringifyer {
                 return `##switch ${discr}${targets}\n###_ => ${otherwise}`;
             }
             case "return":
-                return `##return;`;
+                return `##return ${this.rval(k.val)};`;
         }
         exhausted(k);
     }
@@ -96,11 +96,26 @@ export class LirFnStringifyer {
                         )
                         .join(",")
                 }]`;
+            case "param":
+                return `param ${rval.idx}`;
             case "use":
                 return this.local(rval.local);
             case "const":
                 return `${this.constVal(rval.val)}`;
+            case "binary": {
+                const op = rval.binaryType;
+                const left = this.rval(rval.left);
+                const right = this.rval(rval.right);
+                return `${op}(${left}, ${right})`;
+            }
+            case "unary":
+                return `${rval.unaryType}(${this.rval(rval.operand)})`;
+            case "call":
+                return `call ${this.rval(rval.func)}(${
+                    rval.args.map((arg) => this.rval(arg)).join(", ")
+                })`;
         }
+        exhausted(rval);
     }
 
     private constVal(val: mir.Const): string {
@@ -0,0 +1,81 @@
+#include "heap.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define HEAP_ALIGN 16
+
+struct HeapChunk {
+    HeapChunk* next;
+    max_align_t data[];
+};
+
+static_assert(_Alignof(max_align_t) >= HEAP_ALIGN,
+    "chunk data must be aligned for any allocation");
+
+void heap_construct(Heap* heap)
+{
+    *heap = (Heap) {
+        .chunks = NULL,
+        .ptr = NULL,
+        .end = NULL,
+    };
+}
+
+void heap_destroy(Heap* heap)
+{
+    HeapChunk* chunk = heap->chunks;
+    while (chunk) {
+        HeapChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    *heap = (Heap) { 0 };
+}
+
+static inline HeapChunk* heap_chunk_alloc(size_t size)
+{
+    if (size > SIZE_MAX - sizeof(HeapChunk))
+        return NULL;
+    return calloc(1, sizeof(HeapChunk) + size);
+}
+
+void* heap_alloc(Heap* heap, size_t size)
+{
+    if (size > SIZE_MAX - HEAP_ALIGN)
+        return NULL;
+    size = (size + HEAP_ALIGN - 1) & ~(size_t)(HEAP_ALIGN - 1);
+    // Every allocation gets its own address.
+    if (size == 0)
+        size = HEAP_ALIGN;
+
+    if (size > HEAP_CHUNK_SIZE / 4) {
+        // Large allocations get their own chunk, which is put after the
+        // current chunk, so that the rest of the current chunk is still used.
+        HeapChunk* chunk = heap_chunk_alloc(size);
+        if (!chunk)
+            return NULL;
+        if (heap->chunks) {
+            chunk->next = heap->chunks->next;
+            heap->chunks->next = chunk;
+        } else {
+            chunk->next = NULL;
+            heap->chunks = chunk;
+        }
+        return chunk->data;
+    }
+
+    if (!heap->ptr || (size_t)(heap->end - heap->ptr) < size) {
+        HeapChunk* chunk = heap_chunk_alloc(HEAP_CHUNK_SIZE);
+        if (!chunk)
+            return NULL;
+        chunk->next = heap->chunks;
+        heap->chunks = chunk;
+        heap->ptr = (uint8_t*)chunk->data;
+        heap->end = heap->ptr + HEAP_CHUNK_SIZE;
+    }
+    void* result = heap->ptr;
+    heap->ptr += size;
+    return result;
+}
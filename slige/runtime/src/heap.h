@@ -0,0 +1,27 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Size of the chunks allocations are bumped out of. Allocations larger than
+/// a quarter of this get a chunk of their own.
+#define HEAP_CHUNK_SIZE (1 << 20)
+
+typedef struct HeapChunk HeapChunk;
+
+/// Memory for `Builtin_Alloc`. Allocations are bumped out of chunks, and
+/// freed all at once by `heap_destroy`.
+typedef struct {
+    HeapChunk* chunks;
+    uint8_t* ptr;
+    uint8_t* end;
+} Heap;
+
+void heap_construct(Heap* heap);
+void heap_destroy(Heap* heap);
+
+/// Returns zeroed memory aligned to 16 bytes, or NULL if out of memory.
+void* heap_alloc(Heap* heap, size_t size);
+
+#endif
@@ -0,0 +1,1395 @@
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef VM_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Register use in compiled code:
+//
+// rbx - `Regs*`, pinned.
+// r12 - `JitFrame*`, pinned.
+// rax, rcx, rdx, xmm0, xmm1 - scratch.
+// rdi - helper call argument.
+//
+// Compiled code returns the `Inst*` to continue interpreting at in rax.
+
+typedef const Inst* (*JitFn)(Regs* regs, JitFrame* frame, const void* entry);
+
+static_assert(sizeof(JitFn) == sizeof(void*), "function pointers must fit");
+static_assert(offsetof(JitFrame, sb) == 0, "`LoadSb` template offset");
+static_assert(offsetof(JitFrame, sp) == 8, "`LoadSp` template offset");
+
+/// Maps superinstructions to the op they replaced, since the rest of the
+/// sequence is still in place and compiled on its own.
+static const uint8_t unfused_ops[] = {
+#define JIT_OP_SELF(NAME, FORMAT, DST, LEFT, RIGHT) [Op_##NAME] = Op_##NAME,
+    VM_OP_LIST(JIT_OP_SELF)
+#undef JIT_OP_SELF
+#define JIT_OP_FIRST(NAME, LENGTH, FIRST) [Op_##NAME] = Op_##FIRST,
+    VM_FUSED_OP_LIST(JIT_OP_FIRST)
+#undef JIT_OP_FIRST
+};
+
+static double jit_u64_to_f64(uint64_t value)
+{
+    return (double)value;
+}
+
+static uint64_t jit_f64_to_u64(double value)
+{
+    return (uint64_t)value;
+}
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} CodeBuf;
+
+static inline void code_emit(CodeBuf* code, const uint8_t* bytes, size_t size)
+{
+    if (code->size + size > code->capacity) {
+        size_t capacity = code->capacity == 0 ? 4096 : code->capacity * 2;
+        uint8_t* data = realloc(code->data, capacity);
+        if (!data) {
+            code->failed = true;
+            return;
+        }
+        code->data = data;
+        code->capacity = capacity;
+    }
+    memcpy(&code->data[code->size], bytes, size);
+    code->size += size;
+}
+
+#define EMIT(CODE, ...)                                                        \
+    code_emit((CODE),                                                          \
+        (const uint8_t[]) { __VA_ARGS__ },                                     \
+        sizeof((const uint8_t[]) { __VA_ARGS__ }))
+
+static inline void emit_u32(CodeBuf* code, uint32_t value)
+{
+    EMIT(code,
+        (uint8_t)value,
+        (uint8_t)(value >> 8),
+        (uint8_t)(value >> 16),
+        (uint8_t)(value >> 24));
+}
+
+static inline void emit_u64(CodeBuf* code, uint64_t value)
+{
+    emit_u32(code, (uint32_t)value);
+    emit_u32(code, (uint32_t)(value >> 32));
+}
+
+static inline uint32_t ireg(Reg reg)
+{
+    return (uint32_t)(offsetof(Regs, iregs) + reg * sizeof(uint64_t));
+}
+
+static inline uint32_t freg(Reg reg)
+{
+    return (uint32_t)(offsetof(Regs, fregs) + reg * sizeof(double));
+}
+
+// Templates. Names are the instruction they encode, `regs` meaning the
+// `Regs` block at `[rbx + disp32]`.
+
+static inline void mov_rax_regs(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0x48, 0x8b, 0x83);
+    emit_u32(code, disp);
+}
+
+static inline void mov_rcx_regs(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0x48, 0x8b, 0x8b);
+    emit_u32(code, disp);
+}
+
+static inline void mov_rdi_regs(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0x48, 0x8b, 0xbb);
+    emit_u32(code, disp);
+}
+
+static inline void mov_regs_rax(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0x48, 0x89, 0x83);
+    emit_u32(code, disp);
+}
+
+static inline void mov_regs_rcx(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0x48, 0x89, 0x8b);
+    emit_u32(code, disp);
+}
+
+static inline void movsd_xmm0_regs(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0xf2, 0x0f, 0x10, 0x83);
+    emit_u32(code, disp);
+}
+
+static inline void movsd_xmm1_regs(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0xf2, 0x0f, 0x10, 0x8b);
+    emit_u32(code, disp);
+}
+
+static inline void movsd_regs_xmm0(CodeBuf* code, uint32_t disp)
+{
+    EMIT(code, 0xf2, 0x0f, 0x11, 0x83);
+    emit_u32(code, disp);
+}
+
+static inline void movabs_rax(CodeBuf* code, uint64_t imm)
+{
+    EMIT(code, 0x48, 0xb8);
+    emit_u64(code, imm);
+}
+
+static inline void movabs_rcx(CodeBuf* code, uint64_t imm)
+{
+    EMIT(code, 0x48, 0xb9);
+    emit_u64(code, imm);
+}
+
+static inline void movabs_rdx(CodeBuf* code, uint64_t imm)
+{
+    EMIT(code, 0x48, 0xba);
+    emit_u64(code, imm);
+}
+
+/// rax = regs.iregs[base] + regs.iregs[offset] * incr
+static inline void lea_indexed(
+    CodeBuf* code, Reg base, Reg offset, uint64_t incr)
+{
+    mov_rax_regs(code, ireg(base));
+    mov_rcx_regs(code, ireg(offset));
+    movabs_rdx(code, incr);
+    // imul rcx, rdx
+    EMIT(code, 0x48, 0x0f, 0xaf, 0xca);
+    // add rax, rcx
+    EMIT(code, 0x48, 0x01, 0xc8);
+}
+
+/// Loads from the address in rax into `dst`.
+static inline void load_rax(CodeBuf* code, Op op, Reg dst)
+{
+    switch (op) {
+        case Op_Load8:
+        case Op_LoadI8:
+        case Op_LoadA8:
+            // movzx eax, byte [rax]
+            EMIT(code, 0x0f, 0xb6, 0x00);
+            break;
+        case Op_Load16:
+        case Op_LoadI16:
+        case Op_LoadA16:
+            // movzx eax, word [rax]
+            EMIT(code, 0x0f, 0xb7, 0x00);
+            break;
+        case Op_Load32:
+        case Op_LoadI32:
+        case Op_LoadA32:
+            // mov eax, [rax]
+            EMIT(code, 0x8b, 0x00);
+            break;
+        case Op_LoadF:
+        case Op_LoadIF:
+        case Op_LoadAF:
+            // movsd xmm0, [rax]
+            EMIT(code, 0xf2, 0x0f, 0x10, 0x00);
+            movsd_regs_xmm0(code, freg(dst));
+            return;
+        default:
+            // mov rax, [rax]
+            EMIT(code, 0x48, 0x8b, 0x00);
+            break;
+    }
+    mov_regs_rax(code, ireg(dst));
+}
+
+/// Stores `src` to the address in rax.
+static inline void store_rax(CodeBuf* code, Op op, Reg src)
+{
+    switch (op) {
+        case Op_Store8:
+        case Op_StoreA8:
+            mov_rcx_regs(code, ireg(src));
+            // mov [rax], cl
+            EMIT(code, 0x88, 0x08);
+            break;
+        case Op_Store16:
+        case Op_StoreA16:
+            mov_rcx_regs(code, ireg(src));
+            // mov [rax], cx
+            EMIT(code, 0x66, 0x89, 0x08);
+            break;
+        case Op_Store32:
+        case Op_StoreA32:
+            mov_rcx_regs(code, ireg(src));
+            // mov [rax], ecx
+            EMIT(code, 0x89, 0x08);
+            break;
+        case Op_StoreF:
+        case Op_StoreAF:
+            movsd_xmm0_regs(code, freg(src));
+            // movsd [rax], xmm0
+            EMIT(code, 0xf2, 0x0f, 0x11, 0x00);
+            break;
+        default:
+            mov_rcx_regs(code, ireg(src));
+            // mov [rax], rcx
+            EMIT(code, 0x48, 0x89, 0x08);
+            break;
+    }
+}
+
+/// rax = regs.iregs[left] OP right, where right is rcx.
+static inline void int_binary(CodeBuf* code, Op op)
+{
+    switch (op) {
+        case Op_And:
+        case Op_AndI:
+            // and rax, rcx
+            EMIT(code, 0x48, 0x21, 0xc8);
+            break;
+        case Op_Or:
+        case Op_OrI:
+            // or rax, rcx
+            EMIT(code, 0x48, 0x09, 0xc8);
+            break;
+        case Op_Xor:
+        case Op_XorI:
+            // xor rax, rcx
+            EMIT(code, 0x48, 0x31, 0xc8);
+            break;
+        case Op_Add:
+        case Op_AddI:
+            // add rax, rcx
+            EMIT(code, 0x48, 0x01, 0xc8);
+            break;
+        case Op_Sub:
+        case Op_SubI:
+        case Op_RSubI:
+            // sub rax, rcx
+            EMIT(code, 0x48, 0x29, 0xc8);
+            break;
+        case Op_Mul:
+        case Op_MulI:
+        case Op_IMul:
+        case Op_IMulI:
+            // imul rax, rcx
+            EMIT(code, 0x48, 0x0f, 0xaf, 0xc1);
+            break;
+        case Op_Div:
+        case Op_DivI:
+            // xor edx, edx; div rcx
+            EMIT(code, 0x31, 0xd2, 0x48, 0xf7, 0xf1);
+            break;
+        case Op_Rem:
+        case Op_RemI:
+            // xor edx, edx; div rcx; mov rax, rdx
+            EMIT(code, 0x31, 0xd2, 0x48, 0xf7, 0xf1, 0x48, 0x89, 0xd0);
+            break;
+        case Op_IDiv:
+        case Op_IDivI:
+            // cqo; idiv rcx
+            EMIT(code, 0x48, 0x99, 0x48, 0xf7, 0xf9);
+            break;
+        default: {
+            uint8_t setcc = 0x94;
+            switch (op) {
+                case Op_Ne:
+                case Op_NeI:
+                    setcc = 0x95;
+                    break;
+                case Op_Lt:
+                case Op_LtI:
+                    setcc = 0x92;
+                    break;
+                case Op_Gt:
+                case Op_GtI:
+                    setcc = 0x97;
+                    break;
+                case Op_Lte:
+                case Op_LteI:
+                    setcc = 0x96;
+                    break;
+                case Op_Gte:
+                case Op_GteI:
+                    setcc = 0x93;
+                    break;
+                default:
+                    break;
+            }
+            // cmp rax, rcx; setcc al; movzx eax, al
+            EMIT(code, 0x48, 0x39, 0xc8, 0x0f, setcc, 0xc0, 0x0f, 0xb6, 0xc0);
+            break;
+        }
+    }
+}
+
+/// xmm0 = xmm0 OP right, where right is `[rbx + disp]`, or xmm1 if `disp` is
+/// 0. Compares put their result in rax.
+static inline void float_binary(CodeBuf* code, Op op, uint32_t disp)
+{
+    uint8_t modrm = disp != 0 ? 0x83 : 0xc1;
+    switch (op) {
+        case Op_AddF:
+        case Op_AddFI:
+        case Op_SubF:
+        case Op_SubFI:
+        case Op_RSubFI:
+        case Op_MulF:
+        case Op_MulFI:
+        case Op_DivF:
+        case Op_DivFI: {
+            uint8_t opcode = 0x5e;
+            if (op == Op_AddF || op == Op_AddFI)
+                opcode = 0x58;
+            else if (op == Op_SubF || op == Op_SubFI || op == Op_RSubFI)
+                opcode = 0x5c;
+            else if (op == Op_MulF || op == Op_MulFI)
+                opcode = 0x59;
+            // addsd/subsd/mulsd/divsd xmm0, right
+            EMIT(code, 0xf2, 0x0f, opcode, modrm);
+            if (disp != 0)
+                emit_u32(code, disp);
+            return;
+        }
+        default:
+            break;
+    }
+
+    if (disp != 0)
+        movsd_xmm1_regs(code, disp);
+    // `<` and `<=` are compiled as `>` and `>=` with swapped operands, so that
+    // unordered operands (NaN) give false like in C.
+    switch (op) {
+        case Op_LtF:
+        case Op_LtFI:
+            // ucomisd xmm1, xmm0; seta al
+            EMIT(code, 0x66, 0x0f, 0x2e, 0xc8, 0x0f, 0x97, 0xc0);
+            break;
+        case Op_GtF:
+        case Op_GtFI:
+            // ucomisd xmm0, xmm1; seta al
+            EMIT(code, 0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x97, 0xc0);
+            break;
+        case Op_LteF:
+        case Op_LteFI:
+            // ucomisd xmm1, xmm0; setae al
+            EMIT(code, 0x66, 0x0f, 0x2e, 0xc8, 0x0f, 0x93, 0xc0);
+            break;
+        case Op_GteF:
+        case Op_GteFI:
+            // ucomisd xmm0, xmm1; setae al
+            EMIT(code, 0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x93, 0xc0);
+            break;
+        case Op_NeF:
+        case Op_NeFI:
+            // ucomisd xmm0, xmm1; setne al; setp cl; or al, cl
+            EMIT(code, 0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x95, 0xc0);
+            EMIT(code, 0x0f, 0x9a, 0xc1, 0x08, 0xc8);
+            break;
+        default:
+            // ucomisd xmm0, xmm1; sete al; setnp cl; and al, cl
+            EMIT(code, 0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x94, 0xc0);
+            EMIT(code, 0x0f, 0x9b, 0xc1, 0x20, 0xc8);
+            break;
+    }
+    // movzx eax, al
+    EMIT(code, 0x0f, 0xb6, 0xc0);
+}
+
+/// Target of a jump to the end of the function, which returns to the
+/// interpreter.
+#define EPILOGUE SIZE_MAX
+
+typedef struct {
+    /// Offset of the rel32 to patch.
+    size_t at;
+    /// Instruction index, or `EPILOGUE`.
+    size_t target;
+} Fixup;
+
+typedef struct {
+    Jit* jit;
+    CodeBuf code;
+    /// Instruction indices in the function, sorted after discovery.
+    size_t* insts;
+    size_t insts_size;
+    bool* in_function;
+    /// Code offset per instruction in the function.
+    size_t* offsets;
+    Fixup* fixups;
+    size_t fixups_size;
+} Compiler;
+
+static inline Op compiler_op(const Compiler* c, size_t index)
+{
+    return unfused_ops[c->jit->program->insts[index].op];
+}
+
+static inline size_t compiler_target(const Compiler* c, size_t index)
+{
+    const Inst* insts = c->jit->program->insts;
+    return (size_t)(insts[index].target - insts);
+}
+
+/// Emits `bytes` followed by a rel32 to `target`.
+static inline void compiler_jump(
+    Compiler* c, const uint8_t* bytes, size_t size, size_t target)
+{
+    code_emit(&c->code, bytes, size);
+    c->fixups[c->fixups_size++] = (Fixup) { c->code.size, target };
+    emit_u32(&c->code, 0);
+}
+
+static inline void compiler_jmp(Compiler* c, size_t target)
+{
+    compiler_jump(c, (const uint8_t[]) { 0xe9 }, 1, target);
+}
+
+/// Returns to the interpreter at instruction `index`.
+static inline void compiler_exit(Compiler* c, size_t index)
+{
+    movabs_rax(&c->code, (uint64_t)&c->jit->program->insts[index]);
+    compiler_jmp(c, EPILOGUE);
+}
+
+/// Takes a step from `Regs.budget` for the jump at `index`, as the
+/// interpreter does for jumps to targets at or before themselves. Returns to
+/// the interpreter at the jump if there are no steps left, which then stops
+/// the run.
+static inline void compiler_jump_step(Compiler* c, size_t index)
+{
+    if (compiler_target(c, index) > index)
+        return;
+    CodeBuf* code = &c->code;
+    uint32_t budget = (uint32_t)offsetof(Regs, budget);
+    // cmp qword [rbx + budget], 0
+    EMIT(code, 0x48, 0x83, 0xbb);
+    emit_u32(code, budget);
+    EMIT(code, 0x00);
+    // jne past the exit, which is a movabs and a jmp rel32
+    EMIT(code, 0x75, 10 + 5);
+    compiler_exit(c, index);
+    // dec qword [rbx + budget]
+    EMIT(code, 0x48, 0xff, 0x8b);
+    emit_u32(code, budget);
+}
+
+/// Returns to the interpreter at the division at `index` if its divisor in
+/// rcx is 0, or -1 for `IDiv`, which the interpreter then checks for
+/// `INT64_MIN / -1`. Immediate divisors are never 0, see `program_verify`.
+static inline void compiler_division_check(Compiler* c, size_t index, Op op)
+{
+    CodeBuf* code = &c->code;
+    if (op == Op_IDiv) {
+        // lea rdx, [rcx + 1]; cmp rdx, 1; ja past the exit
+        EMIT(code, 0x48, 0x8d, 0x51, 0x01, 0x48, 0x83, 0xfa, 0x01);
+        EMIT(code, 0x77, 10 + 5);
+    } else {
+        // test rcx, rcx; jnz past the exit
+        EMIT(code, 0x48, 0x85, 0xc9, 0x75, 10 + 5);
+    }
+    compiler_exit(c, index);
+}
+
+static inline void compiler_add(Compiler* c, size_t index)
+{
+    if (c->in_function[index] || c->jit->entries[index]
+        || c->insts_size == JIT_MAX_FUNCTION_SIZE)
+        return;
+    c->in_function[index] = true;
+    c->insts[c->insts_size++] = index;
+}
+
+static inline bool op_falls_through(Op op)
+{
+    switch (op) {
+        case Op_Jmp:
+        case Op_Ret:
+        case Op_Halt:
+        case Op_Call:
+        case Op_CallI:
+        case Op_Builtin:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/// Finds the instructions reachable from `entry` without leaving the
+/// function. Instructions after calls and builtins are included, since the
+/// interpreter enters compiled code again when returning.
+static inline void compiler_discover(Compiler* c, size_t entry)
+{
+    compiler_add(c, entry);
+    for (size_t i = 0; i < c->insts_size; ++i) {
+        size_t index = c->insts[i];
+        Op op = compiler_op(c, index);
+        switch (op) {
+            case Op_Ret:
+            case Op_Halt:
+                break;
+            case Op_Jmp:
+                compiler_add(c, compiler_target(c, index));
+                break;
+            case Op_Jz:
+            case Op_Jnz:
+                compiler_add(c, compiler_target(c, index));
+                compiler_add(c, index + 1);
+                break;
+            default:
+                compiler_add(c, index + 1);
+                break;
+        }
+    }
+}
+
+static int compare_indices(const void* a, const void* b)
+{
+    size_t left = *(const size_t*)a;
+    size_t right = *(const size_t*)b;
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static inline void compiler_inst(Compiler* c, size_t index)
+{
+    CodeBuf* code = &c->code;
+    const Inst* inst = &c->jit->program->insts[index];
+    Op op = compiler_op(c, index);
+    switch (op) {
+        case Op_Nop:
+            break;
+        case Op_Halt:
+        case Op_Builtin:
+        case Op_Call:
+        case Op_CallI:
+        case Op_Ret:
+            compiler_exit(c, index);
+            break;
+        case Op_Alloca:
+            movabs_rax(code, inst->imm * sizeof(uint64_t));
+            // add [r12 + 8], rax
+            EMIT(code, 0x49, 0x01, 0x44, 0x24, 0x08);
+            if (inst->imm != 0) {
+                // Touches the top of the frame, as the interpreter does.
+                // mov rax, [r12 + 8]; mov rax, [rax - 8]
+                EMIT(code, 0x49, 0x8b, 0x44, 0x24, 0x08);
+                EMIT(code, 0x48, 0x8b, 0x40, 0xf8);
+            }
+            break;
+
+        case Op_Jmp:
+            compiler_jump_step(c, index);
+            compiler_jmp(c, compiler_target(c, index));
+            break;
+        case Op_Jnz:
+        case Op_Jz:
+            compiler_jump_step(c, index);
+            mov_rax_regs(code, ireg(inst->left));
+            // test rax, rax
+            EMIT(code, 0x48, 0x85, 0xc0);
+            // jnz/jz rel32
+            compiler_jump(c,
+                (const uint8_t[]) { 0x0f, op == Op_Jnz ? 0x85 : 0x84 },
+                2,
+                compiler_target(c, index));
+            break;
+
+        case Op_Load8:
+        case Op_Load16:
+        case Op_Load32:
+        case Op_Load64:
+        case Op_LoadF:
+            mov_rax_regs(code, ireg(inst->left));
+            load_rax(code, op, inst->dst);
+            break;
+        case Op_LoadI8:
+        case Op_LoadI16:
+        case Op_LoadI32:
+        case Op_LoadI64:
+        case Op_LoadIF:
+            movabs_rax(code, inst->imm);
+            load_rax(code, op, inst->dst);
+            break;
+        case Op_LoadA8:
+        case Op_LoadA16:
+        case Op_LoadA32:
+        case Op_LoadA64:
+        case Op_LoadAF:
+            lea_indexed(code, inst->left, inst->right, inst->imm);
+            load_rax(code, op, inst->dst);
+            break;
+
+        case Op_Store8:
+        case Op_Store16:
+        case Op_Store32:
+        case Op_Store64:
+        case Op_StoreF:
+            mov_rax_regs(code, ireg(inst->dst));
+            store_rax(code, op, inst->left);
+            break;
+        case Op_StoreA8:
+        case Op_StoreA16:
+        case Op_StoreA32:
+        case Op_StoreA64:
+        case Op_StoreAF:
+            lea_indexed(code, inst->dst, inst->right, inst->imm);
+            store_rax(code, op, inst->left);
+            break;
+
+        case Op_LoadImm32:
+        case Op_LoadImm64:
+            movabs_rax(code, inst->imm);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_LoadImmF:
+            movabs_rax(code, inst->imm);
+            mov_regs_rax(code, freg(inst->dst));
+            break;
+        case Op_LoadSb:
+            // mov rax, [r12]
+            EMIT(code, 0x49, 0x8b, 0x04, 0x24);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_LoadSp:
+            // mov rax, [r12 + 8]
+            EMIT(code, 0x49, 0x8b, 0x44, 0x24, 0x08);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+
+        case Op_MovII:
+            mov_rax_regs(code, ireg(inst->left));
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_MovIF:
+            mov_rdi_regs(code, ireg(inst->left));
+            movabs_rax(code, (uint64_t)(uintptr_t)jit_u64_to_f64);
+            // call rax
+            EMIT(code, 0xff, 0xd0);
+            movsd_regs_xmm0(code, freg(inst->dst));
+            break;
+        case Op_MovFI:
+            movsd_xmm0_regs(code, freg(inst->left));
+            movabs_rax(code, (uint64_t)(uintptr_t)jit_f64_to_u64);
+            // call rax
+            EMIT(code, 0xff, 0xd0);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_MovFF:
+            mov_rax_regs(code, freg(inst->left));
+            mov_regs_rax(code, freg(inst->dst));
+            break;
+
+        case Op_Push:
+        case Op_PushF:
+            // mov rax, [r12 + 8]
+            EMIT(code, 0x49, 0x8b, 0x44, 0x24, 0x08);
+            mov_rcx_regs(code,
+                op == Op_Push ? ireg(inst->left) : freg(inst->left));
+            // mov [rax], rcx; add rax, 8; mov [r12 + 8], rax
+            EMIT(code, 0x48, 0x89, 0x08, 0x48, 0x83, 0xc0, 0x08);
+            EMIT(code, 0x49, 0x89, 0x44, 0x24, 0x08);
+            break;
+        case Op_Pop:
+        case Op_PopF:
+            // mov rax, [r12 + 8]; sub rax, 8; mov [r12 + 8], rax
+            EMIT(code, 0x49, 0x8b, 0x44, 0x24, 0x08, 0x48, 0x83, 0xe8, 0x08);
+            EMIT(code, 0x49, 0x89, 0x44, 0x24, 0x08);
+            // mov rcx, [rax]
+            EMIT(code, 0x48, 0x8b, 0x08);
+            mov_regs_rcx(
+                code, op == Op_Pop ? ireg(inst->dst) : freg(inst->dst));
+            break;
+
+        case Op_Eq:
+        case Op_Ne:
+        case Op_Lt:
+        case Op_Gt:
+        case Op_Lte:
+        case Op_Gte:
+        case Op_And:
+        case Op_Or:
+        case Op_Xor:
+        case Op_Add:
+        case Op_Sub:
+        case Op_Mul:
+        case Op_IMul:
+            mov_rax_regs(code, ireg(inst->left));
+            mov_rcx_regs(code, ireg(inst->right));
+            int_binary(code, op);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_Div:
+        case Op_Rem:
+        case Op_IDiv:
+            mov_rax_regs(code, ireg(inst->left));
+            mov_rcx_regs(code, ireg(inst->right));
+            compiler_division_check(c, index, op);
+            int_binary(code, op);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_RSubI:
+            movabs_rax(code, inst->imm);
+            mov_rcx_regs(code, ireg(inst->right));
+            int_binary(code, op);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_EqI:
+        case Op_NeI:
+        case Op_LtI:
+        case Op_GtI:
+        case Op_LteI:
+        case Op_GteI:
+        case Op_AndI:
+        case Op_OrI:
+        case Op_XorI:
+        case Op_AddI:
+        case Op_SubI:
+        case Op_MulI:
+        case Op_DivI:
+        case Op_RemI:
+        case Op_IMulI:
+        case Op_IDivI:
+            mov_rax_regs(code, ireg(inst->left));
+            movabs_rcx(code, inst->imm);
+            int_binary(code, op);
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+
+        case Op_EqF:
+        case Op_NeF:
+        case Op_LtF:
+        case Op_GtF:
+        case Op_LteF:
+        case Op_GteF:
+            movsd_xmm0_regs(code, freg(inst->left));
+            float_binary(code, op, freg(inst->right));
+            mov_regs_rax(code, ireg(inst->dst));
+            break;
+        case Op_AddF:
+        case Op_SubF:
+        case Op_MulF:
+        case Op_DivF:
+            movsd_xmm0_regs(code, freg(inst->left));
+            float_binary(code, op, freg(inst->right));
+            movsd_regs_xmm0(code, freg(inst->dst));
+            break;
+        case Op_RSubFI:
+            movabs_rax(code, inst->imm);
+            // movq xmm0, rax
+            EMIT(code, 0x66, 0x48, 0x0f, 0x6e, 0xc0);
+            float_binary(code, op, freg(inst->right));
+            movsd_regs_xmm0(code, freg(inst->dst));
+            break;
+        case Op_EqFI:
+        case Op_NeFI:
+        case Op_LtFI:
+        case Op_GtFI:
+        case Op_LteFI:
+        case Op_GteFI:
+        case Op_AddFI:
+        case Op_SubFI:
+        case Op_MulFI:
+        case Op_DivFI:
+            movsd_xmm0_regs(code, freg(inst->left));
+            movabs_rax(code, inst->imm);
+            // movq xmm1, rax
+            EMIT(code, 0x66, 0x48, 0x0f, 0x6e, 0xc8);
+            float_binary(code, op, 0);
+            if (op == Op_AddFI || op == Op_SubFI || op == Op_MulFI
+                || op == Op_DivFI)
+                movsd_regs_xmm0(code, freg(inst->dst));
+            else
+                mov_regs_rax(code, ireg(inst->dst));
+            break;
+
+        default:
+            compiler_exit(c, index);
+            break;
+    }
+}
+
+/// Copies `code` into executable memory.
+static inline int code_map(const CodeBuf* code, JitCode* out)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (code->size + page - 1) / page * page;
+    void* data = mmap(
+        NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return -1;
+    memcpy(data, code->data, code->size);
+    if (mprotect(data, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(data, size);
+        return -1;
+    }
+    *out = (JitCode) { .data = data, .size = size };
+    return 0;
+}
+
+static inline int jit_add_code(Jit* jit, const CodeBuf* code, JitCode* out)
+{
+    if (jit->codes_size == jit->codes_capacity) {
+        size_t capacity
+            = jit->codes_capacity == 0 ? 16 : jit->codes_capacity * 2;
+        JitCode* codes = realloc(jit->codes, capacity * sizeof(JitCode));
+        if (!codes)
+            return -1;
+        jit->codes = codes;
+        jit->codes_capacity = capacity;
+    }
+    if (code_map(code, out) != 0)
+        return -1;
+    jit->codes[jit->codes_size++] = *out;
+    return 0;
+}
+
+static inline int jit_compile(Jit* jit, size_t entry)
+{
+    int result = -1;
+    size_t insts_size = jit->program->insts_size;
+
+    Compiler c = {
+        .jit = jit,
+        .code = { 0 },
+        .insts = malloc(JIT_MAX_FUNCTION_SIZE * sizeof(size_t)),
+        .insts_size = 0,
+        .in_function = calloc(insts_size, sizeof(bool)),
+        .offsets = malloc(insts_size * sizeof(size_t)),
+        // Every instruction has at most an exit for the budget or a
+        // division, a jump, and a jump to the next instruction after it.
+        .fixups = malloc(3 * JIT_MAX_FUNCTION_SIZE * sizeof(Fixup)),
+        .fixups_size = 0,
+    };
+    if (!c.insts || !c.in_function || !c.offsets || !c.fixups)
+        goto l0_return;
+
+    compiler_discover(&c, entry);
+    qsort(c.insts, c.insts_size, sizeof(size_t), compare_indices);
+
+    for (size_t i = 0; i < c.insts_size; ++i) {
+        size_t index = c.insts[i];
+        c.offsets[index] = c.code.size;
+        compiler_inst(&c, index);
+        bool next_emitted = i + 1 < c.insts_size && c.insts[i + 1] == index + 1;
+        if (op_falls_through(compiler_op(&c, index)) && !next_emitted)
+            compiler_jmp(&c, index + 1);
+    }
+
+    size_t epilogue = c.code.size;
+    // pop r13; pop r12; pop rbx; ret
+    EMIT(&c.code, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+
+    for (size_t i = 0; i < c.fixups_size; ++i) {
+        size_t target = c.fixups[i].target;
+        size_t target_offset;
+        if (target == EPILOGUE) {
+            target_offset = epilogue;
+        } else if (c.in_function[target]) {
+            target_offset = c.offsets[target];
+        } else {
+            // Leaves the function, either into another compiled function, or
+            // back to the interpreter.
+            target_offset = c.code.size;
+            const uint8_t* other = jit->entries[target];
+            if (other) {
+                movabs_rcx(&c.code, (uint64_t)other);
+                // jmp rcx
+                EMIT(&c.code, 0xff, 0xe1);
+            } else {
+                movabs_rax(&c.code, (uint64_t)&jit->program->insts[target]);
+                EMIT(&c.code, 0xe9);
+                emit_u32(&c.code, (uint32_t)(epilogue - (c.code.size + 4)));
+            }
+        }
+        if (c.code.failed)
+            goto l0_return;
+        uint32_t rel = (uint32_t)(target_offset - (c.fixups[i].at + 4));
+        for (size_t b = 0; b < 4; ++b)
+            c.code.data[c.fixups[i].at + b] = (uint8_t)(rel >> (b * 8));
+    }
+    if (c.code.failed)
+        goto l0_return;
+
+    JitCode mapped;
+    if (jit_add_code(jit, &c.code, &mapped) != 0)
+        goto l0_return;
+    for (size_t i = 0; i < c.insts_size; ++i) {
+        size_t index = c.insts[i];
+        jit->entries[index] = &mapped.data[c.offsets[index]];
+    }
+    result = 0;
+
+l0_return:
+    free(c.code.data);
+    free(c.insts);
+    free(c.in_function);
+    free(c.offsets);
+    free(c.fixups);
+    return result;
+}
+
+int jit_construct(Jit* jit, const Program* program)
+{
+    *jit = (Jit) {
+        .program = program,
+        .entries = calloc(program->insts_size, sizeof(const uint8_t*)),
+        .calls = calloc(program->insts_size, sizeof(uint32_t)),
+        .codes = NULL,
+        .codes_size = 0,
+        .codes_capacity = 0,
+        .trampoline = { 0 },
+    };
+    if (!jit->entries || !jit->calls)
+        return -1;
+
+    CodeBuf code = { 0 };
+    // The extra push keeps the stack 16 byte aligned for helper calls.
+    //
+    // push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi; jmp rdx
+    EMIT(&code, 0x53, 0x41, 0x54, 0x41, 0x55);
+    EMIT(&code, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4, 0xff, 0xe2);
+    int res = code.failed ? -1 : jit_add_code(jit, &code, &jit->trampoline);
+    free(code.data);
+    return res;
+}
+
+void jit_destroy(Jit* jit)
+{
+    for (size_t i = 0; i < jit->codes_size; ++i) {
+        munmap(jit->codes[i].data, jit->codes[i].size);
+    }
+    free(jit->codes);
+    free(jit->entries);
+    free(jit->calls);
+}
+
+const void* jit_call(Jit* jit, const Inst* target)
+{
+    size_t index = (size_t)(target - jit->program->insts);
+    if (jit->entries[index])
+        return jit->entries[index];
+    if (jit->calls[index] == JIT_CALL_THRESHOLD)
+        return NULL;
+    jit->calls[index] += 1;
+    if (jit->calls[index] < JIT_CALL_THRESHOLD)
+        return NULL;
+    if (jit_compile(jit, index) != 0)
+        return NULL;
+    return jit->entries[index];
+}
+
+const void* jit_entry(const Jit* jit, const Inst* inst)
+{
+    return jit->entries[inst - jit->program->insts];
+}
+
+const Inst* jit_run(
+    const Jit* jit, const void* entry, Regs* regs, JitFrame* frame)
+{
+    JitFn fn;
+    memcpy(&fn, &jit->trampoline.data, sizeof(fn));
+    return fn(regs, frame, entry);
+}
+
+#endif
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+#include <math.h>
+
+static const _Alignas(8) uint8_t test_jit_data[16] = { 0x01, 0x82, 0x03, 0x84, 0x05,
+    0x86, 0x07, 0x88, 0x09, 0x8a, 0x0b, 0x8c, 0x0d, 0x8e, 0x0f, 0x90 };
+
+/// Register holding the body's stack base, the first word of which is
+/// scratch memory.
+#define TEST_JIT_SB 30
+/// Register every result is mixed into.
+#define TEST_JIT_SUM 31
+
+static inline void test_jit_mix(TestCode* code, Reg reg)
+{
+    test_emit(code, Op_IMulI, TEST_JIT_SUM, TEST_JIT_SUM, 0, 1000003);
+    test_emit(code, Op_Add, TEST_JIT_SUM, TEST_JIT_SUM, reg, 0);
+}
+
+/// Mixes the bits of a float register.
+static inline void test_jit_mix_f(TestCode* code, Reg reg)
+{
+    test_emit(code, Op_StoreF, TEST_JIT_SB, reg, 0, 0);
+    test_emit(code, Op_Load64, 5, TEST_JIT_SB, 0, 0);
+    test_jit_mix(code, 5);
+}
+
+/// Emits a function which runs every op on `a`, `b`, `c`, `x` and `y` in
+/// `%ireg` 1 to 3 and `%freg` 1 and 2, and mixes the results into
+/// `TEST_JIT_SUM`. Loops run `c` times, divisions by `b` are last, and the
+/// function halts instead of returning if `c` is 3.
+static inline void test_jit_body(TestCode* code, size_t leaf)
+{
+    test_emit(code, Op_Nop, 0, 0, 0, 0);
+    test_emit(code, Op_Alloca, 0, 0, 0, 16);
+    test_emit(code, Op_LoadSb, TEST_JIT_SB, 0, 0, 0);
+    test_emit(code, Op_LoadSp, 5, 0, 0, 0);
+    test_emit(code, Op_Sub, 5, 5, TEST_JIT_SB, 0);
+    test_jit_mix(code, 5);
+
+    // Builtins and calls hand over to the interpreter and back.
+    test_emit(code, Op_MovII, 20, 1, 0, 0);
+    test_emit(code, Op_LoadImm32, 1, 0, 0, 1);
+    test_emit(code, Op_Builtin, 0, 0, 0, Builtin_FsFlush);
+    test_emit(code, Op_MovII, 1, 20, 0, 0);
+    test_emit(code, Op_LoadImm32, 4, 0, 0, leaf);
+    test_emit(code, Op_MovII, 0, 1, 0, 0);
+    test_emit(code, Op_Call, 0, 4, 0, 0);
+    test_jit_mix(code, 0);
+    test_emit(code, Op_CallI, 0, 0, 0, leaf);
+    test_jit_mix(code, 0);
+
+    const Op int_ops[] = { Op_Eq, Op_Ne, Op_Lt, Op_Gt, Op_Lte, Op_Gte, Op_And,
+        Op_Or, Op_Xor, Op_Add, Op_Sub, Op_Mul, Op_IMul };
+    for (size_t i = 0; i < sizeof(int_ops) / sizeof(int_ops[0]); ++i) {
+        test_emit(code, int_ops[i], 5, 1, 2, 0);
+        test_jit_mix(code, 5);
+    }
+    const Op imm_ops[] = { Op_EqI, Op_NeI, Op_LtI, Op_GtI, Op_LteI, Op_GteI,
+        Op_AndI, Op_OrI, Op_XorI, Op_AddI, Op_SubI, Op_MulI, Op_DivI, Op_RemI,
+        Op_IMulI, Op_IDivI };
+    for (size_t i = 0; i < sizeof(imm_ops) / sizeof(imm_ops[0]); ++i) {
+        test_emit(code, imm_ops[i], 5, 1, 0, 7);
+        test_jit_mix(code, 5);
+        // `%i32` is zero extended.
+        test_emit(code, imm_ops[i], 5, 2, 0, 0xfffffff9);
+        test_jit_mix(code, 5);
+    }
+    test_emit(code, Op_RSubI, 5, 0, 2, 100);
+    test_jit_mix(code, 5);
+
+    const Op float_cmp_ops[]
+        = { Op_EqF, Op_NeF, Op_LtF, Op_GtF, Op_LteF, Op_GteF };
+    const Op float_imm_cmp_ops[]
+        = { Op_EqFI, Op_NeFI, Op_LtFI, Op_GtFI, Op_LteFI, Op_GteFI };
+    for (size_t i = 0; i < 6; ++i) {
+        test_emit(code, float_cmp_ops[i], 5, 1, 2, 0);
+        test_jit_mix(code, 5);
+        test_emit(code, float_imm_cmp_ops[i], 5, 1, 0, test_f64(1.5));
+        test_jit_mix(code, 5);
+    }
+    const Op float_ops[] = { Op_AddF, Op_SubF, Op_MulF, Op_DivF };
+    const Op float_imm_ops[] = { Op_AddFI, Op_SubFI, Op_MulFI, Op_DivFI };
+    for (size_t i = 0; i < 4; ++i) {
+        test_emit(code, float_ops[i], 3, 1, 2, 0);
+        test_jit_mix_f(code, 3);
+        test_emit(code, float_imm_ops[i], 3, 1, 0, test_f64(-0.75));
+        test_jit_mix_f(code, 3);
+    }
+    test_emit(code, Op_RSubFI, 3, 0, 2, test_f64(2.25));
+    test_jit_mix_f(code, 3);
+
+    test_emit(code, Op_MovIF, 4, 1, 0, 0);
+    test_jit_mix_f(code, 4);
+    test_emit(code, Op_MovIF, 4, 3, 0, 0);
+    test_emit(code, Op_MovFF, 5, 4, 0, 0);
+    test_emit(code, Op_LoadImmF, 6, 0, 0, test_f64(12345.75));
+    test_emit(code, Op_AddF, 6, 6, 5, 0);
+    // Only converts values that fit, which C leaves undefined otherwise.
+    test_emit(code, Op_MovFI, 5, 6, 0, 0);
+    test_jit_mix(code, 5);
+    test_emit(code, Op_LoadImm64, 5, 0, 0, 0x123456789abcdef0);
+    test_jit_mix(code, 5);
+
+    // Stores of each size into a word, which is then read back whole.
+    test_emit(code, Op_AddI, 7, TEST_JIT_SB, 0, 8);
+    const Op store_ops[] = { Op_Store8, Op_Store16, Op_Store32 };
+    const Op load_ops[] = { Op_Load8, Op_Load16, Op_Load32, Op_Load64 };
+    for (size_t i = 0; i < 3; ++i) {
+        test_emit(code, Op_Store64, 7, 1, 0, 0);
+        test_emit(code, store_ops[i], 7, 2, 0, 0);
+        test_emit(code, Op_Load64, 5, 7, 0, 0);
+        test_jit_mix(code, 5);
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        test_emit(code, load_ops[i], 5, 7, 0, 0);
+        test_jit_mix(code, 5);
+    }
+    test_emit(code, Op_StoreF, 7, 1, 0, 0);
+    test_emit(code, Op_LoadF, 7, 7, 0, 0);
+    test_jit_mix_f(code, 7);
+
+    // Indexed stores and loads at `sb + 2 * 8`.
+    test_emit(code, Op_LoadImm32, 8, 0, 0, 2);
+    const Op store_a_ops[] = { Op_StoreA8, Op_StoreA16, Op_StoreA32 };
+    const Op load_a_ops[]
+        = { Op_LoadA8, Op_LoadA16, Op_LoadA32, Op_LoadA64 };
+    for (size_t i = 0; i < 3; ++i) {
+        test_emit(code, Op_StoreA64, TEST_JIT_SB, 1, 8, 8);
+        test_emit(code, store_a_ops[i], TEST_JIT_SB, 2, 8, 8);
+        test_emit(code, Op_Load64, 5, TEST_JIT_SB, 0, 0);
+        test_emit(code, Op_LoadA64, 5, TEST_JIT_SB, 8, 8);
+        test_jit_mix(code, 5);
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        test_emit(code, load_a_ops[i], 5, TEST_JIT_SB, 8, 8);
+        test_jit_mix(code, 5);
+    }
+    test_emit(code, Op_StoreAF, TEST_JIT_SB, 2, 8, 8);
+    test_emit(code, Op_LoadAF, 7, TEST_JIT_SB, 8, 8);
+    test_jit_mix_f(code, 7);
+    // Fused into `LoadA64Mul`.
+    test_emit(code, Op_LoadA64, 5, TEST_JIT_SB, 8, 8);
+    test_emit(code, Op_Mul, 9, 5, 2, 0);
+    test_jit_mix(code, 9);
+
+    uint64_t data = (uint64_t)(uintptr_t)test_jit_data;
+    const Op load_i_ops[]
+        = { Op_LoadI8, Op_LoadI16, Op_LoadI32, Op_LoadI64 };
+    for (size_t i = 0; i < 4; ++i) {
+        test_emit(code, load_i_ops[i], 5, 0, 0, data);
+        test_jit_mix(code, 5);
+    }
+    test_emit(code, Op_LoadIF, 7, 0, 0, data);
+    test_jit_mix_f(code, 7);
+
+    test_emit(code, Op_Push, 0, 1, 0, 0);
+    test_emit(code, Op_PushF, 0, 1, 0, 0);
+    test_emit(code, Op_LoadSp, 5, 0, 0, 0);
+    test_emit(code, Op_Sub, 5, 5, TEST_JIT_SB, 0);
+    test_jit_mix(code, 5);
+    test_emit(code, Op_PopF, 8, 0, 0, 0);
+    test_emit(code, Op_Pop, 9, 0, 0, 0);
+    test_jit_mix(code, 9);
+    test_jit_mix_f(code, 8);
+
+    // Fused into `AddMovII`.
+    test_emit(code, Op_Add, 5, 1, 2, 0);
+    test_emit(code, Op_MovII, 6, 5, 0, 0);
+    test_jit_mix(code, 6);
+
+    size_t jmp = test_emit(code, Op_Jmp, 0, 0, 0, 0);
+    test_emit(code, Op_AddI, TEST_JIT_SUM, TEST_JIT_SUM, 0, 1);
+    test_patch(code, jmp);
+    // Not fused, since the register is not set by a compare.
+    for (size_t branch = 0; branch < 2; ++branch) {
+        test_emit(code, Op_MovII, 10, 3, 0, 0);
+        size_t jump = test_emit(
+            code, branch == 0 ? Op_Jz : Op_Jnz, 0, 10, 0, 0);
+        test_emit(code, Op_AddI, 11, 11, 0, 1 + branch);
+        test_patch(code, jump);
+        test_jit_mix(code, 11);
+    }
+
+    // Fused into every compare and branch.
+    const Op cmp_ops[][2] = {
+        { Op_Eq, Op_EqI },
+        { Op_Ne, Op_NeI },
+        { Op_Lt, Op_LtI },
+        { Op_Gt, Op_GtI },
+        { Op_Lte, Op_LteI },
+        { Op_Gte, Op_GteI },
+    };
+    for (size_t i = 0; i < 6; ++i) {
+        for (size_t imm = 0; imm < 2; ++imm) {
+            for (size_t branch = 0; branch < 2; ++branch) {
+                if (imm == 0)
+                    test_emit(code, cmp_ops[i][0], 10, 1, 2, 0);
+                else
+                    test_emit(code, cmp_ops[i][1], 10, 3, 0, 1);
+                size_t jump = test_emit(
+                    code, branch == 0 ? Op_Jz : Op_Jnz, 0, 10, 0, 0);
+                test_emit(code, Op_AddI, 11, 11, 0, i * 4 + imm * 2 + branch);
+                test_patch(code, jump);
+                test_jit_mix(code, 10);
+                test_jit_mix(code, 11);
+            }
+        }
+    }
+
+    // Loops jump backwards, which takes steps from the budget. This one is
+    // fused into `AddILtIJnz`.
+    test_emit(code, Op_LoadImm32, 12, 0, 0, 0);
+    size_t loop = code->size;
+    test_emit(code, Op_AddI, 12, 12, 0, 1);
+    test_emit(code, Op_LtI, 13, 12, 0, 5);
+    test_emit(code, Op_Jnz, 0, 13, 0, loop);
+    test_jit_mix(code, 12);
+    // Fused into `GteJnz` and `AddIJmp`, running `c` times.
+    test_emit(code, Op_LoadImm32, 14, 0, 0, 0);
+    loop = code->size;
+    test_emit(code, Op_Gte, 15, 14, 3, 0);
+    size_t exit = test_emit(code, Op_Jnz, 0, 15, 0, 0);
+    test_emit(code, Op_AddI, 14, 14, 0, 1);
+    test_emit(code, Op_Jmp, 0, 0, 0, loop);
+    test_patch(code, exit);
+    test_jit_mix(code, 14);
+
+    test_emit(code, Op_Div, 5, 1, 2, 0);
+    test_jit_mix(code, 5);
+    test_emit(code, Op_Rem, 5, 1, 2, 0);
+    test_jit_mix(code, 5);
+    test_emit(code, Op_IDiv, 5, 1, 2, 0);
+    test_jit_mix(code, 5);
+
+    test_emit(code, Op_EqI, 5, 3, 0, 3);
+    size_t skip = test_emit(code, Op_Jz, 0, 5, 0, 0);
+    test_emit(code, Op_Halt, 0, 0, 0, 0);
+    test_patch(code, skip);
+    test_emit(code, Op_Ret, 0, 0, 0, 0);
+}
+
+typedef struct {
+    int result;
+    Regs regs;
+} TestJitRun;
+
+static inline TestJitRun test_jit_run(VM* vm,
+    const Program* program,
+    const uint64_t* ints,
+    const double* floats,
+    uint64_t budget)
+{
+    TestJitRun run = {
+        .result = 0,
+        .regs = { .iregs = { 0 }, .fregs = { 0.0 }, .budget = budget },
+    };
+    for (size_t i = 0; i < 3; ++i)
+        run.regs.iregs[1 + i] = ints[i];
+    for (size_t i = 0; i < 2; ++i)
+        run.regs.fregs[1 + i] = floats[i];
+    run.result = vm_call(vm, program, program->insts, &run.regs);
+    return run;
+}
+
+/// Whether both runs failed, or both succeeded with the same registers.
+/// Registers are compared bitwise, so that NaNs compare equal.
+static inline bool test_jit_same(const TestJitRun* a, const TestJitRun* b)
+{
+    if (a->result != b->result)
+        return false;
+    return a->result != 0 || memcmp(&a->regs, &b->regs, sizeof(Regs)) == 0;
+}
+
+/// Runs a function covering every op, including the superinstructions, once
+/// compiled by the JIT and once interpreted, and checks that both give the
+/// same registers, or fail the same way on running out of budget and on
+/// division by zero. In builds without the JIT, both are interpreted.
+void test_jit_ops(void)
+{
+    TestCode code = { .size = 0 };
+    // main() calls the body and returns, leaf() is called by the body.
+    size_t main_call = test_emit(&code, Op_CallI, 0, 0, 0, 0);
+    test_emit(&code, Op_Ret, 0, 0, 0, 0);
+    size_t leaf = code.size;
+    test_emit(&code, Op_MulI, 0, 0, 0, 3);
+    test_emit(&code, Op_AddI, 0, 0, 0, 1);
+    test_emit(&code, Op_Ret, 0, 0, 0, 0);
+    test_patch(&code, main_call);
+    size_t body = code.size;
+    test_jit_body(&code, leaf);
+
+    for (size_t op = 0; op < Op_Count; ++op)
+        TEST_ASSERT(code.emitted[op], "every op should be tested");
+
+    VM vm;
+    TEST_ASSERT(vm_construct(&vm) == 0, "vm should be constructed");
+    Program compiled;
+    Program interpreted;
+    TEST_ASSERT(program_decode(&compiled, code.words, code.size) == 0
+            && program_decode(&interpreted, code.words, code.size) == 0,
+        "test program should decode");
+
+#ifndef VM_NO_FUSION
+    bool fused[UINT8_MAX + 1] = { false };
+    for (size_t i = 0; i < interpreted.insts_size; ++i)
+        fused[interpreted.insts[i].op] = true;
+#define TEST_JIT_FUSED(NAME, LENGTH, FIRST)                                    \
+    TEST_ASSERT(fused[Op_##NAME], "`" #NAME "` should be tested");
+    VM_FUSED_OP_LIST(TEST_JIT_FUSED)
+#undef TEST_JIT_FUSED
+#endif
+
+#ifdef VM_JIT
+    if (interpreted.jit) {
+        jit_destroy(interpreted.jit);
+        free(interpreted.jit);
+        interpreted.jit = NULL;
+    }
+    Jit* jit = compiled.jit;
+    TEST_ASSERT(jit, "jit should be set up");
+    const size_t functions[] = { leaf, body };
+    for (size_t i = 0; i < 2; ++i) {
+        const Inst* entry = program_inst_at(&compiled, functions[i]);
+        for (size_t calls = 0; calls < JIT_CALL_THRESHOLD; ++calls)
+            jit_call(jit, entry);
+        TEST_ASSERT(jit_entry(jit, entry), "test function should compile");
+    }
+#else
+    (void)body;
+#endif
+
+    const uint64_t ints[] = { 0, 1, 2, 7, 1000, (uint64_t)INT64_MAX,
+        (uint64_t)INT64_MIN, UINT64_MAX };
+    const double floats[] = { 0.0, -2.5, 1.5, NAN, INFINITY };
+    const size_t ints_size = sizeof(ints) / sizeof(ints[0]);
+    const size_t floats_size = sizeof(floats) / sizeof(floats[0]);
+
+    size_t failures = 0;
+    for (size_t a = 0; a < ints_size; ++a) {
+        for (size_t b = 0; b < ints_size; ++b) {
+            for (size_t x = 0; x < floats_size; ++x) {
+                uint64_t args[] = { ints[a], ints[b], (a + b + x) % 6 };
+                double fargs[] = { floats[x], floats[(a + x) % floats_size] };
+                TestJitRun expected = test_jit_run(
+                    &vm, &interpreted, args, fargs, UINT64_MAX);
+                TestJitRun actual
+                    = test_jit_run(&vm, &compiled, args, fargs, UINT64_MAX);
+                TEST_ASSERT(test_jit_same(&expected, &actual),
+                    "compiled and interpreted runs should match");
+                failures += expected.result != 0 ? 1 : 0;
+            }
+        }
+    }
+    // Division by 0 and `INT64_MIN / -1`.
+    TEST_ASSERT(failures == floats_size * (ints_size + 1),
+        "divisions should fail the run");
+
+    // Stops at every step, until the run completes.
+    uint64_t args[] = { 7, 2, 5 };
+    double fargs[] = { 1.5, -2.5 };
+    uint64_t budget = 0;
+    for (;; ++budget) {
+        TestJitRun expected
+            = test_jit_run(&vm, &interpreted, args, fargs, budget);
+        TestJitRun actual = test_jit_run(&vm, &compiled, args, fargs, budget);
+        TEST_ASSERT(test_jit_same(&expected, &actual),
+            "compiled and interpreted runs should run out of budget alike");
+        if (expected.result == 0)
+            break;
+        TEST_ASSERT(budget < 64, "run should complete within its budget");
+    }
+    // Three calls, and a jump back per iteration of each loop.
+    TEST_ASSERT(budget == 3 + 5 + 5, "run should take a step per jump back");
+
+    program_destroy(&compiled);
+    program_destroy(&interpreted);
+    vm_destroy(&vm);
+}
+#endif
@@ -0,0 +1,85 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// Baseline JIT compiler for x86-64.
+///
+/// Functions are compiled once they have been called `JIT_CALL_THRESHOLD`
+/// times. Every instruction is compiled by copying a fixed machine code
+/// template for its op, and patching the register offsets, immediates and
+/// jump targets into it. The registers are not allocated to host registers.
+/// Instead, the `Regs` block is pinned in `rbx`, so that compiled code and the
+/// interpreter share the same register state, and can hand over to each other
+/// at any instruction.
+///
+/// Compiled code returns to the interpreter at instructions it can't run
+/// itself, ie. `Call`, `CallI`, `Ret` and `Halt`. The interpreter enters
+/// compiled code again when calling a compiled function, and when returning
+/// into one.
+///
+/// Define `VM_NO_JIT` to only use the interpreter. Profiling builds (see
+/// `profile.h`) only use the interpreter too.
+#if defined(__x86_64__) && defined(__linux__) && !defined(VM_NO_JIT)          \
+    && !defined(VM_PROFILE)
+#define VM_JIT
+#endif
+
+#ifndef JIT_CALL_THRESHOLD
+#define JIT_CALL_THRESHOLD 64
+#endif
+
+/// Max instructions compiled for one function.
+#define JIT_MAX_FUNCTION_SIZE 4096
+
+/// Stack registers, which compiled code reads and updates through `r12`.
+typedef struct {
+    uint64_t* sb;
+    uint64_t* sp;
+} JitFrame;
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+} JitCode;
+
+typedef struct Jit {
+    const Program* program;
+    /// Native code address per instruction, NULL if not compiled.
+    const uint8_t** entries;
+    /// Times called per instruction. Is `JIT_CALL_THRESHOLD` for functions
+    /// that failed to compile.
+    uint32_t* calls;
+    /// Executable mappings.
+    JitCode* codes;
+    size_t codes_size;
+    size_t codes_capacity;
+    /// Enters compiled code, see `jit_run`.
+    JitCode trampoline;
+} Jit;
+
+/// Returns -1 if the JIT isn't supported or can't allocate. The `Jit` can be
+/// destroyed either way.
+int jit_construct(Jit* jit, const Program* program);
+void jit_destroy(Jit* jit);
+
+/// Counts a call to `target`, and compiles the function starting at it when
+/// it becomes hot. Returns the native code for `target`, or NULL if it is
+/// not compiled.
+const void* jit_call(Jit* jit, const Inst* target);
+
+/// Returns the native code for `inst`, or NULL if it is not compiled.
+const void* jit_entry(const Jit* jit, const Inst* inst);
+
+/// Runs compiled code starting at `entry`, until it reaches an instruction
+/// it can't run. Returns that instruction.
+const Inst* jit_run(
+    const Jit* jit, const void* entry, Regs* regs, JitFrame* frame);
+
+#ifdef INCLUDE_TESTS
+void test_jit_ops(void);
+#endif
+
+#endif
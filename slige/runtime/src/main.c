@@ -1,6 +1,124 @@
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "module.h"
+#include "profile.h"
+#include "slige.h"
+#include "stack.h"
+#include "vm.h"
 #include <stdio.h>
+#include <string.h>
+
+#ifdef VM_PROFILE
+/// Writes `<prefix>.folded` and `<prefix>.json`.
+static inline int write_profile(
+    const Profile* profile, const Module* module, const char* prefix)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+        goto l0_error;
+    profile_write_collapsed(profile, module, fp);
+    fclose(fp);
+
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    fp = fopen(path, "w");
+    if (!fp)
+        goto l0_error;
+    profile_write_json(profile, module, fp);
+    fclose(fp);
+    return 0;
 
-int main(void)
+l0_error:
+    fprintf(stderr, "error: could not write profile '%s'\n", path);
+    return -1;
+}
+#endif
+
+static inline int run_tests(void)
 {
-    printf("hello world\n");
+#ifdef INCLUDE_TESTS
+    test_verify_programs();
+    test_module_load();
+    test_vm_files();
+    test_stack_overflow();
+#ifdef VM_PROFILE
+    test_profile_counts();
+#endif
+    test_jit_ops();
+    test_slige_division();
+    test_slige_imports();
+    printf("all tests passed\n");
+    return 0;
+#else
+    fprintf(stderr,
+        "error: '--run-tests' passed without building with INCLUDE_TESTS=1\n");
+    return 1;
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && strcmp(argv[1], "--run-tests") == 0)
+        return run_tests();
+
+    const char* path = NULL;
+    const char* profile_prefix = NULL;
+    if (argc == 2) {
+        path = argv[1];
+    } else if (argc == 4 && strcmp(argv[1], "--profile") == 0) {
+        profile_prefix = argv[2];
+        path = argv[3];
+    } else {
+        fprintf(stderr, "usage: %s [--profile <prefix>] <module>\n", argv[0]);
+        return 1;
+    }
+#ifndef VM_PROFILE
+    if (profile_prefix) {
+        fprintf(stderr, "error: built without profiling, see `PROFILE=1`\n");
+        return 1;
+    }
+#endif
+
+    int result = 1;
+
+    Module module;
+    if (module_open(&module, path) != 0)
+        goto l0_return;
+
+    Program program;
+    if (module_decode(&module, &program) != 0)
+        goto l1_return;
+
+    VM vm;
+    if (vm_construct(&vm) != 0) {
+        fprintf(stderr, "error: could not construct vm\n");
+        program_destroy(&program);
+        goto l1_return;
+    }
+#ifdef VM_PROFILE
+    Profile profile;
+    if (profile_prefix) {
+        if (profile_construct(&profile, &program) != 0)
+            goto l2_return;
+        vm.profile = &profile;
+    }
+#endif
+    result = vm_run(&vm, &program) == 0 ? 0 : 1;
+#ifdef VM_PROFILE
+    if (profile_prefix) {
+        if (write_profile(&profile, &module, profile_prefix) != 0)
+            result = 1;
+        profile_destroy(&profile);
+    }
+l2_return:
+#endif
+    vm_destroy(&vm);
+
+    program_destroy(&program);
+l1_return:
+    module_close(&module);
+l0_return:
+    return result;
 }
@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "module.h"
+#include "vm.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "modules are mapped in place, which requires a little endian host"
+#endif
+
+int module_open(Module* module, const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "error: could not open module '%s'\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        fprintf(stderr, "error: could not read module '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "error: could not map module '%s'\n", path);
+        return -1;
+    }
+    if (module_load(module, data, size) != 0) {
+        munmap(data, size);
+        return -1;
+    }
+    module->mapped = true;
+    return 0;
+}
+
+static inline int module_load_section(
+    Module* module, const ModuleSection* section)
+{
+    if (section->offset % 8 != 0 || section->offset > module->size
+        || section->size > module->size - section->offset) {
+        fprintf(stderr, "error: module section out of bounds\n");
+        return -1;
+    }
+    const uint8_t* data = &module->data[section->offset];
+    size_t size = (size_t)section->size;
+
+    switch ((ModuleSectionKind)section->kind) {
+        case ModuleSectionKind_Code:
+            if (module->code || size % sizeof(uint32_t) != 0)
+                break;
+            module->code = (const uint32_t*)data;
+            module->code_size = size / sizeof(uint32_t);
+            return 0;
+        case ModuleSectionKind_RoData:
+            if (module->rodata)
+                break;
+            module->rodata = data;
+            module->rodata_size = size;
+            return 0;
+        case ModuleSectionKind_Strings:
+            if (module->strings || size == 0 || data[size - 1] != '\0')
+                break;
+            module->strings = (const char*)data;
+            module->strings_size = size;
+            return 0;
+        case ModuleSectionKind_Functions:
+            if (module->functions || size % sizeof(ModuleFunction) != 0)
+                break;
+            module->functions = (const ModuleFunction*)data;
+            module->functions_size = size / sizeof(ModuleFunction);
+            return 0;
+        case ModuleSectionKind_Relocs:
+            if (module->relocs || size % sizeof(ModuleReloc) != 0)
+                break;
+            module->relocs = (const ModuleReloc*)data;
+            module->relocs_size = size / sizeof(ModuleReloc);
+            return 0;
+        case ModuleSectionKind_Imports:
+            if (module->imports || size % sizeof(ModuleImport) != 0)
+                break;
+            module->imports = (const ModuleImport*)data;
+            module->imports_size = size / sizeof(ModuleImport);
+            return 0;
+        default:
+            // Unknown sections are skipped, so that sections can be added
+            // without breaking older runtimes.
+            return 0;
+    }
+    fprintf(stderr, "error: malformed module section %u\n", section->kind);
+    return -1;
+}
+
+int module_load(Module* module, const void* data, size_t size)
+{
+    *module = (Module) {
+        .data = data,
+        .size = size,
+        .mapped = false,
+        .header = data,
+        .code = NULL,
+        .code_size = 0,
+        .rodata = NULL,
+        .rodata_size = 0,
+        .strings = NULL,
+        .strings_size = 0,
+        .functions = NULL,
+        .functions_size = 0,
+        .relocs = NULL,
+        .relocs_size = 0,
+        .imports = NULL,
+        .imports_size = 0,
+    };
+
+    const ModuleHeader* header = module->header;
+    if ((uintptr_t)data % 8 != 0 || size < sizeof(ModuleHeader)
+        || memcmp(header->magic, MODULE_MAGIC, 4) != 0) {
+        fprintf(stderr, "error: not a module\n");
+        return -1;
+    }
+    if (header->version != MODULE_VERSION) {
+        fprintf(stderr,
+            "error: unsupported module version %u, expected %u\n",
+            header->version,
+            MODULE_VERSION);
+        return -1;
+    }
+    size_t sections_end = sizeof(ModuleHeader)
+        + (size_t)header->sections_size * sizeof(ModuleSection);
+    if (header->file_size != size
+        || header->sections_size > MODULE_MAX_SECTIONS || sections_end > size) {
+        fprintf(stderr, "error: malformed module header\n");
+        return -1;
+    }
+
+    const ModuleSection* sections = (const ModuleSection*)&header[1];
+    for (uint32_t i = 0; i < header->sections_size; ++i) {
+        if (module_load_section(module, &sections[i]) != 0)
+            return -1;
+    }
+    if (!module->code) {
+        fprintf(stderr, "error: module has no code\n");
+        return -1;
+    }
+    if (module->functions_size != 0
+        && (header->entry >= module->functions_size || !module->strings)) {
+        fprintf(stderr, "error: malformed module function table\n");
+        return -1;
+    }
+    if (module->imports_size != 0 && !module->strings) {
+        fprintf(stderr, "error: malformed module import table\n");
+        return -1;
+    }
+    return 0;
+}
+
+void module_close(Module* module)
+{
+    if (module->mapped)
+        munmap((void*)module->data, module->size);
+    *module = (Module) { 0 };
+}
+
+const char* module_function_name(
+    const Module* module, const ModuleFunction* function)
+{
+    if (function->name >= module->strings_size)
+        return NULL;
+    return &module->strings[function->name];
+}
+
+const char* module_import_name(
+    const Module* module, const ModuleImport* import)
+{
+    if (import->name >= module->strings_size)
+        return NULL;
+    return &module->strings[import->name];
+}
+
+const ModuleFunction* module_function(const Module* module, const char* name)
+{
+    for (size_t i = 0; i < module->functions_size; ++i) {
+        const char* function_name
+            = module_function_name(module, &module->functions[i]);
+        if (function_name && strcmp(function_name, name) == 0)
+            return &module->functions[i];
+    }
+    return NULL;
+}
+
+static inline int module_reloc_base(
+    const Module* module, uint32_t section, uint64_t* base)
+{
+    switch (section) {
+        case ModuleSectionKind_RoData:
+            *base = (uint64_t)module->rodata;
+            return module->rodata ? 0 : -1;
+        case ModuleSectionKind_Strings:
+            *base = (uint64_t)module->strings;
+            return module->strings ? 0 : -1;
+        default:
+            return -1;
+    }
+}
+
+int module_decode(const Module* module, Program* program)
+{
+    if (program_decode(program, module->code, module->code_size) != 0)
+        return -1;
+
+    for (size_t i = 0; i < module->relocs_size; ++i) {
+        const ModuleReloc* reloc = &module->relocs[i];
+        uint64_t base;
+        if (module_reloc_base(module, reloc->section, &base) != 0
+            || program_relocate(program, reloc->word, base) != 0) {
+            fprintf(stderr, "error: invalid relocation at %u\n", reloc->word);
+            goto l0_error;
+        }
+    }
+
+    if (module->functions_size != 0) {
+        const ModuleFunction* entry
+            = &module->functions[module->header->entry];
+        program->entry = program_inst_at(program, entry->word);
+        if (!program->entry) {
+            fprintf(stderr, "error: invalid entry function\n");
+            goto l0_error;
+        }
+    }
+    return 0;
+
+l0_error:
+    program_destroy(program);
+    return -1;
+}
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+
+typedef struct {
+    ModuleHeader header;
+    ModuleSection sections[5];
+    uint32_t code[6];
+    uint64_t rodata[2];
+    char strings[8];
+    ModuleFunction functions[1];
+    ModuleReloc relocs[1];
+} TestModule;
+
+static inline int test_module_decode(
+    const TestModule* data, size_t size, Program* program)
+{
+    Module module;
+    if (module_load(&module, data, size) != 0)
+        return -1;
+    return module_decode(&module, program);
+}
+
+/// Loads a module whose entry function reads a word of its read-only data
+/// through a relocated address, and malformed copies of it.
+void test_module_load(void)
+{
+    const TestModule valid = {
+        .header = {
+            .magic = MODULE_MAGIC,
+            .version = MODULE_VERSION,
+            .flags = 0,
+            .sections_size = 5,
+            .entry = 0,
+            .file_size = sizeof(TestModule),
+        },
+        .sections = {
+            { ModuleSectionKind_Code, 0, offsetof(TestModule, code),
+                sizeof(valid.code) },
+            { ModuleSectionKind_RoData, 0, offsetof(TestModule, rodata),
+                sizeof(valid.rodata) },
+            { ModuleSectionKind_Strings, 0, offsetof(TestModule, strings),
+                sizeof(valid.strings) },
+            { ModuleSectionKind_Functions, 0,
+                offsetof(TestModule, functions), sizeof(valid.functions) },
+            { ModuleSectionKind_Relocs, 0, offsetof(TestModule, relocs),
+                sizeof(valid.relocs) },
+        },
+        .code = {
+            // main() = rodata[1]
+            [0] = test_inst(Op_LoadImm64, 1, 0, 0),
+            [1] = sizeof(uint64_t),
+            [2] = 0,
+            [3] = test_inst(Op_Load64, 0, 1, 0),
+            [4] = test_inst(Op_Ret, 0, 0, 0),
+            // Pads the section to 8 bytes.
+            [5] = test_inst(Op_Halt, 0, 0, 0),
+        },
+        .rodata = { 1, 42 },
+        .strings = "main",
+        .functions = { { 0, 0 } },
+        .relocs = { { 0, ModuleSectionKind_RoData } },
+    };
+
+    Program program;
+    TEST_ASSERT(test_module_decode(&valid, sizeof(valid), &program) == 0,
+        "module should decode");
+    VM vm;
+    TEST_ASSERT(vm_construct(&vm) == 0, "vm should be constructed");
+    Regs regs = { 0 };
+    TEST_ASSERT(vm_call(&vm, &program, program.entry, &regs) == 0
+            && regs.iregs[0] == 42,
+        "relocated address should point into the read-only data");
+    vm_destroy(&vm);
+    program_destroy(&program);
+
+    TestModule module = valid;
+    module.header.magic[0] = 'X';
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "bad magic should be rejected");
+
+    module = valid;
+    module.header.version = MODULE_VERSION + 1;
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "unknown version should be rejected");
+
+    TEST_ASSERT(test_module_decode(&valid, sizeof(valid) - 8, &program) != 0,
+        "truncated file should be rejected");
+
+    module = valid;
+    module.sections[1].size = sizeof(valid.rodata) + sizeof(TestModule);
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "section past the end of the file should be rejected");
+
+    module = valid;
+    module.header.entry = 1;
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "entry past the function table should be rejected");
+
+    module = valid;
+    module.relocs[0].word = 6;
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "relocation past the code should be rejected");
+
+    module = valid;
+    module.relocs[0].word = 3;
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "relocation without a `%i64` immediate should be rejected");
+
+    module = valid;
+    module.relocs[0].section = ModuleSectionKind_Code;
+    TEST_ASSERT(test_module_decode(&module, sizeof(module), &program) != 0,
+        "relocation against the code should be rejected");
+}
+#endif
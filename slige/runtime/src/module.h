@@ -0,0 +1,134 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Module file format.
+///
+/// A module starts with a `ModuleHeader`, followed by a table of
+/// `ModuleSection`s, which locate the sections in the file. All values are
+/// little endian. Sections are aligned to 8 bytes, and each kind of section
+/// appears at most once.
+///
+/// ```
+/// ModuleHeader
+/// ModuleSection[sections_size]
+/// ... sections
+/// ```
+///
+/// The file is mapped read-only and used in place, so that processes running
+/// the same module share its pages. Addresses of `RoData` and `Strings` are
+/// only known after mapping, and are patched into the decoded instructions
+/// through the `Relocs` section, never into the file.
+///
+#define MODULE_MAGIC "SLGM"
+#define MODULE_VERSION 1
+#define MODULE_MAX_SECTIONS 16
+
+typedef struct {
+    /// `MODULE_MAGIC`.
+    char magic[4];
+    /// `MODULE_VERSION`.
+    uint16_t version;
+    uint16_t flags;
+    uint32_t sections_size;
+    /// Index into the function table of the function to run.
+    uint32_t entry;
+    /// Size of the whole file in bytes.
+    uint64_t file_size;
+} ModuleHeader;
+
+typedef enum {
+    /// Instructions, encoded as described by `VM_OP_LIST`.
+    ModuleSectionKind_Code = 1,
+    /// Read-only data.
+    ModuleSectionKind_RoData = 2,
+    /// NUL-terminated strings. Names in the function table are offsets into
+    /// this section.
+    ModuleSectionKind_Strings = 3,
+    /// `ModuleFunction[]`.
+    ModuleSectionKind_Functions = 4,
+    /// `ModuleReloc[]`.
+    ModuleSectionKind_Relocs = 5,
+    /// `ModuleImport[]`. Host functions called through `Builtin_HostCall`,
+    /// which takes an index into this table.
+    ModuleSectionKind_Imports = 6,
+} ModuleSectionKind;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    /// Offset in bytes from the start of the file.
+    uint64_t offset;
+    uint64_t size;
+} ModuleSection;
+
+typedef struct {
+    /// Offset of the name in the string section.
+    uint32_t name;
+    /// Offset in words of the first instruction in the code section.
+    uint32_t word;
+} ModuleFunction;
+
+typedef struct {
+    /// Offset in words of an instruction with a `%i64` immediate.
+    uint32_t word;
+    /// `ModuleSectionKind_RoData` or `ModuleSectionKind_Strings`. The address
+    /// of the section is added to the immediate.
+    uint32_t section;
+} ModuleReloc;
+
+typedef struct {
+    /// Offset of the name in the string section.
+    uint32_t name;
+} ModuleImport;
+
+/// Loaded module. Points into the mapped file.
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    /// Whether `data` is owned by the module, and unmapped by `module_close`.
+    bool mapped;
+    const ModuleHeader* header;
+    const uint32_t* code;
+    size_t code_size;
+    const uint8_t* rodata;
+    size_t rodata_size;
+    const char* strings;
+    size_t strings_size;
+    const ModuleFunction* functions;
+    size_t functions_size;
+    const ModuleReloc* relocs;
+    size_t relocs_size;
+    const ModuleImport* imports;
+    size_t imports_size;
+} Module;
+
+/// Maps the module file at `path`. Only the header and section table are
+/// read. Returns -1 if the file can't be mapped or is malformed.
+int module_open(Module* module, const char* path);
+/// Loads a module from `size` bytes at `data`, without copying. `data` must
+/// outlive the module, and be aligned to 8 bytes.
+int module_load(Module* module, const void* data, size_t size);
+void module_close(Module* module);
+
+/// Returns NULL if there is no function called `name`.
+const ModuleFunction* module_function(const Module* module, const char* name);
+const char* module_function_name(
+    const Module* module, const ModuleFunction* function);
+/// Returns NULL if the name is out of bounds.
+const char* module_import_name(
+    const Module* module, const ModuleImport* import);
+
+/// Decodes the module's code, and applies the relocations. The program starts
+/// at the module's entry function.
+int module_decode(const Module* module, Program* program);
+
+#ifdef INCLUDE_TESTS
+void test_module_load(void);
+#endif
+
+#endif
@@ -0,0 +1,372 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "profile.h"
+#include "module.h"
+#include "vm.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/// Number of op pairs written by `profile_write_json`.
+#define PROFILE_TOP_PAIRS 64
+
+static const char* const op_names[PROFILE_OPS] = {
+#define VM_OP_NAME(NAME, FORMAT, DST, LEFT, RIGHT) [Op_##NAME] = #NAME,
+    VM_OP_LIST(VM_OP_NAME)
+#undef VM_OP_NAME
+#define VM_FUSED_OP_NAME(NAME, LENGTH, FIRST) [Op_##NAME] = #NAME,
+    VM_FUSED_OP_LIST(VM_FUSED_OP_NAME)
+#undef VM_FUSED_OP_NAME
+};
+
+int profile_construct(Profile* profile, const Program* program)
+{
+    *profile = (Profile) {
+        .program = program,
+        .op_counts = { 0 },
+        .op_cycles = { 0 },
+        .pair_counts = calloc(PROFILE_OPS * PROFILE_OPS, sizeof(uint64_t)),
+        .functions = calloc(program->insts_size, sizeof(ProfileFunction)),
+        .frames = malloc(CALL_STACK_SIZE * sizeof(ProfileFrame)),
+        .frames_size = 0,
+        .frames_dropped = 0,
+        .last_op = Op_Nop,
+        .last_time = 0,
+        .next_sample = 0,
+        .samples = NULL,
+        .samples_size = 0,
+        .samples_capacity = 0,
+    };
+    if (!profile->pair_counts || !profile->functions || !profile->frames) {
+        profile_destroy(profile);
+        return -1;
+    }
+    return 0;
+}
+
+void profile_destroy(Profile* profile)
+{
+    free(profile->pair_counts);
+    free(profile->functions);
+    free(profile->frames);
+    free(profile->samples);
+    *profile = (Profile) { 0 };
+}
+
+uint64_t profile_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    // Nanoseconds stand in for cycles where there is no cycle counter.
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void profile_start(Profile* profile, const Inst* entry)
+{
+    profile->last_time = profile_now();
+    profile->next_sample = profile->last_time + PROFILE_SAMPLE_CYCLES;
+    profile_call(profile, entry);
+}
+
+void profile_sample(Profile* profile, uint8_t op)
+{
+    profile->next_sample += PROFILE_SAMPLE_CYCLES;
+    if (profile->next_sample < profile->last_time)
+        profile->next_sample = profile->last_time + PROFILE_SAMPLE_CYCLES;
+
+    size_t needed = profile->samples_size + profile->frames_size + 2;
+    if (needed > profile->samples_capacity) {
+        size_t capacity = profile->samples_capacity * 2;
+        if (capacity < needed)
+            capacity = needed + 1024;
+        uint32_t* samples
+            = realloc(profile->samples, capacity * sizeof(uint32_t));
+        // Dropping a sample only makes the profile less precise.
+        if (!samples)
+            return;
+        profile->samples = samples;
+        profile->samples_capacity = capacity;
+    }
+
+    const Inst* insts = profile->program->insts;
+    uint32_t* sample = &profile->samples[profile->samples_size];
+    sample[0] = (uint32_t)profile->frames_size;
+    for (size_t i = 0; i < profile->frames_size; ++i) {
+        sample[1 + i] = insts[profile->frames[i].function].word;
+    }
+    sample[1 + profile->frames_size] = op;
+    profile->samples_size = needed;
+}
+
+void profile_call(Profile* profile, const Inst* target)
+{
+    size_t function = (size_t)(target - profile->program->insts);
+    profile->functions[function].calls += 1;
+    if (profile->frames_size == CALL_STACK_SIZE) {
+        profile->frames_dropped += 1;
+        return;
+    }
+    profile->functions[function].depth += 1;
+    profile->frames[profile->frames_size++] = (ProfileFrame) {
+        .function = function,
+        .start = profile_now(),
+    };
+}
+
+static inline void profile_end_frame(Profile* profile, uint64_t now)
+{
+    ProfileFrame* frame = &profile->frames[--profile->frames_size];
+    ProfileFunction* function = &profile->functions[frame->function];
+    function->depth -= 1;
+    if (function->depth == 0)
+        function->cycles += now - frame->start;
+}
+
+void profile_ret(Profile* profile)
+{
+    if (profile->frames_dropped != 0)
+        profile->frames_dropped -= 1;
+    else if (profile->frames_size != 0)
+        profile_end_frame(profile, profile_now());
+}
+
+void profile_finish(Profile* profile)
+{
+    uint64_t now = profile_now();
+    profile->op_cycles[profile->last_op] += now - profile->last_time;
+    profile->last_time = now;
+    while (profile->frames_size != 0)
+        profile_end_frame(profile, now);
+}
+
+/// Maps instruction indices of the module's functions to their names.
+static inline const char** function_names(
+    const Profile* profile, const Module* module)
+{
+    const Program* program = profile->program;
+    const char** names = calloc(program->insts_size, sizeof(const char*));
+    if (!names || !module)
+        return names;
+    for (size_t i = 0; i < module->functions_size; ++i) {
+        const ModuleFunction* function = &module->functions[i];
+        const Inst* inst = program_inst_at(program, function->word);
+        if (inst)
+            names[inst - program->insts]
+                = module_function_name(module, function);
+    }
+    return names;
+}
+
+static inline void write_function_name(
+    const Profile* profile, const char** names, uint32_t word, FILE* fp)
+{
+    const Inst* inst = program_inst_at(profile->program, word);
+    const char* name = names && inst ? names[inst - profile->program->insts]
+                                     : NULL;
+    if (name)
+        fputs(name, fp);
+    else
+        fprintf(fp, "fn_%u", word);
+}
+
+void profile_write_collapsed(
+    const Profile* profile, const Module* module, FILE* fp)
+{
+    const char** names = function_names(profile, module);
+
+    // Identical stacks are written as separate lines, which flame graph
+    // tools add up.
+    size_t i = 0;
+    while (i < profile->samples_size) {
+        const uint32_t* sample = &profile->samples[i];
+        uint32_t frames = sample[0];
+        for (uint32_t frame = 0; frame < frames; ++frame) {
+            write_function_name(profile, names, sample[1 + frame], fp);
+            fputc(';', fp);
+        }
+        fprintf(fp, "%s 1\n", op_names[sample[1 + frames]]);
+        i += (size_t)frames + 2;
+    }
+    free(names);
+}
+
+static inline void write_json_string(const char* value, FILE* fp)
+{
+    fputc('"', fp);
+    for (const char* c = value; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\')
+            fprintf(fp, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20)
+            fprintf(fp, "\\u%04x", (unsigned char)*c);
+        else
+            fputc(*c, fp);
+    }
+    fputc('"', fp);
+}
+
+typedef struct {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+} ProfilePair;
+
+static inline void write_json_pairs(const Profile* profile, FILE* fp)
+{
+    ProfilePair pairs[PROFILE_TOP_PAIRS + 1];
+    size_t pairs_size = 0;
+
+    // Keeps the top pairs sorted by inserting each pair into place.
+    for (size_t first = 0; first < PROFILE_OPS; ++first) {
+        for (size_t second = 0; second < PROFILE_OPS; ++second) {
+            uint64_t count = profile->pair_counts[first * PROFILE_OPS + second];
+            if (count == 0)
+                continue;
+            if (pairs_size == PROFILE_TOP_PAIRS
+                && count <= pairs[pairs_size - 1].count)
+                continue;
+            size_t i = pairs_size;
+            while (i > 0 && pairs[i - 1].count < count) {
+                pairs[i] = pairs[i - 1];
+                --i;
+            }
+            pairs[i] = (ProfilePair) {
+                .first = (uint8_t)first,
+                .second = (uint8_t)second,
+                .count = count,
+            };
+            if (pairs_size < PROFILE_TOP_PAIRS)
+                ++pairs_size;
+        }
+    }
+
+    fprintf(fp, "  \"pairs\": [");
+    for (size_t i = 0; i < pairs_size; ++i) {
+        fprintf(fp,
+            "%s\n    { \"first\": \"%s\", \"second\": \"%s\", "
+            "\"count\": %" PRIu64 " }",
+            i == 0 ? "" : ",",
+            op_names[pairs[i].first],
+            op_names[pairs[i].second],
+            pairs[i].count);
+    }
+    fprintf(fp, "\n  ],\n");
+}
+
+void profile_write_json(
+    const Profile* profile, const Module* module, FILE* fp)
+{
+    fprintf(fp, "{\n  \"ops\": [");
+    bool first = true;
+    for (size_t op = 0; op < PROFILE_OPS; ++op) {
+        if (profile->op_counts[op] == 0)
+            continue;
+        fprintf(fp,
+            "%s\n    { \"op\": \"%s\", \"count\": %" PRIu64 ", "
+            "\"cycles\": %" PRIu64 " }",
+            first ? "" : ",",
+            op_names[op],
+            profile->op_counts[op],
+            profile->op_cycles[op]);
+        first = false;
+    }
+    fprintf(fp, "\n  ],\n");
+
+    write_json_pairs(profile, fp);
+
+    const char** names = function_names(profile, module);
+    fprintf(fp, "  \"functions\": [");
+    first = true;
+    for (size_t i = 0; i < profile->program->insts_size; ++i) {
+        const ProfileFunction* function = &profile->functions[i];
+        if (function->calls == 0)
+            continue;
+        uint32_t word = profile->program->insts[i].word;
+        fprintf(fp, "%s\n    { \"name\": ", first ? "" : ",");
+        if (names && names[i])
+            write_json_string(names[i], fp);
+        else
+            fprintf(fp, "\"fn_%u\"", word);
+        fprintf(fp,
+            ", \"word\": %u, \"calls\": %" PRIu64 ", \"cycles\": %" PRIu64 " }",
+            word,
+            function->calls,
+            function->cycles);
+        first = false;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    free(names);
+}
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+
+/// Counts the ops of a loop, which are fused unless built with
+/// `VM_NO_FUSION`, and checks that ops which never ran aren't counted.
+void test_profile_counts(void)
+{
+    const uint32_t code[] = {
+        test_inst(Op_LoadImm32, 1, 0, 0),
+        0,
+        // Adds 1 to `%ireg` 1 until it is 5.
+        test_inst(Op_AddI, 1, 1, 0),
+        1,
+        test_inst(Op_LtI, 2, 1, 0),
+        5,
+        test_inst(Op_Jnz, 0, 2, 0),
+        2,
+        test_inst(Op_Ret, 0, 0, 0),
+        // Never run.
+        test_inst(Op_Mul, 0, 1, 1),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    Program program;
+    TEST_ASSERT(program_decode(&program, code, 11) == 0,
+        "test program should decode");
+    Profile profile;
+    TEST_ASSERT(profile_construct(&profile, &program) == 0,
+        "profile should be constructed");
+    VM vm;
+    TEST_ASSERT(vm_construct(&vm) == 0, "vm should be constructed");
+    vm.profile = &profile;
+    Regs regs = { .budget = UINT64_MAX };
+    TEST_ASSERT(vm_call(&vm, &program, program.entry, &regs) == 0
+            && regs.iregs[1] == 5,
+        "test program should run");
+    profile_finish(&profile);
+
+    uint64_t expected[PROFILE_OPS] = { 0 };
+    expected[Op_LoadImm32] = 1;
+#ifdef VM_NO_FUSION
+    expected[Op_AddI] = 5;
+    expected[Op_LtI] = 5;
+    expected[Op_Jnz] = 5;
+#else
+    expected[Op_AddILtIJnz] = 5;
+#endif
+    expected[Op_Ret] = 1;
+    // The entry returns into the sentinel `Halt`.
+    expected[Op_Halt] = 1;
+    for (size_t op = 0; op < PROFILE_OPS; ++op) {
+        TEST_ASSERT(profile.op_counts[op] == expected[op],
+            "ops should be counted as often as they ran");
+    }
+    TEST_ASSERT(profile.functions[0].calls == 1 && profile.frames_size == 0,
+        "entry function should be counted");
+
+    vm_destroy(&vm);
+    profile_destroy(&profile);
+    program_destroy(&program);
+}
+#endif
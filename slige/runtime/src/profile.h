@@ -0,0 +1,110 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "module.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// Profiler for the interpreter, enabled by building with `VM_PROFILE`.
+///
+/// Counts executed instructions and the cycles spent in each op, and pairs of
+/// consecutive ops, which are candidates for superinstructions. Calls are
+/// counted per function, together with the cycles spent in the function
+/// including its callees. Every `PROFILE_SAMPLE_CYCLES` the call stack is
+/// sampled.
+///
+/// The JIT is disabled in profiling builds, so that every instruction is
+/// seen by the profiler.
+
+#ifndef PROFILE_SAMPLE_CYCLES
+#define PROFILE_SAMPLE_CYCLES 1000000
+#endif
+
+/// Number of op values, including superinstructions, which come after
+/// `Op_Count`.
+#define PROFILE_OPS                                                            \
+    (Op_Count + 1 VM_FUSED_OP_LIST(PROFILE_OPS_ONE))
+#define PROFILE_OPS_ONE(NAME, LENGTH, FIRST) +1
+
+typedef struct {
+    uint64_t calls;
+    /// Cycles spent in the function, including callees. Recursive calls are
+    /// only timed by their outermost call.
+    uint64_t cycles;
+    /// Number of calls currently running.
+    uint64_t depth;
+} ProfileFunction;
+
+typedef struct {
+    /// Instruction index of the function's first instruction.
+    size_t function;
+    uint64_t start;
+} ProfileFrame;
+
+typedef struct Profile {
+    const Program* program;
+    uint64_t op_counts[PROFILE_OPS];
+    uint64_t op_cycles[PROFILE_OPS];
+    /// `[first * PROFILE_OPS + second]`.
+    uint64_t* pair_counts;
+    /// Per instruction index, for function starts.
+    ProfileFunction* functions;
+    ProfileFrame* frames;
+    size_t frames_size;
+    /// Calls nested deeper than `CALL_STACK_SIZE`, which are not timed.
+    size_t frames_dropped;
+    uint8_t last_op;
+    uint64_t last_time;
+    uint64_t next_sample;
+    /// Samples, each stored as the number of frames, the word of each
+    /// frame's function, and the op being run.
+    uint32_t* samples;
+    size_t samples_size;
+    size_t samples_capacity;
+} Profile;
+
+int profile_construct(Profile* profile, const Program* program);
+void profile_destroy(Profile* profile);
+
+uint64_t profile_now(void);
+
+/// Starts timing, and enters the program's first function at `entry`.
+void profile_start(Profile* profile, const Inst* entry);
+
+void profile_sample(Profile* profile, uint8_t op);
+
+/// Called before every instruction is run.
+static inline void profile_inst(Profile* profile, const Inst* inst)
+{
+    uint64_t now = profile_now();
+    profile->op_cycles[profile->last_op] += now - profile->last_time;
+    profile->op_counts[inst->op] += 1;
+    profile->pair_counts[profile->last_op * PROFILE_OPS + inst->op] += 1;
+    profile->last_op = inst->op;
+    profile->last_time = now;
+    if (now >= profile->next_sample)
+        profile_sample(profile, inst->op);
+}
+
+/// Called when entering the function starting at `target`.
+void profile_call(Profile* profile, const Inst* target);
+/// Called when returning from a function.
+void profile_ret(Profile* profile);
+/// Ends the functions still running when the program halts.
+void profile_finish(Profile* profile);
+
+/// Writes the samples in collapsed stack format, for flame graphs. Function
+/// names are looked up in `module`, which may be NULL.
+void profile_write_collapsed(
+    const Profile* profile, const Module* module, FILE* fp);
+/// Writes op counts, op pairs and function stats as JSON.
+void profile_write_json(
+    const Profile* profile, const Module* module, FILE* fp);
+
+#ifdef INCLUDE_TESTS
+void test_profile_counts(void);
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+#include "vm.h"
+#include "jit.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VM_FUSED_OP_ONE(NAME, LENGTH, FIRST) +1
+static_assert(Op_Count + 1 VM_FUSED_OP_LIST(VM_FUSED_OP_ONE) <= UINT8_MAX + 1,
+    "ops must fit in `Inst.op`");
+#undef VM_FUSED_OP_ONE
+
+static const OpFormat op_formats[Op_Count] = {
+#define VM_OP_FORMAT(NAME, FORMAT, DST, LEFT, RIGHT)                           \
+    [Op_##NAME] = OpFormat_##FORMAT,
+    VM_OP_LIST(VM_OP_FORMAT)
+#undef VM_OP_FORMAT
+};
+
+static inline size_t format_words(OpFormat format)
+{
+    switch (format) {
+        case OpFormat_None:
+            return 0;
+        case OpFormat_I32:
+        case OpFormat_Target:
+            return 1;
+        case OpFormat_I64:
+        case OpFormat_F64:
+            return 2;
+    }
+    return 0;
+}
+
+// Compare ops in the same order as the fused compare-and-branch ops, which
+// are laid out as `[Cmp]Jz, [Cmp]Jnz, [Cmp]IJz, [Cmp]IJnz` per compare.
+static const Op fusable_compares[][2] = {
+    { Op_Eq, Op_EqI },
+    { Op_Ne, Op_NeI },
+    { Op_Lt, Op_LtI },
+    { Op_Gt, Op_GtI },
+    { Op_Lte, Op_LteI },
+    { Op_Gte, Op_GteI },
+};
+
+static inline int fused_compare_branch(const Inst* cmp, const Inst* branch)
+{
+    if (branch->op != Op_Jz && branch->op != Op_Jnz)
+        return -1;
+    // The handler branches on the compare result directly, instead of
+    // reading it back from the register.
+    if (branch->left != cmp->dst)
+        return -1;
+    size_t compares
+        = sizeof(fusable_compares) / sizeof(fusable_compares[0]);
+    for (size_t i = 0; i < compares; ++i) {
+        for (size_t imm = 0; imm < 2; ++imm) {
+            if (cmp->op != fusable_compares[i][imm])
+                continue;
+            size_t offset = i * 4 + imm * 2 + (branch->op == Op_Jnz ? 1 : 0);
+            return (int)(Op_EqJz + offset);
+        }
+    }
+    return -1;
+}
+
+static inline int fused_op(const Inst* inst)
+{
+    const Inst* next = &inst[1];
+    if (inst->op == Op_AddI && next->op == Op_LtI && inst[2].op == Op_Jnz
+        && inst[2].left == next->dst)
+        return Op_AddILtIJnz;
+    if (inst->op == Op_LoadA64 && next->op == Op_Mul)
+        return Op_LoadA64Mul;
+    if (inst->op == Op_Add && next->op == Op_MovII)
+        return Op_AddMovII;
+    if (inst->op == Op_AddI && next->op == Op_Jmp)
+        return Op_AddIJmp;
+    return fused_compare_branch(inst, next);
+}
+
+/// Replaces the first instruction of each common sequence with a
+/// superinstruction. The rest of the sequence is kept as is, since it may
+/// also be reached by a jump or a return, and since the fused handlers read
+/// their operands from it.
+static inline void program_fuse(Program* program)
+{
+    // The sentinel `Halt` never continues a sequence, so the look ahead in
+    // `fused_op` stops at it.
+    for (size_t i = 0; i + 1 < program->insts_size; ++i) {
+        Inst* inst = &program->insts[i];
+        int op = fused_op(inst);
+        if (op != -1)
+            inst->op = (uint8_t)op;
+    }
+}
+
+int program_decode(Program* program, const uint32_t* code, size_t size)
+{
+    *program = (Program) {
+        .insts = NULL,
+        .insts_size = 0,
+        .word_insts = calloc(size, sizeof(uint32_t)),
+        .words_size = size,
+        .entry = NULL,
+        .max_frame = 0,
+        .jit = NULL,
+    };
+    if (size != 0 && !program->word_insts)
+        goto l0_error;
+
+    // First pass finds the instruction boundaries, so that jump targets can
+    // be resolved in the second.
+    size_t insts_size = 0;
+    for (size_t i = 0; i < size;) {
+        uint8_t op = code[i] & 0xff;
+        if (op >= Op_Count) {
+            fprintf(stderr, "error: invalid op %d at %zu\n", op, i);
+            goto l0_error;
+        }
+        size_t words = 1 + format_words(op_formats[op]);
+        if (i + words > size) {
+            fprintf(stderr, "error: truncated instruction at %zu\n", i);
+            goto l0_error;
+        }
+        insts_size += 1;
+        program->word_insts[i] = (uint32_t)insts_size;
+        i += words;
+    }
+
+    program->insts = malloc((insts_size + 1) * sizeof(Inst));
+    if (!program->insts)
+        goto l0_error;
+    program->insts_size = insts_size + 1;
+    program->entry = program->insts;
+
+    Inst* inst = program->insts;
+    for (size_t i = 0; i < size; ++inst) {
+        uint32_t line = code[i];
+        uint8_t op = line & 0xff;
+        *inst = (Inst) {
+            .handler = NULL,
+            .imm = 0,
+            .op = op,
+            .dst = (Reg)(line >> 8 & 0xff),
+            .right = (Reg)(line >> 16 & 0xff),
+            .left = (Reg)(line >> 24 & 0xff),
+            .word = (uint32_t)i,
+        };
+        OpFormat format = op_formats[op];
+        switch (format) {
+            case OpFormat_None:
+                break;
+            case OpFormat_I32:
+                inst->imm = code[i + 1];
+                break;
+            case OpFormat_I64:
+            case OpFormat_F64:
+                inst->imm = code[i + 1] | (uint64_t)code[i + 2] << 32;
+                break;
+            case OpFormat_Target: {
+                const Inst* target = program_inst_at(program, code[i + 1]);
+                if (!target) {
+                    fprintf(stderr,
+                        "error: invalid jump target %u at %zu\n",
+                        code[i + 1],
+                        i);
+                    goto l0_error;
+                }
+                inst->target = target;
+                break;
+            }
+        }
+        i += 1 + format_words(format);
+    }
+    *inst = (Inst) {
+        .handler = NULL,
+        .imm = 0,
+        .op = Op_Halt,
+        .dst = 0,
+        .right = 0,
+        .left = 0,
+        .word = (uint32_t)size,
+    };
+
+    if (program_verify(program) != 0)
+        goto l0_error;
+
+#ifndef VM_NO_FUSION
+    program_fuse(program);
+#endif
+    vm_link(program);
+
+#ifdef VM_JIT
+    // Programs the JIT can't be set up for are only interpreted.
+    program->jit = malloc(sizeof(Jit));
+    if (program->jit && jit_construct(program->jit, program) != 0) {
+        jit_destroy(program->jit);
+        free(program->jit);
+        program->jit = NULL;
+    }
+#endif
+    return 0;
+
+l0_error:
+    program_destroy(program);
+    return -1;
+}
+
+void program_destroy(Program* program)
+{
+#ifdef VM_JIT
+    if (program->jit) {
+        jit_destroy(program->jit);
+        free(program->jit);
+    }
+#endif
+    free(program->insts);
+    free(program->word_insts);
+    *program = (Program) { 0 };
+}
+
+const Inst* program_inst_at(const Program* program, uint64_t word)
+{
+    if (word >= program->words_size || program->word_insts[word] == 0)
+        return NULL;
+    return &program->insts[program->word_insts[word] - 1];
+}
+
+int program_relocate(Program* program, uint64_t word, uint64_t addend)
+{
+    if (word >= program->words_size || program->word_insts[word] == 0)
+        return -1;
+    Inst* inst = &program->insts[program->word_insts[word] - 1];
+    // No superinstruction starts with an op with a `%i64` immediate.
+    if (inst->op >= Op_Count || op_formats[inst->op] != OpFormat_I64)
+        return -1;
+    inst->imm += addend;
+    return 0;
+}
@@ -0,0 +1,452 @@
+#include "slige.h"
+#include "heap.h"
+#include "module.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static_assert(SLIGE_HOST_ARGS == HOST_ARGS, "host ABI must match the VM's");
+
+typedef struct {
+    char* name;
+    HostFunction function;
+} SligeHost;
+
+/// A module with everything needed to run it.
+typedef struct {
+    Module module;
+    /// Copy of the module, if it was loaded from memory.
+    void* data;
+    Program program;
+    HostFunction* imports;
+} SligeModule;
+
+struct SligeVm {
+    VM vm;
+    SligeHost* hosts;
+    size_t hosts_size;
+    size_t hosts_capacity;
+    /// Heap allocated, since the program's JIT refers to the program.
+    SligeModule* module;
+    /// Calls running, which is more than 1 when host functions call back
+    /// into the VM.
+    size_t depth;
+};
+
+SligeVm* slige_vm_create(const SligeOptions* options)
+{
+    SligeVm* vm = malloc(sizeof(SligeVm));
+    if (!vm)
+        return NULL;
+    *vm = (SligeVm) {
+        .hosts = NULL,
+        .hosts_size = 0,
+        .hosts_capacity = 0,
+        .module = NULL,
+        .depth = 0,
+    };
+    if (vm_construct(&vm->vm) != 0) {
+        free(vm);
+        return NULL;
+    }
+    if (options && options->stack_size != 0)
+        vm->vm.stack_size = options->stack_size;
+    if (options && options->call_stack_size != 0)
+        vm->vm.call_stack_size = options->call_stack_size;
+    return vm;
+}
+
+static inline void slige_module_destroy(SligeModule* module)
+{
+    program_destroy(&module->program);
+    module_close(&module->module);
+    free(module->data);
+    free(module->imports);
+    free(module);
+}
+
+void slige_vm_destroy(SligeVm* vm)
+{
+    if (vm->module)
+        slige_module_destroy(vm->module);
+    for (size_t i = 0; i < vm->hosts_size; ++i)
+        free(vm->hosts[i].name);
+    free(vm->hosts);
+    vm_destroy(&vm->vm);
+    free(vm);
+}
+
+static inline SligeHost* slige_vm_host(const SligeVm* vm, const char* name)
+{
+    for (size_t i = 0; i < vm->hosts_size; ++i) {
+        if (strcmp(vm->hosts[i].name, name) == 0)
+            return &vm->hosts[i];
+    }
+    return NULL;
+}
+
+int slige_vm_register(
+    SligeVm* vm, const char* name, SligeHostFn fn, void* data)
+{
+    HostFunction function = { .fn = fn, .data = data };
+    SligeHost* host = slige_vm_host(vm, name);
+    if (host) {
+        host->function = function;
+        return 0;
+    }
+    if (vm->hosts_size == vm->hosts_capacity) {
+        size_t capacity = vm->hosts_capacity == 0 ? 8 : vm->hosts_capacity * 2;
+        SligeHost* hosts = realloc(vm->hosts, capacity * sizeof(SligeHost));
+        if (!hosts)
+            return -1;
+        vm->hosts = hosts;
+        vm->hosts_capacity = capacity;
+    }
+    char* copy = malloc(strlen(name) + 1);
+    if (!copy)
+        return -1;
+    strcpy(copy, name);
+    vm->hosts[vm->hosts_size++] = (SligeHost) {
+        .name = copy,
+        .function = function,
+    };
+    return 0;
+}
+
+static inline int slige_module_resolve(const SligeVm* vm, SligeModule* module)
+{
+    size_t imports_size = module->module.imports_size;
+    if (imports_size == 0)
+        return 0;
+    module->imports = malloc(imports_size * sizeof(HostFunction));
+    if (!module->imports)
+        return -1;
+    for (size_t i = 0; i < imports_size; ++i) {
+        const char* name
+            = module_import_name(&module->module, &module->module.imports[i]);
+        const SligeHost* host = name ? slige_vm_host(vm, name) : NULL;
+        if (!host) {
+            fprintf(stderr,
+                "error: unresolved import '%s'\n",
+                name ? name : "<invalid>");
+            return -1;
+        }
+        module->imports[i] = host->function;
+    }
+    return 0;
+}
+
+/// Decodes and links the opened `module`, and makes it the VM's module.
+/// Takes ownership of `module`, also on failure.
+static inline int slige_vm_load_module(SligeVm* vm, SligeModule* module)
+{
+    if (module_decode(&module->module, &module->program) != 0) {
+        // `module_decode` destroys the program on failure.
+        module_close(&module->module);
+        free(module->data);
+        free(module);
+        return -1;
+    }
+    if (slige_module_resolve(vm, module) != 0) {
+        slige_module_destroy(module);
+        return -1;
+    }
+
+    if (vm->module)
+        slige_module_destroy(vm->module);
+    vm->module = module;
+    vm->vm.imports = module->imports;
+    vm->vm.imports_size = module->module.imports_size;
+    return 0;
+}
+
+/// Modules can't be replaced while they are running, which is the case when
+/// a host function loads a module.
+static inline bool slige_vm_running(const SligeVm* vm)
+{
+    if (vm->depth == 0)
+        return false;
+    fprintf(stderr, "error: can't load a module while the VM is running\n");
+    return true;
+}
+
+int slige_vm_load_file(SligeVm* vm, const char* path)
+{
+    if (slige_vm_running(vm))
+        return -1;
+    SligeModule* module = malloc(sizeof(SligeModule));
+    if (!module)
+        return -1;
+    *module = (SligeModule) { .data = NULL, .imports = NULL };
+    if (module_open(&module->module, path) != 0) {
+        free(module);
+        return -1;
+    }
+    return slige_vm_load_module(vm, module);
+}
+
+int slige_vm_load(SligeVm* vm, const void* data, size_t size)
+{
+    if (slige_vm_running(vm))
+        return -1;
+    SligeModule* module = malloc(sizeof(SligeModule));
+    if (!module)
+        return -1;
+    // `malloc` aligns the copy as `module_load` requires.
+    *module = (SligeModule) { .data = malloc(size), .imports = NULL };
+    if (!module->data) {
+        free(module->data);
+        free(module);
+        return -1;
+    }
+    memcpy(module->data, data, size);
+    if (module_load(&module->module, module->data, size) != 0) {
+        free(module->data);
+        free(module);
+        return -1;
+    }
+    return slige_vm_load_module(vm, module);
+}
+
+int slige_vm_call(SligeVm* vm,
+    const char* name,
+    const uint64_t* args,
+    size_t args_size,
+    uint64_t budget,
+    uint64_t* result)
+{
+    if (!vm->module) {
+        fprintf(stderr, "error: no module loaded\n");
+        return -1;
+    }
+    const Module* module = &vm->module->module;
+    const Program* program = &vm->module->program;
+    const ModuleFunction* function = module_function(module, name);
+    const Inst* entry
+        = function ? program_inst_at(program, function->word) : NULL;
+    if (!entry) {
+        fprintf(stderr, "error: no function '%s'\n", name);
+        return -1;
+    }
+    if (args_size > IREGS - 1) {
+        fprintf(stderr, "error: too many arguments for '%s'\n", name);
+        return -1;
+    }
+
+    // Nested calls share the memory of the outermost call.
+    if (vm->depth == 0) {
+        heap_destroy(&vm->vm.heap);
+        heap_construct(&vm->vm.heap);
+    }
+
+    Regs regs = {
+        .iregs = { 0 },
+        .fregs = { 0.0 },
+        .budget = budget,
+    };
+    for (size_t i = 0; i < args_size; ++i)
+        regs.iregs[1 + i] = args[i];
+    vm->depth += 1;
+    int res = vm_call(&vm->vm, program, entry, &regs);
+    vm->depth -= 1;
+    if (res != 0)
+        return -1;
+    if (result)
+        *result = regs.iregs[0];
+    return 0;
+}
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+
+typedef struct {
+    ModuleHeader header;
+    ModuleSection sections[3];
+    uint32_t code[16];
+    char strings[16];
+    ModuleFunction functions[3];
+} TestModule;
+
+static inline int test_call(SligeVm* vm,
+    const char* name,
+    uint64_t a,
+    uint64_t b,
+    uint64_t c,
+    uint64_t* result)
+{
+    uint64_t args[] = { a, b, c };
+    return slige_vm_call(vm, name, args, 3, UINT64_MAX, result);
+}
+
+/// Division by zero, and `INT64_MIN / -1`, fail the call instead of trapping,
+/// both interpreted and compiled by the JIT.
+void test_slige_division(void)
+{
+    TestModule module = {
+        .header = {
+            .magic = MODULE_MAGIC,
+            .version = MODULE_VERSION,
+            .flags = 0,
+            .sections_size = 3,
+            .entry = 0,
+            .file_size = sizeof(TestModule),
+        },
+        .sections = {
+            { ModuleSectionKind_Code, 0, offsetof(TestModule, code),
+                sizeof(module.code) },
+            { ModuleSectionKind_Strings, 0, offsetof(TestModule, strings),
+                sizeof(module.strings) },
+            { ModuleSectionKind_Functions, 0,
+                offsetof(TestModule, functions), sizeof(module.functions) },
+        },
+        .code = {
+            // div(a, b) = a / b
+            [0] = test_inst(Op_IDiv, 0, 1, 2),
+            [1] = test_inst(Op_Ret, 0, 0, 0),
+            // rem(a, b) = a % b
+            [2] = test_inst(Op_Rem, 0, 1, 2),
+            [3] = test_inst(Op_Ret, 0, 0, 0),
+            // many(n, a, b) calls div(a, b) n times.
+            [4] = test_inst(Op_MovII, 4, 1, 0),
+            [5] = test_inst(Op_MovII, 5, 2, 0),
+            [6] = test_inst(Op_MovII, 6, 3, 0),
+            [7] = test_inst(Op_MovII, 1, 5, 0),
+            [8] = test_inst(Op_MovII, 2, 6, 0),
+            [9] = test_inst(Op_CallI, 0, 0, 0),
+            [10] = 0,
+            [11] = test_inst(Op_SubI, 4, 4, 0),
+            [12] = 1,
+            [13] = test_inst(Op_Jnz, 0, 4, 0),
+            [14] = 7,
+            [15] = test_inst(Op_Ret, 0, 0, 0),
+        },
+        .strings = "div\0rem\0many",
+        .functions = { { 0, 0 }, { 4, 2 }, { 8, 4 } },
+    };
+
+    SligeVm* vm = slige_vm_create(NULL);
+    TEST_ASSERT(vm, "vm should be created");
+    TEST_ASSERT(slige_vm_load(vm, &module, sizeof(module)) == 0,
+        "module should load");
+
+    uint64_t result;
+    TEST_ASSERT(test_call(vm, "div", 7, 2, 0, &result) == 0 && result == 3,
+        "division should work");
+    TEST_ASSERT(test_call(vm, "div", 7, 0, 0, NULL) != 0,
+        "division by zero should fail");
+    TEST_ASSERT(test_call(vm, "div", (uint64_t)INT64_MIN, (uint64_t)-1, 0,
+                    NULL)
+            != 0,
+        "INT64_MIN / -1 should fail");
+    TEST_ASSERT(test_call(vm, "rem", 7, 0, 0, NULL) != 0,
+        "remainder by zero should fail");
+
+    // Calls `div` often enough for the JIT to compile it.
+    TEST_ASSERT(test_call(vm, "many", 1000, 100, 5, &result) == 0
+            && result == 20,
+        "repeated division should work");
+    TEST_ASSERT(test_call(vm, "many", 1, 100, (uint64_t)-1, &result) == 0
+            && result == (uint64_t)-100,
+        "division by -1 should work");
+    TEST_ASSERT(test_call(vm, "many", 1, 100, 0, NULL) != 0,
+        "repeated division by zero should fail");
+    TEST_ASSERT(test_call(vm, "many", 1, (uint64_t)INT64_MIN, (uint64_t)-1,
+                    NULL)
+            != 0,
+        "repeated INT64_MIN / -1 should fail");
+
+    // Immediate divisors of 0 are rejected when loading.
+    module.code[0] = test_inst(Op_DivI, 0, 1, 0);
+    module.code[1] = 0;
+    TEST_ASSERT(slige_vm_load(vm, &module, sizeof(module)) != 0,
+        "division by an immediate 0 should not load");
+
+    slige_vm_destroy(vm);
+}
+
+typedef struct {
+    ModuleHeader header;
+    ModuleSection sections[4];
+    uint32_t code[6];
+    char strings[24];
+    ModuleFunction functions[1];
+    ModuleImport imports[2];
+} TestImportModule;
+
+static int test_double(void* data, const uint64_t* args, uint64_t* result)
+{
+    (void)data;
+    *result = args[0] * 2;
+    return 0;
+}
+
+/// Modules only load once every function they import is registered.
+void test_slige_imports(void)
+{
+    TestImportModule module = {
+        .header = {
+            .magic = MODULE_MAGIC,
+            .version = MODULE_VERSION,
+            .flags = 0,
+            .sections_size = 4,
+            .entry = 0,
+            .file_size = sizeof(TestImportModule),
+        },
+        .sections = {
+            { ModuleSectionKind_Code, 0, offsetof(TestImportModule, code),
+                sizeof(module.code) },
+            { ModuleSectionKind_Strings, 0,
+                offsetof(TestImportModule, strings), sizeof(module.strings) },
+            { ModuleSectionKind_Functions, 0,
+                offsetof(TestImportModule, functions),
+                sizeof(module.functions) },
+            { ModuleSectionKind_Imports, 0,
+                offsetof(TestImportModule, imports), sizeof(module.imports) },
+        },
+        .code = {
+            // twice(a) = double(a), where `double` is import 1.
+            [0] = test_inst(Op_MovII, 2, 1, 0),
+            [1] = test_inst(Op_LoadImm32, 1, 0, 0),
+            [2] = 1,
+            [3] = test_inst(Op_Builtin, 0, 0, 0),
+            [4] = Builtin_HostCall,
+            [5] = test_inst(Op_Ret, 0, 0, 0),
+        },
+        .strings = "twice\0half\0double",
+        .functions = { { 0, 0 } },
+        .imports = { { 6 }, { 11 } },
+    };
+
+    SligeVm* vm = slige_vm_create(NULL);
+    TEST_ASSERT(vm, "vm should be created");
+    TEST_ASSERT(slige_vm_load(vm, &module, sizeof(module)) != 0,
+        "module with unregistered imports should not load");
+    TEST_ASSERT(slige_vm_register(vm, "double", test_double, NULL) == 0,
+        "host function should be registered");
+    TEST_ASSERT(slige_vm_load(vm, &module, sizeof(module)) != 0,
+        "module with an unregistered import should not load");
+    // Unused imports are resolved too.
+    TEST_ASSERT(slige_vm_register(vm, "half", test_double, NULL) == 0,
+        "host function should be registered");
+    TEST_ASSERT(slige_vm_load(vm, &module, sizeof(module)) == 0,
+        "module should load once its imports are registered");
+
+    uint64_t result;
+    TEST_ASSERT(test_call(vm, "twice", 21, 0, 0, &result) == 0 && result == 42,
+        "host function should be called");
+
+    // Imports are also checked when running.
+    module.code[2] = 2;
+    TEST_ASSERT(slige_vm_load(vm, &module, sizeof(module)) == 0,
+        "module should load");
+    TEST_ASSERT(test_call(vm, "twice", 21, 0, 0, NULL) != 0,
+        "import past the import table should fail the call");
+
+    slige_vm_destroy(vm);
+}
+#endif
@@ -0,0 +1,69 @@
+#ifndef SLIGE_H
+#define SLIGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Embedding API of the runtime, built as `build/libslige.a`.
+///
+/// A `SligeVm` owns everything it runs, and VMs share no state, so that a
+/// program can run one VM per thread. A VM must only be used by one thread at
+/// a time.
+///
+/// Functions are called with up to 31 arguments, passed in `%ireg` 1 and up,
+/// and return their result in `%ireg` 0. Memory allocated by a call with
+/// `Builtin_Alloc` is valid until the next call. Host functions may call
+/// back into the VM, but must not load a module while doing so.
+///
+/// Errors are reported on stderr.
+
+/// Number of arguments passed to host functions.
+#define SLIGE_HOST_ARGS 6
+
+/// Function called by scripts through `Builtin_HostCall`. `args` holds
+/// `SLIGE_HOST_ARGS` arguments. Returns -1 to stop the script, which makes
+/// `slige_vm_call` fail.
+typedef int (*SligeHostFn)(void* data, const uint64_t* args, uint64_t* result);
+
+typedef struct SligeVm SligeVm;
+
+typedef struct {
+    /// Size in words of the value stack, or 0 for the default.
+    size_t stack_size;
+    /// Max number of nested calls, or 0 for the default.
+    size_t call_stack_size;
+} SligeOptions;
+
+/// `options` may be NULL for the defaults. Returns NULL if out of memory.
+SligeVm* slige_vm_create(const SligeOptions* options);
+void slige_vm_destroy(SligeVm* vm);
+
+/// Registers a host function for modules loaded afterwards, which import it
+/// by `name`. Registering a name again replaces the function.
+int slige_vm_register(
+    SligeVm* vm, const char* name, SligeHostFn fn, void* data);
+
+/// Loads the module file at `path`, replacing the loaded module. If loading
+/// fails, the loaded module is kept. Fails if the module imports a function
+/// that is not registered.
+int slige_vm_load_file(SligeVm* vm, const char* path);
+/// As `slige_vm_load_file`, from `size` bytes at `data`, which are copied.
+int slige_vm_load(SligeVm* vm, const void* data, size_t size);
+
+/// Calls the loaded module's function `name`. The call is stopped with an
+/// error once it has taken `budget` steps, where every call, and every jump
+/// backwards, takes a step. `UINT64_MAX` means no limit. `result` may be
+/// NULL.
+int slige_vm_call(SligeVm* vm,
+    const char* name,
+    const uint64_t* args,
+    size_t args_size,
+    uint64_t budget,
+    uint64_t* result);
+
+#ifdef INCLUDE_TESTS
+void test_slige_division(void);
+void test_slige_imports(void);
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+#define _DEFAULT_SOURCE
+
+#include "stack.h"
+#include "vm.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static _Thread_local Stacks stacks_cache = { 0 };
+
+static pthread_once_t stacks_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stacks_key;
+
+static void stacks_unmap(Stacks* stacks)
+{
+    munmap(stacks->mapping, stacks->mapping_size);
+    *stacks = (Stacks) { 0 };
+}
+
+// Unmaps the cached stacks when a thread exits.
+static void stacks_cache_destroy(void* cache)
+{
+    Stacks* stacks = cache;
+    if (stacks->mapping)
+        stacks_unmap(stacks);
+}
+
+static void stacks_key_create(void)
+{
+    pthread_key_create(&stacks_key, stacks_cache_destroy);
+}
+
+static inline size_t page_align(size_t size, size_t page)
+{
+    return (size + page - 1) / page * page;
+}
+
+int stacks_acquire(Stacks* stacks,
+    size_t stack_size,
+    size_t call_stack_size,
+    size_t max_frame)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t guard_size = page_align(max_frame * sizeof(uint64_t), page) + page;
+
+    Stacks* cache = &stacks_cache;
+    if (cache->mapping) {
+        if (cache->stack_size == stack_size
+            && cache->call_stack_size == call_stack_size
+            && cache->guard_size >= guard_size) {
+            *stacks = *cache;
+            *cache = (Stacks) { 0 };
+            return 0;
+        }
+        stacks_unmap(cache);
+    }
+
+    size_t stack_bytes = page_align(stack_size * sizeof(uint64_t), page);
+    size_t call_stack_bytes = page_align(call_stack_size * sizeof(Call), page);
+    size_t mapping_size
+        = page + stack_bytes + guard_size + call_stack_bytes + page;
+    uint8_t* mapping = mmap(NULL,
+        mapping_size,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0);
+    if (mapping == MAP_FAILED)
+        return -1;
+
+    // The stacks end where their guards start, so that the first word or
+    // call past the end faults.
+    uint8_t* stack = mapping + page;
+    uint8_t* call_stack = stack + stack_bytes + guard_size;
+    if (mprotect(stack, stack_bytes, PROT_READ | PROT_WRITE) != 0
+        || mprotect(call_stack, call_stack_bytes, PROT_READ | PROT_WRITE)
+            != 0) {
+        munmap(mapping, mapping_size);
+        return -1;
+    }
+    *stacks = (Stacks) {
+        .mapping = mapping,
+        .mapping_size = mapping_size,
+        .stack = (uint64_t*)(stack + stack_bytes) - stack_size,
+        .stack_size = stack_size,
+        .call_stack = (Call*)(call_stack + call_stack_bytes) - call_stack_size,
+        .call_stack_size = call_stack_size,
+        .guard_size = guard_size,
+    };
+    return 0;
+}
+
+void stacks_release(Stacks* stacks)
+{
+    Stacks* cache = &stacks_cache;
+    if (cache->mapping) {
+        stacks_unmap(stacks);
+        return;
+    }
+    pthread_once(&stacks_key_once, stacks_key_create);
+    pthread_setspecific(stacks_key, cache);
+    *cache = *stacks;
+    *stacks = (Stacks) { 0 };
+}
+
+static _Thread_local StackTrap* current_trap = NULL;
+
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous_action;
+
+static void stack_trap_handler(int sig, siginfo_t* info, void* context)
+{
+    StackTrap* trap = current_trap;
+    const uint8_t* addr = info->si_addr;
+    if (trap && addr >= trap->stacks->mapping
+        && addr < trap->stacks->mapping + trap->stacks->mapping_size) {
+        siglongjmp(trap->env, 1);
+    }
+
+    if (previous_action.sa_flags & SA_SIGINFO) {
+        previous_action.sa_sigaction(sig, info, context);
+        return;
+    }
+    if (previous_action.sa_handler != SIG_DFL
+        && previous_action.sa_handler != SIG_IGN) {
+        previous_action.sa_handler(sig);
+        return;
+    }
+    // Returning retries the faulting instruction, which then gets the
+    // default action.
+    sigaction(SIGSEGV, &previous_action, NULL);
+}
+
+static void stack_trap_install(void)
+{
+    struct sigaction action = { 0 };
+    action.sa_sigaction = stack_trap_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous_action);
+}
+
+void stack_trap_push(StackTrap* trap, const Stacks* stacks)
+{
+    pthread_once(&handler_once, stack_trap_install);
+    trap->stacks = stacks;
+    trap->prev = current_trap;
+    current_trap = trap;
+}
+
+void stack_trap_pop(StackTrap* trap)
+{
+    current_trap = trap->prev;
+}
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+
+static inline int test_stack_run(VM* vm, const uint32_t* code, size_t size)
+{
+    Program program;
+    TEST_ASSERT(program_decode(&program, code, size) == 0,
+        "test program should decode");
+    Regs regs = { .budget = UINT64_MAX };
+    int result = vm_call(vm, &program, program.entry, &regs);
+    program_destroy(&program);
+    return result;
+}
+
+/// Runaway recursion overflows the call stack, or the value stack if frames
+/// are large enough, which fails the call. The VM, and the stacks it caches,
+/// can still be used afterwards.
+void test_stack_overflow(void)
+{
+    VM vm;
+    TEST_ASSERT(vm_construct(&vm) == 0, "vm should be constructed");
+
+    const uint32_t calls[] = {
+        test_inst(Op_CallI, 0, 0, 0),
+        0,
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_stack_run(&vm, calls, 3) != 0,
+        "call stack overflow should fail the call");
+
+    const uint32_t frames[] = {
+        test_inst(Op_Alloca, 0, 0, 0),
+        64,
+        test_inst(Op_CallI, 0, 0, 0),
+        0,
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_stack_run(&vm, frames, 5) != 0,
+        "value stack overflow should fail the call");
+
+    // add(a, b) = a + b, storing `a` and `b` at both ends of its frame.
+    const uint32_t add[] = {
+        test_inst(Op_Alloca, 0, 0, 0),
+        64,
+        test_inst(Op_LoadSb, 3, 0, 0),
+        test_inst(Op_Store64, 3, 1, 0),
+        test_inst(Op_AddI, 3, 3, 0),
+        63 * sizeof(uint64_t),
+        test_inst(Op_Store64, 3, 2, 0),
+        test_inst(Op_Add, 0, 1, 2),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    Program program;
+    TEST_ASSERT(program_decode(&program, add, 9) == 0,
+        "test program should decode");
+    Regs regs = { .budget = UINT64_MAX };
+    regs.iregs[1] = 40;
+    regs.iregs[2] = 2;
+    TEST_ASSERT(vm_call(&vm, &program, program.entry, &regs) == 0
+            && regs.iregs[0] == 42,
+        "vm should run after a stack overflow");
+    program_destroy(&program);
+
+    vm_destroy(&vm);
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include "vm.h"
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Value and call stacks of a run.
+///
+/// Both stacks live in one mapping, with `PROT_NONE` guard pages below and
+/// above each of them, so that running off either end faults instead of
+/// corrupting memory. The guard above the value stack is at least as large
+/// as the largest frame of the program, so that accesses within a frame that
+/// doesn't fit always hit it.
+///
+/// ```
+/// guard | stack | guard | call stack | guard
+/// ```
+///
+/// Each thread keeps the last released stacks for the next run, so that
+/// running a program doesn't map and unmap them every time.
+typedef struct {
+    uint8_t* mapping;
+    size_t mapping_size;
+    uint64_t* stack;
+    size_t stack_size;
+    Call* call_stack;
+    size_t call_stack_size;
+    /// Size in bytes of the guard above the value stack.
+    size_t guard_size;
+} Stacks;
+
+/// Maps stacks of `stack_size` words and `call_stack_size` calls, with room
+/// for frames of `max_frame` words, or reuses the thread's cached stacks.
+/// Returns -1 if the stacks can't be mapped.
+int stacks_acquire(Stacks* stacks,
+    size_t stack_size,
+    size_t call_stack_size,
+    size_t max_frame);
+/// Puts the stacks in the thread's cache, or unmaps them.
+void stacks_release(Stacks* stacks);
+
+/// Jump target for faults in the guard pages of `stacks`.
+///
+/// While a trap is pushed, a `SIGSEGV` in the guard pages of its stacks
+/// `siglongjmp`s to `env`, which must be set with `sigsetjmp(env, 0)`. Other
+/// faults go to the handler that was installed before.
+typedef struct StackTrap {
+    sigjmp_buf env;
+    const Stacks* stacks;
+    struct StackTrap* prev;
+} StackTrap;
+
+/// If the signal handler can't be installed, faults are not caught, but
+/// still stop the process.
+void stack_trap_push(StackTrap* trap, const Stacks* stacks);
+void stack_trap_pop(StackTrap* trap);
+
+#ifdef INCLUDE_TESTS
+void test_stack_overflow(void);
+#endif
+
+#endif
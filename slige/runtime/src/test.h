@@ -0,0 +1,93 @@
+#ifndef TEST_H
+#define TEST_H
+
+/// Helpers for the tests built with `INCLUDE_TESTS` (see `main.c`).
+
+#ifdef INCLUDE_TESTS
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ASSERT(COND, MSG)                                                 \
+    do {                                                                       \
+        if (!(COND)) {                                                         \
+            fprintf(stderr, "test failed: %s\n", (MSG));                       \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+/// Max words of a `TestCode`.
+#define TEST_CODE_SIZE 2048
+
+/// Code assembled by tests, as encoded by `VM_OP_LIST`.
+typedef struct {
+    uint32_t words[TEST_CODE_SIZE];
+    size_t size;
+    /// Ops emitted, so that tests can check that they cover every op.
+    bool emitted[Op_Count];
+} TestCode;
+
+#define TEST_FORMAT_WORDS_None 0
+#define TEST_FORMAT_WORDS_I32 1
+#define TEST_FORMAT_WORDS_Target 1
+#define TEST_FORMAT_WORDS_I64 2
+#define TEST_FORMAT_WORDS_F64 2
+
+static inline size_t test_imm_words(Op op)
+{
+    switch (op) {
+#define TEST_OP_WORDS(NAME, FORMAT, DST, LEFT, RIGHT)                          \
+    case Op_##NAME:                                                            \
+        return TEST_FORMAT_WORDS_##FORMAT;
+        VM_OP_LIST(TEST_OP_WORDS)
+#undef TEST_OP_WORDS
+        default:
+            return 0;
+    }
+}
+
+static inline uint32_t test_inst(Op op, Reg dst, Reg left, Reg right)
+{
+    return (uint32_t)op | (uint32_t)dst << 8 | (uint32_t)right << 16
+        | (uint32_t)left << 24;
+}
+
+/// Emits an instruction, and as many words of `imm` as its op takes. Jump
+/// targets are word offsets, see `test_patch` for jumps forward. Returns the
+/// word offset of the instruction.
+static inline size_t test_emit(
+    TestCode* code, Op op, Reg dst, Reg left, Reg right, uint64_t imm)
+{
+    size_t words = test_imm_words(op);
+    TEST_ASSERT(code->size + 1 + words <= TEST_CODE_SIZE, "test code full");
+    size_t at = code->size;
+    code->words[code->size++] = test_inst(op, dst, left, right);
+    if (words >= 1)
+        code->words[code->size++] = (uint32_t)imm;
+    if (words == 2)
+        code->words[code->size++] = (uint32_t)(imm >> 32);
+    code->emitted[op] = true;
+    return at;
+}
+
+/// Points the jump at word `at` to the next instruction emitted.
+static inline void test_patch(TestCode* code, size_t at)
+{
+    code->words[at + 1] = (uint32_t)code->size;
+}
+
+static inline uint64_t test_f64(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,273 @@
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    OpReg dst;
+    OpReg left;
+    OpReg right;
+} OpRegs;
+
+static const OpRegs op_regs[Op_Count] = {
+#define VM_OP_REGS(NAME, FORMAT, DST, LEFT, RIGHT)                             \
+    [Op_##NAME] = { OpReg_##DST, OpReg_##LEFT, OpReg_##RIGHT },
+    VM_OP_LIST(VM_OP_REGS)
+#undef VM_OP_REGS
+};
+
+static inline bool reg_valid(OpReg kind, Reg reg)
+{
+    switch (kind) {
+        case OpReg_None:
+            return true;
+        case OpReg_I:
+            return reg < IREGS;
+        case OpReg_F:
+            return reg < FREGS;
+    }
+    return false;
+}
+
+static inline int verify_operands(const Program* program)
+{
+    for (size_t i = 0; i < program->insts_size; ++i) {
+        const Inst* inst = &program->insts[i];
+        OpRegs regs = op_regs[inst->op];
+        if (!reg_valid(regs.dst, inst->dst)
+            || !reg_valid(regs.left, inst->left)
+            || !reg_valid(regs.right, inst->right)) {
+            fprintf(stderr, "error: register out of range at %u\n", inst->word);
+            return -1;
+        }
+        if (inst->op == Op_Builtin && inst->imm >= Builtin_Count) {
+            fprintf(stderr, "error: invalid builtin at %u\n", inst->word);
+            return -1;
+        }
+        // Immediate divisors are checked here, so that only the register
+        // forms check for division by zero while running. `IDivI` can't
+        // overflow, since `%i32` is zero extended.
+        if ((inst->op == Op_DivI || inst->op == Op_RemI
+                || inst->op == Op_IDivI)
+            && inst->imm == 0) {
+            fprintf(stderr, "error: division by zero at %u\n", inst->word);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline size_t inst_index(const Program* program, const Inst* inst)
+{
+    return (size_t)(inst - program->insts);
+}
+
+/// Successors of an instruction within the function it belongs to. Calls
+/// continue at the next instruction, when the callee returns.
+static inline size_t inst_successors(
+    const Program* program, size_t index, size_t successors[2])
+{
+    const Inst* inst = &program->insts[index];
+    switch (inst->op) {
+        case Op_Halt:
+        case Op_Ret:
+            return 0;
+        case Op_Jmp:
+            successors[0] = inst_index(program, inst->target);
+            return 1;
+        case Op_Jz:
+        case Op_Jnz:
+            successors[0] = inst_index(program, inst->target);
+            successors[1] = index + 1;
+            return 2;
+        default:
+            successors[0] = index + 1;
+            return 1;
+    }
+}
+
+/// Words the instruction pushes onto the stack. Calls are balanced, since the
+/// callee's `Ret` restores the stack pointer.
+static inline int64_t inst_stack_effect(const Inst* inst)
+{
+    switch (inst->op) {
+        case Op_Push:
+        case Op_PushF:
+            return 1;
+        case Op_Pop:
+        case Op_PopF:
+            return -1;
+        case Op_Alloca:
+            return (int64_t)inst->imm;
+        default:
+            return 0;
+    }
+}
+
+/// Finds the max stack height relative to the stack base of any function.
+///
+/// Since `Call` can enter any instruction, every instruction is treated as a
+/// possible function start, with height 0. Heights are then propagated to
+/// successors, keeping the largest. A loop that keeps growing the stack makes
+/// the heights exceed `STACK_SIZE`, which is rejected. So is a `Pop` that is
+/// below the stack base even at its largest height, since no path pushes the
+/// word it pops.
+static inline int verify_stack(Program* program)
+{
+    int result = -1;
+    size_t size = program->insts_size;
+    int64_t* heights = calloc(size, sizeof(int64_t));
+    size_t* worklist = malloc(size * sizeof(size_t));
+    bool* queued = malloc(size * sizeof(bool));
+    if (!heights || !worklist || !queued)
+        goto l0_return;
+
+    size_t worklist_size = 0;
+    for (size_t i = 0; i < size; ++i) {
+        worklist[worklist_size++] = size - 1 - i;
+        queued[i] = true;
+    }
+
+    int64_t max_height = 0;
+    while (worklist_size != 0) {
+        size_t index = worklist[--worklist_size];
+        queued[index] = false;
+
+        const Inst* inst = &program->insts[index];
+        // Negative heights aren't propagated, since heights only grow. They
+        // are rejected once the largest heights are known.
+        int64_t height = heights[index] + inst_stack_effect(inst);
+        if (height > STACK_SIZE) {
+            fprintf(stderr,
+                "error: unbounded stack growth at %u\n",
+                inst->word);
+            goto l0_return;
+        }
+        if (height > max_height)
+            max_height = height;
+
+        size_t successors[2];
+        size_t successors_size = inst_successors(program, index, successors);
+        for (size_t i = 0; i < successors_size; ++i) {
+            size_t successor = successors[i];
+            if (height <= heights[successor])
+                continue;
+            heights[successor] = height;
+            if (!queued[successor]) {
+                queued[successor] = true;
+                worklist[worklist_size++] = successor;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        const Inst* inst = &program->insts[i];
+        if (heights[i] + inst_stack_effect(inst) < 0) {
+            fprintf(stderr, "error: stack underflow at %u\n", inst->word);
+            goto l0_return;
+        }
+    }
+    program->max_frame = (size_t)max_height;
+    result = 0;
+
+l0_return:
+    free(heights);
+    free(worklist);
+    free(queued);
+    return result;
+}
+
+int program_verify(Program* program)
+{
+    if (verify_operands(program) != 0)
+        return -1;
+    if (verify_stack(program) != 0)
+        return -1;
+    return 0;
+}
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+
+static inline int test_verify(const uint32_t* code, size_t size)
+{
+    Program program;
+    if (program_decode(&program, code, size) != 0)
+        return -1;
+    program_destroy(&program);
+    return 0;
+}
+
+void test_verify_programs(void)
+{
+    const uint32_t balanced[] = {
+        test_inst(Op_Push, 0, 1, 0),
+        test_inst(Op_PushF, 0, 1, 0),
+        test_inst(Op_PopF, 1, 0, 0),
+        test_inst(Op_Pop, 1, 0, 0),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_verify(balanced, 5) == 0,
+        "balanced pushes and pops should be accepted");
+
+    const uint32_t bad_ireg[] = {
+        test_inst(Op_Add, 0, 1, IREGS),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_verify(bad_ireg, 2) != 0,
+        "out of range `%ireg` should be rejected");
+
+    const uint32_t bad_freg[] = {
+        test_inst(Op_MovFF, FREGS, 0, 0),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_verify(bad_freg, 2) != 0,
+        "out of range `%freg` should be rejected");
+
+    // The target is the jump's own immediate.
+    const uint32_t bad_target[] = {
+        test_inst(Op_Jmp, 0, 0, 0),
+        1,
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_verify(bad_target, 3) != 0,
+        "jump into an instruction should be rejected");
+
+    const uint32_t div_zero[] = {
+        test_inst(Op_DivI, 0, 1, 0),
+        0,
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_verify(div_zero, 3) != 0,
+        "division by immediate 0 should be rejected");
+
+    const uint32_t push_loop[] = {
+        test_inst(Op_Push, 0, 1, 0),
+        test_inst(Op_Jmp, 0, 0, 0),
+        0,
+    };
+    TEST_ASSERT(test_verify(push_loop, 3) != 0,
+        "unbounded stack growth should be rejected");
+
+    const uint32_t pop[] = {
+        test_inst(Op_Pop, 1, 0, 0),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(
+        test_verify(pop, 2) != 0, "pop without a push should be rejected");
+
+    // The push is on the other branch.
+    const uint32_t pop_branch[] = {
+        test_inst(Op_Jz, 0, 1, 0),
+        4,
+        test_inst(Op_Push, 0, 1, 0),
+        test_inst(Op_Ret, 0, 0, 0),
+        test_inst(Op_PopF, 1, 0, 0),
+        test_inst(Op_Ret, 0, 0, 0),
+    };
+    TEST_ASSERT(test_verify(pop_branch, 6) != 0,
+        "pop not preceded by any push should be rejected");
+}
+#endif
@@ -1,832 +1,1153 @@
+#define _DEFAULT_SOURCE
+
 #include "vm.h"
+#include "jit.h"
+#include "profile.h"
+#include "stack.h"
 #include "util.h"
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-void vm_construct(VM* vm)
+int vm_construct(VM* vm)
 {
-    size_t files_capacity = 64;
+    size_t files_capacity = 8;
     FsFile* files = malloc(sizeof(FsFile) * files_capacity);
+    if (!files)
+        return -1;
 
     *vm = (VM) {
         .files = files,
         .files_size = 0,
         .files_capacity = files_capacity,
-        .next_file_id = 0,
+        .free_file = UINT32_MAX,
+        .imports = NULL,
+        .imports_size = 0,
+        .stack_size = STACK_SIZE,
+        .call_stack_size = CALL_STACK_SIZE,
+        .profile = NULL,
     };
+    heap_construct(&vm->heap);
 
-    vm->files[vm->files_size++] = (FsFile) { .id = 0, .fp = stdin };
-    vm->files[vm->files_size++] = (FsFile) { .id = 1, .fp = stdout };
-    vm->files[vm->files_size++] = (FsFile) { .id = 2, .fp = stderr };
-    vm->next_file_id += 3;
+    vm->files[vm->files_size++] = (FsFile) { .fp = stdin };
+    vm->files[vm->files_size++] = (FsFile) { .fp = stdout };
+    vm->files[vm->files_size++] = (FsFile) { .fp = stderr };
+    return 0;
 }
 
-void vm_destroy(VM* vm)
+static inline bool fs_std_stream(const FILE* fp)
 {
-    (void)vm;
+    return fp == stdin || fp == stdout || fp == stderr;
 }
 
-ALWAYS_INLINE static inline Op line_op(uint32_t line)
+void vm_destroy(VM* vm)
 {
-    return line & 0xff;
+    for (size_t i = 0; i < vm->files_size; ++i) {
+        FILE* fp = vm->files[i].fp;
+        if (fp && !fs_std_stream(fp))
+            fclose(fp);
+        free(vm->files[i].buffer);
+    }
+    fflush(stdout);
+    free(vm->files);
+    heap_destroy(&vm->heap);
 }
 
-ALWAYS_INLINE static inline Reg line_dst(uint32_t line)
+ALWAYS_INLINE static inline double bits_f64(uint64_t bits)
 {
-    return line >> 8 & 0xff;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
 }
 
-ALWAYS_INLINE static inline Reg line_src_right(uint32_t line)
+ALWAYS_INLINE static inline uint64_t f64_bits(double value)
 {
-    return line >> 16 & 0xff;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
 }
 
-ALWAYS_INLINE static inline Reg line_src_left(uint32_t line)
-{
-    return line >> 24 & 0xff;
-}
+// The interpreter uses direct threading through GCC's labels-as-values when
+// available, so that every handler ends in its own indirect jump. Define
+// `VM_DISPATCH_SWITCH` to use the portable `switch` loop instead.
+#if defined(__GNUC__) && !defined(VM_DISPATCH_SWITCH)
+#define VM_COMPUTED_GOTO
+#endif
 
-ALWAYS_INLINE static inline uint32_t eat_i32(const uint32_t** pc)
+// After a trap, `vm_exec` only reads locals that don't change after the
+// `sigsetjmp`. GCC still warns about the ones that do.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wclobbered"
+static int vm_exec(VM* vm,
+    const Program* program,
+    const Inst* entry,
+    Regs* regs_io,
+    Program* link)
 {
-    uint32_t imm = **pc;
-    ++*pc;
-    return imm;
-}
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static const void* const dispatch_table[256] = {
+        [0 ... 255] = &&op_invalid,
+#define VM_OP_LABEL(NAME, FORMAT, DST, LEFT, RIGHT) [Op_##NAME] = &&op_##NAME,
+        VM_OP_LIST(VM_OP_LABEL)
+#undef VM_OP_LABEL
+#define VM_FUSED_OP_LABEL(NAME, LENGTH, FIRST) [Op_##NAME] = &&op_##NAME,
+        VM_FUSED_OP_LIST(VM_FUSED_OP_LABEL)
+#undef VM_FUSED_OP_LABEL
+    };
+    if (link) {
+        for (size_t i = 0; i < link->insts_size; ++i) {
+            link->insts[i].handler = dispatch_table[link->insts[i].op];
+        }
+        return 0;
+    }
+#else
+    if (link)
+        return 0;
+#endif
 
-ALWAYS_INLINE static inline uint64_t eat_i64(const uint32_t** pc)
-{
-    uint64_t imm = **pc;
-    ++*pc;
-    imm &= (uint64_t)**pc << 32;
-    ++*pc;
-    return imm;
-}
+    Regs regs = *regs_io;
 
-ALWAYS_INLINE static inline double eat_f64(const uint32_t** pc)
-{
-    return (double)eat_i64(pc);
-}
+    Stacks stacks;
+    if (stacks_acquire(&stacks,
+            vm->stack_size,
+            vm->call_stack_size,
+            program->max_frame)
+        != 0) {
+        fprintf(stderr, "error: could not allocate stacks\n");
+        return -1;
+    }
 
-int vm_run(VM* vm, const uint32_t* program)
-{
-    (void)vm;
+    Call* call_stack = stacks.call_stack;
 
-    Regs regs = {
-        .iregs = { 0 },
-        .fregs = { 0.0 },
+    const Inst* inst;
+    const Inst* pc = entry;
+
+    uint64_t* sb = stacks.stack;
+    uint64_t* sp = sb;
+
+    *call_stack = (Call) {
+        .caller_sb = sb,
+        .return_ptr = &program->insts[program->insts_size - 1],
     };
+    ++call_stack;
 
-    uint64_t* const stack = malloc(STACK_SIZE * sizeof(uint64_t));
-    Call* const call_stack_base = malloc(CALL_STACK_SIZE * sizeof(Call));
+    int result = 0;
 
-    Call* call_stack = call_stack_base;
+#ifdef VM_JIT
+    Jit* const jit = program->jit;
 
-    const uint32_t* program_base = program;
-    const uint32_t* pc = program_base;
+    // Continues in compiled code at `ENTRY`, if it is not NULL, until it
+    // hands back an instruction to interpret.
+#define VM_JIT_ENTER(ENTRY)                                                    \
+    do {                                                                       \
+        const void* native = jit ? (ENTRY) : NULL;                             \
+        if (native) {                                                          \
+            JitFrame frame = { .sb = sb, .sp = sp };                           \
+            pc = jit_run(jit, native, &regs, &frame);                          \
+            sp = frame.sp;                                                     \
+        }                                                                      \
+    } while (0)
+#else
+#define VM_JIT_ENTER(ENTRY)                                                    \
+    do {                                                                       \
+    } while (0)
+#endif
 
-    uint64_t* sb = stack;
-    uint64_t* sp = sb;
+    // Takes a step from the budget (see `Regs.budget`).
+#define VM_STEP()                                                              \
+    do {                                                                       \
+        if (regs.budget == 0)                                                  \
+            goto budget_exhausted;                                             \
+        regs.budget -= 1;                                                      \
+    } while (0)
+#define VM_JUMP_STEP(JUMP)                                                     \
+    do {                                                                       \
+        if ((JUMP)->target <= (JUMP))                                          \
+            VM_STEP();                                                         \
+    } while (0)
+
+#ifdef VM_PROFILE
+    Profile* const profile = vm->profile;
+    if (profile)
+        profile_start(profile, pc);
+
+#define VM_PROFILE_INST()                                                      \
+    do {                                                                       \
+        if (profile)                                                           \
+            profile_inst(profile, inst);                                       \
+    } while (0)
+#define VM_PROFILE_CALL()                                                      \
+    do {                                                                       \
+        if (profile)                                                           \
+            profile_call(profile, pc);                                         \
+    } while (0)
+#define VM_PROFILE_RET()                                                       \
+    do {                                                                       \
+        if (profile)                                                           \
+            profile_ret(profile);                                              \
+    } while (0)
+#else
+#define VM_PROFILE_INST()                                                      \
+    do {                                                                       \
+    } while (0)
+#define VM_PROFILE_CALL()                                                      \
+    do {                                                                       \
+    } while (0)
+#define VM_PROFILE_RET()                                                       \
+    do {                                                                       \
+    } while (0)
+#endif
+
+    // Nothing checks for overflows while running. Instead, overflowing
+    // either stack faults in its guard pages, which lands here.
+    StackTrap trap;
+    stack_trap_push(&trap, &stacks);
+    if (sigsetjmp(trap.env, 0) != 0) {
+        fprintf(stderr, "error: stack overflow\n");
+        result = -1;
+        goto halt_program;
+    }
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_CASE(NAME) op_##NAME:
+#define VM_CASE_INVALID op_invalid:
+#define VM_DISPATCH()                                                          \
+    do {                                                                       \
+        inst = pc;                                                             \
+        ++pc;                                                                  \
+        VM_PROFILE_INST();                                                     \
+        goto* inst->handler;                                                   \
+    } while (0)
+
+    VM_DISPATCH();
+    {
+#else
+#define VM_CASE(NAME) case Op_##NAME:
+#define VM_CASE_INVALID default:
+#define VM_DISPATCH() continue
 
     for (;;) {
-        uint32_t line = *pc;
-        Op op = line_op(line);
+        inst = pc;
         ++pc;
-        switch (op) {
-            case Op_Nop: {
-                break;
-            }
-            case Op_Halt: {
+        VM_PROFILE_INST();
+        switch (inst->op) {
+#endif
+        VM_CASE(Nop) {
+            VM_DISPATCH();
+        }
+        VM_CASE(Halt) {
+            goto halt_program;
+        }
+        VM_CASE(Builtin) {
+            if (vm_exec_builtin(vm, (Builtin)inst->imm, &regs) != 0) {
+                fprintf(stderr, "error: builtin failed at %u\n", inst->word);
+                result = -1;
                 goto halt_program;
             }
-            case Op_Builtin: {
-                break;
-            }
+            VM_JIT_ENTER(jit_entry(jit, pc));
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_Call: {
-                Reg reg = line_src_left(line);
-                *call_stack = (Call) { .caller_sb = sb, .return_ptr = pc + 1 };
-                ++call_stack;
-                pc = program_base + regs.iregs[reg];
-                break;
-            }
-            case Op_CallI: {
-                uint32_t ptr = eat_i32(&pc);
-                *call_stack = (Call) { .caller_sb = sb, .return_ptr = pc + 1 };
-                ++call_stack;
-                pc = program_base + ptr;
-                break;
-            }
-            case Op_Ret: {
-                --call_stack;
-                sb = call_stack->caller_sb;
-                pc = call_stack->return_ptr;
-                break;
-            }
-            case Op_Alloca: {
-                uint32_t size = eat_i32(&pc);
-                sp += size;
-                break;
+        VM_CASE(Call) {
+            Reg reg = inst->left;
+            const Inst* target = program_inst_at(program, regs.iregs[reg]);
+            if (!target) {
+                fprintf(stderr,
+                    "error: invalid call target %" PRIu64 " at %u\n",
+                    regs.iregs[reg],
+                    inst->word);
+                result = -1;
+                goto halt_program;
             }
+            VM_STEP();
+            *call_stack = (Call) { .caller_sb = sb, .return_ptr = pc };
+            ++call_stack;
+            sb = sp;
+            pc = target;
+            VM_PROFILE_CALL();
+            VM_JIT_ENTER(jit_call(jit, pc));
+            VM_DISPATCH();
+        }
+        VM_CASE(CallI) {
+            VM_STEP();
+            *call_stack = (Call) { .caller_sb = sb, .return_ptr = pc };
+            ++call_stack;
+            sb = sp;
+            pc = inst->target;
+            VM_PROFILE_CALL();
+            VM_JIT_ENTER(jit_call(jit, pc));
+            VM_DISPATCH();
+        }
+        VM_CASE(Ret) {
+            --call_stack;
+            sp = sb;
+            sb = call_stack->caller_sb;
+            pc = call_stack->return_ptr;
+            VM_PROFILE_RET();
+            VM_JIT_ENTER(jit_entry(jit, pc));
+            VM_DISPATCH();
+        }
+        VM_CASE(Alloca) {
+            uint64_t size = inst->imm;
+            sp += size;
+            // Touches the top of the frame, so that a frame that doesn't fit
+            // faults in the guard pages, instead of skipping past them.
+            if (size != 0)
+                (void)*(volatile uint64_t*)(sp - 1);
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_Jmp: {
-                uint32_t ptr = eat_i32(&pc);
-                pc = program_base + ptr;
-                break;
-            }
-            case Op_Jnz: {
-                uint32_t ptr = eat_i32(&pc);
-                if (regs.iregs[line_src_right(line)] != 0) {
-                    pc = program_base + ptr;
-                } else {
-                    ++pc;
-                }
-                break;
+        VM_CASE(Jmp) {
+            VM_JUMP_STEP(inst);
+            pc = inst->target;
+            VM_DISPATCH();
+        }
+        VM_CASE(Jnz) {
+            VM_JUMP_STEP(inst);
+            Reg reg = inst->left;
+            if (regs.iregs[reg] != 0) {
+                pc = inst->target;
             }
-            case Op_Jz: {
-                Reg reg = line_src_left(line);
-                uint32_t ptr = eat_i32(&pc);
-                if (regs.iregs[reg] == 0) {
-                    pc = program_base + ptr;
-                } else {
-                    ++pc;
-                }
-                break;
+            VM_DISPATCH();
+        }
+        VM_CASE(Jz) {
+            VM_JUMP_STEP(inst);
+            Reg reg = inst->left;
+            if (regs.iregs[reg] == 0) {
+                pc = inst->target;
             }
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_Load8: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.iregs[dst] = *(uint8_t*)regs.iregs[src];
-                break;
-            }
-            case Op_LoadI8: {
-                Reg dst = line_dst(line);
-                uint64_t addr = eat_i64(&pc);
-                regs.iregs[dst] = *(uint8_t*)addr;
-                break;
-            }
-            case Op_LoadA8: {
-                Reg dst = line_dst(line);
-                Reg base = line_src_left(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                regs.iregs[dst] = *(uint8_t*)(addr);
-                break;
-            }
-            case Op_Load16: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.iregs[dst] = *(uint16_t*)regs.iregs[src];
-                break;
-            }
-            case Op_LoadI16: {
-                Reg dst = line_dst(line);
-                uint64_t addr = eat_i64(&pc);
-                regs.iregs[dst] = *(uint16_t*)addr;
-                break;
-            }
-            case Op_LoadA16: {
-                Reg dst = line_dst(line);
-                Reg base = line_src_left(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                regs.iregs[dst] = *(uint16_t*)(addr);
-                break;
-            }
-            case Op_Load32: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.iregs[dst] = *(uint32_t*)regs.iregs[src];
-                break;
-            }
-            case Op_LoadI32: {
-                Reg dst = line_dst(line);
-                uint64_t addr = eat_i64(&pc);
-                regs.iregs[dst] = *(uint32_t*)addr;
-                break;
-            }
-            case Op_LoadA32: {
-                Reg dst = line_dst(line);
-                Reg base = line_src_left(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                regs.iregs[dst] = *(uint32_t*)(addr);
-                break;
-            }
-            case Op_Load64: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.iregs[dst] = *(uint64_t*)regs.iregs[src];
-                break;
-            }
-            case Op_LoadI64: {
-                Reg dst = line_dst(line);
-                uint64_t addr = eat_i64(&pc);
-                regs.iregs[dst] = *(uint64_t*)addr;
-                break;
-            }
-            case Op_LoadA64: {
-                Reg dst = line_dst(line);
-                Reg base = line_src_left(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                regs.iregs[dst] = *(uint64_t*)(addr);
-                break;
-            }
-            case Op_LoadF: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.fregs[dst] = *(double*)regs.iregs[src];
-                break;
-            }
-            case Op_LoadIF: {
-                Reg dst = line_dst(line);
-                uint64_t addr = eat_i64(&pc);
-                regs.fregs[dst] = *(double*)addr;
-                break;
-            }
-            case Op_LoadAF: {
-                Reg dst = line_dst(line);
-                Reg base = line_src_left(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                regs.fregs[dst]
-                    = *(double*)(regs.iregs[base] + regs.iregs[offset] * incr);
-                break;
-            }
+        VM_CASE(Load8) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.iregs[dst] = *(uint8_t*)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadI8) {
+            Reg dst = inst->dst;
+            uint64_t addr = inst->imm;
+            regs.iregs[dst] = *(uint8_t*)addr;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadA8) {
+            Reg dst = inst->dst;
+            Reg base = inst->left;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            regs.iregs[dst] = *(uint8_t*)(addr);
+            VM_DISPATCH();
+        }
+        VM_CASE(Load16) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.iregs[dst] = *(uint16_t*)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadI16) {
+            Reg dst = inst->dst;
+            uint64_t addr = inst->imm;
+            regs.iregs[dst] = *(uint16_t*)addr;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadA16) {
+            Reg dst = inst->dst;
+            Reg base = inst->left;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            regs.iregs[dst] = *(uint16_t*)(addr);
+            VM_DISPATCH();
+        }
+        VM_CASE(Load32) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.iregs[dst] = *(uint32_t*)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadI32) {
+            Reg dst = inst->dst;
+            uint64_t addr = inst->imm;
+            regs.iregs[dst] = *(uint32_t*)addr;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadA32) {
+            Reg dst = inst->dst;
+            Reg base = inst->left;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            regs.iregs[dst] = *(uint32_t*)(addr);
+            VM_DISPATCH();
+        }
+        VM_CASE(Load64) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.iregs[dst] = *(uint64_t*)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadI64) {
+            Reg dst = inst->dst;
+            uint64_t addr = inst->imm;
+            regs.iregs[dst] = *(uint64_t*)addr;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadA64) {
+            Reg dst = inst->dst;
+            Reg base = inst->left;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            regs.iregs[dst] = *(uint64_t*)(addr);
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadF) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.fregs[dst] = *(double*)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadIF) {
+            Reg dst = inst->dst;
+            uint64_t addr = inst->imm;
+            regs.fregs[dst] = *(double*)addr;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadAF) {
+            Reg dst = inst->dst;
+            Reg base = inst->left;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            regs.fregs[dst]
+                = *(double*)(regs.iregs[base] + regs.iregs[offset] * incr);
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_Store8: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                *(uint8_t*)regs.iregs[dst] = (uint8_t)regs.iregs[src];
-                break;
-            }
-            case Op_StoreA8: {
-                Reg src = line_src_left(line);
-                Reg base = line_dst(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                *(uint8_t*)addr = (uint8_t)regs.iregs[src];
-                break;
-            }
-            case Op_Store16: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                *(uint16_t*)regs.iregs[dst] = (uint16_t)regs.iregs[src];
-                break;
-            }
-            case Op_StoreA16: {
-                Reg src = line_src_left(line);
-                Reg base = line_dst(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                *(uint16_t*)addr = (uint16_t)regs.iregs[src];
-                break;
-            }
-            case Op_Store32: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                *(uint32_t*)regs.iregs[dst] = (uint32_t)regs.iregs[src];
-                break;
-            }
-            case Op_StoreA32: {
-                Reg src = line_src_left(line);
-                Reg base = line_dst(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                *(uint32_t*)addr = (uint32_t)regs.iregs[src];
-                break;
-            }
-            case Op_Store64: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                *(uint64_t*)regs.iregs[dst] = regs.iregs[src];
-                break;
-            }
-            case Op_StoreA64: {
-                Reg src = line_src_left(line);
-                Reg base = line_dst(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                *(uint64_t*)addr = regs.iregs[src];
-                break;
-            }
-            case Op_StoreF: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                *(double*)regs.iregs[dst] = regs.fregs[src];
-                break;
-            }
-            case Op_StoreAF: {
-                Reg src = line_src_left(line);
-                Reg base = line_dst(line);
-                Reg offset = line_src_right(line);
-                uint32_t incr = eat_i32(&pc);
-                uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
-                *(double*)addr = regs.fregs[src];
-                break;
-            }
+        VM_CASE(Store8) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            *(uint8_t*)regs.iregs[dst] = (uint8_t)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(StoreA8) {
+            Reg src = inst->left;
+            Reg base = inst->dst;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            *(uint8_t*)addr = (uint8_t)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(Store16) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            *(uint16_t*)regs.iregs[dst] = (uint16_t)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(StoreA16) {
+            Reg src = inst->left;
+            Reg base = inst->dst;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            *(uint16_t*)addr = (uint16_t)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(Store32) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            *(uint32_t*)regs.iregs[dst] = (uint32_t)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(StoreA32) {
+            Reg src = inst->left;
+            Reg base = inst->dst;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            *(uint32_t*)addr = (uint32_t)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(Store64) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            *(uint64_t*)regs.iregs[dst] = regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(StoreA64) {
+            Reg src = inst->left;
+            Reg base = inst->dst;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            *(uint64_t*)addr = regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(StoreF) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            *(double*)regs.iregs[dst] = regs.fregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(StoreAF) {
+            Reg src = inst->left;
+            Reg base = inst->dst;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            *(double*)addr = regs.fregs[src];
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_LoadImm32: {
-                Reg dst = line_dst(line);
-                regs.iregs[dst] = eat_i32(&pc);
-                break;
-            }
-            case Op_LoadImm64: {
-                Reg dst = line_dst(line);
-                regs.iregs[dst] = eat_i64(&pc);
-                break;
-            }
-            case Op_LoadImmF: {
-                Reg dst = line_dst(line);
-                regs.fregs[dst] = eat_f64(&pc);
-                break;
-            }
-            case Op_LoadSb: {
-                Reg dst = line_dst(line);
-                regs.iregs[dst] = (uint64_t)sb;
-                break;
-            }
-            case Op_LoadSp: {
-                Reg dst = line_dst(line);
-                regs.iregs[dst] = (uint64_t)sp;
-                break;
-            }
+        VM_CASE(LoadImm32) {
+            Reg dst = inst->dst;
+            regs.iregs[dst] = inst->imm;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadImm64) {
+            Reg dst = inst->dst;
+            regs.iregs[dst] = inst->imm;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadImmF) {
+            Reg dst = inst->dst;
+            regs.fregs[dst] = inst->fimm;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadSb) {
+            Reg dst = inst->dst;
+            regs.iregs[dst] = (uint64_t)sb;
+            VM_DISPATCH();
+        }
+        VM_CASE(LoadSp) {
+            Reg dst = inst->dst;
+            regs.iregs[dst] = (uint64_t)sp;
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_MovII: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.iregs[dst] = regs.iregs[src];
-                break;
-            }
-            case Op_MovIF: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.fregs[dst] = (double)regs.iregs[src];
-                break;
-            }
-            case Op_MovFI: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.iregs[dst] = (uint64_t)regs.fregs[src];
-                break;
-            }
-            case Op_MovFF: {
-                Reg dst = line_dst(line);
-                Reg src = line_src_left(line);
-                regs.fregs[dst] = regs.fregs[src];
-                break;
-            }
+        VM_CASE(MovII) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.iregs[dst] = regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(MovIF) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.fregs[dst] = (double)regs.iregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(MovFI) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.iregs[dst] = (uint64_t)regs.fregs[src];
+            VM_DISPATCH();
+        }
+        VM_CASE(MovFF) {
+            Reg dst = inst->dst;
+            Reg src = inst->left;
+            regs.fregs[dst] = regs.fregs[src];
+            VM_DISPATCH();
+        }
 
-            case Op_Push: {
-                Reg src = line_src_left(line);
-                *sp = regs.iregs[src];
-                ++sp;
-                break;
-            }
-            case Op_Pop: {
-                Reg dst = line_dst(line);
-                --sp;
-                regs.iregs[dst] = *sp;
-                break;
-            }
+        VM_CASE(Push) {
+            Reg src = inst->left;
+            *sp = regs.iregs[src];
+            ++sp;
+            VM_DISPATCH();
+        }
+        VM_CASE(Pop) {
+            Reg dst = inst->dst;
+            --sp;
+            regs.iregs[dst] = *sp;
+            VM_DISPATCH();
+        }
 
-            case Op_PushF: {
-                Reg src = line_src_left(line);
-                *sp = (uint64_t)regs.fregs[src];
-                ++sp;
-                break;
-            }
-            case Op_PopF: {
-                Reg dst = line_dst(line);
-                --sp;
-                regs.fregs[dst] = (double)*sp;
-                break;
-            }
+        VM_CASE(PushF) {
+            Reg src = inst->left;
+            *sp = f64_bits(regs.fregs[src]);
+            ++sp;
+            VM_DISPATCH();
+        }
+        VM_CASE(PopF) {
+            Reg dst = inst->dst;
+            --sp;
+            regs.fregs[dst] = bits_f64(*sp);
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_Eq: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] == regs.iregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_Ne: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] != regs.iregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_Lt: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] < regs.iregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_Gt: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] > regs.iregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_Lte: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] <= regs.iregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_Gte: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] >= regs.iregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_And: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] & regs.iregs[right];
-                break;
-            }
-            case Op_Or: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] | regs.iregs[right];
-                break;
-            }
-            case Op_Xor: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] ^ regs.iregs[right];
-                break;
-            }
-            case Op_Add: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] + regs.iregs[right];
-                break;
-            }
-            case Op_Sub: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] - regs.iregs[right];
-                break;
-            }
-            case Op_Mul: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] * regs.iregs[right];
-                break;
-            }
-            case Op_Div: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] / regs.iregs[right];
-                break;
-            }
-            case Op_Rem: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.iregs[left] / regs.iregs[right];
-                break;
-            }
-            case Op_IMul: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                int64_t val
-                    = (int64_t)regs.iregs[left] * (int64_t)regs.iregs[right];
-                regs.iregs[dst] = (uint64_t)val;
-                break;
-            }
-            case Op_IDiv: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                int64_t val
-                    = (int64_t)regs.iregs[left] / (int64_t)regs.iregs[right];
-                regs.iregs[dst] = (uint64_t)val;
-                break;
-            }
+        VM_CASE(Eq) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] == regs.iregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(Ne) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] != regs.iregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(Lt) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] < regs.iregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(Gt) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] > regs.iregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(Lte) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] <= regs.iregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(Gte) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] >= regs.iregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(And) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] & regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Or) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] | regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Xor) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] ^ regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Add) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] + regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Sub) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] - regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Mul) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] * regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Div) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            if (regs.iregs[right] == 0)
+                goto invalid_division;
+            regs.iregs[dst] = regs.iregs[left] / regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(Rem) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            if (regs.iregs[right] == 0)
+                goto invalid_division;
+            regs.iregs[dst] = regs.iregs[left] % regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(IMul) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            // The low 64 bits of the product are the same signed and
+            // unsigned, and unsigned overflow is defined.
+            regs.iregs[dst] = regs.iregs[left] * regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(IDiv) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            int64_t divisor = (int64_t)regs.iregs[right];
+            if (divisor == 0
+                || (divisor == -1 && (int64_t)regs.iregs[left] == INT64_MIN))
+                goto invalid_division;
+            int64_t val = (int64_t)regs.iregs[left] / divisor;
+            regs.iregs[dst] = (uint64_t)val;
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_EqI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] == right ? 1 : 0;
-                break;
-            }
-            case Op_NeI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] != right ? 1 : 0;
-                break;
-            }
-            case Op_LtI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] < right ? 1 : 0;
-                break;
-            }
-            case Op_GtI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] > right ? 1 : 0;
-                break;
-            }
-            case Op_LteI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] <= right ? 1 : 0;
-                break;
-            }
-            case Op_GteI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] >= right ? 1 : 0;
-                break;
-            }
-            case Op_AndI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] & right;
-                break;
-            }
-            case Op_OrI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] | right;
-                break;
-            }
-            case Op_XorI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] ^ right;
-                break;
-            }
-            case Op_AddI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] + right;
-                break;
-            }
-            case Op_SubI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] - right;
-                break;
-            }
-            case Op_RSubI: {
-                Reg dst = line_dst(line);
-                uint64_t left = eat_i32(&pc);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = left - regs.iregs[right];
-                break;
-            }
-            case Op_MulI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] * right;
-                break;
-            }
-            case Op_DivI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] / right;
-                break;
-            }
-            case Op_RemI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                regs.iregs[dst] = regs.iregs[left] % right;
-                break;
-            }
-            case Op_IMulI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                int64_t val = (int64_t)regs.iregs[left] * (int64_t)right;
-                regs.iregs[dst] = (uint64_t)val;
-                break;
-            }
-            case Op_IDivI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                uint64_t right = eat_i32(&pc);
-                int64_t val = (int64_t)regs.iregs[left] / (int64_t)right;
-                regs.iregs[dst] = (uint64_t)val;
-                break;
-            }
+        VM_CASE(EqI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] == right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(NeI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] != right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(LtI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] < right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(GtI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] > right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(LteI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] <= right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(GteI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] >= right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(AndI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] & right;
+            VM_DISPATCH();
+        }
+        VM_CASE(OrI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] | right;
+            VM_DISPATCH();
+        }
+        VM_CASE(XorI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] ^ right;
+            VM_DISPATCH();
+        }
+        VM_CASE(AddI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] + right;
+            VM_DISPATCH();
+        }
+        VM_CASE(SubI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] - right;
+            VM_DISPATCH();
+        }
+        VM_CASE(RSubI) {
+            Reg dst = inst->dst;
+            uint64_t left = inst->imm;
+            Reg right = inst->right;
+            regs.iregs[dst] = left - regs.iregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(MulI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] * right;
+            VM_DISPATCH();
+        }
+        VM_CASE(DivI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] / right;
+            VM_DISPATCH();
+        }
+        VM_CASE(RemI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] % right;
+            VM_DISPATCH();
+        }
+        VM_CASE(IMulI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            // See `IMul`.
+            regs.iregs[dst] = regs.iregs[left] * right;
+            VM_DISPATCH();
+        }
+        VM_CASE(IDivI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            int64_t val = (int64_t)regs.iregs[left] / (int64_t)right;
+            regs.iregs[dst] = (uint64_t)val;
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_EqF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.fregs[left] == regs.fregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_NeF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.fregs[left] != regs.fregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_LtF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.fregs[left] < regs.fregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_GtF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.fregs[left] > regs.fregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_LteF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.fregs[left] <= regs.fregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_GteF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.iregs[dst] = regs.fregs[left] >= regs.fregs[right] ? 1 : 0;
-                break;
-            }
-            case Op_AddF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.fregs[dst] = regs.fregs[left] + regs.fregs[right];
-                break;
-            }
-            case Op_SubF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.fregs[dst] = regs.fregs[left] - regs.fregs[right];
-                break;
-            }
-            case Op_MulF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.fregs[dst] = regs.fregs[left] * regs.fregs[right];
-                break;
-            }
-            case Op_DivF: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                Reg right = line_src_right(line);
-                regs.fregs[dst] = regs.fregs[left] / regs.fregs[right];
-                break;
-            }
+        VM_CASE(EqF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.fregs[left] == regs.fregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(NeF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.fregs[left] != regs.fregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(LtF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.fregs[left] < regs.fregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(GtF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.fregs[left] > regs.fregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(LteF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.fregs[left] <= regs.fregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(GteF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.fregs[left] >= regs.fregs[right] ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(AddF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.fregs[dst] = regs.fregs[left] + regs.fregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(SubF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.fregs[dst] = regs.fregs[left] - regs.fregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(MulF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.fregs[dst] = regs.fregs[left] * regs.fregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(DivF) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.fregs[dst] = regs.fregs[left] / regs.fregs[right];
+            VM_DISPATCH();
+        }
 
-                // ---
+        // ---
 
-            case Op_EqFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.iregs[dst] = regs.fregs[left] == right ? 1 : 0;
-                break;
-            }
-            case Op_NeFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.iregs[dst] = regs.fregs[left] != right ? 1 : 0;
-                break;
-            }
-            case Op_LtFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.iregs[dst] = regs.fregs[left] < right ? 1 : 0;
-                break;
-            }
-            case Op_GtFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.iregs[dst] = regs.fregs[left] > right ? 1 : 0;
-                break;
-            }
-            case Op_LteFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.iregs[dst] = regs.fregs[left] <= right ? 1 : 0;
-                break;
-            }
-            case Op_GteFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.iregs[dst] = regs.fregs[left] >= right ? 1 : 0;
-                break;
-            }
-            case Op_AddFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.fregs[dst] = regs.fregs[left] + right;
-                break;
-            }
-            case Op_SubFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.fregs[dst] = regs.fregs[left] - right;
-                break;
-            }
-            case Op_RSubFI: {
-                Reg dst = line_dst(line);
-                double left = eat_f64(&pc);
-                Reg right = line_src_right(line);
-                regs.fregs[dst] = left - regs.fregs[right];
-                break;
-            }
-            case Op_MulFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.fregs[dst] = regs.fregs[left] * right;
-                break;
-            }
-            case Op_DivFI: {
-                Reg dst = line_dst(line);
-                Reg left = line_src_left(line);
-                double right = eat_f64(&pc);
-                regs.fregs[dst] = regs.fregs[left] / right;
-                break;
-            }
+        VM_CASE(EqFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.iregs[dst] = regs.fregs[left] == right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(NeFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.iregs[dst] = regs.fregs[left] != right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(LtFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.iregs[dst] = regs.fregs[left] < right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(GtFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.iregs[dst] = regs.fregs[left] > right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(LteFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.iregs[dst] = regs.fregs[left] <= right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(GteFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.iregs[dst] = regs.fregs[left] >= right ? 1 : 0;
+            VM_DISPATCH();
+        }
+        VM_CASE(AddFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.fregs[dst] = regs.fregs[left] + right;
+            VM_DISPATCH();
         }
+        VM_CASE(SubFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.fregs[dst] = regs.fregs[left] - right;
+            VM_DISPATCH();
+        }
+        VM_CASE(RSubFI) {
+            Reg dst = inst->dst;
+            double left = inst->fimm;
+            Reg right = inst->right;
+            regs.fregs[dst] = left - regs.fregs[right];
+            VM_DISPATCH();
+        }
+        VM_CASE(MulFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.fregs[dst] = regs.fregs[left] * right;
+            VM_DISPATCH();
+        }
+        VM_CASE(DivFI) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            double right = inst->fimm;
+            regs.fregs[dst] = regs.fregs[left] / right;
+            VM_DISPATCH();
+        }
+
+        // ---
+
+        // Superinstructions, see `VM_FUSED_OP_LIST`. Operands of the
+        // instructions after the first are read from `inst[1]` and `inst[2]`.
+
+#define VM_CASE_COMPARE_BRANCH(NAME, OPERATOR, RIGHT, BRANCH)                  \
+    VM_CASE(NAME) {                                                            \
+        Reg dst = inst->dst;                                                   \
+        Reg left = inst->left;                                                 \
+        uint64_t right = (RIGHT);                                              \
+        uint64_t cond = regs.iregs[left] OPERATOR right ? 1 : 0;               \
+        regs.iregs[dst] = cond;                                                \
+        VM_JUMP_STEP(&inst[1]);                                                \
+        pc = (cond BRANCH 0) ? inst[1].target : &inst[2];                      \
+        VM_DISPATCH();                                                         \
     }
 
+#define VM_CASE_COMPARE_BRANCHES(NAME, OPERATOR)                               \
+    VM_CASE_COMPARE_BRANCH(NAME##Jz, OPERATOR, regs.iregs[inst->right], ==)    \
+    VM_CASE_COMPARE_BRANCH(NAME##Jnz, OPERATOR, regs.iregs[inst->right], !=)   \
+    VM_CASE_COMPARE_BRANCH(NAME##IJz, OPERATOR, inst->imm, ==)                 \
+    VM_CASE_COMPARE_BRANCH(NAME##IJnz, OPERATOR, inst->imm, !=)
+
+        VM_CASE_COMPARE_BRANCHES(Eq, ==)
+        VM_CASE_COMPARE_BRANCHES(Ne, !=)
+        VM_CASE_COMPARE_BRANCHES(Lt, <)
+        VM_CASE_COMPARE_BRANCHES(Gt, >)
+        VM_CASE_COMPARE_BRANCHES(Lte, <=)
+        VM_CASE_COMPARE_BRANCHES(Gte, >=)
+
+#undef VM_CASE_COMPARE_BRANCHES
+#undef VM_CASE_COMPARE_BRANCH
+
+        VM_CASE(LoadA64Mul) {
+            Reg dst = inst->dst;
+            Reg base = inst->left;
+            Reg offset = inst->right;
+            uint64_t incr = inst->imm;
+            uint64_t addr = regs.iregs[base] + regs.iregs[offset] * incr;
+            regs.iregs[dst] = *(uint64_t*)(addr);
+            regs.iregs[inst[1].dst]
+                = regs.iregs[inst[1].left] * regs.iregs[inst[1].right];
+            pc = &inst[2];
+            VM_DISPATCH();
+        }
+        VM_CASE(AddMovII) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            Reg right = inst->right;
+            regs.iregs[dst] = regs.iregs[left] + regs.iregs[right];
+            regs.iregs[inst[1].dst] = regs.iregs[inst[1].left];
+            pc = &inst[2];
+            VM_DISPATCH();
+        }
+        VM_CASE(AddIJmp) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] + right;
+            VM_JUMP_STEP(&inst[1]);
+            pc = inst[1].target;
+            VM_DISPATCH();
+        }
+        VM_CASE(AddILtIJnz) {
+            Reg dst = inst->dst;
+            Reg left = inst->left;
+            uint64_t right = inst->imm;
+            regs.iregs[dst] = regs.iregs[left] + right;
+            uint64_t cond = regs.iregs[inst[1].left] < inst[1].imm ? 1 : 0;
+            regs.iregs[inst[1].dst] = cond;
+            VM_JUMP_STEP(&inst[2]);
+            pc = cond != 0 ? inst[2].target : &inst[3];
+            VM_DISPATCH();
+        }
+
+        // ---
+
+        VM_CASE_INVALID {
+            fprintf(stderr,
+                "error: invalid op %d at %u\n",
+                inst->op,
+                inst->word);
+            result = -1;
+            goto halt_program;
+        }
+#ifdef VM_COMPUTED_GOTO
+    }
+#pragma GCC diagnostic pop
+#else
+        }
+    }
+#endif
+#undef VM_CASE
+#undef VM_CASE_INVALID
+#undef VM_DISPATCH
+#undef VM_JIT_ENTER
+#undef VM_STEP
+#undef VM_JUMP_STEP
+
+invalid_division:
+    fprintf(stderr, "error: division by zero or overflow at %u\n", inst->word);
+    result = -1;
+    goto halt_program;
+budget_exhausted:
+    fprintf(stderr, "error: budget exhausted at %u\n", inst->word);
+    result = -1;
 halt_program:
-    free(stack);
-    free(call_stack_base);
-    return 0;
+#ifdef VM_PROFILE
+    if (profile)
+        profile_finish(profile);
+#endif
+    stack_trap_pop(&trap);
+    stacks_release(&stacks);
+    // Registers are indeterminate after a trap, which also fails the run.
+    if (result == 0)
+        *regs_io = regs;
+    return result;
+}
+#pragma GCC diagnostic pop
+
+void vm_link(Program* program)
+{
+    vm_exec(NULL, program, NULL, NULL, program);
+}
+
+int vm_run(VM* vm, const Program* program)
+{
+    Regs regs = {
+        .iregs = { 0 },
+        .fregs = { 0.0 },
+        .budget = UINT64_MAX,
+    };
+    return vm_exec(vm, program, program->entry, &regs, NULL);
+}
+
+int vm_call(VM* vm, const Program* program, const Inst* entry, Regs* regs)
+{
+    return vm_exec(vm, program, entry, regs, NULL);
+}
+
+static inline uint64_t fs_write(FILE* fp, uint64_t data, uint64_t size)
+{
+    return fwrite((const void*)data, 1, size, fp);
+}
+
+static inline uint64_t fs_read(FILE* fp, uint64_t data, uint64_t size)
+{
+    return fread((void*)data, 1, size, fp);
 }
 
 int vm_exec_builtin(VM* vm, Builtin builtin, Regs* regs)
@@ -837,14 +1158,39 @@ int vm_exec_builtin(VM* vm, Builtin builtin, Regs* regs)
     MAYBE_UNUSED uint64_t arg3 = regs->iregs[3];
     MAYBE_UNUSED uint64_t arg4 = regs->iregs[4];
 
+    FILE* fp = NULL;
+    switch (builtin) {
+        case Builtin_Alloc:
+        case Builtin_FsOpen:
+        case Builtin_HostCall:
+        case Builtin_Count:
+            break;
+        case Builtin_FsClose:
+        case Builtin_FsWrite:
+        case Builtin_FsRead:
+        case Builtin_FsFlush:
+        case Builtin_FsEof:
+        case Builtin_FsWriteV:
+        case Builtin_FsReadV:
+            fp = vm_file_fp(vm, arg1);
+            if (!fp) {
+                fprintf(stderr,
+                    "error: invalid file handle %" PRIu64 "\n",
+                    arg1);
+                return -1;
+            }
+            break;
+    }
+
     switch (builtin) {
         case Builtin_Alloc: {
+            *res = (uint64_t)heap_alloc(&vm->heap, arg1);
             break;
         }
         case Builtin_FsOpen: {
-            uint64_t id = 0;
+            uint64_t id;
             int r = vm_open_file(vm, &id, (char*)arg1, (char*)arg2);
-            *res = r == 0 ? 0 : 1;
+            *res = r == 0 ? id : FS_INVALID_HANDLE;
             break;
         }
         case Builtin_FsClose: {
@@ -852,48 +1198,198 @@ int vm_exec_builtin(VM* vm, Builtin builtin, Regs* regs)
             break;
         }
         case Builtin_FsWrite:
-            fwrite((void*)arg2, arg3, 1, vm_file_fp(vm, arg1));
+            *res = fs_write(fp, arg2, arg3);
             break;
         case Builtin_FsRead:
-            fread((void*)arg2, arg3, 1, vm_file_fp(vm, arg1));
+            *res = fs_read(fp, arg2, arg3);
             break;
         case Builtin_FsFlush:
-            fflush(vm_file_fp(vm, arg1));
+            fflush(fp);
             break;
         case Builtin_FsEof:
-            *res = feof(vm_file_fp(vm, arg1)) == EOF ? 1 : 0;
+            *res = feof(fp) != 0 ? 1 : 0;
+            break;
+        case Builtin_FsWriteV: {
+            const FsIoVec* iovecs = (const FsIoVec*)arg2;
+            uint64_t written = 0;
+            for (uint64_t i = 0; i < arg3; ++i) {
+                uint64_t n = fs_write(fp, iovecs[i].data, iovecs[i].size);
+                written += n;
+                if (n != iovecs[i].size)
+                    break;
+            }
+            *res = written;
+            break;
+        }
+        case Builtin_FsReadV: {
+            const FsIoVec* iovecs = (const FsIoVec*)arg2;
+            uint64_t read = 0;
+            for (uint64_t i = 0; i < arg3; ++i) {
+                uint64_t n = fs_read(fp, iovecs[i].data, iovecs[i].size);
+                read += n;
+                if (n != iovecs[i].size)
+                    break;
+            }
+            *res = read;
             break;
+        }
+        case Builtin_HostCall: {
+            if (arg1 >= vm->imports_size) {
+                fprintf(stderr, "error: invalid import %" PRIu64 "\n", arg1);
+                return -1;
+            }
+            const HostFunction* function = &vm->imports[arg1];
+            return function->fn(function->data, &regs->iregs[2], res);
+        }
+        case Builtin_Count:
+            fprintf(stderr, "error: invalid builtin %d\n", builtin);
+            return -1;
     }
     return 0;
 }
 
+static inline uint64_t fs_handle(uint32_t index, uint32_t generation)
+{
+    return (uint64_t)generation << 32 | index;
+}
+
+static inline FsFile* fs_file(VM* vm, uint64_t id)
+{
+    uint32_t index = (uint32_t)id;
+    uint32_t generation = (uint32_t)(id >> 32);
+    if (index >= vm->files_size)
+        return NULL;
+    FsFile* file = &vm->files[index];
+    if (!file->fp || file->generation != generation)
+        return NULL;
+    return file;
+}
+
 int vm_open_file(VM* vm, uint64_t* id, const char* path, const char* mode)
 {
+    uint32_t index = vm->free_file;
+    if (index == UINT32_MAX) {
+        if (vm->files_size == UINT32_MAX)
+            return -1;
+        if (vm->files_size == vm->files_capacity) {
+            size_t capacity = vm->files_capacity * 2;
+            FsFile* files = realloc(vm->files, sizeof(FsFile) * capacity);
+            if (!files)
+                return -1;
+            vm->files = files;
+            vm->files_capacity = capacity;
+        }
+        index = (uint32_t)vm->files_size;
+        vm->files[index] = (FsFile) { .fp = NULL, .generation = 0 };
+    }
+
     FILE* fp = fopen(path, mode);
     if (fp == NULL)
         return -1;
-    *id = vm->next_file_id;
-    ++vm->next_file_id;
-    vm->files[vm->files_size++] = (FsFile) { *id, fp };
+    // `setvbuf` ignores the size unless given the buffer. Without one, the
+    // file keeps its default buffer.
+    char* buffer = malloc(FS_BUFFER_SIZE);
+    if (buffer && setvbuf(fp, buffer, _IOFBF, FS_BUFFER_SIZE) != 0) {
+        free(buffer);
+        buffer = NULL;
+    }
+
+    FsFile* file = &vm->files[index];
+    if (index == vm->free_file)
+        vm->free_file = file->next_free;
+    else
+        ++vm->files_size;
+    file->fp = fp;
+    file->buffer = buffer;
+    *id = fs_handle(index, file->generation);
     return 0;
 }
 
-void vm_close_file(VM* vm, uint64_t id)
+int vm_close_file(VM* vm, uint64_t id)
 {
-    size_t i = 0;
-    for (; i < vm->files_size; ++i)
-        if (vm->files[i].id == id)
-            break;
-    if (i == vm->files_size)
-        return;
-    for (size_t j = i; j < vm->files_size - 1; ++j)
-        vm->files[j] = vm->files[j + 1];
+    FsFile* file = fs_file(vm, id);
+    if (!file)
+        return -1;
+    if (fs_std_stream(file->fp)) {
+        // The standard streams stay open for the host.
+        fflush(file->fp);
+    } else {
+        fclose(file->fp);
+    }
+    free(file->buffer);
+    file->buffer = NULL;
+    file->fp = NULL;
+    file->generation += 1;
+    file->next_free = vm->free_file;
+    vm->free_file = (uint32_t)(file - vm->files);
+    return 0;
 }
 
 FILE* vm_file_fp(VM* vm, uint64_t id)
 {
-    for (size_t i = 0; i < vm->files_size; ++i)
-        if (vm->files[i].id == id)
-            return vm->files[i].fp;
-    return NULL;
+    FsFile* file = fs_file(vm, id);
+    return file ? file->fp : NULL;
+}
+
+#ifdef INCLUDE_TESTS
+#include "test.h"
+
+static inline uint32_t test_file_index(uint64_t id)
+{
+    return (uint32_t)id;
+}
+
+static inline uint32_t test_file_generation(uint64_t id)
+{
+    return (uint32_t)(id >> 32);
+}
+
+/// Closed handles are rejected, also once their slot is reused for another
+/// file, with the next generation.
+void test_vm_files(void)
+{
+    VM vm;
+    TEST_ASSERT(vm_construct(&vm) == 0, "vm should be constructed");
+    TEST_ASSERT(vm_file_fp(&vm, 1) == stdout, "handle 1 should be stdout");
+
+    uint64_t first;
+    uint64_t second;
+    TEST_ASSERT(vm_open_file(&vm, &first, "/dev/null", "r") == 0
+            && vm_open_file(&vm, &second, "/dev/null", "r") == 0,
+        "files should open");
+    TEST_ASSERT(test_file_index(first) != test_file_index(second),
+        "open files should have their own slots");
+
+    TEST_ASSERT(vm_close_file(&vm, first) == 0, "file should close");
+    TEST_ASSERT(!vm_file_fp(&vm, first), "closed handle should be rejected");
+    TEST_ASSERT(vm_close_file(&vm, first) != 0,
+        "closed handle should not close again");
+
+    uint64_t third;
+    TEST_ASSERT(vm_open_file(&vm, &third, "/dev/null", "r") == 0,
+        "file should open");
+    TEST_ASSERT(test_file_index(third) == test_file_index(first)
+            && test_file_generation(third) == test_file_generation(first) + 1,
+        "freed slot should be reused with the next generation");
+    TEST_ASSERT(vm_file_fp(&vm, third) && !vm_file_fp(&vm, first),
+        "only the new handle should refer to the reused slot");
+    TEST_ASSERT(vm_close_file(&vm, first) != 0 && vm_file_fp(&vm, third),
+        "old handle should not close the reused slot");
+
+    Regs regs = { 0 };
+    regs.iregs[1] = first;
+    TEST_ASSERT(vm_exec_builtin(&vm, Builtin_FsFlush, &regs) != 0,
+        "builtins should reject closed handles");
+    regs.iregs[1] = 1000;
+    TEST_ASSERT(vm_exec_builtin(&vm, Builtin_FsFlush, &regs) != 0,
+        "builtins should reject unknown handles");
+    regs.iregs[1] = third;
+    TEST_ASSERT(vm_exec_builtin(&vm, Builtin_FsFlush, &regs) == 0,
+        "builtins should accept open handles");
+
+    TEST_ASSERT(vm_close_file(&vm, second) == 0
+            && vm_close_file(&vm, third) == 0,
+        "files should close");
+    vm_destroy(&vm);
 }
+#endif
@@ -1,6 +1,8 @@
 #ifndef VM_H
 #define VM_H
 
+#include "heap.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -38,144 +40,289 @@
 /// is big endian ie. WRONG. Put the bytes `12 34` into the array in reverse
 /// order `[34, 12]`. This is little endiang ie. CORRECT.
 ///
+/// `VM_OP_LIST` lists every op in encoding order, as
+/// `OP(NAME, FORMAT, DST, LEFT, RIGHT)`. `FORMAT` is the format of its
+/// immediate (see `OpFormat`), and `DST`, `LEFT` and `RIGHT` are the kinds of
+/// the register fields (see `OpReg`). It is used to generate the `Op` enum,
+/// the decoder's format table and the interpreter's dispatch table, so that
+/// they can't get out of sync.
+///
+#define VM_OP_LIST(OP)                                                         \
+    OP(Nop, None, None, None, None)                                            \
+    OP(Halt, None, None, None, None)                                           \
+    OP(Builtin, I32, None, None, None)                                         \
+                                                                               \
+    OP(Call, None, None, I, None)                                              \
+    OP(CallI, Target, None, None, None)                                        \
+    OP(Ret, None, None, None, None)                                            \
+    OP(Alloca, I32, None, None, None)                                          \
+                                                                               \
+    OP(Jmp, Target, None, None, None)                                          \
+    OP(Jnz, Target, None, I, None)                                             \
+    OP(Jz, Target, None, I, None)                                              \
+                                                                               \
+    OP(Load8, None, I, I, None)                                                \
+    OP(LoadI8, I64, I, None, None)                                             \
+    OP(LoadA8, I32, I, I, I)                                                   \
+    OP(Load16, None, I, I, None)                                               \
+    OP(LoadI16, I64, I, None, None)                                            \
+    OP(LoadA16, I32, I, I, I)                                                  \
+    OP(Load32, None, I, I, None)                                               \
+    OP(LoadI32, I64, I, None, None)                                            \
+    OP(LoadA32, I32, I, I, I)                                                  \
+    OP(Load64, None, I, I, None)                                               \
+    OP(LoadI64, I64, I, None, None)                                            \
+    OP(LoadA64, I32, I, I, I)                                                  \
+    OP(LoadF, None, F, I, None)                                                \
+    OP(LoadIF, I64, F, None, None)                                             \
+    OP(LoadAF, I32, F, I, I)                                                   \
+                                                                               \
+    OP(Store8, None, I, I, None)                                               \
+    OP(StoreA8, I32, I, I, I)                                                  \
+    OP(Store16, None, I, I, None)                                              \
+    OP(StoreA16, I32, I, I, I)                                                 \
+    OP(Store32, None, I, I, None)                                              \
+    OP(StoreA32, I32, I, I, I)                                                 \
+    OP(Store64, None, I, I, None)                                              \
+    OP(StoreA64, I32, I, I, I)                                                 \
+    OP(StoreF, None, I, F, None)                                               \
+    OP(StoreAF, I32, I, F, I)                                                  \
+                                                                               \
+    OP(LoadImm32, I32, I, None, None)                                          \
+    OP(LoadImm64, I64, I, None, None)                                          \
+    OP(LoadImmF, F64, F, None, None)                                           \
+    OP(LoadSb, None, I, None, None)                                            \
+    OP(LoadSp, None, I, None, None)                                            \
+                                                                               \
+    OP(MovII, None, I, I, None)                                                \
+    OP(MovIF, None, F, I, None)                                                \
+    OP(MovFI, None, I, F, None)                                                \
+    OP(MovFF, None, F, F, None)                                                \
+                                                                               \
+    OP(Push, None, None, I, None)                                              \
+    OP(Pop, None, I, None, None)                                               \
+                                                                               \
+    OP(PushF, None, None, F, None)                                             \
+    OP(PopF, None, F, None, None)                                              \
+                                                                               \
+    OP(Eq, None, I, I, I)                                                      \
+    OP(Ne, None, I, I, I)                                                      \
+    OP(Lt, None, I, I, I)                                                      \
+    OP(Gt, None, I, I, I)                                                      \
+    OP(Lte, None, I, I, I)                                                     \
+    OP(Gte, None, I, I, I)                                                     \
+    OP(And, None, I, I, I)                                                     \
+    OP(Or, None, I, I, I)                                                      \
+    OP(Xor, None, I, I, I)                                                     \
+    OP(Add, None, I, I, I)                                                     \
+    OP(Sub, None, I, I, I)                                                     \
+    OP(Mul, None, I, I, I)                                                     \
+    OP(Div, None, I, I, I)                                                     \
+    OP(Rem, None, I, I, I)                                                     \
+    OP(IMul, None, I, I, I)                                                    \
+    OP(IDiv, None, I, I, I)                                                    \
+                                                                               \
+    OP(EqI, I32, I, I, None)                                                   \
+    OP(NeI, I32, I, I, None)                                                   \
+    OP(LtI, I32, I, I, None)                                                   \
+    OP(GtI, I32, I, I, None)                                                   \
+    OP(LteI, I32, I, I, None)                                                  \
+    OP(GteI, I32, I, I, None)                                                  \
+    OP(AndI, I32, I, I, None)                                                  \
+    OP(OrI, I32, I, I, None)                                                   \
+    OP(XorI, I32, I, I, None)                                                  \
+    OP(AddI, I32, I, I, None)                                                  \
+    OP(SubI, I32, I, I, None)                                                  \
+    OP(RSubI, I32, I, None, I)                                                 \
+    OP(MulI, I32, I, I, None)                                                  \
+    OP(DivI, I32, I, I, None)                                                  \
+    OP(RemI, I32, I, I, None)                                                  \
+    OP(IMulI, I32, I, I, None)                                                 \
+    OP(IDivI, I32, I, I, None)                                                 \
+                                                                               \
+    OP(EqF, None, I, F, F)                                                     \
+    OP(NeF, None, I, F, F)                                                     \
+    OP(LtF, None, I, F, F)                                                     \
+    OP(GtF, None, I, F, F)                                                     \
+    OP(LteF, None, I, F, F)                                                    \
+    OP(GteF, None, I, F, F)                                                    \
+    OP(AddF, None, F, F, F)                                                    \
+    OP(SubF, None, F, F, F)                                                    \
+    OP(MulF, None, F, F, F)                                                    \
+    OP(DivF, None, F, F, F)                                                    \
+                                                                               \
+    OP(EqFI, F64, I, F, None)                                                  \
+    OP(NeFI, F64, I, F, None)                                                  \
+    OP(LtFI, F64, I, F, None)                                                  \
+    OP(GtFI, F64, I, F, None)                                                  \
+    OP(LteFI, F64, I, F, None)                                                 \
+    OP(GteFI, F64, I, F, None)                                                 \
+    OP(AddFI, F64, F, F, None)                                                 \
+    OP(SubFI, F64, F, F, None)                                                 \
+    OP(RSubFI, F64, F, None, F)                                                \
+    OP(MulFI, F64, F, F, None)                                                 \
+    OP(DivFI, F64, F, F, None)
+
+/// Superinstructions. These are not part of the encoding. The decoder
+/// replaces the first instruction of a matching sequence with one of these
+/// (see `program.c`), and leaves the rest of the sequence in place, so that
+/// jumps into the middle of it still work. The handler executes the whole
+/// sequence, and then skips past it.
+///
+/// `FUSED(NAME, LENGTH, FIRST)`, where `NAME` is the ops of the sequence
+/// concatenated, `LENGTH` is the number of instructions, and `FIRST` is the
+/// op that was replaced.
+///
+#define VM_FUSED_OP_LIST(FUSED)                                                \
+    FUSED(EqJz, 2, Eq)                                                         \
+    FUSED(EqJnz, 2, Eq)                                                        \
+    FUSED(EqIJz, 2, EqI)                                                       \
+    FUSED(EqIJnz, 2, EqI)                                                      \
+    FUSED(NeJz, 2, Ne)                                                         \
+    FUSED(NeJnz, 2, Ne)                                                        \
+    FUSED(NeIJz, 2, NeI)                                                       \
+    FUSED(NeIJnz, 2, NeI)                                                      \
+    FUSED(LtJz, 2, Lt)                                                         \
+    FUSED(LtJnz, 2, Lt)                                                        \
+    FUSED(LtIJz, 2, LtI)                                                       \
+    FUSED(LtIJnz, 2, LtI)                                                      \
+    FUSED(GtJz, 2, Gt)                                                         \
+    FUSED(GtJnz, 2, Gt)                                                        \
+    FUSED(GtIJz, 2, GtI)                                                       \
+    FUSED(GtIJnz, 2, GtI)                                                      \
+    FUSED(LteJz, 2, Lte)                                                       \
+    FUSED(LteJnz, 2, Lte)                                                      \
+    FUSED(LteIJz, 2, LteI)                                                     \
+    FUSED(LteIJnz, 2, LteI)                                                    \
+    FUSED(GteJz, 2, Gte)                                                       \
+    FUSED(GteJnz, 2, Gte)                                                      \
+    FUSED(GteIJz, 2, GteI)                                                     \
+    FUSED(GteIJnz, 2, GteI)                                                    \
+                                                                               \
+    FUSED(LoadA64Mul, 2, LoadA64)                                              \
+    FUSED(AddMovII, 2, Add)                                                    \
+    FUSED(AddIJmp, 2, AddI)                                                    \
+    FUSED(AddILtIJnz, 3, AddI)
+
 typedef enum {
-    Op_Nop,
-    Op_Halt,
-    Op_Builtin,
-
-    Op_Call,
-    Op_CallI,
-    Op_Ret,
-    Op_Alloca,
-
-    Op_Jmp,
-    Op_Jnz,
-    Op_Jz,
-
-    Op_Load8,
-    Op_LoadI8,
-    Op_LoadA8,
-    Op_Load16,
-    Op_LoadI16,
-    Op_LoadA16,
-    Op_Load32,
-    Op_LoadI32,
-    Op_LoadA32,
-    Op_Load64,
-    Op_LoadI64,
-    Op_LoadA64,
-    Op_LoadF,
-    Op_LoadIF,
-    Op_LoadAF,
-
-    Op_Store8,
-    Op_StoreA8,
-    Op_Store16,
-    Op_StoreA16,
-    Op_Store32,
-    Op_StoreA32,
-    Op_Store64,
-    Op_StoreA64,
-    Op_StoreF,
-    Op_StoreAF,
-
-    Op_LoadImm32,
-    Op_LoadImm64,
-    Op_LoadImmF,
-    Op_LoadSb,
-    Op_LoadSp,
-
-    Op_MovII,
-    Op_MovIF,
-    Op_MovFI,
-    Op_MovFF,
-
-    Op_Push,
-    Op_Pop,
-
-    Op_PushF,
-    Op_PopF,
-
-    Op_Eq,
-    Op_Ne,
-    Op_Lt,
-    Op_Gt,
-    Op_Lte,
-    Op_Gte,
-    Op_And,
-    Op_Or,
-    Op_Xor,
-    Op_Add,
-    Op_Sub,
-    Op_Mul,
-    Op_Div,
-    Op_Rem,
-    Op_IMul,
-    Op_IDiv,
-
-    Op_EqI,
-    Op_NeI,
-    Op_LtI,
-    Op_GtI,
-    Op_LteI,
-    Op_GteI,
-    Op_AndI,
-    Op_OrI,
-    Op_XorI,
-    Op_AddI,
-    Op_SubI,
-    Op_RSubI,
-    Op_MulI,
-    Op_DivI,
-    Op_RemI,
-    Op_IMulI,
-    Op_IDivI,
-
-    Op_EqF,
-    Op_NeF,
-    Op_LtF,
-    Op_GtF,
-    Op_LteF,
-    Op_GteF,
-    Op_AddF,
-    Op_SubF,
-    Op_MulF,
-    Op_DivF,
-
-    Op_EqFI,
-    Op_NeFI,
-    Op_LtFI,
-    Op_GtFI,
-    Op_LteFI,
-    Op_GteFI,
-    Op_AddFI,
-    Op_SubFI,
-    Op_RSubFI,
-    Op_MulFI,
-    Op_DivFI,
+#define VM_OP_ENUM(NAME, FORMAT, DST, LEFT, RIGHT) Op_##NAME,
+    VM_OP_LIST(VM_OP_ENUM)
+#undef VM_OP_ENUM
+    /// Number of encodable ops.
+    Op_Count,
+#define VM_FUSED_OP_ENUM(NAME, LENGTH, FIRST) Op_##NAME,
+    VM_FUSED_OP_LIST(VM_FUSED_OP_ENUM)
+#undef VM_FUSED_OP_ENUM
 } Op;
 
+/// Immediate appended after an instruction header.
 typedef enum {
+    /// No immediate.
+    OpFormat_None,
+    /// `%i32`.
+    OpFormat_I32,
+    /// `%i64`.
+    OpFormat_I64,
+    /// `%f64`.
+    OpFormat_F64,
+    /// 32-bit immediate holding a jump target, as an offset in words from the
+    /// start of the program.
+    OpFormat_Target,
+} OpFormat;
+
+/// Kind of register an instruction's register field refers to.
+typedef enum {
+    /// The field is unused.
+    OpReg_None,
+    /// `%ireg`.
+    OpReg_I,
+    /// `%freg`.
+    OpReg_F,
+} OpReg;
+
+/// Builtins run by `Builtin`, which holds the builtin in its `%i32`.
+///
+/// Arguments are passed in `%ireg` 1 to 4, and the result is returned in
+/// `%ireg` 0. Files are referred to by handles (see `FsFile`). Using a handle
+/// that is not open stops the program.
+typedef enum {
+    /// `(size) -> ptr`. Allocates zeroed memory on the VM's heap, aligned to
+    /// 16 bytes. It is freed with the VM. Returns 0 if out of memory.
     Builtin_Alloc,
+    /// `(path, mode) -> handle`. `path` and `mode` are NUL-terminated, and
+    /// `mode` is as for `fopen`. Returns `FS_INVALID_HANDLE` on failure.
     Builtin_FsOpen,
+    /// `(handle)`.
     Builtin_FsClose,
+    /// `(handle, data, size) -> written`.
     Builtin_FsWrite,
+    /// `(handle, data, size) -> read`.
     Builtin_FsRead,
+    /// `(handle)`.
     Builtin_FsFlush,
+    /// `(handle) -> eof`. 1 at the end of the file, 0 otherwise.
     Builtin_FsEof,
+    /// `(handle, iovecs, count) -> written`. Writes the `FsIoVec`s in order.
+    Builtin_FsWriteV,
+    /// `(handle, iovecs, count) -> read`. Fills the `FsIoVec`s in order,
+    /// stopping at the end of the file.
+    Builtin_FsReadV,
+    /// `(import, args...) -> result`. Calls the host function the module's
+    /// import at index `import` was resolved to, with `HOST_ARGS` arguments
+    /// from `%ireg` 2 and up.
+    Builtin_HostCall,
+    /// Number of builtins.
+    Builtin_Count,
 } Builtin;
 
 #define IREGS 32
 #define FREGS 16
 
+/// Default stack sizes (see `VM`). Frames larger than `STACK_SIZE` words are
+/// rejected by the verifier.
 #define STACK_SIZE 65536
 #define CALL_STACK_SIZE 65536
 
+/// Size of the buffer of files opened by `Builtin_FsOpen`.
+#define FS_BUFFER_SIZE 65536
+
+#define FS_INVALID_HANDLE UINT64_MAX
+
+#define HOST_ARGS 6
+
+/// Function of the program embedding the VM, called by `Builtin_HostCall`.
+/// `args` holds `HOST_ARGS` arguments. Returns -1 to stop the program.
+typedef int (*HostFn)(void* data, const uint64_t* args, uint64_t* result);
+
+typedef struct {
+    HostFn fn;
+    void* data;
+} HostFunction;
+
+/// Slot in the VM's file table.
+///
+/// A handle holds the slot's index in the low 32 bits, and the slot's
+/// generation in the high 32 bits. Closing a file bumps the generation, so
+/// that old handles to a reused slot are rejected. `stdin`, `stdout` and
+/// `stderr` have the handles 0, 1 and 2.
 typedef struct {
-    uint64_t id;
+    /// NULL if the slot is free.
     FILE* fp;
+    uint32_t generation;
+    /// Next free slot, if the slot is free.
+    uint32_t next_free;
+    /// `FS_BUFFER_SIZE` bytes used as the buffer of `fp`, freed after `fp` is
+    /// closed. NULL for the standard streams, or if it could not be
+    /// allocated, in which case `fp` keeps its default buffer.
+    char* buffer;
 } FsFile;
 
+/// Buffer for `Builtin_FsWriteV` and `Builtin_FsReadV`.
+typedef struct {
+    uint64_t data;
+    uint64_t size;
+} FsIoVec;
+
 ///
 /// Main data structure for the runtime virtual machine.
 ///
@@ -189,10 +336,23 @@ typedef struct {
     FsFile* files;
     size_t files_size;
     size_t files_capacity;
-    uint64_t next_file_id;
+    /// First free slot in `files`, or `UINT32_MAX`.
+    uint32_t free_file;
+    Heap heap;
+    /// Host functions, indexed by the module's imports.
+    const HostFunction* imports;
+    size_t imports_size;
+    /// Size in words of the value stack. `STACK_SIZE` by default.
+    size_t stack_size;
+    /// Max number of nested calls. `CALL_STACK_SIZE` by default.
+    size_t call_stack_size;
+    /// Profile recorded while running, in builds with `VM_PROFILE` (see
+    /// `profile.h`). NULL to not profile.
+    struct Profile* profile;
 } VM;
 
-void vm_construct(VM* vm);
+/// Returns -1 if out of memory, in which case `vm` must not be destroyed.
+int vm_construct(VM* vm);
 void vm_destroy(VM* vm);
 
 typedef uint8_t Reg;
@@ -200,22 +360,104 @@ typedef uint8_t Reg;
 typedef struct {
     uint64_t iregs[IREGS];
     double fregs[FREGS];
+    /// Steps left before the run is stopped. Every call, and every jump
+    /// instruction with a target at or before itself, takes a step, so that
+    /// any loop takes at least one step per iteration. `UINT64_MAX` for no
+    /// limit.
+    uint64_t budget;
 } Regs;
 
+typedef struct Inst Inst;
+
+/// Instruction decoded into a fixed size form, so that the interpreter doesn't
+/// have to decode the variable length encoding while running.
+struct Inst {
+    /// Address of the interpreter's handler for `op`. Set by `vm_link`.
+    const void* handler;
+    union {
+        /// `%i32` (zero extended) or `%i64`.
+        uint64_t imm;
+        /// `%f64`.
+        double fimm;
+        /// Resolved jump target.
+        const Inst* target;
+    };
+    uint8_t op;
+    Reg dst;
+    Reg left;
+    Reg right;
+    /// Offset in words of the instruction in the encoded program.
+    uint32_t word;
+};
+
+typedef struct {
+    /// Always ends with a `Halt`, so running past the last instruction stops
+    /// the program.
+    Inst* insts;
+    size_t insts_size;
+    /// Maps word offsets to instructions, for `Call` with a register target.
+    /// Holds index + 1 for the first word of an instruction and 0 otherwise.
+    uint32_t* word_insts;
+    size_t words_size;
+    /// Instruction the program starts at. It is run as a function, returning
+    /// into the final `Halt`.
+    const Inst* entry;
+    /// Max words a function grows the stack by, not counting its callees. The
+    /// guard pages of the stack are made at least this large (see `stack.h`).
+    size_t max_frame;
+    /// Compiled code (see `jit.h`), kept for as long as the program. NULL if
+    /// the program is only interpreted. Since it is filled in while running,
+    /// a program must only be run by one thread at a time.
+    struct Jit* jit;
+} Program;
+
+/// Decodes `code`, which is `size` words encoded according to the encoding
+/// rules. Returns -1 if the code is malformed.
+int program_decode(Program* program, const uint32_t* code, size_t size);
+void program_destroy(Program* program);
+
+/// Checks that register fields and builtins are in range, and finds the
+/// largest frame of the program. Returns -1 if the program can't be run
+/// safely. Called by `program_decode`, before any instruction is fused.
+int program_verify(Program* program);
+
+#ifdef INCLUDE_TESTS
+void test_verify_programs(void);
+#endif
+
+/// Returns NULL if `word` is not the start of an instruction.
+const Inst* program_inst_at(const Program* program, uint64_t word);
+
+/// Adds `addend` to the `%i64` immediate of the instruction at `word`.
+/// Returns -1 if there is no such instruction.
+int program_relocate(Program* program, uint64_t word, uint64_t addend);
+
 typedef struct {
     uint64_t* caller_sb;
-    const uint32_t* return_ptr;
+    const Inst* return_ptr;
 } Call;
 
-/// Runner function for the VM.
-///
-/// 'program` is a program encoded according to the encoding rules. The program
-/// is expected to exit before hitting the end, hence there's no size parameter.
-int vm_run(VM* vm, const uint32_t* program);
+/// Fills in the handler addresses of a decoded program. Called by
+/// `program_decode`.
+void vm_link(Program* program);
+
+/// Runner function for the VM. Runs the program from `Program.entry`, with
+/// all registers zeroed.
+int vm_run(VM* vm, const Program* program);
+/// Calls the function starting at `entry`. Arguments are passed in `regs`,
+/// which holds the registers as the function left them when it returns.
+int vm_call(VM* vm, const Program* program, const Inst* entry, Regs* regs);
 
+/// Returns -1 if the program should stop.
 int vm_exec_builtin(VM* vm, Builtin builtin, Regs* regs);
 int vm_open_file(VM* vm, uint64_t* id, const char* path, const char* mode);
-void vm_close_file(VM* vm, uint64_t id);
+/// Returns -1 if `id` is not an open file.
+int vm_close_file(VM* vm, uint64_t id);
+/// Returns NULL if `id` is not an open file.
 FILE* vm_file_fp(VM* vm, uint64_t id);
 
+#ifdef INCLUDE_TESTS
+void test_vm_files(void);
+#endif
+
 #endif